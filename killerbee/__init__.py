@@ -5,6 +5,8 @@ import glob
 from warnings import warn
 
 from .pcapdump import *
+from .pcapng import *
+from .pcapindex import *
 from .daintree import *
 from .pcapdlt import *
 
@@ -0,0 +1,118 @@
+from typing import Optional, Dict, List, Tuple, Iterable, Any
+
+import zigbee_crypt # type: ignore
+
+# ZigBee key identifiers of the auxiliary security header
+ZBEE_SEC_KEY_LINK      = 0  #: Data (link) key
+ZBEE_SEC_KEY_NWK       = 1  #: Network key
+ZBEE_SEC_KEY_TRANSPORT = 2  #: Key-transport key, hashed from a link key
+ZBEE_SEC_KEY_LOAD      = 3  #: Key-load key, hashed from a link key
+
+class StreamDecryptor:
+    def __init__(self, network_keys: Iterable[bytes]=(), link_keys: Iterable[bytes]=(), fcs: bool=True) -> None:
+        '''
+        Decrypts a stream of raw 802.15.4 frames, such as those of pnext(),
+        without scapy. NWK-secured frames are decrypted with the network
+        keys and APS-secured frames with the link keys or the key-transport
+        and key-load keys derived from them, as selected by the frame's key
+        identifier.
+
+        Frames which do not carry the extended source of their nonce are
+        decrypted with the address table, which is learned from the NWK and
+        auxiliary security headers of the frames fed so far.
+        @type network_keys: List
+        @param network_keys: 16-byte network keys
+        @type link_keys: List
+        @param link_keys: 16-byte link keys
+        @type fcs: Boolean
+        @param fcs: Whether the frames end in the 2-byte FCS
+        @rtype: None
+        '''
+        self.fcs: bool = fcs
+        #: NWK short address to extended address, as integers
+        self.addresses: Dict[int, int] = {}
+        # Keyed CCM* contexts by key identifier, most recently matched first
+        self._contexts: Dict[int, List[Any]] = {
+            ZBEE_SEC_KEY_LINK: [], ZBEE_SEC_KEY_NWK: [], ZBEE_SEC_KEY_TRANSPORT: [], ZBEE_SEC_KEY_LOAD: []
+        }
+        self._keys: Dict[Tuple[int, bytes], Any] = {}
+        for key in network_keys:
+            self.add_network_key(key)
+        for key in link_keys:
+            self.add_link_key(key)
+
+    def __add_key(self, keyid: int, key: bytes) -> None:
+        key = bytes(key)
+        if (keyid, key) not in self._keys:
+            ctx = zigbee_crypt.CCMContext(key, 4)
+            self._keys[(keyid, key)] = ctx
+            self._contexts[keyid].append(ctx)
+
+    def add_network_key(self, key: bytes) -> None:
+        '''
+        Adds a network key, for NWK-secured frames and APS frames secured
+        with the network key.
+        @type key: Bytes
+        @param key: 16-byte network key
+        @rtype: None
+        '''
+        self.__add_key(ZBEE_SEC_KEY_NWK, key)
+
+    def add_link_key(self, key: bytes) -> None:
+        '''
+        Adds a link key, and the key-transport and key-load keys hashed from
+        it (ZigBee specification B.1.4), for APS-secured frames.
+        @type key: Bytes
+        @param key: 16-byte link key, such as the trust center link key
+        @rtype: None
+        '''
+        self.__add_key(ZBEE_SEC_KEY_LINK, key)
+        self.__add_key(ZBEE_SEC_KEY_TRANSPORT, zigbee_crypt.sec_key_hash(key, b'\x00'))
+        self.__add_key(ZBEE_SEC_KEY_LOAD, zigbee_crypt.sec_key_hash(key, b'\x02'))
+
+    def learn(self, short_addr: int, ext_addr: int) -> None:
+        '''
+        Adds an address mapping learned elsewhere, such as from a device
+        announcement.
+        @type short_addr: Int
+        @param short_addr: NWK short address
+        @type ext_addr: Int
+        @param ext_addr: Extended address, as in scapy
+        @rtype: None
+        '''
+        self.addresses[short_addr] = ext_addr
+
+    def feed(self, frame: bytes) -> Optional[bytes]:
+        '''
+        Decrypts one frame, learning its addresses along the way.
+        @type frame: Bytes
+        @param frame: Raw 802.15.4 frame
+        @rtype: Bytes
+        @return: The decrypted NWK or APS payload, or None if the frame is
+            not secured, no key matches or its extended source is unknown.
+        '''
+        info = zigbee_crypt.parse_nwk_frame(frame, self.fcs)
+        if info is None:
+            return None
+        (aps, keyid, mac_src, nwk_src, nwk_ext_src, aux_ext_src) = info
+
+        if nwk_ext_src is not None:
+            self.addresses[nwk_src] = nwk_ext_src
+        if aux_ext_src is not None:
+            # NWK security is applied hop by hop, by the MAC source; APS
+            # security end to end, by the NWK source
+            if aps:
+                self.addresses[nwk_src] = aux_ext_src
+            elif mac_src is not None:
+                self.addresses[mac_src] = aux_ext_src
+
+        contexts = self._contexts[ZBEE_SEC_KEY_NWK if not aps else keyid]
+        for (i, ctx) in enumerate(contexts):
+            result = ctx.decrypt_nwk_frame(frame, self.addresses, self.fcs)
+            if result is None:
+                return None
+            if result[2] == 1:
+                if i > 0:
+                    contexts.insert(0, contexts.pop(i))
+                return result[1]
+        return None
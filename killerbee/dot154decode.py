@@ -1,7 +1,5 @@
 import struct  # type: ignore
 
-from Crypto.Cipher import AES  # type: ignore
-
 ## Constants for packet decoding fields
 # Frame Control Field
 DOT154_FCF_TYPE_MASK            = 0x0007  #: Frame type mask
@@ -38,30 +36,103 @@ DOT154_CRYPT_ENC_MIC32          = 0x05    #: Encryption, 32-bit MIC
 DOT154_CRYPT_ENC_MIC64          = 0x06    #: Encryption, 64-bit MIC
 DOT154_CRYPT_ENC_MIC128         = 0x07    #: Encryption, 128-bit MIC
 
+# Auxiliary Security Header
+DOT154_SEC_LEVEL_MASK           = 0x07    #: Security level mask
+DOT154_SEC_KEYID_MASK           = 0x18    #: Key identifier mode mask
+DOT154_SEC_KEYID_MASK_SHIFT     = 3       #: Key identifier mode mask shift
+DOT154_SEC_ENC                  = 0x04    #: Set for encrypted security levels
+
+DOT154_SEC_MIC_LEN              = [0, 4, 8, 16]  #: MIC length by security level & 3
+DOT154_SEC_KEYID_LEN            = [0, 1, 5, 9]   #: Key identifier length by key identifier mode
+
+#: NumPy dtype of the records of zigbee_crypt.parse_mac_many(), e.g.
+#: numpy.frombuffer(zigbee_crypt.parse_mac_many(frames), DOT154_MAC_RECORD_DTYPE)
+DOT154_MAC_RECORD_DTYPE = [
+    ("dst_addr", "=u8"), ("src_addr", "=u8"), ("frame_counter", "=u4"),
+    ("fcf", "=u2"), ("dst_pan", "=u2"), ("src_pan", "=u2"),
+    ("hdr_len", "=u2"), ("payload", "=u2"), ("payload_len", "=u2"),
+    ("frame_type", "u1"), ("seq", "u1"), ("dst_addr_mode", "u1"), ("src_addr_mode", "u1"),
+    ("sec_level", "u1"), ("key_id_mode", "u1"), ("key_index", "u1"), ("valid", "u1"),
+]
+
 class Dot154PacketParser:
     def __init__(self):
         """
         Instantiates the Dot154PacketParser class.
         """
-
-        # State values for AES-CTR mode
-        self.__crypt_blockcntr = 1
-        self.__crypt_A_i = []
         return
 
-    def __crypt_counter(self):
+    def __ccminputs(self, packet):
         """
-        Used for AES-CTR mode after populating self.__crypt_A_i
-        Don't call this directly.  Just don't.
+        Splits a secured packet into its CCM* inputs, following the
+        802.15.4-2006 auxiliary security header. Don't call this directly.
+
+        @type packet: Bytes
+        @param packet: Packet contents, without the FCS.
+        @rtype: Tuple
+        @return: (security level, nonce, mic, encrypted payload, authenticated
+            data, private payload), the last four as memoryviews of packet, or
+            None if the packet is not secured.
         """
-        retindex = self.__crypt_blockcntr
-        self.__crypt_blockcntr += 1
-        return self.__crypt_A_i[retindex]
+        fcf = struct.unpack("<H", packet[0:2])[0]
+        if (fcf & DOT154_FCF_SEC_EN) == 0:
+            return None
+
+        import zigbee_crypt  # type: ignore
+
+        # The MAC header and the auxiliary security header:
+        # Security Control | 4-byte frame counter | Key Identifier
+        mac = zigbee_crypt.parse_mac(packet, False)
+        if mac is None:
+            raise BadPayloadLength(
+                "Payload length too short (%d)." % len(packet)
+            )
+        level = mac.sec_level
+        offset = mac.payload
+        frametype = mac.frame_type
+
+        # The command identifier and the beacon fields ahead of the beacon
+        # payload are authenticated but never encrypted
+        if frametype == DOT154_FCF_TYPE_MACCMD:
+            offset += 1
+        elif frametype == DOT154_FCF_TYPE_BEACON and len(packet) > offset + 3:
+            # Superframe Spec | GTS Spec | [GTS Directions | GTS List] |
+            # Pending Addr Spec | Pending Addr List
+            gtscount = packet[offset + 2] & 0x07
+            offset += 3 + (1 + 3 * gtscount if gtscount else 0)
+            if len(packet) > offset:
+                pending = packet[offset]
+                offset += 1 + 2 * (pending & 0x07) + 8 * ((pending >> 4) & 0x07)
+            else:
+                offset += 1
+
+        miclen = DOT154_SEC_MIC_LEN[level & 0x03]
+        if len(packet) - miclen < offset:
+            raise BadPayloadLength(
+                "Payload length too short (%d)." % (len(packet) - offset)
+            )
+
+        # Nonce formation is Src Addr || Frame Counter || Security Level,
+        # both most significant byte first
+        if mac.src_addr_mode != DOT154_FCF_ADDR_EXT:
+            raise UnsupportedPacket("Packet has no extended source address for the nonce.")
+        nonce = struct.pack(">QIB", mac.src_addr, mac.frame_counter, level)
+
+        # zigbee_crypt takes any buffer, so hand it views of the packet
+        # rather than copies. Without encryption the private payload is
+        # only authenticated, as part of a.
+        view = memoryview(packet)
+        end = len(view) - miclen
+        if level & DOT154_SEC_ENC:
+            return (level, nonce, view[end:], view[offset:end], view[0:offset], view[offset:end])
+        return (level, nonce, view[end:], view[end:end], view[0:end], view[offset:end])
 
     def decrypt(self, packet, key):
         """
         Decrypts the specified packet. Returns empty byte if the packet is
-        not encrypted, or if decryption MIC validation fails.
+        not secured, or if decryption MIC validation fails. All eight
+        802.15.4-2006 security levels are supported, for frames secured
+        without encryption the authenticated payload is returned.
 
         @type packet: Bytes
         @param packet: Packet contents.
@@ -71,105 +142,46 @@ class Dot154PacketParser:
         @return: Decrypted packet contents, empty byte if not encrypted or if
         decryped MIC fails validation.
         """
-
-        # Retrieve the data payload from the packet contents
-        encpayload = packet[-self.payloadlen(packet) :]
-
-        if encpayload[0] != DOT154_CRYPT_ENC_MIC64:
-            raise UnsupportedPacket(
-                "Unsupported security level in packet: 0x%02x." % encpayload[0]
-            )
-
         if len(key) != 16:
             raise BadKeyLength("Invalid key length (%d)." % len(key))
 
-        # Encrypted content is:
-        # Sec Level | 4-byte counter | Flags | Ciphertext | Encrypted 8-byte MIC
-
-        if self.payloadlen(packet) < 15:
-            raise BadPayloadLength(
-                "Payload length too short (%d)." % self.payloadlen(packet)
-            )
-
-        nonce = self.nonce(packet)
-
-        # c = ciphertext payload including trailing 8-byte encrypted MIC
-        c = encpayload[-9:]
-
-        # 1. Parse C||U where U is the right-most bytes for MIC and C is the
-        #    remaining bytes (representing encrypted packet payload content)
-        C = c[0:-8]
-        U = c[-8:]
-
-        # 2. Form cipherText by padding C to a block size
-        cipherText = C + (b"\x00" * (16 - len(C) % 16))
-
-        # 3. Form 1-byte flags field = 01
-        #    XXX will vary when L changes
-        flags = b"\x01"
+        params = self.__ccminputs(packet)
+        if params is None or params[0] == DOT154_CRYPT_NONE:
+            return b""
+        (level, nonce, mic, c, a, payload) = params
 
-        # 4. Define 16-octet A_i consisting of:
-        #        Flags || Nonce || 2-byte counter i for i=0,1,2, ...
-        #    A[0] is for authenticity check, A[1] is for the first block of data,
-        #    A[2] is for the 2nd block of data, if C > 16
-        self.__crypt_A_i = []
-        for i in range(0, (1 + 1 + int(len(C) / 16))):
-            self.__crypt_A_i.append(flags + nonce + struct.pack(">H", i))
+        # Imported here, so that the decoder loads without the extension
+        import zigbee_crypt  # type: ignore
 
-        # 5. Decrypt cipherText producing plainText (observed)
-        self.__crypt_blockcntr = 1  # Start at A[1] to decrypt
-        crypt = AES.new(key, AES.MODE_CTR, counter=self.__crypt_counter)
+        (plainText, micCheck) = zigbee_crypt.decrypt_ccm(key, nonce, mic, c, a)
+        if (level & DOT154_SEC_ENC) == 0:
+            plainText = bytes(payload)
 
-        plainText = crypt.decrypt(cipherText)[0 : len(C)]
-
-        # 6. Compute S_0 as E(Key, A[0])
-        crypt = AES.new(key, AES.MODE_CBC, b"\x00" * 16)
-        S_0 = crypt.encrypt(self.__crypt_A_i[0])
-
-        # 7. Compute MIC (T) observed as S_0 XOR U
-        T_obs = []
-        for i in range(0, len(S_0[0:8])):
-            T_obs.append((S_0[i] ^ U[i]))
-
-        # Convert T_obs back into a string (please, I need Python help)
-        T_obs = b"".join(struct.pack("B", i) for i in T_obs)
-
-        # 8. Compute a over packet contents before ciphertext payload
-        #    This is the 802.15.4 header,plus the security level, frame
-        #    counter and flags byte (01)
-        hdrlen = self.hdrlen(packet)
-        a = packet[0:hdrlen] + packet[hdrlen : hdrlen + 6]
-
-        # 9. Concatenate L(a) of 2-byte length a with a
-        addAuthData = struct.pack(">H", len(a)) + a
-
-        # 10. Pad addAuthData to an even block size
-        addAuthData += b"\x00" * (16 - len(addAuthData) % 16)
-
-        # 11. Form AuthData by concatenating addAuthData and PlaintextData
-        #     Pad plainText to an even block size
-        plainTextPadded = plainText + (b"\x00" * (16 - len(plainText) % 16))
-
-        authData = addAuthData + plainTextPadded
-
-        # 12. Perform authData transformation into B[0], B[1], ..., B[i]
-        B = b"\x59" + nonce + b"\x00\x01" + authData
-
-        # 13. Calculate the MIC (T) calculated with CBC-MAC
-        iv = b"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
-
-        for i in range(0, int(len(B) / 16)):
-            crypt = AES.new(key, AES.MODE_CBC, iv)
-            Bn = B[i * 16 : (i * 16) + 16]
-            iv = crypt.encrypt(Bn)
-
-        T_calc = iv[0:8]
-
-        # 14. Compare
-        if T_obs == T_calc:
+        if micCheck == 1:
             return plainText
         else:
-            return ""
+            return b""
+
+    def ccmparams(self, packet):
+        """
+        Returns the CCM* inputs of a secured packet, in the form taken by
+        the zigbee_crypt functions, so they can be derived once and reused
+        for any number of candidate keys. The security level must have a
+        MIC to check candidate keys against.
+
+        @type packet: Bytes
+        @param packet: Packet contents.
+        @rtype: Tuple
+        @return: (nonce, mic, encrypted payload, authenticated header data),
+            the last three as memoryviews of packet
+        """
+        params = self.__ccminputs(packet)
+        if params is None or DOT154_SEC_MIC_LEN[params[0] & 0x03] == 0:
+            raise UnsupportedPacket(
+                "Unsupported security level in packet, no MIC to check."
+            )
+        (level, nonce, mic, c, a, payload) = params
+        return (nonce, mic, c, a)
 
     def pktchop(self, packet):
         """
@@ -303,31 +315,12 @@ class Dot154PacketParser:
         @return: Length of the 802.15.4 header.
         """
 
-        # Minimum size is 11 (2 bytes FCF + 1 byte SEQ + 2 bytes DPAN +
-        #  2 bytes DstAddr + 2 bytes SPAN + 2 bytes SrcAddr)
-        # XXX Need to validate this logic based on specification
-        if len(packet) < 9:
-            raise Exception("Packet too small, %d bytes." % len(packet))
-
-        # Start with minimum size, increase as needed based on FCF flags
-        plen = 9
+        import zigbee_crypt  # type: ignore
 
-        # Byte swap
-        fcf = struct.unpack("<H", packet[0:2])[0]
-
-        # Examine the destination addressing mode
-        if (fcf & DOT154_FCF_DADDR_MASK) >> 10 == DOT154_FCF_ADDR_EXT:
-            plen += 6  # 8-byte addressing is in use, increasing addr 6 bytes
-
-        # Examine the source addressing mode
-        if (fcf & DOT154_FCF_SADDR_MASK) >> 14 == DOT154_FCF_ADDR_EXT:
-            plen += 6  # 8-byte addressing is in use, increasing addr 6 bytes
-
-        # Examine the Intra-PAN flag
-        if (fcf & DOT154_FCF_INTRA_PAN) == 0:
-            plen += 2  # Intra-PAN is false, source PAN 2-bytes is present
-
-        return plen
+        mac = zigbee_crypt.parse_mac(packet, False)
+        if mac is None:
+            raise Exception("Packet too small, %d bytes." % len(packet))
+        return mac.hdr_len
 
     def payloadlen(self, packet):
         """
@@ -17,6 +17,12 @@ from struct import pack
 
 from .config import *       #to get DEV_ENABLE_* variables 
 
+# Native FCS from the zigbee_crypt extension, makeFCS() falls back to Python
+try:
+    from zigbee_crypt import fcs as native_fcs # type: ignore
+except ImportError:
+    native_fcs = None
+
 # Known devices by USB ID:
 RZ_USB_VEND_ID: int       = 0x03EB
 RZ_USB_PROD_ID: int       = 0x210A
@@ -571,6 +577,11 @@ def makeFCS(data: bytes) -> bytes:
     @return: a CRC that is the FCS for the frame, as two hex bytes in
         little-endian order.
     '''
+    if native_fcs is not None:
+        try:
+            return native_fcs(data)
+        except TypeError:
+            pass    # not a buffer, such as a list of ints
     crc: int = 0
     for c in bytearray(data):
         #if (A PARITY BIT EXISTS): c = c & 127	#Mask off any parity bit
@@ -123,3 +123,5 @@ DLT_RAIF1 =   	198
 DLT_IPMB =   	199
 DLT_JUNIPER_ST =         200
 DLT_BLUETOOTH_HCI_H4_WITH_PHDR =   201
+DLT_IEEE802_15_4_NOFCS =   230	# 802.15.4, without the FCS 
+DLT_IEEE802_15_4_TAP =   283	# 802.15.4 with a TAP header of TLVs (RSS, LQI, channel) 
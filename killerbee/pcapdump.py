@@ -1,8 +1,21 @@
+import array
+import atexit
+import functools
+import mmap
 import struct
 import time
+import weakref
 from datetime import datetime
 
+from .pcapdlt import DLT_PPI, DLT_IEEE802_15_4
+
+try:
+    from ._pcapindex import pcap_index # type: ignore
+except ImportError:
+    pcap_index = None
+
 PCAPH_MAGIC_NUM = 0xa1b2c3d4
+PCAPH_MAGIC_NUM_NSEC = 0xa1b23c4d
 PCAPH_VER_MAJOR = 2
 PCAPH_VER_MINOR = 4
 PCAPH_THISZONE  = 0
@@ -12,47 +25,123 @@ PCAPH_SNAPLEN   = 65535
 DOT11COMMON_TAG = 0o00002
 GPS_TAG		= 30002
 
+def _open_capture_file(savefile):
+    '''
+    Opens a capture for the readers, returning the file, its mapping and a
+    memoryview of its contents. Files that can not be mapped, such as
+    pipes, FIFOs and /dev/stdin, are read whole instead, and the mapping
+    is None.
+    '''
+    if isinstance(savefile, str):
+        fh = open(savefile, mode='rb')
+    elif hasattr(savefile, 'read'):
+        fh = savefile
+    else:
+        raise ValueError("Unsupported type for 'savefile' argument")
+    try:
+        capmap = mmap.mmap(fh.fileno(), 0, access=mmap.ACCESS_READ)
+    except (OSError, ValueError):
+        # Empty files and streams can not be mapped
+        return (fh, None, memoryview(fh.read()))
+    return (fh, capmap, memoryview(capmap))
+
 class PcapReader:
 
     def __init__(self, savefile):
         '''
         Opens the specified file, validates a libpcap header is present.
-        @type savefile: String
-        @param savefile: Input libpcap filename to open
+        The file is memory-mapped rather than read, so records are found
+        without a read() per header and frames can be returned as views of
+        the mapping by pnext_view() and read_batch(), without copying.
+        Pipes and other streams that can not be mapped are read whole.
+        An empty file is an empty capture, whose datalink() is None.
+        @type savefile: String or file-like object
+        @param savefile: Input libpcap filename to open, or file-like object
         @rtype: None
         '''
         PCAPH_LEN = 24
-        self.__fh = open(savefile, mode='rb')
-        self._pcaphsnaplen = 0
-        header = self.__fh.read(PCAPH_LEN)
+        self._pcaphsnaplen = PCAPH_SNAPLEN
+        self._datalink = None
+        self._tsdiv = 1e6
+        self.__endflag = "<"
+        self.__rechdr = struct.Struct("<IIII")
+        (self.__fh, self.__map, self.__buf) = _open_capture_file(savefile)
+        if len(self.__buf) == 0:
+            self.__pos = 0
+            return
+        header = self.__buf[0:PCAPH_LEN]
+        if len(header) < PCAPH_LEN:
+            self.close()
+            raise Exception('Specified file is not a libpcap capture')
 
-        # Read the first 4 bytes for the magic number, determine endianness
-        magicnum = struct.unpack("I", header[0:4])[0]
-        if magicnum != 0xd4c3b2a1:
+        # The magic number, in the byte order of the writer, gives the
+        # endianness and whether timestamps are in micro or nanoseconds
+        magicnum = struct.unpack_from("<I", header)[0]
+        if magicnum in (PCAPH_MAGIC_NUM, PCAPH_MAGIC_NUM_NSEC):
             # Little endian
             self.__endflag = "<"
-        elif magicnum == 0xa1b2c3d4:
-            # Big endign
+        elif struct.unpack_from(">I", header)[0] in (PCAPH_MAGIC_NUM, PCAPH_MAGIC_NUM_NSEC):
+            # Big endian
             self.__endflag = ">"
+            magicnum = PCAPH_MAGIC_NUM if magicnum == 0xd4c3b2a1 else PCAPH_MAGIC_NUM_NSEC
         else:
+            self.close()
             raise Exception('Specified file is not a libpcap capture')
+        self._tsdiv = 1e9 if magicnum == PCAPH_MAGIC_NUM_NSEC else 1e6
 
         pcaph = struct.unpack("%sIHHIIII"%self.__endflag, header)
         if pcaph[1] != PCAPH_VER_MAJOR and pcaph[2] != PCAPH_VER_MINOR \
                 and pcaph[3] != PCAPH_THISZONE and pcaph[4] != PCAPH_SIGFIGS \
                 and pcaph[5] != PCAPH_SNAPLEN:
+            self.close()
             raise Exception('Unsupported pcap header format or version')
 
         self._pcaphsnaplen = pcaph[5]
         self._datalink = pcaph[6]
+        self.__rechdr = struct.Struct("%sIIII"%self.__endflag)
+        self.__pos = PCAPH_LEN
 
     def datalink(self):
         '''
-        Returns the data link type for the packet capture.
+        Returns the data link type for the packet capture, or None for an
+        empty capture.
         @rtype: Int
         '''
         return self._datalink
 
+    def tsresol(self):
+        '''
+        Returns the timestamp fraction units per second, 1e6 or 1e9 for
+        nanosecond captures, which the ts_usec of read_batch() are in.
+        As the 'tsresol' of PcapngReader.interfaces.
+        @rtype: Float
+        '''
+        return self._tsdiv
+
+    def frame_datalink(self):
+        '''
+        Returns the data link type of the frames read_batch() and frames()
+        return: for DLT_PPI captures, that of the frame inside the PPI
+        header of the first record, and otherwise datalink().
+        @rtype: Int
+        '''
+        if self._datalink != DLT_PPI:
+            return self._datalink
+        buf = self.__buf
+        PCAPH_LEN = 24
+        PCAPH_RECLEN = 16
+        if len(buf) < PCAPH_LEN + PCAPH_RECLEN + 8:
+            return DLT_IEEE802_15_4
+        return struct.unpack_from("<I", buf, PCAPH_LEN + PCAPH_RECLEN + 4)[0]
+
+    def buffer(self):
+        '''
+        Returns the whole capture file as a memoryview, which the offsets
+        of read_batch() index.
+        @rtype: memoryview
+        '''
+        return self.__buf
+
     def close(self):
         '''
         Closes the output packet capture; wrapper for pcap_close().
@@ -62,9 +151,18 @@ class PcapReader:
 
     def pcap_close(self):
         '''
-        Closes the output packet capture.
+        Closes the output packet capture. While views returned by
+        pnext_view() or buffer() are still held, the mapping stays open
+        until they are released.
         @rtype: None
         '''
+        self.__buf.release()
+        if self.__map is not None:
+            try:
+                self.__map.close()
+            except BufferError:
+                pass
+            self.__map = None
         self.__fh.close()
 
     def pnext(self):
@@ -72,69 +170,200 @@ class PcapReader:
         Wrapper for pcap_next to mimic method for Daintree SNA.  See pcap_next()
         '''
         return self.pcap_next()
- 
+
     def pcap_next(self):
         '''
         Retrieves the next packet from the capture file.  Returns a list of
         [Hdr, packet] where Hdr is a list of [timestamp, snaplen, plen] and
-        packet is a string of the payload content.  Returns None at the end
-        of the packet capture.
+        packet is a string of the payload content.  Returns [None, None] at
+        the end of the packet capture.
         @rtype: List
         '''
-        # Read the next header block
-        PCAPH_RECLEN = 16
-        rechdrdata = self.__fh.read(PCAPH_RECLEN)
-
-        try:
-            rechdrtmp = struct.unpack("%sIIII"%self.__endflag, rechdrdata)
-        except struct.error:
+        (rechdr, frame) = self.pnext_view()
+        if frame is None:
             return [None,None]
+        return [rechdr, bytes(frame)]
 
-        rechdr = [
-                float("%s.%s"%(rechdrtmp[0],rechdrtmp[1])), 
-                rechdrtmp[2], 
-                rechdrtmp[3]
-                ]
-        if rechdr[1] > rechdr[2] or rechdr[1] > self._pcaphsnaplen or rechdr[2] > self._pcaphsnaplen:
+    def pnext_view(self):
+        '''
+        As pcap_next(), but the packet is a memoryview into the capture
+        file rather than a copy of it.
+        @rtype: List
+        '''
+        PCAPH_RECLEN = 16
+        pos = self.__pos
+        buf = self.__buf
+        if len(buf) - pos < PCAPH_RECLEN:
+            return [None,None]
+        (sec, usec, caplen, plen) = self.__rechdr.unpack_from(buf, pos)
+        if caplen > plen or caplen > self._pcaphsnaplen or plen > self._pcaphsnaplen:
             raise Exception('Corrupted or invalid libpcap record header (included length exceeds actual length)')
 
-        # Read the included packet length
-        frame = self.__fh.read(rechdr[1])
-        return [rechdr, frame]
+        pos += PCAPH_RECLEN
+        self.__pos = pos + caplen
+        return [[sec + usec / self._tsdiv, caplen, plen], buf[pos:pos + caplen]]
 
+    def __iter__(self):
+        '''
+        Iterates over the remaining packets as pnext_view() returns them.
+        '''
+        while True:
+            packet = self.pnext_view()
+            if packet[1] is None:
+                return
+            yield packet
 
-class PcapDumper:
-    def __init__(self, datalink, savefile, ppi = False):
+    def tell(self):
         '''
-        Creates a libpcap file using the specified datalink type.
-        @type datalink: Integer
-        @param datalink: Datalink type, one of DLT_* defined in pcap-bpf.h
-        @type savefile: String or file-like object
-        @param savefile: Output libpcap filename to open, or file-like object
-        @type ppi: Boolean
-        @param ppi: Include CACE Per-Packet Information (defaults to False)
+        Returns the offset in buffer() of the next record header.
+        @rtype: Integer
+        '''
+        return self.__pos
+
+    def seek(self, pos):
+        '''
+        Moves to the record header at offset pos of buffer(), such as one
+        from tell() or a CaptureIndex, so pnext() returns that record next.
+        @type pos: Integer
+        @param pos: Offset of a record header
         @rtype: None
         '''
-        if ppi: from killerbee.pcapdlt import DLT_PPI
-        self.ppi = ppi
+        if pos < 24 or pos > len(self.__buf):
+            raise ValueError("Offset %r is outside the capture" % (pos,))
+        self.__pos = pos
+
+    def read_batch(self, n, strip=True):
+        '''
+        Indexes up to n of the next packets without slicing them out.
+        Returns arrays of the timestamp seconds, the timestamp fraction (in
+        microseconds, or nanoseconds for nanosecond captures), the captured
+        length and the offset of each frame in buffer(), so a frame is
+        buffer()[offset:offset+caplen]. The arrays are empty at the end of
+        the capture.
+        @type n: Integer
+        @param n: Maximum number of packets to index
+        @type strip: Boolean
+        @param strip: Index the frames of DLT_PPI captures past their CACE
+        PPI header (the default), rather than the whole record
+        @rtype: Tuple
+        @return: (ts_sec, ts_usec, caplen, offset) as array.array
+        '''
+        PCAPH_RECLEN = 16
+        ts_sec = array.array('I')
+        ts_usec = array.array('I')
+        caplens = array.array('I')
+        offsets = array.array('Q')
+        buf = self.__buf
+        snaplen = self._pcaphsnaplen
+        ppi = strip and self._datalink == DLT_PPI
+        pos = self.__pos
+        corrupt = False
+        if pcap_index is not None:
+            (pos, secs, usecs, lens, offs, corrupt) = pcap_index(buf, pos, n, self.__endflag == ">", snaplen, ppi)
+            ts_sec.frombytes(secs)
+            ts_usec.frombytes(usecs)
+            caplens.frombytes(lens)
+            offsets.frombytes(offs)
+        else:
+            unpack_from = self.__rechdr.unpack_from
+            end = len(buf) - PCAPH_RECLEN
+            while n > 0 and pos <= end:
+                (sec, usec, caplen, plen) = unpack_from(buf, pos)
+                if caplen > plen or caplen > snaplen or plen > snaplen:
+                    corrupt = True
+                    break
+                # A final record cut short by the end of the file keeps
+                # what is there, as pcap_next() does
+                avail = min(caplen, len(buf) - pos - PCAPH_RECLEN)
+                hlen = 0
+                if ppi:
+                    hlen = avail
+                    if avail >= 4:
+                        # PPI headers are little endian, whatever the file
+                        hlen = struct.unpack_from("<H", buf, pos + PCAPH_RECLEN + 2)[0]
+                        if hlen < 8 or hlen > caplen:
+                            corrupt = True
+                            break
+                        hlen = min(hlen, avail)
+                ts_sec.append(sec)
+                ts_usec.append(usec)
+                caplens.append(avail - hlen)
+                offsets.append(pos + PCAPH_RECLEN + hlen)
+                pos += PCAPH_RECLEN + caplen
+                n -= 1
+            pos = min(pos, len(buf))
+        self.__pos = pos
+        # Hand back the records before a corrupt one; the next call raises
+        if corrupt and len(offsets) == 0:
+            raise Exception('Corrupted or invalid libpcap record header (included length exceeds actual length)')
+        return (ts_sec, ts_usec, caplens, offsets)
+
+    def frames(self, n=4096):
+        '''
+        Iterates over the remaining frames as memoryviews into the capture
+        file, without their PPI header, indexing them n at a time with
+        read_batch(). Faster than iterating over pnext_view() when only
+        the frames are needed.
+        @type n: Integer
+        @param n: Packets indexed at a time
+        '''
+        buf = self.__buf
+        while True:
+            (_, _, caplens, offsets) = self.read_batch(n)
+            if len(offsets) == 0:
+                return
+            for (offset, caplen) in zip(offsets, caplens):
+                yield buf[offset:offset + caplen]
+
+
+def _flush_at_exit(ref):
+    # Registered with atexit through a weak reference, so dumpers that are
+    # never closed are not kept alive until exit, and a savefile closed by
+    # the caller, or a pipe to an exited reader, is not written to
+    dumper = ref()
+    if dumper is None:
+        return
+    try:
+        dumper.flush()
+    except (ValueError, OSError):
+        pass
+
+class _CaptureDumper:
+    def __init__(self, savefile, flush = 'interval', flush_interval = 1.0,
+                 flush_bytes = 65536):
+        '''
+        Write buffering shared by the capture writers. Subclasses append
+        their records to self._buf and call self._maybe_flush().
+        '''
+        if flush not in ('every', 'interval', 'bytes'):
+            raise ValueError("Unsupported flush policy %r" % (flush,))
+        self.flush_policy = flush
+        self.flush_interval = flush_interval
+        self.flush_bytes = flush_bytes
 
         if isinstance(savefile, str):
-            self.__fh = open(savefile, mode='wb')
+            self._fh = open(savefile, mode='wb')
         elif hasattr(savefile, 'write'):
-            self.__fh = savefile
+            self._fh = savefile
         else:
             raise ValueError("Unsupported type for 'savefile' argument")
 
-        self.datalink = datalink
-        self.__fh.write(b"".join([
-            struct.pack("I", PCAPH_MAGIC_NUM), 
-            struct.pack("H", PCAPH_VER_MAJOR),
-            struct.pack("H", PCAPH_VER_MINOR),
-            struct.pack("I", PCAPH_THISZONE),
-            struct.pack("I", PCAPH_SIGFIGS),
-            struct.pack("I", PCAPH_SNAPLEN),
-            struct.pack("I", DLT_PPI if self.ppi else self.datalink)
-            ]))
+        self._buf = bytearray()
+        self._last_flush = time.monotonic()
+        self._closed = False
+        self._atexit = functools.partial(_flush_at_exit, weakref.ref(self))
+        atexit.register(self._atexit)
+
+    def __del__(self):
+        # Records still buffered when a dumper that was never closed goes
+        # away are written out, as they would have been at exit
+        if getattr(self, '_closed', True):
+            return
+        atexit.unregister(self._atexit)
+        try:
+            self.flush()
+        except (ValueError, OSError):
+            pass
 
     def __enter__(self):
         return self
@@ -142,6 +371,113 @@ class PcapDumper:
     def __exit__(self, *exinfo):
         self.close()
 
+    def flush(self):
+        '''
+        Writes out the buffered records.
+        @rtype: None
+        '''
+        if self._closed:
+            return
+        if self._buf:
+            self._fh.write(self._buf)
+            self._buf.clear()
+        # Specially for handling FIFO needs:
+        self._fh.flush()
+        self._last_flush = time.monotonic()
+
+    def poll(self):
+        '''
+        Writes out the buffered records if flush_interval seconds have
+        passed since the last write with the 'interval' policy. The policy
+        is otherwise only checked as records are added, so a capture loop
+        calls this while no packets arrive, lest the last records stay
+        buffered until traffic resumes or the dumper is closed.
+        @rtype: None
+        '''
+        if self._closed or self.flush_policy != 'interval':
+            return
+        if time.monotonic() - self._last_flush >= self.flush_interval:
+            self.flush()
+
+    def _maybe_flush(self):
+        if self._closed:
+            raise ValueError("Write to a closed %s" % type(self).__name__)
+        if self.flush_policy == 'every':
+            self.flush()
+        elif self.flush_policy == 'bytes':
+            if len(self._buf) >= self.flush_bytes:
+                self.flush()
+        elif time.monotonic() - self._last_flush >= self.flush_interval:
+            self.flush()
+
+    def _now(self):
+        now = time.time()
+        ts_sec = int(now)
+        return (ts_sec, int((now - ts_sec) * 1e6))
+
+    def close(self):
+        '''
+        Closes the output packet capture; wrapper for pcap_close().
+        @rtype: None
+        '''
+        self.pcap_close()
+
+    def pcap_close(self):
+        '''
+        Flushes and closes the output packet capture.
+        @rtype: None
+        '''
+        if self._closed:
+            return
+        try:
+            self.flush()
+        finally:
+            self._closed = True
+            atexit.unregister(self._atexit)
+            self._fh.close()
+
+
+class PcapDumper(_CaptureDumper):
+    def __init__(self, datalink, savefile, ppi = False, flush = 'interval',
+                 flush_interval = 1.0, flush_bytes = 65536):
+        '''
+        Creates a libpcap file using the specified datalink type.
+        Records are collected in a write buffer and written out as set by
+        flush. 'every' writes each call to pcap_dump() or pcap_dump_many()
+        straight through, as a FIFO read live by Wireshark needs;
+        'interval' writes once flush_interval seconds have passed since the
+        last write, checked as records are added and by poll(), so records
+        stay buffered when traffic stops unless poll() is called; 'bytes'
+        once flush_bytes are buffered. Whatever is buffered is written by
+        flush(), close(), and at interpreter exit.
+        @type datalink: Integer
+        @param datalink: Datalink type, one of DLT_* defined in pcap-bpf.h
+        @type savefile: String or file-like object
+        @param savefile: Output libpcap filename to open, or file-like object
+        @type ppi: Boolean
+        @param ppi: Include CACE Per-Packet Information (defaults to False)
+        @type flush: String
+        @param flush: Flush policy, 'every', 'interval' (default) or 'bytes'
+        @type flush_interval: Float
+        @param flush_interval: Seconds between writes for 'interval'
+        @type flush_bytes: Integer
+        @param flush_bytes: Buffered bytes that trigger a write for 'bytes'
+        @rtype: None
+        '''
+        if ppi: from killerbee.pcapdlt import DLT_PPI
+        self.ppi = ppi
+        _CaptureDumper.__init__(self, savefile, flush, flush_interval, flush_bytes)
+
+        self.datalink = datalink
+        # Record header: ts_sec | ts_usec | incl_len | orig_len
+        self.__rechdr = struct.Struct("IIII")
+        self._buf += struct.pack("IHHIIII", PCAPH_MAGIC_NUM,
+            PCAPH_VER_MAJOR, PCAPH_VER_MINOR, PCAPH_THISZONE, PCAPH_SIGFIGS,
+            PCAPH_SNAPLEN, DLT_PPI if self.ppi else self.datalink)
+        # The global header goes out at once, so a reader of a FIFO can
+        # start before the first frame
+        self.flush()
+
     #TODO: fix freq_mhz for subGHz which end up as float
     def pcap_dump(self, packet, ts_sec=None, ts_usec=None, orig_len=None, 
                   freq_mhz = None, ant_dbm = None, location = None):
@@ -229,49 +565,61 @@ class PcapDumper:
                 ])
 
         if ts_sec == None or ts_usec == None: 
-            dt = datetime.now() 
-            ts_sec = int(dt.strftime('%s')) 
-            ts_usec = dt.microsecond
+            (ts_sec, ts_usec) = self._now()
 
         plen = len(packet)
         if orig_len == None:
             orig_len = plen
 
         #Encapsulated packet header and packet
-        output_list = [ struct.pack("I", ts_sec),
-                        struct.pack("I", ts_usec),
-                        struct.pack("I", orig_len),
-                        struct.pack("I", plen) ]
-
+        buf = self._buf
         if self.ppi is True:
-            output_list[2] = struct.pack("I", orig_len + pph_len)
-            output_list[3] = struct.pack("I", plen + pph_len)
-            output_list.append(caceppi_hdr)
+            buf += self.__rechdr.pack(ts_sec, ts_usec, plen + pph_len, orig_len + pph_len)
+            buf += caceppi_hdr
             if location is not None:
-                output_list.append(caceppi_fgeolocation)
-            output_list.append(caceppi_f80211common)
-
-        output_list.append(packet)
-        output = b''.join(output_list)
-
-        self.__fh.write(output)
-        # Specially for handling FIFO needs:
-        try:
-            self.__fh.flush()
-        except IOError as e:
-            raise e
+                buf += caceppi_fgeolocation
+            buf += caceppi_f80211common
+        else:
+            buf += self.__rechdr.pack(ts_sec, ts_usec, plen, orig_len)
+        buf += packet
 
+        self._maybe_flush()
 
-    def close(self):
+    def pcap_dump_many(self, packets, timestamps=None):
         '''
-        Closes the output packet capture; wrapper for pcap_close().
+        Appends a batch of packets to the libpcap file, with one write for
+        the batch under the 'every' flush policy. PPI headers are added as
+        by pcap_dump(), without RF or location information.
+        @type packets: List
+        @param packets: Packet contents
+        @type timestamps: List
+        @param timestamps: (ts_sec, ts_usec) of each packet.  Defaults to
+        the current timestamp for all of them.
         @rtype: None
         '''
-        self.pcap_close()
-
-    def pcap_close(self):
-        '''
-        Closed the output packet capture.
-        @rtype: None
-        '''
-        self.__fh.close()
+        if self.ppi is True:
+            policy = self.flush_policy
+            self.flush_policy = 'bytes'
+            try:
+                if timestamps is None:
+                    (ts_sec, ts_usec) = self._now()
+                    for packet in packets:
+                        self.pcap_dump(packet, ts_sec, ts_usec)
+                else:
+                    for (packet, (ts_sec, ts_usec)) in zip(packets, timestamps):
+                        self.pcap_dump(packet, ts_sec, ts_usec)
+            finally:
+                self.flush_policy = policy
+        else:
+            buf = self._buf
+            pack = self.__rechdr.pack
+            if timestamps is None:
+                (ts_sec, ts_usec) = self._now()
+                for packet in packets:
+                    buf += pack(ts_sec, ts_usec, len(packet), len(packet))
+                    buf += packet
+            else:
+                for (packet, (ts_sec, ts_usec)) in zip(packets, timestamps):
+                    buf += pack(ts_sec, ts_usec, len(packet), len(packet))
+                    buf += packet
+        self._maybe_flush()
@@ -0,0 +1,342 @@
+import array
+import mmap
+import os
+import struct
+
+from .pcapdump import PcapReader, PCAPH_MAGIC_NUM, PCAPH_MAGIC_NUM_NSEC
+from .pcapdlt import DLT_IEEE802_15_4_NOFCS, DLT_PPI
+
+KBIDX_MAGIC = b'KBIX'
+KBIDX_VERSION = 2
+KBIDX_SUFFIX = '.kbidx'
+
+# Index header: magic | version | record size | record count | offset of
+# the next record header to index | libpcap global header | fcs | sorted |
+# st_dev and st_ino of the capture | last indexed record header
+KBIDX_HEADER = struct.Struct("=4sHHQQ24sBB6xQQ16s")
+# Index record: record header offset | ts_sec | ts_frac | dst_addr |
+# src_addr | PAN ID | MAC frame control field | flags
+KBIDX_RECORD = struct.Struct("=QIIQQHHB3x")
+
+KBIDX_VALID        = 0x01  #: The MAC header parsed
+KBIDX_MAC_SECURITY = 0x02  #: MAC security enabled
+KBIDX_NWK_SECURITY = 0x04  #: ZigBee NWK security enabled
+
+#: NumPy dtype of the records of CaptureIndex.records(), e.g.
+#: numpy.frombuffer(index.records(), KBIDX_RECORD_DTYPE)
+KBIDX_RECORD_DTYPE = [
+    ("offset", "=u8"), ("ts_sec", "=u4"), ("ts_frac", "=u4"),
+    ("dst_addr", "=u8"), ("src_addr", "=u8"), ("pan", "=u2"), ("fcf", "=u2"),
+    ("flags", "u1"), ("pad", "V3"),
+]
+
+# Records indexed per call to PcapReader.read_batch()
+KBIDX_BATCH = 4096
+
+class CaptureIndex:
+
+    def __init__(self, capfile, indexfile=None):
+        '''
+        Opens the sidecar index of a libpcap capture of IEEE 802.15.4
+        frames, creating it if there is none. The index holds a fixed-size
+        record per frame of its offset, timestamp, PAN ID, source and
+        destination address, frame type and security flags, so frames can
+        be selected by time or address without reading the capture.
+        Call update() to index the frames added to the capture since.
+        @type capfile: String
+        @param capfile: libpcap capture to index
+        @type indexfile: String
+        @param indexfile: Index filename, defaults to capfile + '.kbidx'
+        @rtype: None
+        '''
+        self.capfile = capfile
+        self.indexfile = indexfile if indexfile is not None else capfile + KBIDX_SUFFIX
+        self.count = 0
+        self.sorted = True
+        self.__next = 0
+        self.__pcaph = b''
+        self.__fcs = True
+        self.__ident = (0, 0)
+        self.__lasthdr = b''
+        self.__map = None
+        self.__buf = memoryview(b'')
+        if os.path.exists(self.indexfile):
+            self.__fh = open(self.indexfile, mode='r+b')
+            header = self.__fh.read(KBIDX_HEADER.size)
+            if len(header) == KBIDX_HEADER.size:
+                (magic, version, recsize, count, nextpos, pcaph, fcs, issorted, dev, ino, lasthdr) = \
+                    KBIDX_HEADER.unpack(header)
+                if magic == KBIDX_MAGIC and version == KBIDX_VERSION and recsize == KBIDX_RECORD.size:
+                    # Records past count are from an update that did not
+                    # finish, and are written again
+                    self.count = min(count, (os.fstat(self.__fh.fileno()).st_size - KBIDX_HEADER.size) // recsize)
+                    self.__next = nextpos
+                    self.__pcaph = pcaph
+                    self.__fcs = bool(fcs)
+                    self.sorted = bool(issorted)
+                    self.__ident = (dev, ino)
+                    self.__lasthdr = lasthdr
+        else:
+            self.__fh = open(self.indexfile, mode='w+b')
+        self.__remap()
+
+    def __remap(self):
+        self.__buf.release()
+        if self.__map is not None:
+            try:
+                self.__map.close()
+            except BufferError:
+                pass
+            self.__map = None
+        size = KBIDX_HEADER.size + self.count * KBIDX_RECORD.size
+        if self.count > 0:
+            self.__map = mmap.mmap(self.__fh.fileno(), size, access=mmap.ACCESS_READ)
+            self.__buf = memoryview(self.__map)[KBIDX_HEADER.size:size]
+        else:
+            self.__buf = memoryview(b'')
+
+    def __reset(self, pcaph, datalink, ident):
+        self.count = 0
+        self.sorted = True
+        self.__next = len(pcaph)
+        self.__pcaph = pcaph
+        self.__fcs = datalink != DLT_IEEE802_15_4_NOFCS
+        self.__ident = ident
+        self.__lasthdr = b''
+
+    def __resumes(self, buf, pcaph, ident):
+        # Whether the capture is the one indexed, grown or not, rather than
+        # one written over it: the same file, still holding the record
+        # indexed last where it was
+        if pcaph != self.__pcaph or ident != self.__ident or self.__next > len(buf):
+            return False
+        if self.count == 0:
+            return True
+        self.__fh.seek(KBIDX_HEADER.size + (self.count - 1) * KBIDX_RECORD.size)
+        offset = KBIDX_RECORD.unpack(self.__fh.read(KBIDX_RECORD.size))[0]
+        return bytes(buf[offset:offset + 16]) == self.__lasthdr
+
+    def update(self):
+        '''
+        Indexes the frames added to the capture since the last update, or
+        all of them if the index is new or was built for another capture.
+        A capture replaced by another file, or written over, is indexed
+        afresh. A final record still being written is left for the next
+        update.
+        @rtype: Integer
+        @return: Number of frames indexed
+        '''
+        # Only indexing needs the extension, so importing killerbee does not
+        import zigbee_crypt  # type: ignore
+
+        cap = PcapReader(self.capfile)
+        buf = cap.buffer()
+        pcaph = bytes(buf[0:24])
+        st = os.stat(self.capfile)
+        ident = (st.st_dev, st.st_ino)
+        if not self.__resumes(buf, pcaph, ident):
+            self.__reset(pcaph, cap.frame_datalink(), ident)
+        ppi = cap.datalink() == DLT_PPI
+        endflag = "<"
+        if len(pcaph) > 0:
+            magic = struct.unpack_from("<I", pcaph)[0]
+            endflag = "<" if magic in (PCAPH_MAGIC_NUM, PCAPH_MAGIC_NUM_NSEC) else ">"
+            cap.seek(self.__next)
+
+        self.__buf.release()
+        self.__fh.seek(KBIDX_HEADER.size + self.count * KBIDX_RECORD.size)
+        self.__fh.truncate()
+        last = self.__last_ts()
+        added = 0
+        try:
+            while True:
+                start = cap.tell()
+                # Whole records, so offsets[i] - 16 is the record header
+                (ts_sec, ts_frac, caplens, offsets) = cap.read_batch(KBIDX_BATCH, strip=False)
+                n = len(offsets)
+                if n == 0:
+                    break
+                # Stop short of a record cut off by the end of the file,
+                # which is indexed once it is complete
+                if struct.unpack_from(endflag + "I", buf, offsets[n - 1] - 8)[0] != caplens[n - 1]:
+                    n -= 1
+                    cap.seek(offsets[n] - 16)
+                frames = [buf[offsets[i]:offsets[i] + caplens[i]] for i in range(n)]
+                if ppi:
+                    frames = [frame[struct.unpack_from("<H", frame, 2)[0] if len(frame) >= 4 else len(frame):]
+                              for frame in frames]
+                macs = zigbee_crypt.parse_mac_many(frames, fcs=self.__fcs)
+                records = bytearray(n * KBIDX_RECORD.size)
+                for (i, mac) in enumerate(struct.iter_unpack(zigbee_crypt.MAC_RECORD_FORMAT, macs)):
+                    (dst, src, _, fcf, dst_pan, src_pan, _, payload, payload_len, ftype) = mac[0:10]
+                    flags = 0
+                    if mac[16]:
+                        flags = KBIDX_VALID
+                        if fcf & 0x0008:
+                            flags |= KBIDX_MAC_SECURITY
+                        elif ftype == 1 and payload_len >= 2 and frames[i][payload + 1] & 0x02:
+                            flags |= KBIDX_NWK_SECURITY
+                    ts = (ts_sec[i], ts_frac[i])
+                    if ts < last:
+                        self.sorted = False
+                    last = ts
+                    KBIDX_RECORD.pack_into(records, i * KBIDX_RECORD.size, offsets[i] - 16, ts_sec[i], ts_frac[i],
+                                           dst, src, dst_pan if mac[11] else src_pan, fcf, flags)
+                del frames
+                self.__fh.write(records)
+                if n > 0:
+                    self.__lasthdr = bytes(buf[offsets[n - 1] - 16:offsets[n - 1]])
+                self.count += n
+                added += n
+                self.__next = cap.tell()
+                if n < len(offsets) or self.__next == start:
+                    break
+        finally:
+            # What was indexed is kept, also when a corrupt record stops
+            # the update
+            del buf
+            cap.close()
+            self.__fh.flush()
+            self.__fh.seek(0)
+            self.__fh.write(KBIDX_HEADER.pack(KBIDX_MAGIC, KBIDX_VERSION, KBIDX_RECORD.size, self.count,
+                                              self.__next, self.__pcaph, self.__fcs, self.sorted,
+                                              self.__ident[0], self.__ident[1], self.__lasthdr))
+            self.__fh.flush()
+            self.__remap()
+        return added
+
+    def __last_ts(self):
+        if self.count == 0:
+            return (0, 0)
+        self.__fh.seek(KBIDX_HEADER.size + (self.count - 1) * KBIDX_RECORD.size)
+        record = KBIDX_RECORD.unpack(self.__fh.read(KBIDX_RECORD.size))
+        return (record[1], record[2])
+
+    def records(self):
+        '''
+        Returns the index records as a memoryview, KBIDX_RECORD.size bytes
+        each, laid out as KBIDX_RECORD.
+        @rtype: memoryview
+        '''
+        return self.__buf
+
+    def __len__(self):
+        return self.count
+
+    def __ts(self, i):
+        return KBIDX_RECORD.unpack_from(self.__buf, i * KBIDX_RECORD.size)[1:3]
+
+    def __bisect(self, ts):
+        # First record at or after ts, on a capture in time order
+        (lo, hi) = (0, self.count)
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if self.__ts(mid) < ts:
+                lo = mid + 1
+            else:
+                hi = mid
+        return lo
+
+    def __split_ts(self, t):
+        tsdiv = 1e9 if struct.unpack_from("<I", self.__pcaph)[0] in (PCAPH_MAGIC_NUM_NSEC, 0x4d3cb2a1) else 1e6
+        sec = int(t)
+        return (sec, int(round((t - sec) * tsdiv)))
+
+    def select(self, start=None, end=None, pan=None, src=None, dst=None,
+               frame_type=None, secured=None):
+        '''
+        Finds the frames matching all of the given criteria. On a capture
+        in time order, as written by one sniffer, a time range is found by
+        binary search rather than by reading every record.
+        @type start: Float
+        @param start: Earliest timestamp, in seconds since the Unix epoch
+        @type end: Float
+        @param end: Timestamp the frames are before
+        @type pan: Integer
+        @param pan: PAN ID, the destination PAN or else the source PAN
+        @type src: Integer
+        @param src: Source address, short or extended
+        @type dst: Integer
+        @param dst: Destination address, short or extended
+        @type frame_type: Integer
+        @param frame_type: MAC frame type, one of DOT154_FCF_TYPE_*
+        @type secured: Boolean
+        @param secured: Whether the frame has MAC or NWK security enabled
+        @rtype: array.array
+        @return: Offsets of the matching records in the capture, for
+            PcapReader.seek()
+        '''
+        (lo, hi) = (0, self.count)
+        ts_start = self.__split_ts(start) if start is not None else None
+        ts_end = self.__split_ts(end) if end is not None else None
+        if self.sorted:
+            if ts_start is not None:
+                lo = self.__bisect(ts_start)
+            if ts_end is not None:
+                hi = self.__bisect(ts_end)
+            (ts_start, ts_end) = (None, None)
+
+        result = array.array('Q')
+        if lo >= hi:
+            return result
+        view = self.__buf[lo * KBIDX_RECORD.size:hi * KBIDX_RECORD.size]
+        # Frames whose MAC header did not parse only match on time
+        mac = pan is not None or src is not None or dst is not None \
+            or frame_type is not None or secured is not None
+        if ts_start is None and ts_end is None and not mac:
+            result.extend(record[0] for record in KBIDX_RECORD.iter_unpack(view))
+            return result
+        for (offset, ts_sec, ts_frac, rdst, rsrc, rpan, fcf, flags) in KBIDX_RECORD.iter_unpack(view):
+            if mac and not flags & KBIDX_VALID:
+                continue
+            if ts_start is not None and (ts_sec, ts_frac) < ts_start:
+                continue
+            if ts_end is not None and (ts_sec, ts_frac) >= ts_end:
+                continue
+            if pan is not None and (rpan != pan or not fcf & 0xcc00):
+                continue
+            if src is not None and (rsrc != src or not fcf & 0xc000):
+                continue
+            if dst is not None and (rdst != dst or not fcf & 0x0c00):
+                continue
+            if frame_type is not None and fcf & 0x0007 != frame_type:
+                continue
+            if secured is not None and bool(flags & (KBIDX_MAC_SECURITY | KBIDX_NWK_SECURITY)) != secured:
+                continue
+            result.append(offset)
+        return result
+
+    def packets(self, **criteria):
+        '''
+        Reads the frames matching the criteria of select() from the
+        capture, seeking past the others.
+        @return: Iterator of [Hdr, packet], as PcapReader.pnext_view()
+        '''
+        offsets = self.select(**criteria)
+        cap = PcapReader(self.capfile)
+        try:
+            for offset in offsets:
+                cap.seek(offset)
+                yield cap.pnext_view()
+        finally:
+            cap.close()
+
+    def close(self):
+        '''
+        Closes the index.
+        @rtype: None
+        '''
+        self.__buf.release()
+        if self.__map is not None:
+            try:
+                self.__map.close()
+            except BufferError:
+                pass
+            self.__map = None
+        self.__fh.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exinfo):
+        self.close()
@@ -0,0 +1,603 @@
+import array
+import io
+import os
+import re
+import stat
+import struct
+
+from .pcapdump import PcapReader, _CaptureDumper, _open_capture_file, PCAPH_SNAPLEN
+from .pcapdlt import DLT_IEEE802_15_4, DLT_IEEE802_15_4_TAP
+
+try:
+    from ._pcapindex import pcapng_index # type: ignore
+except ImportError:
+    pcapng_index = None
+
+# pcapng block types
+PCAPNG_SHB = 0x0A0D0D0A     # Section Header Block
+PCAPNG_IDB = 0x00000001     # Interface Description Block
+PCAPNG_SPB = 0x00000003     # Simple Packet Block
+PCAPNG_EPB = 0x00000006     # Enhanced Packet Block
+PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D
+PCAPNG_VER_MAJOR = 1
+PCAPNG_VER_MINOR = 0
+
+# Option codes
+PCAPNG_OPT_ENDOFOPT = 0
+PCAPNG_OPT_COMMENT  = 1
+PCAPNG_SHB_USERAPPL = 4
+PCAPNG_IF_NAME      = 2
+PCAPNG_IF_DESCRIPTION = 3
+PCAPNG_IF_TSRESOL   = 9
+
+# IEEE 802.15.4 TAP header TLV types, for DLT_IEEE802_15_4_TAP
+TAP_FCS_TYPE = 0            # 1 byte, 0 none, 1 16-bit, 2 32-bit
+TAP_RSS      = 1            # float, dBm
+TAP_CHANNEL  = 3            # 2 bytes channel, 1 byte page
+TAP_LQI      = 10           # 1 byte
+
+def _pad4(n):
+    return (4 - n % 4) % 4
+
+def _option(code, value):
+    return struct.pack("HH", code, len(value)) + value + b'\x00' * _pad4(len(value))
+
+def _tap_tlv(tlv, value):
+    return struct.pack("<HH", tlv, len(value)) + value + b'\x00' * _pad4(len(value))
+
+def open_capture(savefile):
+    '''
+    Opens a libpcap or pcapng capture, as told apart by its first block.
+    Pipes and other files that can not be read twice are read whole.
+    @type savefile: String or file-like object
+    @param savefile: Input capture filename to open, or file-like object
+    @rtype: PcapReader or PcapngReader
+    '''
+    if isinstance(savefile, str) and stat.S_ISREG(os.stat(savefile).st_mode):
+        with open(savefile, mode='rb') as fh:
+            magic = fh.read(4)
+    else:
+        # Reading the magic number would take it out of a stream
+        (fh, capmap, buf) = _open_capture_file(savefile)
+        if capmap is not None:
+            savefile = fh
+            magic = bytes(buf[0:4])
+            buf.release()
+            capmap.close()
+            fh.seek(0)
+        else:
+            savefile = io.BytesIO(buf)
+            fh.close()
+            magic = bytes(buf[0:4])
+    if len(magic) == 4 and struct.unpack("<I", magic)[0] == PCAPNG_SHB:
+        return PcapngReader(savefile)
+    return PcapReader(savefile)
+
+
+class PcapngReader:
+
+    def __init__(self, savefile):
+        '''
+        Opens the specified pcapng file, as written by PcapngDumper,
+        Wireshark or dumpcap. Packets of all interfaces come back from
+        pnext() in file order, along with the interface they were captured
+        on. Frames of DLT_IEEE802_15_4_TAP interfaces are returned without
+        their TAP header, whose RSS, LQI and channel are returned alongside.
+        Pipes and other streams that can not be mapped are read whole.
+        @type savefile: String or file-like object
+        @param savefile: Input pcapng filename to open, or file-like object
+        @rtype: None
+        '''
+        (self.__fh, self.__map, self.__buf) = _open_capture_file(savefile)
+        #: Interfaces of the current section, as dictionaries of linktype,
+        #: snaplen, name, description, tsresol, channel and page
+        self.interfaces = []
+        self.__pos = 0
+        if len(self.__buf) < 28 or struct.unpack_from("<I", self.__buf)[0] != PCAPNG_SHB:
+            self.close()
+            raise Exception('Specified file is not a pcapng capture')
+        self.__endflag = "<"
+        self.__read_shb(0)
+        # Interfaces are described before their first packet, usually right
+        # after the section header, so datalink() is known up front
+        pos = self.__pos
+        while len(self.__buf) - pos >= 12:
+            (btype, blen) = struct.unpack_from("%sII" % self.__endflag, self.__buf, pos)
+            if btype != PCAPNG_IDB or blen < 20 or blen > len(self.__buf) - pos:
+                break
+            self.__read_idb(pos, blen)
+            pos += blen
+        self.__pos = pos
+
+    def __read_shb(self, pos):
+        buf = self.__buf
+        if struct.unpack_from("<I", buf, pos + 8)[0] == PCAPNG_BYTE_ORDER_MAGIC:
+            self.__endflag = "<"
+        elif struct.unpack_from(">I", buf, pos + 8)[0] == PCAPNG_BYTE_ORDER_MAGIC:
+            self.__endflag = ">"
+        else:
+            raise Exception('Unsupported pcapng section header format or version')
+        (blen, major) = struct.unpack_from("%sIIH" % self.__endflag, buf, pos + 4)[0:3:2]
+        if major != PCAPNG_VER_MAJOR or blen < 28 or blen > len(buf) - pos:
+            raise Exception('Unsupported pcapng section header format or version')
+        # Interface identifiers are numbered per section
+        self.interfaces = []
+        self.__pos = pos + blen
+
+    def __options(self, pos, end):
+        opts = {}
+        while end - pos >= 4:
+            (code, olen) = struct.unpack_from("%sHH" % self.__endflag, self.__buf, pos)
+            if code == PCAPNG_OPT_ENDOFOPT or pos + 4 + olen > end:
+                break
+            opts.setdefault(code, bytes(self.__buf[pos + 4:pos + 4 + olen]))
+            pos += 4 + olen + _pad4(olen)
+        return opts
+
+    def __read_idb(self, pos, blen):
+        (linktype, snaplen) = struct.unpack_from("%sHxxI" % self.__endflag, self.__buf, pos + 8)
+        opts = self.__options(pos + 16, pos + blen - 4)
+        iface = {'linktype': linktype, 'snaplen': snaplen, 'tsresol': 1e6,
+                 'name': None, 'description': None, 'channel': None, 'page': None}
+        if PCAPNG_IF_NAME in opts:
+            iface['name'] = opts[PCAPNG_IF_NAME].rstrip(b'\x00').decode('utf-8', 'replace')
+        if PCAPNG_IF_DESCRIPTION in opts:
+            iface['description'] = opts[PCAPNG_IF_DESCRIPTION].rstrip(b'\x00').decode('utf-8', 'replace')
+            # The channel as PcapngDumper describes it
+            match = re.search(r'channel (\d+), page (\d+)', iface['description'])
+            if match is not None:
+                iface['channel'] = int(match.group(1))
+                iface['page'] = int(match.group(2))
+        if PCAPNG_IF_TSRESOL in opts and len(opts[PCAPNG_IF_TSRESOL]) > 0:
+            tsresol = opts[PCAPNG_IF_TSRESOL][0]
+            iface['tsresol'] = float(2 ** (tsresol & 0x7f) if tsresol & 0x80 else 10 ** tsresol)
+        self.interfaces.append(iface)
+
+    def datalink(self):
+        '''
+        Returns the data link type of the first interface of the capture,
+        or None if it describes none.
+        @rtype: Int
+        '''
+        if len(self.interfaces) == 0:
+            return None
+        return self.interfaces[0]['linktype']
+
+    def frame_datalink(self):
+        '''
+        Returns the data link type of the frames of the first interface as
+        read_batch() and frames() return them, DLT_IEEE802_15_4 for a
+        DLT_IEEE802_15_4_TAP interface as written by PcapngDumper, whose
+        TAP headers are taken off.
+        @rtype: Int
+        '''
+        linktype = self.datalink()
+        return DLT_IEEE802_15_4 if linktype == DLT_IEEE802_15_4_TAP else linktype
+
+    def buffer(self):
+        '''
+        Returns the whole capture file as a memoryview.
+        @rtype: memoryview
+        '''
+        return self.__buf
+
+    def close(self):
+        '''
+        Closes the packet capture; wrapper for pcap_close().
+        @rtype: None
+        '''
+        self.pcap_close()
+
+    def pcap_close(self):
+        '''
+        Closes the packet capture. While views returned by pnext_view() or
+        buffer() are still held, the mapping stays open until they are
+        released.
+        @rtype: None
+        '''
+        self.__buf.release()
+        if self.__map is not None:
+            try:
+                self.__map.close()
+            except BufferError:
+                pass
+            self.__map = None
+        self.__fh.close()
+
+    def pnext(self):
+        '''
+        Wrapper for pcap_next to mimic method for Daintree SNA.  See pcap_next()
+        '''
+        return self.pcap_next()
+
+    def pcap_next(self):
+        '''
+        Retrieves the next packet from the capture file.  Returns a list of
+        [Hdr, packet] where Hdr is a list of [timestamp, snaplen, plen,
+        interface, info], as PcapReader with the index of the packet's
+        interface in self.interfaces and a dictionary of its channel, page,
+        rssi and lqi, as known. Returns [None, None] at the end of the
+        packet capture.
+        @rtype: List
+        '''
+        (hdr, frame) = self.pnext_view()
+        if frame is None:
+            return [None,None]
+        return [hdr, bytes(frame)]
+
+    def pnext_view(self):
+        '''
+        As pcap_next(), but the packet is a memoryview into the capture
+        file rather than a copy of it.
+        @rtype: List
+        '''
+        buf = self.__buf
+        while True:
+            pos = self.__pos
+            if len(buf) - pos < 12:
+                return [None,None]
+            (btype, blen) = struct.unpack_from("%sII" % self.__endflag, buf, pos)
+            if btype == PCAPNG_SHB:
+                self.__read_shb(pos)
+                continue
+            if blen < 12 or blen % 4 != 0 or blen > len(buf) - pos:
+                raise Exception('Corrupted or invalid pcapng block (block length exceeds the file)')
+            self.__pos = pos + blen
+
+            if btype == PCAPNG_IDB and blen >= 20:
+                self.__read_idb(pos, blen)
+            elif btype == PCAPNG_EPB and blen >= 32:
+                (ifid, ts_high, ts_low, caplen, plen) = struct.unpack_from("%sIIIII" % self.__endflag, buf, pos + 8)
+                if ifid >= len(self.interfaces) or caplen > blen - 32:
+                    raise Exception('Corrupted or invalid pcapng enhanced packet block')
+                iface = self.interfaces[ifid]
+                ts = ((ts_high << 32) | ts_low) / iface['tsresol']
+                opts = self.__options(pos + 28 + caplen + _pad4(caplen), pos + blen - 4)
+                return self.__packet(ts, ifid, buf[pos + 28:pos + 28 + caplen], plen,
+                                     opts.get(PCAPNG_OPT_COMMENT))
+            elif btype == PCAPNG_SPB and blen >= 16 and len(self.interfaces) > 0:
+                plen = struct.unpack_from("%sI" % self.__endflag, buf, pos + 8)[0]
+                caplen = min(plen, blen - 16)
+                return self.__packet(None, 0, buf[pos + 12:pos + 12 + caplen], plen)
+            # Other blocks (name resolution, statistics, ...) are skipped
+
+    def __packet(self, ts, ifid, frame, plen, comment=None):
+        iface = self.interfaces[ifid]
+        info = {'channel': iface['channel'], 'page': iface['page'], 'rssi': None, 'lqi': None}
+        if comment is not None:
+            # The RSSI and LQI as PcapngDumper notes them without a TAP header
+            comment = comment.rstrip(b'\x00').decode('utf-8', 'replace')
+            match = re.search(r'rssi (-?[\d.]+) dBm', comment)
+            if match is not None:
+                info['rssi'] = float(match.group(1))
+            match = re.search(r'lqi (\d+)', comment)
+            if match is not None:
+                info['lqi'] = int(match.group(1))
+        if iface['linktype'] == DLT_IEEE802_15_4_TAP and len(frame) >= 4:
+            taplen = struct.unpack_from("<H", frame, 2)[0]
+            if 4 <= taplen <= len(frame):
+                pos = 4
+                while taplen - pos >= 4:
+                    (tlv, vlen) = struct.unpack_from("<HH", frame, pos)
+                    value = frame[pos + 4:pos + 4 + vlen]
+                    if tlv == TAP_RSS and vlen == 4:
+                        info['rssi'] = struct.unpack("<f", value)[0]
+                    elif tlv == TAP_LQI and vlen == 1:
+                        info['lqi'] = value[0]
+                    elif tlv == TAP_CHANNEL and vlen == 3:
+                        (info['channel'], info['page']) = struct.unpack("<HB", value)
+                    pos += 4 + vlen + _pad4(vlen)
+                frame = frame[taplen:]
+                plen -= taplen
+        return [[ts, len(frame), plen, ifid, info], frame]
+
+    def __iter__(self):
+        '''
+        Iterates over the remaining packets as pnext_view() returns them.
+        '''
+        while True:
+            packet = self.pnext_view()
+            if packet[1] is None:
+                return
+            yield packet
+
+    def read_batch(self, n):
+        '''
+        Indexes up to n of the next packets without slicing them out, as
+        PcapReader.read_batch(). Returns arrays of the timestamp in seconds
+        (0 for simple packet blocks), the captured length, the offset of
+        each frame in buffer() and the index of its interface in
+        self.interfaces. Frames of DLT_IEEE802_15_4_TAP interfaces are
+        indexed past their TAP header. The arrays are empty at the end of
+        the capture.
+        @type n: Integer
+        @param n: Maximum number of packets to index
+        @rtype: Tuple
+        @return: (ts, caplen, offset, interface) as array.array
+        '''
+        PCAPNG_STATUS_CORRUPT = 1
+        PCAPNG_STATUS_HEADER = 2
+        ts = array.array('d')
+        caplens = array.array('I')
+        offsets = array.array('Q')
+        ifids = array.array('I')
+        buf = self.__buf
+        corrupt = False
+        while len(offsets) < n:
+            pos = self.__pos
+            tsdiv = array.array('d', [iface['tsresol'] for iface in self.interfaces])
+            tap = bytes(iface['linktype'] == DLT_IEEE802_15_4_TAP for iface in self.interfaces)
+            if pcapng_index is not None:
+                (pos, t, lens, offs, ifs, status) = pcapng_index(buf, pos, n - len(offsets), self.__endflag == ">", tsdiv, tap)
+                ts.frombytes(t)
+                caplens.frombytes(lens)
+                offsets.frombytes(offs)
+                ifids.frombytes(ifs)
+            else:
+                (pos, status) = self.__index(pos, n - len(offsets), tsdiv, tap, ts, caplens, offsets, ifids)
+            self.__pos = pos
+            if status == PCAPNG_STATUS_CORRUPT:
+                corrupt = True
+                break
+            if status != PCAPNG_STATUS_HEADER:
+                break
+            (btype, blen) = struct.unpack_from("%sII" % self.__endflag, buf, pos)
+            if btype == PCAPNG_SHB:
+                self.__read_shb(pos)
+            elif blen < 20 or blen % 4 != 0 or blen > len(buf) - pos:
+                corrupt = True
+                break
+            else:
+                self.__read_idb(pos, blen)
+                self.__pos = pos + blen
+        # Hand back the packets before a corrupt block; the next call raises
+        if corrupt and len(offsets) == 0:
+            raise Exception('Corrupted or invalid pcapng block')
+        return (ts, caplens, offsets, ifids)
+
+    def __index(self, pos, n, tsdiv, tap, ts, caplens, offsets, ifids):
+        # read_batch() without _pcapindex.pcapng_index(), see there
+        buf = self.__buf
+        fmt = "%sIIIIII" % self.__endflag
+        while n > 0 and len(buf) - pos >= 12:
+            (btype, blen) = struct.unpack_from(fmt[:3], buf, pos)
+            if btype in (PCAPNG_SHB, PCAPNG_IDB):
+                return (pos, 2)
+            if blen < 12 or blen % 4 != 0:
+                return (pos, 1)
+            if blen > len(buf) - pos:
+                break
+            if btype == PCAPNG_EPB and blen >= 32:
+                (ifid, ts_high, ts_low, caplen) = struct.unpack_from(fmt, buf, pos)[2:6]
+                if ifid >= len(tsdiv) or caplen > blen - 32:
+                    return (pos, 1)
+                t = ((ts_high << 32) | ts_low) / tsdiv[ifid]
+                off = pos + 28
+            elif btype == PCAPNG_SPB and blen >= 16:
+                if len(tsdiv) == 0:
+                    return (pos, 1)
+                (ifid, t, off) = (0, 0.0, pos + 12)
+                caplen = min(struct.unpack_from(fmt[:2], buf, pos + 8)[0], blen - 16)
+            else:
+                pos += blen
+                continue
+            if ifid < len(tap) and tap[ifid] and caplen >= 4:
+                hlen = struct.unpack_from("<H", buf, off + 2)[0]
+                if 4 <= hlen <= caplen:
+                    off += hlen
+                    caplen -= hlen
+            ts.append(t)
+            caplens.append(caplen)
+            offsets.append(off)
+            ifids.append(ifid)
+            pos += blen
+            n -= 1
+        return (pos, 0)
+
+    def frames(self, n=4096):
+        '''
+        Iterates over the remaining frames as memoryviews into the capture
+        file, without their TAP header, indexing them n at a time with
+        read_batch().
+        @type n: Integer
+        @param n: Packets indexed at a time
+        '''
+        buf = self.__buf
+        while True:
+            (_, caplens, offsets, _) = self.read_batch(n)
+            if len(offsets) == 0:
+                return
+            for (offset, caplen) in zip(offsets, caplens):
+                yield buf[offset:offset + caplen]
+
+
+class PcapngDumper(_CaptureDumper):
+    def __init__(self, savefile, flush = 'interval', flush_interval = 1.0,
+                 flush_bytes = 65536):
+        '''
+        Creates a pcapng file. Unlike libpcap, a pcapng file describes each
+        interface it holds packets of, so frames of several radios, each on
+        its own channel and data link type, can share one file. Interfaces
+        are added by add_interface(), or on the first packet written if
+        there are none. Writes are buffered as for PcapDumper.
+        @type savefile: String or file-like object
+        @param savefile: Output pcapng filename to open, or file-like object
+        @type flush: String
+        @param flush: Flush policy, 'every', 'interval' (default) or 'bytes'
+        @type flush_interval: Float
+        @param flush_interval: Seconds between writes for 'interval'
+        @type flush_bytes: Integer
+        @param flush_bytes: Buffered bytes that trigger a write for 'bytes'
+        @rtype: None
+        '''
+        _CaptureDumper.__init__(self, savefile, flush, flush_interval, flush_bytes)
+        # Block header: block type | block total length, closed by the
+        # block total length again
+        self.__epbhdr = struct.Struct("IIIIIII")
+        self.__interfaces = []
+        self.__taps = []
+        opts = _option(PCAPNG_SHB_USERAPPL, b'KillerBee') + struct.pack("HH", PCAPNG_OPT_ENDOFOPT, 0)
+        blen = 28 + len(opts)
+        # A section length of -1 leaves the section length unspecified
+        self._buf += struct.pack("IIIHHq", PCAPNG_SHB, blen, PCAPNG_BYTE_ORDER_MAGIC,
+                                 PCAPNG_VER_MAJOR, PCAPNG_VER_MINOR, -1)
+        self._buf += opts + struct.pack("I", blen)
+        self.flush()
+
+    def add_interface(self, datalink = DLT_IEEE802_15_4, name = None,
+                      channel = None, page = 0, snaplen = PCAPH_SNAPLEN):
+        '''
+        Describes an interface, e.g. one radio on one channel, for the
+        packets that follow. Adding an interface that is already described
+        returns its existing identifier.
+        @type datalink: Integer
+        @param datalink: DLT_IEEE802_15_4, DLT_IEEE802_15_4_NOFCS or
+        DLT_IEEE802_15_4_TAP, whose packets carry their RSSI, LQI and
+        channel in a TAP header
+        @type name: String
+        @param name: Interface name, e.g. the device string
+        @type channel: Integer
+        @param channel: Channel the interface captures on
+        @type page: Integer
+        @param page: Channel page the interface captures on
+        @type snaplen: Integer
+        @param snaplen: Maximum captured length of a packet
+        @rtype: Integer
+        @return: Interface identifier, for pcap_dump()
+        '''
+        key = (datalink, name, channel, page, snaplen)
+        if key in self.__interfaces:
+            return self.__interfaces.index(key)
+        opts = b''
+        if name is not None:
+            opts += _option(PCAPNG_IF_NAME, name.encode('utf-8'))
+        tap = b''
+        if channel is not None:
+            opts += _option(PCAPNG_IF_DESCRIPTION, 'IEEE 802.15.4 channel {0}, page {1}'.format(channel, page).encode('utf-8'))
+            tap = _tap_tlv(TAP_CHANNEL, struct.pack("<HB", channel, page))
+        if opts:
+            opts += struct.pack("HH", PCAPNG_OPT_ENDOFOPT, 0)
+        blen = 20 + len(opts)
+        self._buf += struct.pack("IIHHI", PCAPNG_IDB, blen, datalink, 0, snaplen)
+        self._buf += opts + struct.pack("I", blen)
+        self.__interfaces.append(key)
+        # TAP TLVs that are the same for every packet of the interface:
+        # the FCS type (frames are written with their 16-bit FCS, as for
+        # DLT_IEEE802_15_4) and the channel
+        self.__taps.append(_tap_tlv(TAP_FCS_TYPE, b'\x01') + tap if datalink == DLT_IEEE802_15_4_TAP else None)
+        self._maybe_flush()
+        return len(self.__interfaces) - 1
+
+    def __interface(self, interface):
+        if interface is None:
+            if len(self.__interfaces) == 0:
+                return self.add_interface()
+            return 0
+        if interface < 0 or interface >= len(self.__interfaces):
+            raise ValueError("Unknown pcapng interface %r" % (interface,))
+        return interface
+
+    def pcap_dump(self, packet, ts_sec=None, ts_usec=None, orig_len=None,
+                  freq_mhz = None, ant_dbm = None, location = None,
+                  interface = None, lqi = None):
+        '''
+        Appends a new packet to the pcapng file.  Takes the arguments of
+        PcapDumper.pcap_dump(); freq_mhz and location are not recorded, as
+        the interface gives the channel.
+        @type packet: String
+        @param packet: Packet contents
+        @type ts_sec: Integer
+        @param ts_sec: Timestamp, number of seconds since Unix epoch.  Default
+        is the current timestamp.
+        @type ts_usec: Integer
+        @param ts_usec: Timestamp microseconds.  Defaults to current timestamp.
+        @type orig_len: Integer
+        @param orig_len: Length of the original packet.  Defaults to the
+        specified packet's length.
+        @type ant_dbm: Integer
+        @param ant_dbm: Received signal strength in dBm, recorded in the
+        TAP header for DLT_IEEE802_15_4_TAP interfaces and in a comment on
+        the packet for others
+        @type interface: Integer
+        @param interface: Interface identifier from add_interface().
+        Defaults to the first interface.
+        @type lqi: Integer
+        @param lqi: Link quality indication, recorded as ant_dbm is
+        @rtype: None
+        '''
+        ifid = self.__interface(interface)
+        if ts_sec == None or ts_usec == None:
+            (ts_sec, ts_usec) = self._now()
+        if orig_len == None:
+            orig_len = len(packet)
+
+        tap = self.__taps[ifid]
+        if tap is not None:
+            if ant_dbm is not None:
+                tap += _tap_tlv(TAP_RSS, struct.pack("<f", ant_dbm))
+            if lqi is not None:
+                tap += _tap_tlv(TAP_LQI, struct.pack("<B", lqi))
+            tap = struct.pack("<BBH", 0, 0, 4 + len(tap)) + tap
+            orig_len += len(tap)
+            packet = tap + bytes(packet)
+            opts = b''
+        else:
+            # Without a TAP header, as PcapngReader reads it back
+            comment = []
+            if ant_dbm is not None:
+                comment.append('rssi {0} dBm'.format(ant_dbm))
+            if lqi is not None:
+                comment.append('lqi {0}'.format(lqi))
+            opts = b''
+            if comment:
+                opts = _option(PCAPNG_OPT_COMMENT, ', '.join(comment).encode('utf-8'))
+                opts += struct.pack("HH", PCAPNG_OPT_ENDOFOPT, 0)
+        self.__epb(ifid, ts_sec, ts_usec, packet, orig_len, opts)
+        self._maybe_flush()
+
+    def pcap_dump_many(self, packets, timestamps=None, interface=None):
+        '''
+        Appends a batch of packets of one interface to the pcapng file,
+        with one write for the batch under the 'every' flush policy.
+        @type packets: List
+        @param packets: Packet contents
+        @type timestamps: List
+        @param timestamps: (ts_sec, ts_usec) of each packet.  Defaults to
+        the current timestamp for all of them.
+        @type interface: Integer
+        @param interface: Interface identifier from add_interface()
+        @rtype: None
+        '''
+        ifid = self.__interface(interface)
+        if self.__taps[ifid] is not None:
+            policy = self.flush_policy
+            self.flush_policy = 'bytes'
+            try:
+                if timestamps is None:
+                    timestamps = [self._now()] * len(packets)
+                for (packet, (ts_sec, ts_usec)) in zip(packets, timestamps):
+                    self.pcap_dump(packet, ts_sec, ts_usec, interface=ifid)
+            finally:
+                self.flush_policy = policy
+        else:
+            if timestamps is None:
+                (ts_sec, ts_usec) = self._now()
+                for packet in packets:
+                    self.__epb(ifid, ts_sec, ts_usec, packet, len(packet))
+            else:
+                for (packet, (ts_sec, ts_usec)) in zip(packets, timestamps):
+                    self.__epb(ifid, ts_sec, ts_usec, packet, len(packet))
+        self._maybe_flush()
+
+    def __epb(self, ifid, ts_sec, ts_usec, packet, orig_len, opts=b''):
+        # Timestamps are in the default resolution of microseconds
+        ts = ts_sec * 1000000 + ts_usec
+        caplen = len(packet)
+        pad = _pad4(caplen)
+        blen = 32 + caplen + pad + len(opts)
+        buf = self._buf
+        buf += self.__epbhdr.pack(PCAPNG_EPB, blen, ifid, ts >> 32, ts & 0xffffffff, caplen, orig_len)
+        buf += packet
+        buf += b'\x00' * pad
+        buf += opts
+        buf += struct.pack("I", blen)
@@ -1,4 +1,4 @@
-from typing import Optional, Union, Tuple, Any, List
+from typing import Optional, Union, Tuple, Any, List, Dict
 
 DEFAULT_KB_CHANNEL: int = 11
 DEFAULT_KB_PAGE: Optional[int] = None
@@ -26,7 +26,7 @@ from scapy.all import Packet # type: ignore
 
 from killerbee import *
 
-import os, time, struct
+import os, time, struct, mmap
 from .kbutils import randmac
 
 import logging
@@ -35,6 +35,121 @@ log_killerbee = logging.getLogger('scapy.killerbee')
 # new scapy needs to know if we're using sixlowpan or zigbee
 conf.dot15d4_protocol = "zigbee"
 
+# kbdecrypt()/kbencrypt() are usually called many times in a row with the same
+# key, so keep the keyed zigbee_crypt.CCMContext objects around rather than
+# expanding the AES key schedule again for every frame.
+KB_CCM_CONTEXT_CACHE_SIZE: int = 16
+__kb_ccm_contexts: Dict[Tuple[bytes, int], Any] = {}
+
+# Records kbrdpcap() indexes per call to read_batch()
+KBRDPCAP_BATCH: int = 4096
+
+def __kb_ccm_context(key: bytes, miclen: int) -> Any:
+    import zigbee_crypt # type: ignore
+    ctxkey: Tuple[bytes, int] = (bytes(key), miclen)
+    ctx: Any = __kb_ccm_contexts.get(ctxkey)
+    if ctx is None:
+        if len(__kb_ccm_contexts) >= KB_CCM_CONTEXT_CACHE_SIZE:
+            __kb_ccm_contexts.clear()
+        ctx = zigbee_crypt.CCMContext(ctxkey[0], miclen)
+        __kb_ccm_contexts[ctxkey] = ctx
+    return ctx
+
+class KBLazyPacket:
+    """
+    A captured frame kept as its raw bytes, dissected into a scapy packet
+    only when one of the packet's attributes is first used. The MAC, NWK and
+    APS headers can be inspected through the mac, nwk and aps properties,
+    which zigbee_crypt decodes from the raw bytes without building a scapy
+    packet, so holding a large capture costs little more than its bytes.
+    """
+    __slots__ = ('raw', 'time', 'fcs', '_pkt')
+
+    def __init__(self, raw: bytes, time: Optional[float]=None, fcs: bool=True) -> None:
+        self.raw: bytes = raw
+        self.time: Optional[float] = time
+        self.fcs: bool = fcs
+        self._pkt: Any = None
+
+    @property
+    def pkt(self) -> Packet:
+        """The dissected Dot15d4FCS, or Dot15d4 if the frame has no FCS."""
+        if self._pkt is None:
+            self._pkt = Dot15d4FCS(self.raw) if self.fcs else Dot15d4(self.raw)
+            if self.time is not None:
+                self._pkt.time = self.time
+        return self._pkt
+
+    @property
+    def mac(self) -> Any:
+        """zigbee_crypt.parse_mac() of the frame, or None if it is malformed."""
+        import zigbee_crypt # type: ignore
+        return zigbee_crypt.parse_mac(self.raw, self.fcs)
+
+    @property
+    def nwk(self) -> Any:
+        """zigbee_crypt.NWKFrame of a MAC data frame, or None."""
+        import zigbee_crypt # type: ignore
+        mac = self.mac
+        if mac is None or mac.frame_type != 1:
+            return None
+        try:
+            return zigbee_crypt.NWKFrame(self.raw, mac.payload, mac.payload_len)
+        except ValueError:
+            return None
+
+    @property
+    def aps(self) -> Any:
+        """zigbee_crypt.APSFrame of a NWK data frame without NWK security, or None."""
+        import zigbee_crypt # type: ignore
+        nwk = self.nwk
+        if nwk is None or nwk.frame_type != ZBEE_NWK_FCF_DATA or nwk.security:
+            return None
+        end = len(self.raw) - (2 if self.fcs else 0)
+        try:
+            return zigbee_crypt.APSFrame(self.raw, nwk.payload_offset, end - nwk.payload_offset)
+        except ValueError:
+            return None
+
+    def __getattr__(self, name: str) -> Any:
+        if name in KBLazyPacket.__slots__:
+            raise AttributeError(name)
+        return getattr(self.pkt, name)
+
+    def __bytes__(self) -> bytes:
+        return self.raw
+
+    def __len__(self) -> int:
+        return len(self.raw)
+
+    def __contains__(self, cls: Any) -> bool:
+        return cls in self.pkt
+
+    def __getitem__(self, cls: Any) -> Any:
+        return self.pkt[cls]
+
+    def __truediv__(self, other: Any) -> Any:
+        return self.pkt / other
+
+    def __repr__(self) -> str:
+        return repr(self.pkt)
+
+class KBLazyPacketList(plist.PacketList):
+    """
+    PacketList of KBLazyPacket. Its repr only counts the frames, where that
+    of PacketList would dissect every one of them to tally the protocols.
+    """
+    def __repr__(self) -> str:
+        return "<%s: %d frames>" % (self.listname, len(self.res))
+
+def __kb_lazy_keep(packet: KBLazyPacket, lfilter_raw: Optional[Any], lazy: bool) -> Optional[Any]:
+    # Apply lfilter_raw to the raw frame, then dissect it unless lazy. The
+    # frame may be a view of the capture, copied only once it is kept.
+    if lfilter_raw and not lfilter_raw(packet):
+        return None
+    packet.raw = bytes(packet.raw)
+    return packet if lazy else packet.pkt
+
 def __kb_send(kb: KillerBee, x: Union[str, Gen], channel: Optional[int]=None, page: int=0, inter: int=0, loop: int=0, count: Optional[int]=None, verbose: Optional[int]=None, realtime: Optional[int]=None, *args: Any, **kargs: Any) -> int:
     if type(x) is str:
         x = Raw(load=x)
@@ -72,7 +187,7 @@ def __kb_send(kb: KillerBee, x: Union[str, Gen], channel: Optional[int]=None, pa
         pass
     return n
 
-def __kb_recv(kb: KillerBee, count: int=0, store: int=1, prn: Optional[Any]=None, lfilter: Optional[Any]=None, stop_filter: Optional[Any]=None, verbose: Optional[int]=None, timeout: Optional[int]=None) -> List[bytes]:
+def __kb_recv(kb: KillerBee, count: int=0, store: int=1, prn: Optional[Any]=None, lfilter: Optional[Any]=None, stop_filter: Optional[Any]=None, verbose: Optional[int]=None, timeout: Optional[int]=None, lazy: bool=False, lfilter_raw: Optional[Any]=None) -> List[bytes]:
     kb.sniffer_on()
     if timeout is not None:
         stoptime = time.time()+timeout
@@ -93,7 +208,9 @@ def __kb_recv(kb: KillerBee, count: int=0, store: int=1, prn: Optional[Any]=None
             if packet is None: continue
             if verbose > 1:
                 os.write(1, b"*")
-            packet = Dot15d4(packet[0])
+            packet = __kb_lazy_keep(KBLazyPacket(packet[0], time.time(), fcs=False), lfilter_raw, lazy)
+            if packet is None:
+                continue
             if lfilter and not lfilter(packet):
                 continue
             packetcount += 1
@@ -206,7 +323,7 @@ def kbsrp1(pkt: bytes, channel: Optional[int]=None, page: int=0, inter: int=0, i
     return kbsrp(pkt, channel = channel, page = page, inter = inter, count = 1, iface = iface, store = store, prn = prn, lfilter = lfilter, timeout = timeout, verbose = verbose, realtime = realtime)
 
 @conf.commands.register
-def kbsniff(channel: Optional[int]=None, page: int=0, count: int=0, iface: Optional[Any]=None, store: int=1, prn: Optional[int]=None, lfilter: Optional[int]=None, stop_filter: Any=None, verbose: Optional[int]=None, timeout: Optional[int]=None) -> plist.PacketList:
+def kbsniff(channel: Optional[int]=None, page: int=0, count: int=0, iface: Optional[Any]=None, store: int=1, prn: Optional[int]=None, lfilter: Optional[int]=None, stop_filter: Any=None, verbose: Optional[int]=None, timeout: Optional[int]=None, lazy: bool=False, lfilter_raw: Optional[Any]=None) -> plist.PacketList:
     """
     Sniff packets with KillerBee.
     @param channel:  802.15.4 channel to transmit/receive on
@@ -221,6 +338,10 @@ def kbsniff(channel: Optional[int]=None, page: int=0, count: int=0, iface: Optio
                       if further action may be done
                       ex: lfilter = lambda x: x.haslayer(Padding)
     @param timeout:  stop sniffing after a given time (default: None)
+    @param lazy:     keep packets as KBLazyPacket, dissected on first use
+    @param lfilter_raw: python function applied to each KBLazyPacket before
+                      it is dissected, to drop packets cheaply
+                      ex: lfilter_raw = lambda x: x.mac.dst_pan == 0x1234
     """
     if channel is None:
         channel = conf.killerbee_channel
@@ -235,10 +356,13 @@ def kbsniff(channel: Optional[int]=None, page: int=0, count: int=0, iface: Optio
     else:
         kb = iface
 
-    return plist.PacketList(__kb_recv(kb, count = count, store = store, prn = prn, lfilter = lfilter, stop_filter = stop_filter, verbose = verbose, timeout = timeout), 'Sniffed')
+    pkts: List[Any] = __kb_recv(kb, count = count, store = store, prn = prn, lfilter = lfilter, stop_filter = stop_filter, verbose = verbose, timeout = timeout, lazy = lazy, lfilter_raw = lfilter_raw)
+    if lazy:
+        return KBLazyPacketList(pkts, 'Sniffed')
+    return plist.PacketList(pkts, 'Sniffed')
 
 @conf.commands.register
-def kbrdpcap(filename: str, count: int=-1, skip: int=0, nofcs: bool=False) -> plist.PacketList:
+def kbrdpcap(filename: str, count: int=-1, skip: int=0, nofcs: bool=False, lazy: bool=False, lfilter_raw: Optional[Any]=None) -> plist.PacketList:
     """
     Read a pcap file with the KillerBee library.
     Wraps the PcapReader to return scapy packet object from pcap files.
@@ -246,34 +370,72 @@ def kbrdpcap(filename: str, count: int=-1, skip: int=0, nofcs: bool=False) -> pl
     This is not necessarily better, and suggestions are welcome.
     Specify nofcs parameter as True if for some reason the packets in the PCAP
     don't have FCS (checksums) at the end.
+    pcapng captures are read as well, the packets of all their interfaces
+    in file order. The CACE PPI header of DLT_PPI captures is taken off.
+    With lazy, packets are kept as KBLazyPacket and only dissected when
+    used, so large captures load quickly and in little memory.
+    lfilter_raw, if given, is applied to each KBLazyPacket before it is
+    dissected, and packets it rejects are dropped, e.g.
+    lfilter_raw = lambda x: x.nwk is not None and x.nwk.src == 0
     @return: Scapy packetlist of Dot15d4 packets parsed from the given PCAP file.
     """
-    cap: PcapReader = PcapReader(filename)
-    lst: List[bytes] = []
+    cap: Union[PcapReader, PcapngReader] = open_capture(filename)
+    buf: memoryview = cap.buffer()
+    lst: List[Any] = []
     packetcount: int = 0
     if count > 0:
         count += skip
 
-    while 1:
-        packet: bytes = cap.pnext()
-        packetcount += 1
-        if packet[1] == None:
-            break
-        if skip > 0 and packetcount <= skip:
-            continue
-        if nofcs: packet = Dot15d4(packet[1])
-        else:     packet = Dot15d4FCS(packet[1])
-        lst.append(packet)
-        if count > 0 and packetcount >= count:
+    # Records are indexed a batch at a time, natively where the
+    # killerbee._pcapindex extension is built, and the frames sliced out of
+    # the mapped file
+    while count <= 0 or packetcount < count:
+        n: int = KBRDPCAP_BATCH if count <= 0 else min(KBRDPCAP_BATCH, count - packetcount)
+        if isinstance(cap, PcapngReader):
+            (ts, caplens, offsets, _) = cap.read_batch(n)
+        else:
+            (ts_sec, ts_frac, caplens, offsets) = cap.read_batch(n)
+            tsresol: float = cap.tsresol()
+            ts = [sec + frac / tsresol for (sec, frac) in zip(ts_sec, ts_frac)]
+        if len(offsets) == 0:
             break
+        for i in range(len(offsets)):
+            packetcount += 1
+            if packetcount <= skip:
+                continue
+            packet: Any = __kb_lazy_keep(KBLazyPacket(buf[offsets[i]:offsets[i] + caplens[i]], ts[i], fcs = not nofcs),
+                                         lfilter_raw, lazy)
+            if packet is not None:
+                lst.append(packet)
+    del buf
+    cap.close()
 
+    if lazy:
+        return KBLazyPacketList(lst, os.path.basename(filename))
     return plist.PacketList(lst, os.path.basename(filename))
 
 @conf.commands.register
 def kbwrpcap(save_file: str, pkts: List[bytes]) -> None:
     """
     Write a pcap using the KillerBee library.
+    A save_file ending in .pcapng is written as pcapng, with the link type
+    of the first packet.
     """
+    if save_file.lower().endswith('.pcapng'):
+        pkts = list(pkts)
+        linktype: int = DLT_IEEE802_15_4
+        if len(pkts) > 0:
+            first: Any = pkts[0]
+            if (isinstance(first, KBLazyPacket) and not first.fcs) or \
+                    (isinstance(first, Packet) and not first.haslayer(Dot15d4FCS)):
+                linktype = DLT_IEEE802_15_4_NOFCS
+        timestamps: Optional[List[Tuple[int, int]]] = None
+        if all(getattr(packet, 'time', None) is not None for packet in pkts):
+            timestamps = [(int(packet.time), int(float(packet.time) % 1 * 1e6)) for packet in pkts]
+        with PcapngDumper(save_file) as png:
+            png.add_interface(linktype)
+            png.pcap_dump_many([bytes(packet) for packet in pkts], timestamps)
+        return
     pd: PcapWriter = PcapWriter(save_file)
     for packet in pkts:
         pd.write(bytes(packet))
@@ -315,101 +477,103 @@ def kbwrdain(save_file: str, pkts: List[Any]) -> None:
     dt.close()
 
 @conf.commands.register
-def kbkeysearch(packet: Any, searchdata: str, ispath: bool=True, skipfcs: bool=True, raw: bool=False) -> Optional[str]:
+def kbkeysearch(packet: Any, searchdata: Union[str, bytes], ispath: bool=True, skipfcs: bool=True, raw: bool=False, threads: int=1) -> Optional[Union[str, bytes]]:
     """
     Search a binary file for the encryption key to an encrypted packet.
     """
     if 'fcf_security' in packet.fields and packet.fcf_security == 0:
         raise Exception('Packet Not Encrypted (fcf_security Not Set)')
-    if ispath:
-        searchdata = open(searchdata, 'r').read()
+    try:
+        import zigbee_crypt # type: ignore
+    except ImportError:
+        log_killerbee.error("Could not import zigbee_crypt extension, cryptographic functionality is not available.")
+        return None
     packet = packet.do_build()
     if skipfcs:
         packet = packet[:-2]
-    offset: int = 0
-    keybytes: List[bytes] = []
-    d: Dot154PacketParser = Dot154PacketParser()
-    searchdatalen: int = len(searchdata)
-    while (offset < (searchdatalen - 16)):
-        if d.decrypt(packet, searchdata[offset:offset+16]) != '':
-            if raw:
-                return ''.join(searchdata[offset + i] for i in range(0, 16))
-            else:
-                return ':'.join("%02x" % ord(searchdata[offset + i]) for i in range(0, 16))
-        else:
-            offset+=1
-    return None
+    (nonce, mic, encrypted, zigbeeData) = Dot154PacketParser().ccmparams(packet)
+
+    def search(buf: Any) -> Optional[bytes]:
+        offset: Optional[int] = zigbee_crypt.search_key(nonce, mic, encrypted, zigbeeData, buf, threads=threads)
+        if offset is None:
+            return None
+        return bytes(buf[offset:offset+16])
+
+    key: Optional[bytes]
+    if ispath:
+        # The search file is mapped rather than read, and unmapped again
+        # before returning
+        with open(searchdata, 'rb') as f:
+            if os.fstat(f.fileno()).st_size == 0:
+                return None
+            with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+                key = search(m)
+    else:
+        key = search(searchdata)
+    if key is None:
+        return None
+    if raw:
+        return key
+    else:
+        return ':'.join("%02x" % b for b in key)
 
 @conf.commands.register
 def kbgetnetworkkey(pkts: Gen) -> Dict[str, str]:
     """
     Search packets for a plaintext key exchange returns the first one found.
     """
+    import zigbee_crypt # type: ignore
     if not isinstance(pkts, Gen):
         pkts = SetGen(pkts)
-    for packet in pkts:
-        packet = bytes(packet)
-        zmac = Dot154PacketParser()
-        znwk = ZigBeeNWKPacketParser()
-        zaps = ZigBeeAPSPacketParser()
+    for pkt in pkts:
+        packet = bytes(pkt)
         try:
-            # Process MAC layer details
-            zmacpayload = zmac.pktchop(packet)[-1]
-            if zmacpayload == None:
-                continue
-
-            # Process NWK layer details
-            znwkpayload = znwk.pktchop(zmacpayload)[-1]
-            if znwkpayload == None:
+            # Walk the MAC, NWK and APS headers in place, reading only the
+            # fields needed to rule the frame out
+            if isinstance(pkt, KBLazyPacket):
+                fcs = pkt.fcs
+            else:
+                fcs = isinstance(pkt, Packet) and pkt.haslayer(Dot15d4FCS)
+            mac = zigbee_crypt.parse_mac(packet, fcs)
+            if mac is None or mac.frame_type != 1:
                 continue
-
-            # Process the APS layer details
-            zapschop = zaps.pktchop(znwkpayload)
-            if zapschop == None:
-                continue
-
-            # See if this is an APS Command frame
-            apsfc = ord(zapschop[0])
-            if (apsfc & ZBEE_APS_FCF_FRAME_TYPE) != ZBEE_APS_FCF_CMD:
+            nwk = zigbee_crypt.NWKFrame(packet, mac.payload, mac.payload_len)
+            if nwk.frame_type != ZBEE_NWK_FCF_DATA or nwk.security:
                 continue
+            aps = zigbee_crypt.APSFrame(packet, nwk.payload_offset, mac.payload + mac.payload_len - nwk.payload_offset)
+        except ValueError:
+            continue
 
-            # Delivery mode is Normal Delivery (0)
-            apsdeliverymode = (apsfc & ZBEE_APS_FCF_DELIVERY_MODE) >> 2
-            if apsdeliverymode != 0:
-                continue
+        # An unsecured APS Command frame with Normal Delivery (0)
+        if aps.frame_type != ZBEE_APS_FCF_CMD or aps.delivery_mode != 0 or aps.security:
+            continue
 
-            # Ensure Security is Disabled
-            if (apsfc & ZBEE_APS_FCF_SECURITY) == 1:
-                continue
+        zapspayload = aps.payload
 
-            zapspayload = zapschop[-1]
+        # Check payload length, must be at least 35 bytes
+        # APS cmd | key type | key | sequence number | dest addr | src addr
+        if len(zapspayload) < 35:
+            continue
 
-            # Check payload length, must be at least 35 bytes
-            # APS cmd | key type | key | sequence number | dest addr | src addr
-            if len(zapspayload) < 35:
-                continue
+        # Check for APS command identifier Transport Key (0x05)
+        if zapspayload[0] != 5:
+            continue
 
-            # Check for APS command identifier Transport Key (0x05)
-            if ord(zapspayload[0]) != 5:
-                continue
+        # Transport Key Frame, get the key type.  Network Key is 0x01, no
+        # other keys should be sent in plaintext
+        if zapspayload[1] != 1:
+            continue
 
-            # Transport Key Frame, get the key type.  Network Key is 0x01, no
-            # other keys should be sent in plaintext
-            if ord(zapspayload[1]) != 1:
-                continue
+        # Reverse these fields
+        networkkey = zapspayload[2:18][::-1]
+        destaddr = zapspayload[19:27][::-1]
+        srcaddr = zapspayload[27:35][::-1]
 
-            # Reverse these fields
-            networkkey = zapspayload[2:18][::-1]
-            destaddr = zapspayload[19:27][::-1]
-            srcaddr = zapspayload[27:35][::-1]
-
-            key: Dict[str, str] = {}
-            key['key'] = ':'.join("%02x" % ord(networkkey[x]) for x in range(16))
-            key['dst'] = ':'.join("%02x" % ord(destaddr[x]) for x in range(8))
-            key['src'] = ':'.join("%02x" % ord(srcaddr[x]) for x in range(8))
-            return key
-        except:
-            continue
+        key: Dict[str, str] = {}
+        key['key'] = ':'.join("%02x" % x for x in networkkey)
+        key['dst'] = ':'.join("%02x" % x for x in destaddr)
+        key['src'] = ':'.join("%02x" % x for x in srcaddr)
+        return key
     return { }
 
 @conf.commands.register
@@ -422,30 +586,18 @@ def kbrandmac(length: int=8) -> str:
     """Returns a random MAC address using a list valid OUI's from ZigBee device manufacturers."""
     return randmac(length)
 
-@conf.commands.register
-def kbdecrypt(source_pkt: Gen, key: Optional[Union[Dict[str, str], Any]]=None, verbose: Optional[int]=None, doMicCheck: bool =False) -> Optional[Tuple[bytes, bool]]:
-    """Decrypt Zigbee frames using AES CCM* with 32-bit MIC"""
-    if verbose is None:
-        verbose = conf.verb
-    if key is None:
-        if conf.killerbee_nkey == None:
-            log_killerbee.error("Cannot find decryption key. (Set conf.killerbee_nkey)")
-            return None
-        key = conf.killerbee_nkey
-    if len(key) != 16:
-        log_killerbee.error("Invalid decryption key, must be a 16 byte string.")
-        return None
+def __kb_decrypt_params(source_pkt: Gen) -> Optional[Tuple[Gen, bytes, bytes, bytes, memoryview]]:
+    """
+    Builds the CCM* inputs for decrypting a Zigbee frame.
+    @return: (pkt, nonce, mic, encrypted, zigbeeData), where pkt is a working copy of source_pkt,
+        or None if the frame can not be decrypted.
+    """
     if not ZigbeeSecurityHeader in source_pkt:
         log_killerbee.error("Cannot decrypt frame without a ZigbeeSecurityHeader.")
         return None
     if not ZigbeeNWK in source_pkt:
         log_killerbee.error("Cannot decrypt frame without a ZigbeeNWK.")
         return None
-    try:
-        import zigbee_crypt # type: ignore
-    except ImportError:
-        log_killerbee.error("Could not import zigbee_crypt extension, cryptographic functionality is not available.")
-        return None
 
     # This function destroys the packet, therefore work on a copy - @cutaway
     pkt: Gen = source_pkt.copy()
@@ -477,19 +629,13 @@ def kbdecrypt(source_pkt: Gen, key: Optional[Union[Dict[str, str], Any]]=None, v
         nonce = struct.pack('L',source_pkt[ZigbeeSecurityHeader].source)+struct.pack('I',source_pkt[ZigbeeSecurityHeader].fc) + sec_ctrl_byte
         zigbeeData = pkt[ZigbeeNWK].do_build()
     # For zigbeeData, we need the entire zigbee packet, minus the encrypted data and mic (4 bytes).
-    zigbeeData = zigbeeData[:-crop_size]
+    # zigbee_crypt reads it through the buffer protocol, so a view avoids copying the header.
+    zigbeeData = memoryview(zigbeeData)[:-crop_size]
 
-    (payload, micCheck) = zigbee_crypt.decrypt_ccm(key, nonce, pkt.mic, encrypted, zigbeeData)
-
-    if verbose > 2:
-        print("Decrypt Details:")
-        print("\tKey:            {!r}".format(key))
-        print("\tNonce:          {!r}".format(nonce))
-        print("\tZigbeeData:     {!r}".format(zigbeeData))
-        print("\tEncrypted Data: {!r}".format(encrypted))
-        print("\tDecrypted Data: {}".format(payload))
-        print("\tMic:            {}".format(pkt.mic))
+    return (pkt, nonce, pkt.mic, encrypted, zigbeeData)
 
+def __kb_decrypt_result(pkt: Gen, payload: bytes, micCheck: int, doMicCheck: bool) -> Union[Gen, Tuple[Gen, bool]]:
+    """Wraps a decrypted payload in the scapy layer matching the NWK frame type."""
     frametype = pkt[ZigbeeNWK].frametype
     if frametype == 0 and micCheck == 1:
         payload = ZigbeeAppDataPayload(payload)
@@ -504,6 +650,118 @@ def kbdecrypt(source_pkt: Gen, key: Optional[Union[Dict[str, str], Any]]=None, v
         if micCheck == 1: return (payload, True)
         else:             return (payload, False)
 
+@conf.commands.register
+def kbdecrypt(source_pkt: Gen, key: Optional[Union[Dict[str, str], Any]]=None, verbose: Optional[int]=None, doMicCheck: bool =False) -> Optional[Tuple[bytes, bool]]:
+    """Decrypt Zigbee frames using AES CCM* with 32-bit MIC"""
+    if verbose is None:
+        verbose = conf.verb
+    if key is None:
+        if conf.killerbee_nkey == None:
+            log_killerbee.error("Cannot find decryption key. (Set conf.killerbee_nkey)")
+            return None
+        key = conf.killerbee_nkey
+    if len(key) != 16:
+        log_killerbee.error("Invalid decryption key, must be a 16 byte string.")
+        return None
+    try:
+        import zigbee_crypt # type: ignore
+    except ImportError:
+        log_killerbee.error("Could not import zigbee_crypt extension, cryptographic functionality is not available.")
+        return None
+
+    params = __kb_decrypt_params(source_pkt)
+    if params is None:
+        return None
+    (pkt, nonce, mic, encrypted, zigbeeData) = params
+
+    (payload, micCheck) = __kb_ccm_context(key, len(mic)).decrypt(nonce, mic, encrypted, zigbeeData)
+
+    if verbose > 2:
+        print("Decrypt Details:")
+        print("\tKey:            {!r}".format(key))
+        print("\tNonce:          {!r}".format(nonce))
+        print("\tZigbeeData:     {!r}".format(bytes(zigbeeData)))
+        print("\tEncrypted Data: {!r}".format(encrypted))
+        print("\tDecrypted Data: {}".format(payload))
+        print("\tMic:            {}".format(mic))
+
+    return __kb_decrypt_result(pkt, payload, micCheck, doMicCheck)
+
+@conf.commands.register
+def kbdecryptmany(source_pkts: Gen, key: Optional[Union[Dict[str, str], Any]]=None, verbose: Optional[int]=None, doMicCheck: bool =False) -> Optional[List[Any]]:
+    """
+    Decrypt a list of Zigbee frames using AES CCM* with 32-bit MIC.
+    All frames are handed to zigbee_crypt in a single call, which is much faster than calling
+    kbdecrypt() per frame for whole captures.
+    @return: A list with one kbdecrypt() style result per input frame, or None for frames
+        which can not be decrypted.
+    """
+    if verbose is None:
+        verbose = conf.verb
+    if key is None:
+        if conf.killerbee_nkey == None:
+            log_killerbee.error("Cannot find decryption key. (Set conf.killerbee_nkey)")
+            return None
+        key = conf.killerbee_nkey
+    if len(key) != 16:
+        log_killerbee.error("Invalid decryption key, must be a 16 byte string.")
+        return None
+    try:
+        import zigbee_crypt # type: ignore
+    except ImportError:
+        log_killerbee.error("Could not import zigbee_crypt extension, cryptographic functionality is not available.")
+        return None
+
+    params = [__kb_decrypt_params(source_pkt) for source_pkt in source_pkts]
+    frames = [p for p in params if p is not None]
+    decrypted = zigbee_crypt.decrypt_ccm_many(key,
+                                              [f[1] for f in frames],
+                                              [f[2] for f in frames],
+                                              [f[3] for f in frames],
+                                              [f[4] for f in frames])
+    if verbose > 2:
+        print("Decrypted {} of {} frames.".format(len(frames), len(params)))
+
+    results: List[Any] = []
+    it = iter(decrypted)
+    for p in params:
+        if p is None:
+            results.append(None)
+        else:
+            (payload, micCheck) = next(it)
+            results.append(__kb_decrypt_result(p[0], payload, micCheck, doMicCheck))
+    return results
+
+@conf.commands.register
+def kbtrykeys(source_pkt: Gen, keys: List[bytes], verbose: Optional[int]=None) -> Optional[Tuple[int, Any]]:
+    """
+    Find which of several candidate keys a Zigbee frame was encrypted with.
+    @param keys: A list of 16 byte keys.
+    @return: A tuple of the index of the matching key and the decrypted payload, or None.
+    """
+    if verbose is None:
+        verbose = conf.verb
+    try:
+        import zigbee_crypt # type: ignore
+    except ImportError:
+        log_killerbee.error("Could not import zigbee_crypt extension, cryptographic functionality is not available.")
+        return None
+
+    params = __kb_decrypt_params(source_pkt)
+    if params is None:
+        return None
+    (pkt, nonce, mic, encrypted, zigbeeData) = params
+
+    keys = list(keys)
+    index = zigbee_crypt.try_keys(keys, nonce, mic, encrypted, zigbeeData)
+    if verbose > 2:
+        print("Tried {} keys, matching key: {}".format(len(keys), index))
+    if index is None:
+        return None
+
+    (payload, micCheck) = __kb_ccm_context(keys[index], len(mic)).decrypt(nonce, mic, encrypted, zigbeeData)
+    return (index, __kb_decrypt_result(pkt, payload, micCheck, False))
+
 @conf.commands.register
 def kbencrypt(source_pkt: Gen, data: bytes, key: Optional[bytes]=None, verbose: Optional[int]=None) -> Optional[Gen]:
     """Encrypt Zigbee frames using AES CCM* with 32-bit MIC"""
@@ -563,7 +821,7 @@ def kbencrypt(source_pkt: Gen, data: bytes, key: Optional[bytes]=None, verbose:
     if miclen < 4:
         miclen= 4
 
-    (payload, mic) = zigbee_crypt.encrypt_ccm(key, nonce, miclen, decrypted, zigbeeData)
+    (payload, mic) = __kb_ccm_context(key, miclen).encrypt(nonce, decrypted, zigbeeData)
 
     if verbose > 2:
         print("Encrypt Details:")
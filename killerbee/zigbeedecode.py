@@ -110,6 +110,23 @@ class ZigBeeNWKPacketParser:
 
         return pktchop
         
+    def view(self, packet, offset=0):
+        '''
+        Returns a zigbee_crypt.NWKFrame view of the NWK header, whose fields
+        are decoded from packet only as they are accessed. packet is not
+        copied, so a raw 802.15.4 frame can be passed with offset at its MAC
+        payload. ValueError is raised if the header is truncated.
+        @type packet: Bytes
+        @param packet: Packet contents.
+        @type offset: Int
+        @param offset: Offset of the NWK header in packet.
+        @rtype: zigbee_crypt.NWKFrame
+        @return: View of the ZigBee NWK header.
+        '''
+        import zigbee_crypt  # type: ignore
+
+        return zigbee_crypt.NWKFrame(packet, offset)
+
     def hdrlen(self, packet):
         '''
         Returns the length of the ZigBee NWK header.
@@ -118,26 +135,12 @@ class ZigBeeNWKPacketParser:
         @rtype: Int
         @return: Length of the ZigBEE NWK header.
         '''
-        # Frame control field
-        fc = struct.unpack("<H",packet[0:2])[0]
-        plen = 8
-
-        # Check if the DA bit is set in the frame control field
-        if (fc & ZBEE_NWK_FCF_EXT_DEST) != 0:
-            plen+=8
-
-        # Check if the SA bit is set in the frame control field
-        if (fc & ZBEE_NWK_FCF_EXT_SOURCE) != 0:
-            plen+=8
+        import zigbee_crypt  # type: ignore
 
-        # Check if the Source Route bit is set in the frame control field
-        if (fc & ZBEE_NWK_FCF_SOURCE_ROUTE) != 0:
-            # relay list based on relay count * 2
-            plen+= (ord(packet[plen])*2)
-            # relay count and relay index fields
-            plen+=2 
-        
-        return plen
+        try:
+            return zigbee_crypt.NWKFrame(packet).hdr_len
+        except ValueError:
+            raise Exception("Packet too small, %d bytes." % len(packet))
 
     def payloadlen(self, packet):
         '''
@@ -285,50 +288,37 @@ class ZigBeeAPSPacketParser:
         pktchop.append(packet[offset:])
         return pktchop
         
+    def view(self, packet, offset=0):
+        '''
+        Returns a zigbee_crypt.APSFrame view of the APS header, whose fields
+        are decoded from packet only as they are accessed. packet is not
+        copied, so a raw 802.15.4 frame can be passed with offset at its NWK
+        payload. ValueError is raised if the header is truncated.
+        @type packet: Bytes
+        @param packet: Packet contents.
+        @type offset: Int
+        @param offset: Offset of the APS header in packet.
+        @rtype: zigbee_crypt.APSFrame
+        @return: View of the ZigBee APS header.
+        '''
+        import zigbee_crypt  # type: ignore
+
+        return zigbee_crypt.APSFrame(packet, offset)
+
     def hdrlen(self, packet):
         '''
-        Returns the length of the ZigBee NWK header.
+        Returns the length of the ZigBee APS header.
         @type packet: String
         @param packet: Packet contents to evaluate for header length.
         @rtype: Int
-        @return: Length of the ZigBEE NWK header.
+        @return: Length of the ZigBee APS header.
         '''
-        # Frame control field
-        fc = packet[0]
-        pktchop = [fc,]
-        plen = 1
+        import zigbee_crypt  # type: ignore
 
-        # Identify the APS frame type
-        apsftype = ord(fc) & ZBEE_APS_FCF_FRAME_TYPE
-        apsdeliverymode = (ord(fc) & ZBEE_APS_FCF_DELIVERY_MODE >> 2)
-
-        if apsftype == ZBEE_APS_FCF_DATA:
-            if apsdeliverymode == 0 or apsdeliverymode == 2:
-                plen += 6
-            elif apsdeliverymode == 1:
-                plen += 5
-            else:
-                plen += 7
-
-        elif apsftype == ZBEE_APS_FCF_CMD:
-            if apsdeliverymode == 2:
-                plen += 2
-
-        elif apsftype == ZBEE_APS_FCF_ACK:
-            if apsdeliverymode == 3:
-                plen += 8
-            else:
-                plen += 6
-        
-        plen += 1 # APS Counter
-
-        # fragmentation + packet number if true
-        if ord(fc) & ZBEE_APS_FCF_EXT_HEADER:
-            if packet[plen] != 0x00:
-                plen += 1
-            plen += 1
-
-        return plen
+        try:
+            return zigbee_crypt.APSFrame(packet).hdr_len
+        except ValueError:
+            raise Exception("Packet too small, %d bytes." % len(packet))
 
     def payloadlen(self, packet):
         '''
@@ -0,0 +1,297 @@
+/*
+ * pcapindex.c
+ * Indexes the records of libpcap and pcapng captures in bulk, for
+ * killerbee.pcapdump.PcapReader and killerbee.pcapng.PcapngReader, which
+ * fall back to the same walk in Python when this module is not built.
+ *
+ * Each call walks up to count records of a buffer, such as a memory-mapped
+ * capture, without the GIL and returns columns of timestamps, lengths and
+ * frame offsets, so frames are sliced out of the buffer rather than read
+ * one record at a time.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static uint32_t
+pcap_get32(const unsigned char *p, int big_endian)
+{
+	if (big_endian) {
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+	return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+/* PPI and IEEE 802.15.4 TAP headers are little endian, whatever the file */
+static uint32_t
+pcap_get16le(const unsigned char *p)
+{
+	return ((uint32_t)p[1] << 8) | p[0];
+}
+
+/*
+ * Walks up to count libpcap record headers of buffer from pos, for
+ * killerbee.pcapdump.PcapReader.read_batch(). The four columns are built
+ * as bytes in native byte order, ready for array.frombytes(). With ppi,
+ * the frames of a DLT_PPI capture are indexed past their PPI header.
+ */
+static PyObject *pcapindex_pcap_index(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"buffer", "pos", "count", "big_endian", "snaplen", "ppi", NULL};
+	Py_buffer			buf;
+	Py_ssize_t			pos, count;
+	int					big_endian = 0;
+	int					ppi = 0;
+	unsigned long		snaplen = 65535;
+	const unsigned char	*p;
+	uint32_t			*ts_sec, *ts_frac, *caplens, caplen, plen, avail, hlen;
+	uint64_t			*offsets;
+	PyObject			*cols[4] = {NULL, NULL, NULL, NULL};
+	PyObject			*res = NULL;
+	Py_ssize_t			n = 0;
+	int					corrupt = 0, i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*nn|pkp", kwlist, &buf, &pos, &count, &big_endian, &snaplen, &ppi)) {
+		return NULL;
+	}
+	if (pos < 0 || count < 0) {
+		PyErr_SetString(PyExc_ValueError, "pos and count must not be negative");
+		goto out;
+	}
+	/* Every record takes at least its 16-byte header */
+	if (pos < buf.len && count > (buf.len - pos) / 16) {
+		count = (buf.len - pos) / 16;
+	} else if (pos >= buf.len) {
+		count = 0;
+	}
+	cols[0] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+	cols[1] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+	cols[2] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+	cols[3] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+	if (cols[0] == NULL || cols[1] == NULL || cols[2] == NULL || cols[3] == NULL) {
+		goto out;
+	}
+	ts_sec = (uint32_t *)PyBytes_AS_STRING(cols[0]);
+	ts_frac = (uint32_t *)PyBytes_AS_STRING(cols[1]);
+	caplens = (uint32_t *)PyBytes_AS_STRING(cols[2]);
+	offsets = (uint64_t *)PyBytes_AS_STRING(cols[3]);
+
+	Py_BEGIN_ALLOW_THREADS
+	while (n < count && buf.len - pos >= 16) {
+		p = (const unsigned char *)buf.buf + pos;
+		caplen = pcap_get32(p + 8, big_endian);
+		plen = pcap_get32(p + 12, big_endian);
+		if (caplen > plen || caplen > snaplen || plen > snaplen) {
+			corrupt = 1;
+			break;
+		}
+		/* A final record cut short by the end of the buffer keeps what is there */
+		avail = (buf.len - pos - 16 < (Py_ssize_t)caplen) ? (uint32_t)(buf.len - pos - 16) : caplen;
+		hlen = 0;
+		if (ppi) {
+			if (avail < 4) {
+				hlen = avail;
+			} else {
+				hlen = pcap_get16le(p + 18);
+				if (hlen < 8 || hlen > caplen) {
+					corrupt = 1;
+					break;
+				}
+				if (hlen > avail) {
+					hlen = avail;
+				}
+			}
+		}
+		ts_sec[n] = pcap_get32(p, big_endian);
+		ts_frac[n] = pcap_get32(p + 4, big_endian);
+		caplens[n] = avail - hlen;
+		offsets[n] = (uint64_t)(pos + 16 + hlen);
+		pos += 16 + caplen;
+		n++;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (pos > buf.len) {
+		pos = buf.len;
+	}
+	for (i = 0; i < 4; i++) {
+		if (_PyBytes_Resize(&cols[i], n * (i == 3 ? sizeof(uint64_t) : sizeof(uint32_t)))) {
+			goto out;
+		}
+	}
+	res = Py_BuildValue("nOOOOO", pos, cols[0], cols[1], cols[2], cols[3], corrupt ? Py_True : Py_False);
+out:
+	for (i = 0; i < 4; i++) {
+		Py_XDECREF(cols[i]);
+	}
+	PyBuffer_Release(&buf);
+	return res;
+}
+
+#define PCAPNG_SHB		0x0A0D0D0A
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_SPB		0x00000003
+#define PCAPNG_EPB		0x00000006
+
+/* Why pcapng_index() stopped */
+#define PCAPNG_DONE			0	/* count packets, or the end of buffer */
+#define PCAPNG_CORRUPT		1	/* a corrupt block at next_pos */
+#define PCAPNG_HEADER		2	/* a section or interface block at next_pos */
+
+/*
+ * Walks the packet blocks of a pcapng section from pos, for
+ * killerbee.pcapng.PcapngReader.read_batch(). Section header and
+ * interface description blocks change how the blocks after them are
+ * read, so indexing stops at them for the caller to read. Frames of the
+ * interfaces flagged in tap are indexed past their IEEE 802.15.4 TAP
+ * header.
+ */
+static PyObject *pcapindex_pcapng_index(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"buffer", "pos", "count", "big_endian", "tsdiv", "tap", NULL};
+	Py_buffer			buf, tsdiv_buf, tap_buf;
+	Py_ssize_t			pos, count, nif, ntap;
+	int					big_endian = 0;
+	const unsigned char	*p, *tap;
+	const double		*tsdiv;
+	uint32_t			*caplens, *ifids, btype, blen, ifid, caplen, hlen;
+	uint64_t			*offsets, off;
+	double				*ts, t;
+	PyObject			*cols[4] = {NULL, NULL, NULL, NULL};
+	PyObject			*res = NULL;
+	Py_ssize_t			n = 0;
+	int					status = PCAPNG_DONE, i;
+
+	memset(&tsdiv_buf, 0, sizeof(tsdiv_buf));
+	memset(&tap_buf, 0, sizeof(tap_buf));
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*nn|py*y*", kwlist, &buf, &pos, &count, &big_endian, &tsdiv_buf, &tap_buf)) {
+		return NULL;
+	}
+	if (pos < 0 || count < 0) {
+		PyErr_SetString(PyExc_ValueError, "pos and count must not be negative");
+		goto out;
+	}
+	tsdiv = (const double *)tsdiv_buf.buf;
+	nif = tsdiv_buf.len / (Py_ssize_t)sizeof(double);
+	tap = (const unsigned char *)tap_buf.buf;
+	ntap = tap_buf.len;
+	/* Every packet block takes at least 16 bytes, one more is let in so a
+	 * shorter corrupt block at the end is still looked at */
+	if (pos < buf.len && count > (buf.len - pos) / 16 + 1) {
+		count = (buf.len - pos) / 16 + 1;
+	} else if (pos >= buf.len) {
+		count = 0;
+	}
+	cols[0] = PyBytes_FromStringAndSize(NULL, count * sizeof(double));
+	cols[1] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+	cols[2] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+	cols[3] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+	if (cols[0] == NULL || cols[1] == NULL || cols[2] == NULL || cols[3] == NULL) {
+		goto out;
+	}
+	ts = (double *)PyBytes_AS_STRING(cols[0]);
+	caplens = (uint32_t *)PyBytes_AS_STRING(cols[1]);
+	offsets = (uint64_t *)PyBytes_AS_STRING(cols[2]);
+	ifids = (uint32_t *)PyBytes_AS_STRING(cols[3]);
+
+	Py_BEGIN_ALLOW_THREADS
+	while (n < count && buf.len - pos >= 12) {
+		p = (const unsigned char *)buf.buf + pos;
+		btype = pcap_get32(p, big_endian);
+		blen = pcap_get32(p + 4, big_endian);
+		if (btype == PCAPNG_SHB || btype == PCAPNG_IDB) {
+			status = PCAPNG_HEADER;
+			break;
+		}
+		if (blen < 12 || blen % 4 != 0) {
+			status = PCAPNG_CORRUPT;
+			break;
+		}
+		/* A final block cut short by the end of the buffer is left for
+		 * when it is complete */
+		if ((Py_ssize_t)blen > buf.len - pos) {
+			break;
+		}
+		if (btype == PCAPNG_EPB && blen >= 32) {
+			ifid = pcap_get32(p + 8, big_endian);
+			caplen = pcap_get32(p + 20, big_endian);
+			if ((Py_ssize_t)ifid >= nif || caplen > blen - 32) {
+				status = PCAPNG_CORRUPT;
+				break;
+			}
+			t = (double)(((uint64_t)pcap_get32(p + 12, big_endian) << 32) | pcap_get32(p + 16, big_endian));
+			t /= tsdiv[ifid];
+			off = (uint64_t)pos + 28;
+		} else if (btype == PCAPNG_SPB && blen >= 16) {
+			if (nif == 0) {
+				status = PCAPNG_CORRUPT;
+				break;
+			}
+			ifid = 0;
+			caplen = pcap_get32(p + 8, big_endian);
+			if (caplen > blen - 16) {
+				caplen = blen - 16;
+			}
+			/* Simple packet blocks carry no timestamp */
+			t = 0.0;
+			off = (uint64_t)pos + 12;
+		} else {
+			pos += blen;
+			continue;
+		}
+		if ((Py_ssize_t)ifid < ntap && tap[ifid] && caplen >= 4) {
+			hlen = pcap_get16le(p + (off - pos) + 2);
+			if (hlen >= 4 && hlen <= caplen) {
+				off += hlen;
+				caplen -= hlen;
+			}
+		}
+		ts[n] = t;
+		caplens[n] = caplen;
+		offsets[n] = off;
+		ifids[n] = ifid;
+		pos += blen;
+		n++;
+	}
+	Py_END_ALLOW_THREADS
+
+	for (i = 0; i < 4; i++) {
+		if (_PyBytes_Resize(&cols[i], n * (i == 0 ? sizeof(double) : i == 2 ? sizeof(uint64_t) : sizeof(uint32_t)))) {
+			goto out;
+		}
+	}
+	res = Py_BuildValue("nOOOOi", pos, cols[0], cols[1], cols[2], cols[3], status);
+out:
+	for (i = 0; i < 4; i++) {
+		Py_XDECREF(cols[i]);
+	}
+	PyBuffer_Release(&buf);
+	if (tsdiv_buf.obj != NULL) {
+		PyBuffer_Release(&tsdiv_buf);
+	}
+	if (tap_buf.obj != NULL) {
+		PyBuffer_Release(&tap_buf);
+	}
+	return res;
+}
+
+
+static PyMethodDef pcapindex_Methods[] = {
+	{ "pcap_index", (PyCFunction)(void(*)(void))pcapindex_pcap_index, METH_VARARGS | METH_KEYWORDS, "pcap_index(buffer, pos, count, big_endian=False, snaplen=65535, ppi=False)\nIndex up to count libpcap records of buffer, starting at the record header at pos\n\nUsed by killerbee.pcapdump.PcapReader.read_batch(). The columns are bytes in native byte order, 32-bit but for the 64-bit offsets of the frames in buffer. A final record cut short by the end of buffer gets the length that is there.\n\n@type buffer: Buffer\n@param buffer: The capture, such as a memory-mapped libpcap file\n@type ppi: Boolean\n@param ppi: Index the frames of a DLT_PPI capture past their PPI header\n@rtype: Tuple\n@return: (next_pos, ts_sec, ts_frac, caplen, offset, corrupt), where corrupt is True if indexing stopped at a record header whose lengths exceed each other or snaplen, or at a bad PPI header" },
+	{ "pcapng_index", (PyCFunction)(void(*)(void))pcapindex_pcapng_index, METH_VARARGS | METH_KEYWORDS, "pcapng_index(buffer, pos, count, big_endian=False, tsdiv=b'', tap=b'')\nIndex up to count enhanced and simple packet blocks of a pcapng section of buffer, starting at the block at pos\n\nUsed by killerbee.pcapng.PcapngReader.read_batch(). Blocks of other types are skipped, but indexing stops at a section header or interface description block, which the caller reads before calling again from next_pos. A final block cut short by the end of buffer is not indexed. The columns are bytes in native byte order.\n\n@type buffer: Buffer\n@param buffer: The capture, such as a memory-mapped pcapng file\n@type tsdiv: Buffer\n@param tsdiv: Native doubles, the timestamp units per second of each interface of the section\n@type tap: Buffer\n@param tap: One byte per interface, nonzero to index its frames past their IEEE 802.15.4 TAP header\n@rtype: Tuple\n@return: (next_pos, ts, caplen, offset, interface, status), with ts as doubles in seconds (0 for simple packet blocks), 32-bit caplen and interface and 64-bit offset columns; status is 0 at count or the end of buffer, 1 at a corrupt block and 2 at a section header or interface description block" },
+	{ NULL, NULL, 0, NULL },
+};
+
+static struct PyModuleDef pcapindex_module = {
+	PyModuleDef_HEAD_INIT,
+	"killerbee._pcapindex",
+	"Bulk indexing of libpcap and pcapng capture records",
+	-1,
+	pcapindex_Methods,
+};
+
+PyMODINIT_FUNC PyInit__pcapindex(void)
+{
+	return PyModule_Create(&pcapindex_module);
+}
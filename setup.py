@@ -1,6 +1,7 @@
 # NOTE: See the README file for a list of dependencies to install.
 
 from __future__ import print_function
+import os
 import sys
 
 try:
@@ -27,7 +28,7 @@ try:
 except ImportError:
     err.append("You are using pyUSB 0.x. Upgrade to pyUSB 1.x.")
 
-# TODO: Ideally we would detect missing python-dev and libgcrypt-dev to give better errors.
+# TODO: Ideally we would detect missing python-dev (and libgcrypt-dev with KILLERBEE_USE_GCRYPT) to give better errors.
 
 # Dot15d4 is a dep of some of the newer tools
 try:
@@ -58,13 +59,31 @@ if len(apt_get_pkgs) > 0 or len(pip_pkgs) > 0:
 if len(err) > 0:
     sys.exit(1)
 
+# zigbee_crypt ships its own AES-128 (AES-NI where the CPU has it). Set
+# KILLERBEE_USE_GCRYPT=1 to build it against libgcrypt instead.
+if os.environ.get('KILLERBEE_USE_GCRYPT', '0') not in ('', '0'):
+    zigbee_crypt_sources = ['zigbee_crypt/zigbee_crypt.c', 'zigbee_crypt/zbcrypt.c']
+    zigbee_crypt_libraries = ['gcrypt']
+    zigbee_crypt_macros = [('ZBEE_USE_GCRYPT', None)]
+else:
+    zigbee_crypt_sources = ['zigbee_crypt/zigbee_crypt.c', 'zigbee_crypt/zbcrypt.c', 'zigbee_crypt/zbee_aes.c']
+    zigbee_crypt_libraries = []
+    zigbee_crypt_macros = []
+
 zigbee_crypt = Extension('zigbee_crypt',
-                         sources = ['zigbee_crypt/zigbee_crypt.c'],
-                         libraries = ['gcrypt'],
+                         sources = zigbee_crypt_sources,
+                         libraries = zigbee_crypt_libraries,
+                         define_macros = zigbee_crypt_macros,
                          include_dirs = ['/usr/local/include', '/usr/include', '/sw/include/', 'zigbee_crypt'],
                          library_dirs = ['/usr/local/lib', '/usr/lib','/sw/var/lib/']
                          )
 
+# Bulk capture record indexing for PcapReader and PcapngReader, which fall
+# back to Python without it
+pcapindex = Extension('killerbee._pcapindex',
+                      sources = ['pcapindex/pcapindex.c'],
+                      )
+
 setup(name        = 'killerbee',
       version     = '3.0.0-beta.2',
       description = 'ZigBee and IEEE 802.15.4 Attack Framework and Tools',
@@ -77,8 +96,8 @@ setup(name        = 'killerbee',
                  'tools/zbscapy', 'tools/zbwireshark', 'tools/zbkey',
                  'tools/zbwardrive', 'tools/zbopenear', 'tools/zbfakebeacon',
                  'tools/zborphannotify', 'tools/zbpanidconflictflood', 'tools/zbrealign', 'tools/zbcat',
-                 'tools/zbjammer', 'tools/kbbootloader'],
-      install_requires=['pyserial>=2.0', 'pyusb', 'pycrypto', 'rangeparser', 'scapy'],
+                 'tools/zbjammer', 'tools/kbbootloader', 'tools/zbindex'],
+      install_requires=['pyserial>=2.0', 'pyusb', 'rangeparser', 'scapy'],
       # NOTE: pygtk doesn't install via distutils on non-Windows hosts
-      ext_modules = [zigbee_crypt],
+      ext_modules = [zigbee_crypt, pcapindex],
       )
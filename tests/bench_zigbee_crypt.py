@@ -0,0 +1,112 @@
+'''
+Microbenchmarks of zigbee_crypt and the decrypt paths built on it. Run with
+pytest-benchmark, from the tests/ directory:
+
+    $ pip3 install pytest pytest-benchmark
+    $ python3 -m pytest bench_zigbee_crypt.py --benchmark-json=bench.json
+
+The raw C routines are benchmarked by zigbee_crypt/zbcrypt_bench.
+'''
+import os
+import struct
+
+import pytest
+
+pytest.importorskip('pytest_benchmark')
+
+import zigbee_crypt
+from killerbee.pcapdump import PcapReader
+from killerbee.crypto import StreamDecryptor
+
+KEY = bytes(range(0x40, 0x50))
+NONCE = bytes(range(0x20, 0x2d))
+AAD = bytes(range(20))
+PAYLOAD_SIZES = (0, 16, 32, 64, 110)
+MIC_SIZES = (0, 4, 8, 16)
+
+CONTROL4_PCAP = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'sample', 'control4-sample.pcap')
+CONTROL4_KEY = bytes.fromhex('26546b723b396a727b5d5271517d392f')
+
+def control4_frames():
+    '''Raw frames of the Control4 sample capture, with FCS.'''
+    reader = PcapReader(CONTROL4_PCAP)
+    frames = []
+    while True:
+        (hdr, frame) = reader.pnext()
+        if hdr is None:
+            break
+        frames.append(frame)
+    reader.close()
+    return frames
+
+def payload(size):
+    return bytes((i * 7) & 0xff for i in range(size))
+
+@pytest.mark.parametrize('mic_size', MIC_SIZES)
+@pytest.mark.parametrize('size', PAYLOAD_SIZES)
+def test_encrypt_ccm(benchmark, size, mic_size):
+    benchmark.group = 'encrypt_ccm'
+    benchmark(zigbee_crypt.encrypt_ccm, KEY, NONCE, mic_size, payload(size), AAD)
+
+@pytest.mark.parametrize('mic_size', MIC_SIZES)
+@pytest.mark.parametrize('size', PAYLOAD_SIZES)
+def test_decrypt_ccm(benchmark, size, mic_size):
+    benchmark.group = 'decrypt_ccm'
+    (enc_data, mic) = zigbee_crypt.encrypt_ccm(KEY, NONCE, mic_size, payload(size), AAD)
+    result = benchmark(zigbee_crypt.decrypt_ccm, KEY, NONCE, mic, enc_data, AAD)
+    assert result == (payload(size), 1)
+
+@pytest.mark.parametrize('mic_size', MIC_SIZES)
+@pytest.mark.parametrize('size', PAYLOAD_SIZES)
+def test_ccm_context_decrypt(benchmark, size, mic_size):
+    benchmark.group = 'CCMContext.decrypt'
+    ctx = zigbee_crypt.CCMContext(KEY, mic_size)
+    (enc_data, mic) = ctx.encrypt(NONCE, payload(size), AAD)
+    assert benchmark(ctx.decrypt, NONCE, mic, enc_data, AAD)[1]
+
+def test_sec_key_hash(benchmark):
+    benchmark(zigbee_crypt.sec_key_hash, KEY, b'\x02')
+
+def test_hash_mmo(benchmark):
+    benchmark(zigbee_crypt.hash_mmo, payload(18))
+
+@pytest.mark.parametrize('count', (16, 256))
+def test_decrypt_ccm_many(benchmark, count):
+    benchmark.group = 'decrypt_ccm_many'
+    nonces = [NONCE[:9] + struct.pack('<I', i) for i in range(count)]
+    payloads = [payload(64)] * count
+    encrypted = zigbee_crypt.encrypt_ccm_many(KEY, nonces, 4, payloads, [AAD] * count)
+    mics = [mic for (enc_data, mic) in encrypted]
+    enc_payloads = [enc_data for (enc_data, mic) in encrypted]
+    benchmark(zigbee_crypt.decrypt_ccm_many, KEY, nonces, mics, enc_payloads, [AAD] * count)
+
+@pytest.mark.parametrize('count', (16, 256))
+def test_encrypt_ccm_sequence(benchmark, count):
+    benchmark.group = 'encrypt_ccm_sequence'
+    benchmark(zigbee_crypt.encrypt_ccm_sequence, KEY, NONCE, 4, 0, count, payload(32), AAD)
+
+def test_control4_decrypt_nwk_frame(benchmark):
+    benchmark.group = 'control4-sample.pcap'
+    frames = control4_frames()
+    ctx = zigbee_crypt.CCMContext(CONTROL4_KEY, 4)
+    def run():
+        return sum(1 for frame in frames if (ctx.decrypt_nwk_frame(frame) or (0, b'', 0))[2] == 1)
+    assert benchmark(run) > 0
+
+def test_control4_stream_decryptor(benchmark):
+    benchmark.group = 'control4-sample.pcap'
+    frames = control4_frames()
+    def run():
+        sd = StreamDecryptor([CONTROL4_KEY])
+        return sum(1 for frame in frames if sd.feed(frame) is not None)
+    assert benchmark(run) > 0
+
+def test_control4_kbdecrypt(benchmark):
+    benchmark.group = 'control4-sample.pcap'
+    pytest.importorskip('scapy')
+    from scapy.all import rdpcap
+    from killerbee.scapy_extensions import kbdecrypt
+    packets = [pkt for pkt in rdpcap(CONTROL4_PCAP) if pkt.haslayer('ZigbeeSecurityHeader')]
+    def run():
+        return sum(1 for pkt in packets if kbdecrypt(pkt, CONTROL4_KEY, verbose=0) is not None)
+    assert benchmark(run) > 0
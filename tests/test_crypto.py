@@ -0,0 +1,46 @@
+import unittest
+import struct
+
+import zigbee_crypt
+
+from killerbee.crypto import *
+
+KEY = bytes(range(0x40, 0x50))
+EXT_SRC = 0x0807060504030201
+MAC = bytes.fromhex('418801341200000100')
+
+def nwk_frame(counter, payload, with_ext_src):
+    '''Builds a NWK-secured frame from 0x0001, with the extended source in the auxiliary header or not.'''
+    sec_ctrl = 0x28 if with_ext_src else 0x08
+    nwk = struct.pack('<HHHBB', 0x0208, 0x0000, 0x0001, 30, counter & 0xff)
+    aux = struct.pack('<BI', sec_ctrl, counter) + (struct.pack('<Q', EXT_SRC) if with_ext_src else b'') + b'\x00'
+    nonce = struct.pack('<QIB', EXT_SRC, counter, sec_ctrl | 5)
+    (enc_data, mic) = zigbee_crypt.encrypt_ccm(KEY, nonce, 4, payload, nwk + bytes([sec_ctrl | 5]) + aux[1:])
+    return MAC + nwk + aux + enc_data + mic
+
+class TestStreamDecryptor(unittest.TestCase):
+    def test_feed(self):
+        sd = StreamDecryptor([bytes(16), KEY], fcs=False)
+        # Unknown extended source until a frame carrying it was seen.
+        self.assertIsNone(sd.feed(nwk_frame(1, b'first', False)))
+        self.assertEqual(b'second', sd.feed(nwk_frame(2, b'second', True)))
+        self.assertEqual({1: EXT_SRC}, sd.addresses)
+        self.assertEqual(b'third', sd.feed(nwk_frame(3, b'third', False)))
+        self.assertIsNone(sd.feed(b'\x03\x08\x01\xff\xff\xff\xff\x07'))
+        self.assertIsNone(StreamDecryptor([bytes(16)], fcs=False).feed(nwk_frame(4, b'wrong key', True)))
+
+    def test_link_keys(self):
+        link_key = b'ZigBeeAlliance09'
+        sd = StreamDecryptor(link_keys=[link_key], fcs=False)
+        sd.learn(0x0001, EXT_SRC)
+        # APS command secured with the key-transport key.
+        nwk = struct.pack('<HHHBB', 0x0008, 0x0000, 0x0001, 30, 1)
+        aps = bytes.fromhex('2101')
+        aux = struct.pack('<BI', 0x10, 9)
+        nonce = struct.pack('<QIB', EXT_SRC, 9, 0x15)
+        (enc_data, mic) = zigbee_crypt.encrypt_ccm(zigbee_crypt.sec_key_hash(link_key, b'\x00'), nonce, 4,
+                                                   b'\x05\x01key', aps + b'\x15' + aux[1:])
+        self.assertEqual(b'\x05\x01key', sd.feed(MAC + nwk + aps + aux + enc_data + mic))
+
+if __name__ == "__main__":
+    unittest.main()
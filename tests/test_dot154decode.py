@@ -0,0 +1,65 @@
+import unittest
+import struct
+
+import zigbee_crypt
+
+from killerbee.dot154decode import *
+
+# MAC command frame from sample/802154_encr_sample.dcf, without the FCS.
+SAMPLE = bytes.fromhex('2bdc842143020000000048deacffff010000000048deac060500000001d84fde529061f9c6f1')
+HEADER = bytes.fromhex('09dc842143020000000048deacffff010000000048deac')
+
+class TestDot154PacketParser(unittest.TestCase):
+    def secure(self, key, level, keyid, payload):
+        aux = bytes([level | keyid << 3]) + struct.pack('<I', 5) + bytes(DOT154_SEC_KEYID_LEN[keyid])
+        nonce = bytes.fromhex('acde480000000001') + struct.pack('>I', 5) + bytes([level])
+        miclen = DOT154_SEC_MIC_LEN[level & 3]
+        if level & DOT154_SEC_ENC:
+            (enc_data, mic) = zigbee_crypt.encrypt_ccm(key, nonce, miclen, payload, HEADER + aux)
+            return HEADER + aux + enc_data + mic
+        (_, mic) = zigbee_crypt.encrypt_ccm(key, nonce, miclen, b'', HEADER + aux + payload)
+        return HEADER + aux + payload + mic
+
+    def test_ccmparams(self):
+        (nonce, mic, enc_data, a) = Dot154PacketParser().ccmparams(SAMPLE)
+        self.assertEqual(bytes.fromhex('acde4800000000010000000506'), nonce)
+        self.assertEqual(bytes.fromhex('4fde529061f9c6f1'), mic)
+        self.assertEqual(b'\xd8', enc_data)
+        self.assertEqual(SAMPLE[:29], a)
+        self.assertRaises(UnsupportedPacket, Dot154PacketParser().ccmparams, self.secure(bytes(16), DOT154_CRYPT_ENC, 0, b'x'))
+
+    def test_decrypt(self):
+        key = bytes(range(0xc0, 0xd0))
+        parser = Dot154PacketParser()
+        for level in range(1, 8):
+            for keyid in range(4):
+                packet = self.secure(key, level, keyid, b'secret payload')
+                self.assertEqual(b'secret payload', parser.decrypt(packet, key))
+                if level & 3:
+                    self.assertEqual(b'', parser.decrypt(packet, bytes(16)))
+        self.assertEqual(b'', parser.decrypt(self.secure(key, DOT154_CRYPT_NONE, 0, b'x'), key))
+        # The sample is encrypted with the key zbgoodfind -d hides.
+        self.assertEqual(b'\xce', parser.decrypt(SAMPLE, key))
+        self.assertEqual(b'', parser.decrypt(SAMPLE, bytes(16)))
+        self.assertRaises(BadKeyLength, parser.decrypt, SAMPLE, key[:8])
+        self.assertRaises(BadPayloadLength, parser.decrypt, SAMPLE[:25], key)
+
+    def test_hdrlen(self):
+        parser = Dot154PacketParser()
+        self.assertEqual(23, parser.hdrlen(SAMPLE))
+        self.assertEqual(len(SAMPLE) - 23, parser.payloadlen(SAMPLE))
+        # Beacon, with only a source PAN and address.
+        self.assertEqual(7, parser.hdrlen(bytes.fromhex('008001341200000f00')))
+        self.assertRaises(Exception, parser.hdrlen, SAMPLE[:10])
+
+    def test_mac_record_dtype(self):
+        self.assertEqual(zigbee_crypt.MAC_RECORD_SIZE, struct.calcsize(zigbee_crypt.MAC_RECORD_FORMAT))
+        self.assertEqual(len(DOT154_MAC_RECORD_DTYPE), len(struct.unpack(zigbee_crypt.MAC_RECORD_FORMAT, bytes(zigbee_crypt.MAC_RECORD_SIZE))))
+        record = struct.unpack(zigbee_crypt.MAC_RECORD_FORMAT, zigbee_crypt.parse_mac_many([SAMPLE], fcs=False))
+        fields = dict(zip([name for (name, _) in DOT154_MAC_RECORD_DTYPE], record))
+        self.assertEqual(0xacde480000000001, fields['src_addr'])
+        self.assertEqual(5, fields['frame_counter'])
+        self.assertEqual(1, fields['valid'])
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,357 @@
+import unittest
+import struct
+import os
+import tempfile
+import io
+import gc
+import time
+import weakref
+
+import killerbee.pcapng
+from killerbee import pcapdump
+from killerbee.pcapdump import *
+from killerbee.pcapng import *
+
+FRAMES = [b'\x41\x88\x01\x34\x12\x00\x00\x01\x00', b'\x02\x00\x01', b'\x03\x08\x07\xff\xff\xff\xff\x07\x00\x00']
+
+def capture(endflag='<', magic=PCAPH_MAGIC_NUM, frames=FRAMES, frac=5):
+    '''Builds a capture of frames in the given byte order, the nth frame at n seconds and frac.'''
+    data = struct.pack(endflag + 'IHHIIII', magic, 2, 4, 0, 0, 65535, 195)
+    for (i, frame) in enumerate(frames):
+        data += struct.pack(endflag + 'IIII', i, frac, len(frame), len(frame)) + frame
+    return data
+
+class TestPcapReader(unittest.TestCase):
+    def setUp(self):
+        (fd, self.path) = tempfile.mkstemp(suffix='.pcap')
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def reader(self, data):
+        with open(self.path, 'wb') as f:
+            f.write(data)
+        return PcapReader(self.path)
+
+    def test_pnext(self):
+        for endflag in ('<', '>'):
+            pr = self.reader(capture(endflag))
+            self.assertEqual(195, pr.datalink())
+            for (i, frame) in enumerate(FRAMES):
+                (hdr, data) = pr.pnext()
+                self.assertEqual([i + 0.000005, len(frame), len(frame)], hdr)
+                self.assertEqual(frame, data)
+            self.assertEqual([None, None], pr.pnext())
+            pr.close()
+
+        pr = self.reader(capture(magic=PCAPH_MAGIC_NUM_NSEC, frac=500000000))
+        self.assertEqual(1e9, pr.tsresol())
+        self.assertEqual(0.5, pr.pnext()[0][0])
+        pr.close()
+
+        self.assertRaises(Exception, self.reader, b'not a capture at all, really')
+        # An empty file is an empty capture
+        pr = self.reader(b'')
+        self.assertEqual((None, [None, None]), (pr.datalink(), pr.pnext()))
+        self.assertEqual(0, len(pr.read_batch(10)[3]))
+        pr.close()
+
+    def test_pipe(self):
+        # Pipes can not be mapped, and are read whole
+        for (data, cls) in ((capture('>'), PcapReader), (pcapng(), PcapngReader), (b'', PcapReader)):
+            (rfd, wfd) = os.pipe()
+            os.write(wfd, data)
+            os.close(wfd)
+            pr = open_capture('/dev/fd/%d' % rfd)
+            os.close(rfd)
+            self.assertIsInstance(pr, cls)
+            self.assertEqual(FRAMES if data else [], [bytes(frame) for frame in pr.frames()])
+            pr.close()
+        (rfd, wfd) = os.pipe()
+        os.write(wfd, capture())
+        os.close(wfd)
+        pr = PcapReader('/dev/fd/%d' % rfd)
+        os.close(rfd)
+        self.assertEqual(FRAMES, [bytes(frame) for (hdr, frame) in pr])
+        pr.close()
+        with open(self.path, 'wb') as f:
+            f.write(capture())
+        with open(self.path, 'rb') as f:
+            pr = PcapReader(io.BytesIO(f.read()))
+        self.assertEqual(FRAMES, [bytes(frame) for (hdr, frame) in pr])
+        pr.close()
+
+    def test_pnext_view(self):
+        pr = self.reader(capture()[:-4])
+        packets = list(pr)
+        self.assertEqual(3, len(packets))
+        self.assertIsInstance(packets[0][1], memoryview)
+        self.assertEqual(FRAMES[1], bytes(packets[1][1]))
+        # The final record is cut short
+        self.assertEqual(FRAMES[2][:-4], bytes(packets[2][1]))
+        pr.close()
+        self.assertEqual(FRAMES[0], bytes(packets[0][1]))
+
+    def test_read_batch(self):
+        data = capture('>') + struct.pack('>IIII', 9, 0, 70000, 70000)
+        for native in (pcapdump.pcap_index, None):
+            saved = pcapdump.pcap_index
+            pcapdump.pcap_index = native
+            try:
+                pr = self.reader(data)
+                (ts_sec, ts_usec, caplen, offset) = pr.read_batch(2)
+                self.assertEqual([0, 1], list(ts_sec))
+                self.assertEqual([5, 5], list(ts_usec))
+                self.assertEqual([len(FRAMES[0]), len(FRAMES[1])], list(caplen))
+                self.assertEqual(FRAMES[1], bytes(pr.buffer()[offset[1]:offset[1] + caplen[1]]))
+                # The corrupt record ends the batch before it, then raises
+                self.assertEqual([2], list(pr.read_batch(10)[0]))
+                self.assertRaises(Exception, pr.read_batch, 10)
+                pr.close()
+
+                pr = self.reader(capture())
+                self.assertEqual(3, len(pr.read_batch(10)[3]))
+                self.assertEqual(0, len(pr.read_batch(10)[3]))
+                pr.close()
+            finally:
+                pcapdump.pcap_index = saved
+
+    def test_frames_ppi(self):
+        with PcapDumper(DLT_IEEE802_15_4, self.path, ppi=True) as pd:
+            for (i, frame) in enumerate(FRAMES):
+                pd.pcap_dump(frame, i, 5, freq_mhz=2405, ant_dbm=-40)
+        for native in (pcapdump.pcap_index, None):
+            saved = pcapdump.pcap_index
+            pcapdump.pcap_index = native
+            try:
+                pr = PcapReader(self.path)
+                self.assertEqual((DLT_PPI, DLT_IEEE802_15_4), (pr.datalink(), pr.frame_datalink()))
+                # The PPI headers are taken off, unless asked not to
+                self.assertEqual(FRAMES, [bytes(frame) for frame in pr.frames(2)])
+                pr.seek(24)
+                (_, _, caplen, offset) = pr.read_batch(10, strip=False)
+                self.assertEqual(FRAMES[0], bytes(pr.buffer()[offset[0]:offset[0] + caplen[0]])[-len(FRAMES[0]):])
+                self.assertLess(len(FRAMES[0]), caplen[0])
+                pr.close()
+            finally:
+                pcapdump.pcap_index = saved
+
+class CountingWriter(io.BytesIO):
+    '''In-memory savefile counting the writes that reach it.'''
+    def __init__(self):
+        super().__init__()
+        self.writes = 0
+
+    def write(self, data):
+        self.writes += 1
+        return super().write(data)
+
+    def close(self):
+        pass
+
+class TestPcapDumper(unittest.TestCase):
+    def test_pcap_dump(self):
+        out = CountingWriter()
+        with PcapDumper(195, out) as pd:
+            for (i, frame) in enumerate(FRAMES):
+                pd.pcap_dump(frame, i, 5)
+        self.assertEqual(capture(), out.getvalue())
+
+        out = CountingWriter()
+        pd = PcapDumper(195, out)
+        pd.pcap_dump(b'abc', 1, 2, orig_len=10)
+        pd.close()
+        self.assertEqual(struct.pack('<IIII', 1, 2, 3, 10), out.getvalue()[24:40])
+        self.assertRaises(ValueError, pd.pcap_dump, b'abc')
+
+    def test_pcap_dump_many(self):
+        out = CountingWriter()
+        pd = PcapDumper(195, out, flush='every')
+        pd.pcap_dump_many(FRAMES, [(i, 5) for i in range(len(FRAMES))])
+        # The global header, then the batch in one write
+        self.assertEqual(2, out.writes)
+        pd.close()
+        self.assertEqual(capture(), out.getvalue())
+
+    def test_flush_policy(self):
+        out = CountingWriter()
+        pd = PcapDumper(195, out, flush='every')
+        for frame in FRAMES:
+            pd.pcap_dump(frame)
+        self.assertEqual(1 + len(FRAMES), out.writes)
+
+        out = CountingWriter()
+        pd = PcapDumper(195, out, flush='bytes', flush_bytes=40)
+        for frame in FRAMES:
+            pd.pcap_dump(frame)
+        self.assertEqual(2, out.writes)
+        pd.close()
+        self.assertEqual(3, out.writes)
+
+        out = CountingWriter()
+        pd = PcapDumper(195, out, flush='interval', flush_interval=3600)
+        for frame in FRAMES:
+            pd.pcap_dump(frame)
+        self.assertEqual(1, out.writes)
+        pd.poll()
+        self.assertEqual(1, out.writes)
+        pd.flush()
+        self.assertEqual(24 + 3 * 16 + sum(map(len, FRAMES)), len(out.getvalue()))
+
+        # Once the interval is up, poll() writes without another record
+        out = CountingWriter()
+        pd = PcapDumper(195, out, flush='interval', flush_interval=0.01)
+        pd.flush()
+        pd.pcap_dump(FRAMES[0])
+        writes = out.writes
+        time.sleep(0.02)
+        pd.poll()
+        self.assertEqual(writes + 1, out.writes)
+
+        self.assertRaises(ValueError, PcapDumper, 195, CountingWriter(), flush='never')
+
+    def test_unclosed(self):
+        # A dumper that is never closed is not kept alive until exit, and
+        # writes out what it buffered when it goes away
+        out = CountingWriter()
+        pd = PcapDumper(195, out, flush='bytes')
+        pd.pcap_dump(FRAMES[0])
+        ref = weakref.ref(pd)
+        del pd
+        gc.collect()
+        self.assertIsNone(ref())
+        self.assertEqual(24 + 16 + len(FRAMES[0]), len(out.getvalue()))
+
+        # Nor does flushing at exit fail on a savefile the caller closed
+        out = io.BytesIO()
+        pd = PcapDumper(195, out, flush='bytes')
+        pd.pcap_dump(FRAMES[0])
+        out.close()
+        pd._atexit()
+        del pd
+        gc.collect()
+
+def pcapng(endflag='<', frames=FRAMES):
+    '''Builds a pcapng capture of frames in the given byte order, as capture() on one DLT 195 interface.'''
+    data = struct.pack(endflag + 'IIIHHqI', 0x0A0D0D0A, 28, 0x1A2B3C4D, 1, 0, -1, 28)
+    data += struct.pack(endflag + 'IIHHII', 1, 20, 195, 0, 65535, 20)
+    # A block of an unknown type, skipped
+    data += struct.pack(endflag + 'III', 0x0BAD, 12, 12)
+    for (i, frame) in enumerate(frames):
+        pad = b'\x00' * ((4 - len(frame) % 4) % 4)
+        blen = 32 + len(frame) + len(pad)
+        data += struct.pack(endflag + 'IIIIIII', 6, blen, 0, 0, i * 1000000 + 5, len(frame), len(frame)) + frame + pad
+        data += struct.pack(endflag + 'I', blen)
+    return data
+
+class TestPcapng(unittest.TestCase):
+    def setUp(self):
+        (fd, self.path) = tempfile.mkstemp(suffix='.pcapng')
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def reader(self, data):
+        with open(self.path, 'wb') as f:
+            f.write(data)
+        return open_capture(self.path)
+
+    def test_pnext(self):
+        for endflag in ('<', '>'):
+            pr = self.reader(pcapng(endflag))
+            self.assertIsInstance(pr, PcapngReader)
+            self.assertEqual(195, pr.datalink())
+            for (i, frame) in enumerate(FRAMES):
+                (hdr, data) = pr.pnext()
+                self.assertEqual([i + 0.000005, len(frame), len(frame), 0], hdr[0:4])
+                self.assertEqual(frame, data)
+            self.assertEqual([None, None], pr.pnext())
+            pr.close()
+
+        # The last block is cut short
+        pr = self.reader(pcapng()[:-8])
+        self.assertEqual(FRAMES[0], pr.pnext()[1])
+        self.assertEqual(FRAMES[1], pr.pnext()[1])
+        self.assertRaises(Exception, pr.pnext)
+        pr.close()
+
+        self.assertIsInstance(self.reader(capture()), PcapReader)
+        self.assertRaises(Exception, PcapngReader, self.path)
+
+    def test_pcap_dump(self):
+        out = CountingWriter()
+        with PcapngDumper(out) as pd:
+            for (i, frame) in enumerate(FRAMES):
+                pd.pcap_dump(frame, i, 5)
+        data = out.getvalue()
+        # The header blocks differ by their options, the packets not
+        shb_len = struct.unpack_from('<I', data, 4)[0]
+        self.assertEqual(pcapng()[28 + 20 + 12:], data[shb_len + 20:])
+        self.assertEqual(pcapng()[28:48], data[shb_len:shb_len + 20])
+
+    def test_interfaces(self):
+        out = CountingWriter()
+        pd = PcapngDumper(out, flush='every')
+        a = pd.add_interface(DLT_IEEE802_15_4, name='/dev/ttyUSB0', channel=11)
+        b = pd.add_interface(DLT_IEEE802_15_4_TAP, name='/dev/ttyUSB1', channel=25, page=0)
+        self.assertEqual(a, pd.add_interface(DLT_IEEE802_15_4, name='/dev/ttyUSB0', channel=11))
+        pd.pcap_dump(FRAMES[0], 1, 0, interface=a, ant_dbm=-40, lqi=180)
+        pd.pcap_dump(FRAMES[1], 2, 0, interface=b, ant_dbm=-40, lqi=200)
+        pd.pcap_dump_many(FRAMES[2:], interface=b)
+        self.assertRaises(ValueError, pd.pcap_dump, FRAMES[0], interface=2)
+        pd.close()
+
+        pr = self.reader(out.getvalue())
+        self.assertEqual([(195, '/dev/ttyUSB0', 11, 0), (283, '/dev/ttyUSB1', 25, 0)],
+                         [(i['linktype'], i['name'], i['channel'], i['page']) for i in pr.interfaces])
+        packets = [(hdr[3], hdr[4], bytes(frame)) for (hdr, frame) in pr]
+        pr.close()
+        # TAP headers are taken off, and give the RSSI and LQI of the packet,
+        # which other interfaces note in a packet comment
+        self.assertEqual([
+            (0, {'channel': 11, 'page': 0, 'rssi': -40.0, 'lqi': 180}, FRAMES[0]),
+            (1, {'channel': 25, 'page': 0, 'rssi': -40.0, 'lqi': 200}, FRAMES[1]),
+            (1, {'channel': 25, 'page': 0, 'rssi': None, 'lqi': None}, FRAMES[2]),
+        ], packets)
+        for native in (killerbee.pcapng.pcapng_index, None):
+            saved = killerbee.pcapng.pcapng_index
+            killerbee.pcapng.pcapng_index = native
+            try:
+                pr = self.reader(out.getvalue())
+                self.assertEqual(FRAMES, [bytes(frame) for frame in pr.frames()])
+                pr.close()
+            finally:
+                killerbee.pcapng.pcapng_index = saved
+
+    def test_read_batch(self):
+        out = CountingWriter()
+        with PcapngDumper(out) as pd:
+            tap = pd.add_interface(DLT_IEEE802_15_4_TAP, channel=15)
+            pd.pcap_dump_many(FRAMES, [(i, 5) for i in range(len(FRAMES))], interface=tap)
+        # Two sections, the second with its own interfaces
+        data = pcapng('>') + out.getvalue()
+        for native in (killerbee.pcapng.pcapng_index, None):
+            saved = killerbee.pcapng.pcapng_index
+            killerbee.pcapng.pcapng_index = native
+            try:
+                pr = self.reader(data)
+                (ts, caplen, offset, interface) = pr.read_batch(4)
+                self.assertEqual([i + 0.000005 for i in range(3)] + [0.000005], list(ts))
+                self.assertEqual([0, 0, 0, 0], list(interface))
+                self.assertEqual(FRAMES + FRAMES[:1], [bytes(pr.buffer()[o:o + c]) for (o, c) in zip(offset, caplen)])
+                self.assertEqual(DLT_IEEE802_15_4_TAP, pr.datalink())
+                self.assertEqual(DLT_IEEE802_15_4, pr.frame_datalink())
+                self.assertEqual(FRAMES[1:], [bytes(frame) for frame in pr.frames(1)])
+                pr.close()
+                # The corrupt block ends the batch before it, then raises
+                pr = self.reader(data + struct.pack('<III', 6, 14, 14))
+                self.assertEqual(6, len(pr.read_batch(10)[0]))
+                self.assertRaises(Exception, pr.read_batch, 10)
+                pr.close()
+            finally:
+                killerbee.pcapng.pcapng_index = saved
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,101 @@
+import unittest
+import os
+import shutil
+import tempfile
+
+import zigbee_crypt
+
+from killerbee.pcapdump import PcapReader, PcapDumper
+from killerbee.pcapdlt import DLT_IEEE802_15_4
+from killerbee.pcapindex import *
+
+CONTROL4_PCAP = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'sample', 'control4-sample.pcap')
+
+class TestCaptureIndex(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, 'capture.pcap')
+        with open(CONTROL4_PCAP, 'rb') as f:
+            self.data = f.read()
+        pr = PcapReader(CONTROL4_PCAP)
+        self.packets = [(hdr, bytes(frame)) for (hdr, frame) in pr]
+        pr.close()
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def write(self, data, mode='wb'):
+        with open(self.path, mode) as f:
+            f.write(data)
+
+    def test_select(self):
+        self.write(self.data)
+        with CaptureIndex(self.path) as idx:
+            self.assertEqual(407, idx.update())
+            self.assertEqual(0, idx.update())
+            self.assertTrue(idx.sorted)
+            self.assertEqual(407, len(idx.select()))
+
+            def pan(frame):
+                mac = zigbee_crypt.parse_mac(frame)
+                return None if mac is None else (mac.dst_pan if mac.dst_pan is not None else mac.src_pan)
+            expected = [frame for (hdr, frame) in self.packets if pan(frame) == 0x3359]
+            self.assertEqual(expected, [bytes(frame) for (hdr, frame) in idx.packets(pan=0x3359)])
+
+            (start, end) = (self.packets[100][0][0], self.packets[200][0][0])
+            expected = [frame for (hdr, frame) in self.packets if start <= hdr[0] < end]
+            self.assertEqual(expected, [bytes(frame) for (hdr, frame) in idx.packets(start=start, end=end)])
+
+            valid = [frame for (hdr, frame) in self.packets if zigbee_crypt.parse_mac(frame) is not None]
+            self.assertEqual(len(valid), len(idx.select(secured=True)) + len(idx.select(secured=False)))
+            for (hdr, frame) in idx.packets(secured=True, frame_type=1, src=0):
+                mac = zigbee_crypt.parse_mac(frame)
+                self.assertEqual((1, 0), (mac.frame_type, mac.src_addr))
+                self.assertTrue(frame[mac.payload + 1] & 0x02)
+
+        # The index is kept, and reopened without indexing again
+        with CaptureIndex(self.path) as idx:
+            self.assertEqual(407, len(idx))
+            self.assertEqual(0, idx.update())
+
+    def test_update(self):
+        # The capture grows, its last record cut short at first
+        self.write(self.data[:5003])
+        with CaptureIndex(self.path) as idx:
+            first = idx.update()
+            self.write(self.data[5003:9000], 'ab')
+            second = idx.update()
+        self.write(self.data[9000:], 'ab')
+        with CaptureIndex(self.path) as idx:
+            self.assertEqual(407, first + second + idx.update())
+            records = bytes(idx.records())
+        with CaptureIndex(self.path, os.path.join(self.dir, 'full.kbidx')) as full:
+            full.update()
+            self.assertEqual(bytes(full.records()), records)
+
+        # A capture shorter than the index is indexed afresh
+        self.write(self.data[:5003])
+        with CaptureIndex(self.path) as idx:
+            self.assertEqual(first, idx.update())
+            self.assertEqual(first, len(idx.select()))
+
+        # So is a longer capture written over it, with the same header
+        with PcapDumper(DLT_IEEE802_15_4, self.path) as pd:
+            for (hdr, frame) in self.packets[100:100 + first + 2]:
+                pd.pcap_dump(frame, int(hdr[0]), 0)
+        with CaptureIndex(self.path) as idx:
+            self.assertEqual(first + 2, idx.update())
+            self.assertEqual([frame for (hdr, frame) in self.packets[100:100 + first + 2]],
+                             [bytes(frame) for (hdr, frame) in idx.packets()])
+
+        # And a capture replaced by another file, though what was indexed
+        # is still there
+        replacement = os.path.join(self.dir, 'replacement.pcap')
+        with open(replacement, 'wb') as f:
+            f.write(self.data)
+        os.replace(replacement, self.path)
+        with CaptureIndex(self.path) as idx:
+            self.assertEqual(407, idx.update())
+
+if __name__ == "__main__":
+    unittest.main()
@@ -39,6 +39,22 @@ class TestKbScapyExt(unittest.TestCase):
         packets = kbrdpcap(path_to_file)
         self.assertEqual(b'\x08\x07\x06\x05\x04\x03\x02\x01', packets[0].dest_addr.to_bytes(8, 'big'))
 
+    def test_kbrdpcap_lazy(self):
+        path_to_file = "./sample/control4-sample.pcap"
+
+        packets = kbrdpcap(path_to_file, lazy=True)
+        self.assertEqual(407, len(packets))
+        self.assertIsNone(packets[0]._pkt)
+        self.assertEqual(0x3359, packets[1].mac.dst_pan)
+        self.assertEqual(bytes(Dot15d4FCS(bytes(packets[1]))), bytes(packets[1].pkt))
+        self.assertTrue(packets[1].haslayer(Dot15d4FCS))
+
+        # The plaintext transport key of the capture
+        keyframes = kbrdpcap(path_to_file, lfilter_raw=lambda x: x.aps is not None and x.aps.frame_type == ZBEE_APS_FCF_CMD)
+        self.assertEqual(1, len(keyframes))
+        self.assertTrue(keyframes[0].haslayer(ZigbeeAppCommandPayload))
+        self.assertEqual('2f:39:7d:51:71:52:5d:7b:72:6a:39:3b:72:6b:54:26', kbgetnetworkkey(kbrdpcap(path_to_file, lazy=True))['key'])
+
     def _test_kbwrpcap(self):
         path_to_file = "./tests/fixtures/test_pcap.pcap"
         path_to_file_out = "./tests/fixtures/test_pcap_out.pcap"
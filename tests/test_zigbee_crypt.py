@@ -2,6 +2,7 @@ import unittest
 import struct
 import argparse
 import os
+import threading
 
 from zigbee_crypt import * 
 
@@ -30,10 +31,481 @@ class TestZigbeeCrypt(unittest.TestCase):
         self.assertEqual(b'\x01\x02\x03\x04', pt_data) 
         self.assertTrue(mic_check)
 
+    def test_ccm_rfc3610(self):
+        # RFC 3610 packet vector #1, CCM* with an 8-byte MIC is plain CCM
+        key = bytes(range(0xc0, 0xd0))
+        nonce = bytes.fromhex('00000003020100a0a1a2a3a4a5')
+        zigbee_data = bytes(range(0x00, 0x08))
+        pt_data = bytes(range(0x08, 0x1f))
+        (enc_data, mic) = encrypt_ccm(key, nonce, 8, pt_data, zigbee_data)
+        self.assertEqual(bytes.fromhex('588c979a61c663d2f066d0c2c0f989806d5f6b61dac384'), enc_data)
+        self.assertEqual(bytes.fromhex('17e8d12cfdf926e0'), mic)
+        self.assertEqual((pt_data, 1), decrypt_ccm(key, nonce, mic, enc_data, zigbee_data))
+
+    def test_ccm_lengths(self):
+        key = bytes(range(0x40, 0x50))
+        nonce = bytes(range(13))
+        for payload_len in range(0, 128, 3):
+            for aad_len in (0, 1, 13, 14, 15, 30):
+                payload = bytes(range(payload_len))
+                aad = bytes(range(aad_len))
+                (enc_data, mic) = encrypt_ccm(key, nonce, 4, payload, aad)
+                self.assertEqual((payload, 1), decrypt_ccm(key, nonce, mic, enc_data, aad))
+                buf = bytearray(enc_data)
+                self.assertEqual(1, decrypt_ccm_into(buf, key, nonce, mic, buf, aad))
+                self.assertEqual(payload, buf)
+
+    def test_ccm_length_limits(self):
+        key = bytes(range(0x40, 0x50))
+        nonce = bytes(range(13))
+        # The payload length is L = 2 bytes, longer additional data would
+        # need the six byte length encoding
+        (enc_data, mic) = encrypt_ccm(key, nonce, 4, bytes(0xffff), bytes(0xfeff))
+        self.assertEqual((bytes(0xffff), 1), decrypt_ccm(key, nonce, mic, enc_data, bytes(0xfeff)))
+        ctx = CCMContext(key, 4)
+        for (payload, aad) in ((bytes(0x10000), b''), (b'', bytes(0xff00))):
+            self.assertRaises(ValueError, encrypt_ccm, key, nonce, 4, payload, aad)
+            self.assertRaises(ValueError, decrypt_ccm, key, nonce, mic, payload, aad)
+            self.assertRaises(ValueError, decrypt_ccm_into, bytearray(len(payload)), key, nonce, mic, payload, aad)
+            self.assertRaises(ValueError, ctx.encrypt, nonce, payload, aad)
+            self.assertRaises(ValueError, ctx.decrypt, nonce, mic, payload, aad)
+            self.assertRaises(ValueError, try_keys, [key], nonce, mic, payload, aad)
+            self.assertRaises(ValueError, encrypt_ccm_sequence, key, nonce, 0, 0, 1, payload, aad + bytes(4))
+
     def test_sec_key_hash(self):
         key = b'\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f'
         key_hash = sec_key_hash(key, b'\x00') 
         self.assertEqual(b'\xd2\x28\x9c\x6f\xeb\xfe\xdc\xb8\x91\xda\x27\xdc\xd0\xb6\x88\x5d', key_hash)
+
+    def test_hash_mmo(self):
+        # Install code and derived link key from the ZigBee specification
+        install_code = b'\x83\xfe\xd3\x40\x7a\x93\x97\x23\xa5\xc6\x39\xb2\x69\x16\xd5\x05\xc3\xb5'
+        link_key = b'\x66\xb6\x90\x09\x81\xe1\xee\x3c\xa4\x20\x6b\x6b\x86\x1c\x02\xbb'
+        self.assertEqual(link_key, hash_mmo(install_code))
+
+        inputs = [install_code, b'', bytes(range(16)), bytes(range(17)), bytes(8191)]
+        hashes = hash_mmo_many(inputs)
+        self.assertEqual([hash_mmo(data) for data in inputs], hashes)
+        offsets = [0]
+        for data in inputs:
+            offsets.append(offsets[-1] + len(data))
+        self.assertEqual(hashes, hash_mmo_many(b''.join(inputs), offsets=offsets))
+        self.assertEqual([], hash_mmo_many([]))
+
+        self.assertRaises(ValueError, hash_mmo, bytes(8192))
+        self.assertRaises(ValueError, hash_mmo_many, [b'', bytes(8192)])
+
+    def test_fcs(self):
+        # CRC-16/KERMIT check value
+        self.assertEqual(b'\x89\x21', fcs(b'123456789'))
+        self.assertEqual(b'\xa7\xf7', fcs(b'\x01' * 20))
+        self.assertEqual(b'\x00\x00', fcs(b''))
+
+        frames = [bytes(range(size)) for size in (0, 3, 8, 9, 16, 127)]
+        frames = [frame + fcs(frame) for frame in frames]
+        for frame in frames:
+            self.assertTrue(fcs_check(frame))
+            self.assertTrue(fcs_check(bytearray(frame)))
+        self.assertFalse(fcs_check(frames[3][:-1] + b'\x00'))
+        self.assertFalse(fcs_check(b'\x00'))
+
+        frames[2] = b'\xff' + frames[2][1:]
+        valid = fcs_check_many(frames)
+        self.assertEqual([True, True, False, True, True, True], valid)
+        offsets = [0]
+        for frame in frames:
+            offsets.append(offsets[-1] + len(frame))
+        self.assertEqual(valid, fcs_check_many(b''.join(frames), offsets=offsets))
+        self.assertEqual([], fcs_check_many([]))
+
+    def test_aes_impl(self):
+        self.assertIn(aes_impl, ('aesni', 'portable', 'gcrypt'))
+
+    def test_ccm_context(self):
+        key = b'\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f'
+        nonce = b'\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c'
+        zigbee_data = b'\x00\x00\x00\x00'
+        ctx = CCMContext(key, 4)
+
+        (enc_data, mic) = ctx.encrypt(nonce, b'\x01\x02\x03\x04', zigbee_data)
+        self.assertEqual(b'\x17\x36\xb7\x8c', enc_data)
+        self.assertEqual(b'\xfc\xe0\xce\x86', mic)
+
+        (pt_data, mic_check) = ctx.decrypt(nonce, mic, enc_data, zigbee_data)
+        self.assertEqual(b'\x01\x02\x03\x04', pt_data)
+        self.assertTrue(mic_check)
+
+        (pt_data, mic_check) = ctx.decrypt(nonce, b'\x00\x00\x00\x00', enc_data, zigbee_data)
+        self.assertFalse(mic_check)
+
+    def test_ccm_context_matches_module(self):
+        key = bytes(range(0x40, 0x50))
+        nonce = bytes(range(0x20, 0x2d))
+        for mic_len in (0, 4, 8, 16):
+            ctx = CCMContext(key, mic_len)
+            self.assertEqual(mic_len, ctx.mic_len)
+            for size in (0, 1, 15, 16, 17, 100):
+                pt_data = bytes((i * 7) & 0xff for i in range(size))
+                zigbee_data = bytes(range(size % 23))
+                expected = encrypt_ccm(key, nonce, mic_len, pt_data, zigbee_data)
+                self.assertEqual(expected, ctx.encrypt(nonce, pt_data, zigbee_data))
+                (pt_check, mic_check) = ctx.decrypt(nonce, expected[1], expected[0], zigbee_data)
+                self.assertEqual(pt_data, pt_check)
+                self.assertTrue(mic_check)
+
+    def test_ccm_many(self):
+        key = bytes(range(0x40, 0x50))
+        nonces = [bytes([n]) * 13 for n in range(5)]
+        payloads = [bytes(range(size)) for size in (0, 4, 16, 33, 100)]
+        aads = [bytes(range(size)) for size in (7, 0, 16, 20, 3)]
+
+        encrypted = encrypt_ccm_many(key, nonces, 4, payloads, aads)
+        self.assertEqual(5, len(encrypted))
+        for i in range(5):
+            self.assertEqual(encrypt_ccm(key, nonces[i], 4, payloads[i], aads[i]), encrypted[i])
+
+        mics = [mic for (enc_data, mic) in encrypted]
+        enc_payloads = [enc_data for (enc_data, mic) in encrypted]
+        decrypted = decrypt_ccm_many(key, nonces, mics, enc_payloads, aads)
+        self.assertEqual([(payloads[i], 1) for i in range(5)], decrypted)
+
+        # The same frames as packed buffers plus offsets
+        payload_offsets = [0]
+        for enc_data in enc_payloads:
+            payload_offsets.append(payload_offsets[-1] + len(enc_data))
+        aad_offsets = [0]
+        for aad in aads:
+            aad_offsets.append(aad_offsets[-1] + len(aad))
+        packed = decrypt_ccm_many(key, b''.join(nonces), b''.join(mics),
+                                  b''.join(enc_payloads), b''.join(aads),
+                                  payload_offsets=payload_offsets, aad_offsets=aad_offsets)
+        self.assertEqual(decrypted, packed)
+
+        ctx = CCMContext(key, 4)
+        self.assertEqual(encrypted, ctx.encrypt_many(nonces, payloads, aads))
+        self.assertEqual(decrypted, ctx.decrypt_many(nonces, mics, enc_payloads, aads))
+
+        mics[2] = b'\x00\x00\x00\x00'
+        self.assertFalse(decrypt_ccm_many(key, nonces, mics, enc_payloads, aads)[2][1])
+
+    def test_ccm_many_bad_args(self):
+        key = bytes(range(0x40, 0x50))
+        nonce = b'\x00' * 13
+        self.assertRaises(ValueError, decrypt_ccm_many, key, [nonce], [b'\x00' * 4] * 2, [b''] * 2, [b''] * 2)
+        self.assertRaises(ValueError, decrypt_ccm_many, key, [nonce[:12]], [b''], [b''], [b''])
+        self.assertRaises(ValueError, decrypt_ccm_many, key, [nonce], [b''], b'\x00' * 4, [b''])
+        self.assertRaises(ValueError, decrypt_ccm_many, key, [nonce], [b''], b'\x00' * 4, [b''], payload_offsets=[0, 5])
+        self.assertRaises(TypeError, encrypt_ccm_many, key, [nonce], 4, [b''], [None])
+        # Every frame's lengths are checked before any is encrypted
+        ctx = CCMContext(key, 4)
+        for (payloads, aads) in (([b'', bytes(0x10000)], [b'', b'']), ([b'', b''], [b'', bytes(0xff00)])):
+            mics = [b'\x00' * 4] * 2
+            with self.assertRaisesRegex(ValueError, '^frame 1: '):
+                encrypt_ccm_many(key, [nonce] * 2, 4, payloads, aads)
+            with self.assertRaisesRegex(ValueError, '^frame 1: '):
+                decrypt_ccm_many(key, [nonce] * 2, mics, payloads, aads)
+            with self.assertRaisesRegex(ValueError, '^frame 1: '):
+                ctx.encrypt_many([nonce] * 2, payloads, aads)
+            with self.assertRaisesRegex(ValueError, '^frame 1: '):
+                ctx.decrypt_many([nonce] * 2, mics, payloads, aads)
+
+    def test_ccm_context_bad_args(self):
+        self.assertRaises(ValueError, CCMContext, b'\x00' * 15, 4)
+        self.assertRaises(ValueError, CCMContext, b'\x00' * 16, 5)
+        ctx = CCMContext(b'\x00' * 16, 4)
+        self.assertRaises(ValueError, ctx.encrypt, b'\x00' * 12, b'', b'')
+        self.assertRaises(ValueError, ctx.decrypt, b'\x00' * 13, b'\x00' * 8, b'', b'')
+        self.assertRaises(ValueError, sec_key_hash, b'\x00' * 15, b'\x00')
+
+    def test_search_key(self):
+        key = b'\xc0\xc1\xc2\xc3\xc4\xc5\xc6\xc7\xc8\xc9\xca\xcb\xcc\xcd\xce\xcf'
+        nonce = b'\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c'
+        zigbee_data = b'\x00\x00\x00\x00'
+        (enc_data, mic) = encrypt_ccm(key, nonce, 8, b'\x01\x02\x03\x04', zigbee_data)
+
+        searchdata = bytes((i * 31 + 7) & 0xff for i in range(20000))
+        offset = 12345
+        searchdata = searchdata[:offset] + key + searchdata[offset + 16:]
+        for threads in (1, 4):
+            self.assertEqual(offset, search_key(nonce, mic, enc_data, zigbee_data, searchdata, threads=threads))
+        self.assertEqual(offset, search_key(nonce, mic, enc_data, zigbee_data, bytearray(searchdata), stride=5))
+        self.assertIsNone(search_key(nonce, mic, enc_data, zigbee_data, searchdata, stride=2))
+        self.assertIsNone(search_key(nonce, mic, enc_data, zigbee_data, searchdata[:offset + 15]))
+        self.assertEqual(0, search_key(nonce, mic, enc_data, zigbee_data, key * 3, threads=2))
+        self.assertRaises(ValueError, search_key, nonce, b'', enc_data, zigbee_data, searchdata)
+        self.assertRaises(ValueError, search_key, nonce, mic, enc_data, zigbee_data, searchdata, stride=0)
+        self.assertRaises(ValueError, search_key, nonce, mic, b'\x00' * 128, zigbee_data, searchdata)
+        self.assertRaises(ValueError, search_key, nonce, mic, enc_data, b'\x00' * 128, searchdata)
+
+    def test_try_keys(self):
+        keys = [bytes([i]) * 16 for i in range(10)]
+        nonce = b'\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c'
+        keyring = Keyring(keys)
+        self.assertEqual(10, len(keyring))
+        for index in (0, 3, 4, 9):
+            for (payload, zigbee_data) in ((b'\x01\x02\x03\x04', b'\x00' * 4), (bytes(range(40)), bytes(range(21))),
+                                           (b'', b'\x00' * 4), (b'\x01', b''), (b'', b'')):
+                (enc_data, mic) = encrypt_ccm(keys[index], nonce, 4, payload, zigbee_data)
+                self.assertEqual(index, keyring.try_keys(nonce, mic, enc_data, zigbee_data))
+                self.assertEqual(index, try_keys(keys, nonce, mic, enc_data, zigbee_data))
+                self.assertEqual(index, try_keys(keyring, nonce, mic, enc_data, zigbee_data))
+                self.assertIsNone(try_keys(keys[:index] + keys[index + 1:], nonce, mic, enc_data, zigbee_data))
+        (enc_data, mic) = encrypt_ccm(keys[7], nonce, 16, b'\x01\x02', b'\x00')
+        self.assertEqual(7, keyring.try_keys(nonce, mic, enc_data, b'\x00'))
+        self.assertIsNone(try_keys([], nonce, mic, enc_data, b'\x00'))
+
+    def test_try_keys_bad_args(self):
+        nonce = b'\x00' * 13
+        self.assertRaises(ValueError, Keyring, [b'\x00' * 16, b'\x00' * 15])
+        self.assertRaises(ValueError, try_keys, [b'\x00' * 16], nonce[:12], b'\x00' * 4, b'', b'')
+        self.assertRaises(ValueError, try_keys, [b'\x00' * 16], nonce, b'', b'', b'')
+        self.assertRaises(ValueError, Keyring([b'\x00' * 16]).try_keys, nonce, b'\x00' * 17, b'', b'')
+        # ZigBee MICs are 4, 8 or 16 bytes
+        for size in (1, 6, 12):
+            self.assertRaises(ValueError, try_keys, [b'\x00' * 16], nonce, b'\x00' * size, b'', b'')
+
+    def test_buffer_inputs(self):
+        key = bytes(range(0x40, 0x50))
+        nonce = bytes(range(13))
+        payload = bytes(range(30))
+        aad = bytes(range(9))
+        (enc_data, mic) = encrypt_ccm(key, nonce, 4, payload, aad)
+        capture = bytearray(b'\xff' * 3 + aad + enc_data + mic)
+        view = memoryview(capture)
+        aad_view = view[3:3 + len(aad)]
+        enc_view = view[3 + len(aad):-4]
+        mic_view = view[-4:]
+
+        self.assertEqual((enc_data, mic), encrypt_ccm(bytearray(key), memoryview(nonce), 4, bytearray(payload), aad_view))
+        self.assertEqual((payload, 1), decrypt_ccm(memoryview(key), nonce, mic_view, enc_view, aad_view))
+        self.assertEqual((payload, 1), CCMContext(bytearray(key), 4).decrypt(nonce, mic_view, enc_view, aad_view))
+        self.assertEqual([(payload, 1)], decrypt_ccm_many(key, [nonce], [mic_view], [enc_view], [bytearray(aad)]))
+        self.assertEqual(0, try_keys([bytearray(key)], bytearray(nonce), mic_view, enc_view, aad_view))
+        self.assertEqual(hash_mmo(payload), hash_mmo(bytearray(payload)))
+        self.assertEqual(sec_key_hash(key, b'\x02'), sec_key_hash(memoryview(key), b'\x02'))
+        self.assertRaises(TypeError, decrypt_ccm, key, nonce, mic, enc_data, 'aad')
+
+    def test_decrypt_ccm_into(self):
+        key = bytes(range(0x40, 0x50))
+        nonce = bytes(range(13))
+        payload = bytes(range(30))
+        aad = bytes(range(9))
+        (enc_data, mic) = encrypt_ccm(key, nonce, 4, payload, aad)
+
+        out = bytearray(40)
+        self.assertEqual(1, decrypt_ccm_into(out, key, nonce, mic, enc_data, aad))
+        self.assertEqual(payload + bytes(10), out)
+        self.assertEqual(0, decrypt_ccm_into(out, key, nonce, b'\x00' * 4, enc_data, aad))
+
+        # In place, straight out of a capture buffer.
+        capture = bytearray(aad + enc_data)
+        enc_view = memoryview(capture)[len(aad):]
+        self.assertEqual(1, decrypt_ccm_into(enc_view, key, nonce, mic, enc_view, memoryview(capture)[:len(aad)]))
+        self.assertEqual(aad + payload, capture)
+
+        out = bytearray(30)
+        self.assertEqual(1, CCMContext(key, 4).decrypt_into(out, nonce, mic, enc_data, aad))
+        self.assertEqual(payload, out)
+
+        self.assertRaises(TypeError, decrypt_ccm_into, bytes(30), key, nonce, mic, enc_data, aad)
+        self.assertRaises(ValueError, decrypt_ccm_into, bytearray(29), key, nonce, mic, enc_data, aad)
+        capture = bytearray(aad + enc_data)
+        self.assertRaises(ValueError, decrypt_ccm_into, memoryview(capture)[1:], key, nonce, mic,
+                          memoryview(capture)[len(aad):], memoryview(capture)[:len(aad)])
+        self.assertRaises(ValueError, CCMContext(key, 8).decrypt_into, bytearray(30), nonce, mic, enc_data, aad)
+
+    def test_decrypt_nwk_frame(self):
+        # NWK secured frame from sample/control4-sample.pcap, with its FCS.
+        key = bytes.fromhex('26546b723b396a727b5d5271517d392f')
+        frame = bytes.fromhex('61880f5933c01800000806e4b700001ec10100c01828bb22010022021f0000ff0f0000'
+                              '493f78febf65db9d6e8940287cd0')
+        self.assertEqual((35, b'\x02\xc5\x01\x00\\\xc2\xc5,', 1), decrypt_nwk_frame(frame, key))
+        self.assertEqual((35, b'\x02\xc5\x01\x00\\\xc2\xc5,', 1), decrypt_nwk_frame(frame[:-2], key, fcs=False))
+        self.assertEqual(0, decrypt_nwk_frame(frame, bytes(16))[2])
+        self.assertIsNone(decrypt_nwk_frame(frame[:9] + b'\x08\x00' + frame[11:], key))
+        self.assertIsNone(decrypt_nwk_frame(b'\x03\x08\x01\xff\xff\xff\xff\x07\xff\xff', key))
+        self.assertRaises(ValueError, decrypt_nwk_frame, frame, key[:15])
+
+        # APS secured frame without the extended source, which comes from the lookup.
+        key = bytes(range(0x40, 0x50))
+        ext_src = 0x0807060504030201
+        mac = bytes.fromhex('418801341200000100')
+        nwk = struct.pack('<HHHBB', 0x0008, 0x0000, 0x0001, 30, 1)
+        aps = bytes.fromhex('2001060004010102')
+        aux = bytes([0x00]) + struct.pack('<I', 77)
+        nonce = struct.pack('<QI', ext_src, 77) + b'\x05'
+        (enc_data, mic) = encrypt_ccm(key, nonce, 4, b'hello', aps + b'\x05' + aux[1:])
+        frame = mac + nwk + aps + aux + enc_data + mic
+        self.assertIsNone(decrypt_nwk_frame(frame, key, fcs=False))
+        self.assertIsNone(decrypt_nwk_frame(frame, key, {}, fcs=False))
+        self.assertEqual((30, b'hello', 1), decrypt_nwk_frame(frame, key, {1: ext_src}, fcs=False))
+        self.assertEqual((30, b'hello', 1), decrypt_nwk_frame(frame, key, lambda src: struct.pack('<Q', ext_src), fcs=False))
+        self.assertRaises(ValueError, decrypt_nwk_frame, frame, key, {1: b'\x00'}, fcs=False)
+        self.assertRaises(ZeroDivisionError, decrypt_nwk_frame, frame, key, lambda src: 1 // 0, fcs=False)
+
+        self.assertEqual((True, 0, 1, 1, None, None), parse_nwk_frame(frame, fcs=False))
+        self.assertEqual((30, b'hello', 1), CCMContext(key, 8).decrypt_nwk_frame(frame, {1: ext_src}, fcs=False))
+        self.assertIsNone(parse_nwk_frame(b'\x03\x08\x01\xff\xff\xff\xff\x07\xff\xff'))
+
+    def test_parse_mac(self):
+        data = bytes.fromhex('418801341200000100') + b'payload'
+        mac = parse_mac(data + fcs(data))
+        self.assertEqual((1, 1, 0x1234, 0x0000, 0x1234, 0x0001), (mac.frame_type, mac.seq, mac.dst_pan, mac.dst_addr, mac.src_pan, mac.src_addr))
+        self.assertEqual((9, 9, 7), (mac.hdr_len, mac.payload, mac.payload_len))
+        self.assertIsNone(mac.sec_level)
+        self.assertIsNone(mac.frame_counter)
+
+        # MAC command secured with ENC-MIC-32, key identifier mode 1
+        secured = bytes.fromhex('0bcc0734120807060504030201341211223344556677880d0500000007') + b'\x01' + bytes(4)
+        mac = parse_mac(secured, fcs=False)
+        self.assertEqual((0x0102030405060708, 0x8877665544332211), (mac.dst_addr, mac.src_addr))
+        self.assertEqual((5, 1, 7, 5), (mac.sec_level, mac.key_id_mode, mac.key_index, mac.frame_counter))
+        self.assertEqual((23, 29, 1), (mac.hdr_len, mac.payload, mac.payload_len))
+
+        beacon = parse_mac(bytes.fromhex('008001341200000f00'), fcs=False)
+        self.assertEqual((None, None, 0x1234, 0), (beacon.dst_pan, beacon.dst_addr, beacon.src_pan, beacon.src_addr))
+        self.assertIsNone(parse_mac(secured[:-5], fcs=False))
+        self.assertIsNone(parse_mac(b'\x41\x88'))
+
+        frames = [data, secured, b'\x41\x88']
+        records = parse_mac_many(frames, fcs=False)
+        self.assertEqual(3 * MAC_RECORD_SIZE, len(records))
+        unpacked = [struct.unpack_from(MAC_RECORD_FORMAT, records, i * MAC_RECORD_SIZE) for i in range(3)]
+        self.assertEqual((0, 1, 0, 0x8841, 0x1234, 0x1234, 9, 9, 7, 1, 1, 2, 2, 0, 0, 0, 1), unpacked[0])
+        self.assertEqual((0x0102030405060708, 0x8877665544332211, 5), unpacked[1][:3])
+        self.assertEqual((0,) * 17, unpacked[2])
+        out = bytearray(4 * MAC_RECORD_SIZE)
+        offsets = [0, len(data), len(data) + len(secured), len(data) + len(secured) + 2]
+        self.assertIs(out, parse_mac_many(b''.join(frames), offsets=offsets, fcs=False, out=out))
+        self.assertEqual(records, out[:3 * MAC_RECORD_SIZE])
+        self.assertRaises(ValueError, parse_mac_many, frames, out=bytearray(MAC_RECORD_SIZE))
+        self.assertRaises(BufferError, parse_mac_many, frames, out=bytes(3 * MAC_RECORD_SIZE))
+
+    def test_nwk_frame(self):
+        # Data frame with an extended source, multicast control and a source
+        # route of two relays, behind a 9-byte MAC header
+        nwk = bytes.fromhex('0815fcff01001e05') + bytes(range(8, 0, -1)) + b'\x12' + bytes.fromhex('020134127856')
+        frame = bytes.fromhex('418801341200000100') + nwk + b'payload'
+        view = NWKFrame(frame, 9)
+        self.assertEqual((0x1508, 0, 2, 0), (view.fcf, view.frame_type, view.version, view.discover_route))
+        self.assertEqual((True, False, True), (view.multicast, view.security, view.source_route))
+        self.assertEqual((0xfffc, 0x0001, 30, 5), (view.dst, view.src, view.radius, view.seq))
+        self.assertEqual((None, 0x0102030405060708), (view.ext_dst, view.ext_src))
+        self.assertEqual((0x12, 2, 1, (0x1234, 0x5678)), (view.multicast_control, view.relay_count, view.relay_index, view.relays))
+        self.assertEqual((len(nwk), 9 + len(nwk), b'payload'), (view.hdr_len, view.payload_offset, view.payload))
+        self.assertEqual(b'pay', NWKFrame(frame, 9, len(nwk) + 3).payload)
+
+        plain = NWKFrame(bytes.fromhex('0802fcff01001e05'))
+        self.assertEqual((False, False, None, None, None), (plain.multicast, plain.source_route, plain.ext_src, plain.multicast_control, plain.relays))
+        self.assertEqual((8, b''), (plain.hdr_len, plain.payload))
+        self.assertTrue(plain.security)
+
+        self.assertRaises(ValueError, NWKFrame, nwk[:-1])
+        self.assertRaises(ValueError, NWKFrame, nwk[:7])
+        self.assertRaises(ValueError, NWKFrame, nwk, 4, len(nwk))
+
+    def test_aps_frame(self):
+        # Unicast data frame
+        view = APSFrame(bytes.fromhex('400106000401010b') + b'\x01\x00')
+        self.assertEqual((0, 0, False, False, True, False), (view.frame_type, view.delivery_mode, view.ack_format, view.security, view.ack_request, view.ext_header))
+        self.assertEqual((1, None, 0x0006, 0x0104, 1, 11), (view.dst_endpoint, view.group, view.cluster, view.profile, view.src_endpoint, view.counter))
+        self.assertEqual((8, b'\x01\x00'), (view.hdr_len, view.payload))
+
+        # Group delivery, and a fragmented data frame with its block number
+        group = APSFrame(bytes.fromhex('0c341206000401010b'))
+        self.assertEqual((None, 0x1234, 9), (group.dst_endpoint, group.group, group.hdr_len))
+        fragment = APSFrame(bytes.fromhex('800106000401010b0103') + b'data')
+        self.assertEqual((True, 1, 3, None), (fragment.ext_header, fragment.fragmentation, fragment.block_number, fragment.ack_bitfield))
+        self.assertEqual((10, b'data'), (fragment.hdr_len, fragment.payload))
+
+        # Unsecured transport key command, as sent to a joining device
+        command = APSFrame(b'\x00\x01\x2a\x05\x01' + bytes(16), 1)
+        self.assertEqual((1, None, None, 0x2a, 2, False), (command.frame_type, command.cluster, command.profile, command.counter, command.hdr_len, command.security))
+        self.assertEqual((3, b'\x05\x01'), (command.payload_offset, command.payload[:2]))
+
+        self.assertRaises(ValueError, APSFrame, bytes.fromhex('400106000401'))
+        self.assertRaises(ValueError, APSFrame, bytes.fromhex('800106000401010b01'))
+        self.assertRaises(ValueError, APSFrame, b'')
+
+    def test_encrypt_ccm_sequence(self):
+        key = bytes(range(0x40, 0x50))
+        ext_src = bytes(range(1, 9))
+        mac = bytes.fromhex('418801341200000100')
+        aad = struct.pack('<HHHBB', 0x1208, 0x0000, 0x0001, 30, 1) + ext_src + b'\x2d' + bytes(4) + ext_src + b'\x00'
+        nonce = ext_src + bytes(4) + b'\x2d'
+        payload = b'toggle the light'
+
+        frames = encrypt_ccm_sequence(key, nonce, 17, 0xfffffffd, 3, payload, aad, header=mac)
+        self.assertEqual(3, len(frames))
+        for (i, frame) in enumerate(frames):
+            counter = struct.pack('<I', 0xfffffffd + i)
+            (enc_data, mic) = encrypt_ccm(key, ext_src + counter + b'\x2d', 4, payload, aad[:17] + counter + aad[21:])
+            self.assertEqual(mac + aad[:17] + counter + aad[21:] + enc_data + mic, frame[:-2])
+            self.assertEqual((len(mac) + len(aad), payload, 1), decrypt_nwk_frame(frame, key))
+
+        frames = encrypt_ccm_sequence(key, nonce, 17, 7, 2, payload, aad, mic_size=8, fcs=False)
+        self.assertEqual(len(aad) + len(payload) + 8, len(frames[1]))
+        self.assertEqual([], encrypt_ccm_sequence(key, nonce, 17, 0, 0, payload, aad))
+
+        self.assertRaises(ValueError, encrypt_ccm_sequence, key, nonce, 17, 0xfffffffe, 3, payload, aad)
+        self.assertRaises(ValueError, encrypt_ccm_sequence, key, nonce, len(aad) - 3, 0, 1, payload, aad)
+        self.assertRaises(ValueError, encrypt_ccm_sequence, key, nonce[:12], 17, 0, 1, payload, aad)
+        self.assertRaises(ValueError, encrypt_ccm_sequence, key, nonce, 17, 0, 1, payload, aad, mic_size=5)
+
+    def test_threaded(self):
+        key = bytes(range(0x40, 0x50))
+        nonces = [bytes([n]) * 13 for n in range(8)]
+        payloads = [bytes(range(size)) for size in (0, 4, 16, 33, 100, 1, 60, 127)]
+        aads = [bytes(range(size)) for size in (7, 0, 16, 20, 3, 9, 1, 30)]
+        encrypted = [encrypt_ccm(key, nonces[i], 4, payloads[i], aads[i]) for i in range(8)]
+        decrypted = [(payload, 1) for payload in payloads]
+        key_hash = sec_key_hash(key, b'\x02')
+        shared = CCMContext(key, 4)
+        # Known answers, the vectors of test_encrypt_ccm and test_ccm_rfc3610
+        # as (key, nonce, payload, aad, encrypted payload, mic), each with a
+        # context shared by the threads, and the control4 sample frame
+        vectors = [
+            (bytes(range(16)), bytes(range(13)), b'\x01\x02\x03\x04', b'\x00' * 4,
+             bytes.fromhex('1736b78c'), bytes.fromhex('fce0ce86')),
+            (bytes(range(0xc0, 0xd0)), bytes.fromhex('00000003020100a0a1a2a3a4a5'),
+             bytes(range(0x08, 0x1f)), bytes(range(0x00, 0x08)),
+             bytes.fromhex('588c979a61c663d2f066d0c2c0f989806d5f6b61dac384'), bytes.fromhex('17e8d12cfdf926e0')),
+        ]
+        contexts = [CCMContext(vector[0], len(vector[5])) for vector in vectors]
+        nwk_key = bytes.fromhex('26546b723b396a727b5d5271517d392f')
+        nwk_frame = bytes.fromhex('61880f5933c01800000806e4b700001ec10100c01828bb22010022021f0000ff0f0000'
+                                  '493f78febf65db9d6e8940287cd0')
+        errors = []
+
+        def worker():
+            try:
+                for _ in range(200):
+                    for i in range(8):
+                        (enc_data, mic) = encrypted[i]
+                        assert encrypt_ccm(key, nonces[i], 4, payloads[i], aads[i]) == encrypted[i]
+                        assert decrypt_ccm(key, nonces[i], mic, enc_data, aads[i]) == decrypted[i]
+                        assert shared.encrypt(nonces[i], payloads[i], aads[i]) == encrypted[i]
+                        assert shared.decrypt(nonces[i], mic, enc_data, aads[i]) == decrypted[i]
+                    for (ctx, (vkey, nonce, payload, aad, enc_data, mic)) in zip(contexts, vectors):
+                        assert encrypt_ccm(vkey, nonce, len(mic), payload, aad) == (enc_data, mic)
+                        assert decrypt_ccm(vkey, nonce, mic, enc_data, aad) == (payload, 1)
+                        assert ctx.encrypt(nonce, payload, aad) == (enc_data, mic)
+                        assert ctx.decrypt(nonce, mic, enc_data, aad) == (payload, 1)
+                    assert decrypt_nwk_frame(nwk_frame, nwk_key) == (35, b'\x02\xc5\x01\x00\\\xc2\xc5,', 1)
+                    assert sec_key_hash(bytes(range(16)), b'\x00') == bytes.fromhex('d2289c6febfedcb891da27dcd0b6885d')
+                    assert sec_key_hash(key, b'\x02') == key_hash
+                    assert encrypt_ccm_many(key, nonces, 4, payloads, aads) == encrypted
+                    assert shared.decrypt_many(nonces, [mic for (enc_data, mic) in encrypted],
+                                               [enc_data for (enc_data, mic) in encrypted], aads) == decrypted
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=worker) for _ in range(8)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual([], errors)
         
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,1067 @@
+/*
+ * zbcrypt.c
+ * libzbcrypt, the ZigBee CCM*, MMO hash and keyed hash functions of
+ * zigbee_crypt as a plain C library.
+ *
+ * Nothing in here touches Python, so the zigbee_crypt module calls it with
+ * the GIL released, and C programs such as the zbcrypt tool link it
+ * directly. See zbcrypt.h for the API.
+ *
+ * The CCM* and hash code started out as zbee_sec_ccm_decrypt and friends
+ * from wireshark's packet-zbee-security.c.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "zbcrypt.h"
+#if defined(ZBEE_USE_GCRYPT) && GCRYPT_VERSION_NUMBER < 0x010600
+#include <pthread.h>
+GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#endif
+
+static void zbee_fcs_init(void);
+
+/*
+ * One-time setup, call before any other function. libgcrypt must be
+ * initialized once before its handles are used from several threads at a
+ * time; it is left alone if the host application already did so. Returns
+ * non-zero on failure.
+ */
+int
+zbee_crypt_init(void)
+{
+#ifdef ZBEE_USE_GCRYPT
+	if (!gcry_control(GCRYCTL_INITIALIZATION_FINISHED_P)) {
+#if GCRYPT_VERSION_NUMBER < 0x010600
+		gcry_control(GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+#endif
+		if (!gcry_check_version(NULL)) {
+			return -1;
+		}
+		gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
+		gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+	}
+#else
+	zbee_aes_init();
+#endif
+	zbee_fcs_init();
+	return 0;
+}
+
+/* Name of the AES implementation in use. */
+const char *
+zbee_crypt_impl(void)
+{
+#ifdef ZBEE_USE_GCRYPT
+	return "gcrypt";
+#else
+	return zbee_aes_impl();
+#endif
+}
+
+/*
+ * The AES-128 block cipher behind CCM* and the MMO hash. This is the
+ * in-tree implementation of zbee_aes.c, unless the library was built with
+ * ZBEE_USE_GCRYPT to use libgcrypt instead.
+ */
+#ifdef ZBEE_USE_GCRYPT
+int
+zbee_cipher_open(zbee_cipher *cipher)
+{
+	return gcry_cipher_open(cipher, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0) ? -1 : 0;
+}
+
+int
+zbee_cipher_setkey(zbee_cipher *cipher, const char *key)
+{
+	return gcry_cipher_setkey(*cipher, key, ZBEE_SEC_CONST_KEYSIZE) ? -1 : 0;
+}
+
+static int
+zbee_cipher_encrypt(zbee_cipher *cipher, char *out, const char *in)
+{
+	return gcry_cipher_encrypt(*cipher, out, ZBEE_SEC_CONST_BLOCKSIZE, in, ZBEE_SEC_CONST_BLOCKSIZE) ? -1 : 0;
+}
+
+void
+zbee_cipher_close(zbee_cipher *cipher)
+{
+	gcry_cipher_close(*cipher);
+}
+
+/* Encrypts two consecutive blocks of in, ECB handles take both at once. */
+static int
+zbee_cipher_encrypt2(zbee_cipher *cipher, char *out, const char *in)
+{
+	return gcry_cipher_encrypt(*cipher, out, 2 * ZBEE_SEC_CONST_BLOCKSIZE, in, 2 * ZBEE_SEC_CONST_BLOCKSIZE) ? -1 : 0;
+}
+
+/* Encrypts n consecutive blocks of in, block i under ciphers[i]. */
+static int
+zbee_cipher_encrypt_lanes(zbee_cipher **ciphers, int n, char *out, const char *in)
+{
+	int					i;
+
+	for (i = 0; i < n; i++) {
+		if (zbee_cipher_encrypt(ciphers[i], out + i * ZBEE_SEC_CONST_BLOCKSIZE, in + i * ZBEE_SEC_CONST_BLOCKSIZE)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Matyas-Meyer-Oseas step, hash = E(hash, block) XOR block. */
+static int
+zbee_cipher_mmo(zbee_cipher *cipher, char *hash, const char *block)
+{
+	int					i;
+
+	if (zbee_cipher_setkey(cipher, hash) || zbee_cipher_encrypt(cipher, hash, block)) {
+		return -1;
+	}
+	for (i = 0; i < ZBEE_SEC_CONST_BLOCKSIZE; i++) {
+		hash[i] ^= block[i];
+	}
+	return 0;
+}
+#else
+int
+zbee_cipher_open(zbee_cipher *cipher)
+{
+	(void)cipher;
+	return 0;
+}
+
+int
+zbee_cipher_setkey(zbee_cipher *cipher, const char *key)
+{
+	zbee_aes_setkey(cipher, (const unsigned char *)key);
+	return 0;
+}
+
+static int
+zbee_cipher_encrypt(zbee_cipher *cipher, char *out, const char *in)
+{
+	zbee_aes_encrypt(cipher, (const unsigned char *)in, (unsigned char *)out);
+	return 0;
+}
+
+void
+zbee_cipher_close(zbee_cipher *cipher)
+{
+	(void)cipher;
+}
+
+/* Encrypts two consecutive blocks of in, as two interleaved streams. */
+static int
+zbee_cipher_encrypt2(zbee_cipher *cipher, char *out, const char *in)
+{
+	zbee_aes_encrypt2(cipher, (const unsigned char *)in, (unsigned char *)out);
+	return 0;
+}
+
+/* Encrypts n consecutive blocks of in, block i under ciphers[i]. */
+static int
+zbee_cipher_encrypt_lanes(zbee_cipher **ciphers, int n, char *out, const char *in)
+{
+	zbee_aes_encrypt_lanes((const zbee_aes_key *const *)ciphers, n,
+							(const unsigned char *)in, (unsigned char *)out);
+	return 0;
+}
+
+/* Matyas-Meyer-Oseas step, hash = E(hash, block) XOR block. */
+static int
+zbee_cipher_mmo(zbee_cipher *cipher, char *hash, const char *block)
+{
+	(void)cipher;
+	zbee_aes_mmo((unsigned char *)hash, (const unsigned char *)block);
+	return 0;
+}
+#endif
+
+/*
+ * Block b of the CBC-MAC input B0 || L(a) || a || Padding || m || Padding.
+ * Where L(a) =
+ *	  - an empty string if l(a) == 0.
+ *	  - 2-octet encoding of l(a) if 0 < l(a) < (2^16 - 2^8)
+ *	  - 0xff || 0xfe || 4-octet encoding of l(a) if (2^16 - 2^8) <= l(a) < 2^32
+ *	  - 0xff || 0xff || 8-octet encoding of l(a)
+ * But for ZigBee, the largest packet size we should ever see is 2^7, so we
+ * are only really concerned with the first two cases. Padding sections have
+ * the minimum non-negative length such that the padding ends on a block
+ * boundary. Padded bytes are 0.
+ */
+static void
+zbee_ccm_auth_block(const char *nonce, int mic_len, const char *a, int a_len,
+                    const char *m, int m_len, int b, char *block)
+{
+	int					a_blocks, pos, n, i;
+
+	if (b == 0) {
+		block[0] = ZBEE_SEC_CCM_FLAG_M(mic_len) | ZBEE_SEC_CCM_FLAG_ADATA(a_len) | ZBEE_SEC_CCM_FLAG_L;
+		memcpy(block + 1, nonce, ZBEE_SEC_CONST_NONCE_LEN);
+		for (i = 0; i < ZBEE_SEC_CONST_L; i++) {
+			block[(ZBEE_SEC_CONST_BLOCKSIZE-1)-i] = (m_len >> (8*i)) & 0xff;
+		}
+		return;
+	}
+	a_blocks = (a_len > 0) ? (2 + a_len + ZBEE_SEC_CONST_BLOCKSIZE - 1) / ZBEE_SEC_CONST_BLOCKSIZE : 0;
+	memset(block, 0, ZBEE_SEC_CONST_BLOCKSIZE);
+	if (b <= a_blocks) {
+		/* Offset into a, the first block starts with L(a). */
+		pos = (b - 1) * ZBEE_SEC_CONST_BLOCKSIZE - 2;
+		i = 0;
+		if (pos < 0) {
+			block[0] = (a_len >> 8) & 0xff;
+			block[1] = (a_len >> 0) & 0xff;
+			pos = 0;
+			i = 2;
+		}
+		n = a_len - pos;
+		if (n > ZBEE_SEC_CONST_BLOCKSIZE - i) {
+			n = ZBEE_SEC_CONST_BLOCKSIZE - i;
+		}
+		memcpy(block + i, a + pos, n);
+	} else {
+		pos = (b - 1 - a_blocks) * ZBEE_SEC_CONST_BLOCKSIZE;
+		n = m_len - pos;
+		if (n > ZBEE_SEC_CONST_BLOCKSIZE) {
+			n = ZBEE_SEC_CONST_BLOCKSIZE;
+		}
+		if (n > 0) {
+			memcpy(block, m + pos, n);
+		}
+	}
+}
+
+/* The CCM* counter block A[i] = Flags || Nonce || i, i is big-endian. */
+static void
+zbee_ccm_counter_block(const char *nonce, int counter, char *block)
+{
+	block[0] = ZBEE_SEC_CCM_FLAG_L;
+	memcpy(block + 1, nonce, ZBEE_SEC_CONST_NONCE_LEN);
+	block[ZBEE_SEC_CONST_BLOCKSIZE-2] = (counter >> 8) & 0xff;
+	block[ZBEE_SEC_CONST_BLOCKSIZE-1] = (counter >> 0) & 0xff;
+}
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_ccm_crypt
+ *  DESCRIPTION
+ *      CCM* in a single pass. The CTR keystream E(Key, A[i]) and the
+ *      CBC-MAC chain over B0 || L(a) || a || Padding || m || Padding
+ *      are independent, so every step puts one block of each through
+ *      the cipher together. The keystream runs in the order A[1], A[2],
+ *      ..., A[0], which keeps it at least one block ahead of the
+ *      CBC-MAC, so when decrypting the plaintext block a CBC-MAC step
+ *      needs is always ready.
+ *
+ *      Like the separate CTR and CBC-MAC passes this replaces, a frame
+ *      with neither a nor m still pads one block after B0.
+ *
+ *      The cipher must already have the key loaded.
+ *  PARAMETERS
+ *      zbee_cipher *    cipher     - Keyed AES-128 cipher.
+ *      const char *     nonce      - 13-byte CCM* nonce.
+ *      int              mic_len    - MIC length, encoded into B0.
+ *      const char *     in         - Payload to encrypt or decrypt.
+ *      char *           out        - Output payload (may equal in
+ *                                    when decrypting).
+ *      int              len        - Length of in and out.
+ *      const char *     a          - Additional authenticated data.
+ *      int              a_len      - Length of a.
+ *      int              decrypt    - Non-zero if in is the ciphertext.
+ *      char *           tag        - Output tag T (1 block).
+ *      char *           s0         - Output MIC keystream E(Key, A[0])
+ *                                    (1 block).
+ *  RETURNS
+ *      int                         - 0 on success, non-zero on failure.
+ *---------------------------------------------------------------
+ */
+static int
+zbee_ccm_crypt(zbee_cipher *cipher, const char *nonce, int mic_len,
+               const char *in, char *out, int len, const char *a, int a_len,
+               int decrypt, char *tag, char *s0)
+{
+	/* Block 0 is the CBC-MAC input, block 1 the counter block. */
+	char				cipher_in[2 * ZBEE_SEC_CONST_BLOCKSIZE];
+	char				cipher_out[2 * ZBEE_SEC_CONST_BLOCKSIZE];
+	const char			*m = decrypt ? out : in;
+	int					a_blocks, m_blocks, blocks, counter, b, i, j;
+
+	a_blocks = (a_len > 0) ? (2 + a_len + ZBEE_SEC_CONST_BLOCKSIZE - 1) / ZBEE_SEC_CONST_BLOCKSIZE : 0;
+	m_blocks = (len + ZBEE_SEC_CONST_BLOCKSIZE - 1) / ZBEE_SEC_CONST_BLOCKSIZE;
+	blocks = 1 + a_blocks + m_blocks;
+	if (blocks == 1) {
+		blocks = 2;
+	}
+
+	memset(cipher_out, 0, ZBEE_SEC_CONST_BLOCKSIZE);
+	for (b = 0; b < blocks; b++) {
+		/* X(b+1) = E(Key, X(b) XOR B(b)) */
+		zbee_ccm_auth_block(nonce, mic_len, a, a_len, m, len, b, cipher_in);
+		for (j = 0; j < ZBEE_SEC_CONST_BLOCKSIZE; j++) {
+			cipher_in[j] ^= cipher_out[j];
+		}
+		/* The CBC-MAC has at least one block more than the keystream. */
+		counter = (b < m_blocks) ? b + 1 : 0;
+		if (b > m_blocks) {
+			if (zbee_cipher_encrypt(cipher, cipher_out, cipher_in)) {
+				return -1;
+			}
+			continue;
+		}
+		zbee_ccm_counter_block(nonce, counter, cipher_in + ZBEE_SEC_CONST_BLOCKSIZE);
+		if (zbee_cipher_encrypt2(cipher, cipher_out, cipher_in)) {
+			return -1;
+		}
+		if (counter == 0) {
+			memcpy(s0, cipher_out + ZBEE_SEC_CONST_BLOCKSIZE, ZBEE_SEC_CONST_BLOCKSIZE);
+			continue;
+		}
+		i = (counter - 1) * ZBEE_SEC_CONST_BLOCKSIZE;
+		for (j = 0; j < ZBEE_SEC_CONST_BLOCKSIZE && i < len; i++, j++) {
+			out[i] = in[i] ^ cipher_out[ZBEE_SEC_CONST_BLOCKSIZE + j];
+		}
+	}
+	memcpy(tag, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE);
+	return 0;
+} /* zbee_ccm_crypt */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_ccm_encrypt
+ *  DESCRIPTION
+ *      CCM* encryption with an already keyed AES-128 ECB cipher.
+ *      Produces the encrypted payload and the encrypted MIC.
+ *  RETURNS
+ *      int                         - 0 on success, non-zero on failure.
+ *---------------------------------------------------------------
+ */
+int
+zbee_ccm_encrypt(zbee_cipher *cipher, const char *nonce, int mic_len,
+                 const char *m, int m_len, const char *a, int a_len,
+                 char *c, char *mic)
+{
+	char				tag[ZBEE_SEC_CONST_BLOCKSIZE];
+	char				s0[ZBEE_SEC_CONST_BLOCKSIZE];
+	int					i;
+
+	if (zbee_ccm_crypt(cipher, nonce, mic_len, m, c, m_len, a, a_len, 0, tag, s0)) {
+		return -1;
+	}
+	/* The MIC is encrypted with A[0]. */
+	for (i = 0; i < mic_len; i++) {
+		mic[i] = tag[i] ^ s0[i];
+	}
+	return 0;
+} /* zbee_ccm_encrypt */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_ccm_decrypt
+ *  DESCRIPTION
+ *      CCM* decryption with an already keyed AES-128 ECB cipher.
+ *      Produces the decrypted payload and verifies the MIC.
+ *  RETURNS
+ *      int                         - 1 if the MIC matched, 0 if it did
+ *                                    not, -1 on failure.
+ *---------------------------------------------------------------
+ */
+int
+zbee_ccm_decrypt(zbee_cipher *cipher, const char *nonce,
+                 const char *mic, int mic_len, const char *c, int c_len,
+                 const char *a, int a_len, char *m)
+{
+	char				tag[ZBEE_SEC_CONST_BLOCKSIZE];
+	char				s0[ZBEE_SEC_CONST_BLOCKSIZE];
+	int					i, diff = 0;
+
+	if (zbee_ccm_crypt(cipher, nonce, mic_len, c, m, c_len, a, a_len, 1, tag, s0)) {
+		return -1;
+	}
+	/* The MIC is decrypted with A[0]. */
+	for (i = 0; i < mic_len; i++) {
+		diff |= (mic[i] ^ s0[i]) ^ tag[i];
+	}
+	return (diff == 0) ? 1 : 0;
+} /* zbee_ccm_decrypt */
+
+/*
+ * Checks the MIC of one frame under n (up to ZBEE_CIPHER_LANES) keys at
+ * once, with the blocks of all keys going through the cipher together. m
+ * is scratch space for n decrypted payloads of c_len bytes. Sets match[l]
+ * to 1 if the MIC matched under ciphers[l].
+ *  RETURNS
+ *      int                         - 0 on success, non-zero on failure.
+ */
+int
+zbee_ccm_check_lanes(zbee_cipher **ciphers, int n, const char *nonce,
+                     const char *mic, int mic_len, const char *c, int c_len,
+                     const char *a, int a_len, char *m, int *match)
+{
+	char				in[ZBEE_CIPHER_LANES * ZBEE_SEC_CONST_BLOCKSIZE];
+	char				x[ZBEE_CIPHER_LANES * ZBEE_SEC_CONST_BLOCKSIZE];
+	char				dec_mic[ZBEE_CIPHER_LANES * ZBEE_SEC_CONST_BLOCKSIZE];
+	char				block[ZBEE_SEC_CONST_BLOCKSIZE];
+	int					a_blocks, blocks, counter, b, i, j, l;
+
+	/* CTR, the counter blocks are the same in every lane. A[0] is for the
+	 * MIC and A[1] onwards for the payload. */
+	for (counter = 0, i = 0; counter == 0 || i < c_len; counter++) {
+		for (l = 0; l < n; l++) {
+			zbee_ccm_counter_block(nonce, counter, in + l * ZBEE_SEC_CONST_BLOCKSIZE);
+		}
+		if (zbee_cipher_encrypt_lanes(ciphers, n, x, in)) {
+			return -1;
+		}
+		for (l = 0; l < n; l++) {
+			if (counter == 0) {
+				for (j = 0; j < mic_len; j++) {
+					dec_mic[l * ZBEE_SEC_CONST_BLOCKSIZE + j] = mic[j] ^ x[l * ZBEE_SEC_CONST_BLOCKSIZE + j];
+				}
+			} else {
+				for (j = 0; j < ZBEE_SEC_CONST_BLOCKSIZE && i + j < c_len; j++) {
+					m[l * c_len + i + j] = c[i + j] ^ x[l * ZBEE_SEC_CONST_BLOCKSIZE + j];
+				}
+			}
+		}
+		if (counter > 0) {
+			i += ZBEE_SEC_CONST_BLOCKSIZE;
+		}
+	}
+
+	/* CBC-MAC, B0 and the blocks of a are also the same in every lane.
+	 * Like zbee_ccm_crypt(), a frame without a or m still pads one block. */
+	a_blocks = (a_len > 0) ? (2 + a_len + ZBEE_SEC_CONST_BLOCKSIZE - 1) / ZBEE_SEC_CONST_BLOCKSIZE : 0;
+	blocks = 1 + a_blocks + (c_len + ZBEE_SEC_CONST_BLOCKSIZE - 1) / ZBEE_SEC_CONST_BLOCKSIZE;
+	if (blocks == 1) {
+		blocks = 2;
+	}
+	memset(x, 0, sizeof(x));
+	for (b = 0; b < blocks; b++) {
+		for (l = 0; l < n; l++) {
+			if (l == 0 || b > a_blocks) {
+				zbee_ccm_auth_block(nonce, mic_len, a, a_len, m + l * c_len, c_len, b, block);
+			}
+			for (j = 0; j < ZBEE_SEC_CONST_BLOCKSIZE; j++) {
+				in[l * ZBEE_SEC_CONST_BLOCKSIZE + j] = x[l * ZBEE_SEC_CONST_BLOCKSIZE + j] ^ block[j];
+			}
+		}
+		if (zbee_cipher_encrypt_lanes(ciphers, n, x, in)) {
+			return -1;
+		}
+	}
+	for (l = 0; l < n; l++) {
+		match[l] = (memcmp(x + l * ZBEE_SEC_CONST_BLOCKSIZE, dec_mic + l * ZBEE_SEC_CONST_BLOCKSIZE, mic_len) == 0);
+	}
+	return 0;
+} /* zbee_ccm_check_lanes */
+
+/*
+ * Opens an AES-128 cipher and loads the key. Returns non-zero on failure,
+ * in which case there is nothing to close.
+ */
+int
+zbee_ccm_open(zbee_cipher *cipher, const char *key)
+{
+	if (zbee_cipher_open(cipher)) {
+		return -1;
+	}
+	if (zbee_cipher_setkey(cipher, key)) {
+		zbee_cipher_close(cipher);
+		return -1;
+	}
+	return 0;
+}
+
+/* IEEE 802.15.4 frame control field. */
+#define DOT154_FCF_TYPE_MASK	0x0007
+#define DOT154_FCF_TYPE_DATA	0x0001
+#define DOT154_FCF_SEC_EN		0x0008
+#define DOT154_FCF_INTRA_PAN	0x0040
+#define DOT154_FCF_DADDR(f)		(((f) >> 10) & 0x3)
+#define DOT154_FCF_VERSION(f)	(((f) >> 12) & 0x3)
+#define DOT154_FCF_SADDR(f)		(((f) >> 14) & 0x3)
+#define DOT154_FCF_ADDR_NONE	0
+#define DOT154_FCF_ADDR_SHORT	2
+#define DOT154_FCF_ADDR_EXT		3
+
+/* IEEE 802.15.4-2006 auxiliary security header. */
+#define DOT154_SEC_LEVEL_MASK	0x07
+#define DOT154_SEC_KEYID(s)		(((s) >> 3) & 0x3)
+
+/* ZigBee NWK frame control field. */
+#define ZBEE_NWK_FCF_TYPE_MASK	0x0003
+#define ZBEE_NWK_FCF_TYPE_DATA	0x0000
+#define ZBEE_NWK_FCF_MULTICAST	0x0100
+#define ZBEE_NWK_FCF_SRC_ROUTE	0x0400
+#define ZBEE_NWK_FCF_EXT_DEST	0x0800
+#define ZBEE_NWK_FCF_EXT_SRC	0x1000
+
+/* ZigBee APS frame control field. */
+#define ZBEE_APS_FCF_TYPE_MASK	0x03
+#define ZBEE_APS_FCF_TYPE_DATA	0x00
+#define ZBEE_APS_FCF_TYPE_ACK	0x02
+#define ZBEE_APS_FCF_DELIVERY(f)	(((f) >> 2) & 0x3)
+#define ZBEE_APS_FCF_INDIRECT	1
+#define ZBEE_APS_FCF_GROUP		3
+#define ZBEE_APS_FCF_ACK_FORMAT	0x10
+#define ZBEE_APS_FCF_EXT_HEADER	0x80
+
+/* The secured header and auxiliary security header are authenticated as
+ * the CCM* a, which the longest source route makes a little over 512
+ * bytes. */
+#define ZBEE_SEC_AAD_MAX		640
+
+#define ZBEE_GET16(p)			((uint16_t)((unsigned char)(p)[0] | ((unsigned char)(p)[1] << 8)))
+#define ZBEE_GET32(p)			((uint32_t)ZBEE_GET16(p) | ((uint32_t)ZBEE_GET16((p) + 2) << 16))
+#define ZBEE_GET64(p)			((uint64_t)ZBEE_GET32(p) | ((uint64_t)ZBEE_GET32((p) + 4) << 32))
+
+/*
+ * 802.15.4 FCS, the ITU-T CRC-16 in its reflected form (0x8408) with a zero
+ * initial value, as in Kermit. Computed slice-by-8: zbee_fcs_table[0] is the
+ * CRC of one byte, zbee_fcs_table[k] that of a byte followed by k zero
+ * bytes, so eight bytes are folded in with eight lookups.
+ */
+static uint16_t zbee_fcs_table[8][256];
+static volatile int zbee_fcs_table_ready = 0;
+
+static void
+zbee_fcs_init(void)
+{
+	uint16_t			crc;
+	int					b, j, k;
+
+	for (b = 0; b < 256; b++) {
+		crc = (uint16_t)b;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+		}
+		zbee_fcs_table[0][b] = crc;
+	}
+	for (k = 1; k < 8; k++) {
+		for (b = 0; b < 256; b++) {
+			crc = zbee_fcs_table[k-1][b];
+			zbee_fcs_table[k][b] = (crc >> 8) ^ zbee_fcs_table[0][crc & 0xff];
+		}
+	}
+	zbee_fcs_table_ready = 1;
+}
+
+static uint16_t
+zbee_fcs_crc(const unsigned char *p, int len)
+{
+	uint16_t			crc = 0;
+
+	if (!zbee_fcs_table_ready) {
+		zbee_fcs_init();
+	}
+	for (; len >= 8; p += 8, len -= 8) {
+		crc = zbee_fcs_table[7][(p[0] ^ crc) & 0xff] ^ zbee_fcs_table[6][(p[1] ^ (crc >> 8)) & 0xff]
+			^ zbee_fcs_table[5][p[2]] ^ zbee_fcs_table[4][p[3]]
+			^ zbee_fcs_table[3][p[4]] ^ zbee_fcs_table[2][p[5]]
+			^ zbee_fcs_table[1][p[6]] ^ zbee_fcs_table[0][p[7]];
+	}
+	for (; len > 0; p++, len--) {
+		crc = (crc >> 8) ^ zbee_fcs_table[0][(crc ^ *p) & 0xff];
+	}
+	return crc;
+}
+
+/* Writes the FCS of frame to fcs, least significant byte first. */
+void
+zbee_dot154_fcs(const char *frame, int len, char *fcs)
+{
+	uint16_t			crc = zbee_fcs_crc((const unsigned char *)frame, len);
+
+	fcs[0] = (char)(crc & 0xff);
+	fcs[1] = (char)(crc >> 8);
+}
+
+/* 1 if frame ends in the FCS of the bytes before it. */
+int
+zbee_dot154_fcs_check(const char *frame, int len)
+{
+	if (len < 2) {
+		return 0;
+	}
+	/* Running the CRC over a frame and its own FCS leaves a zero residue. */
+	return zbee_fcs_crc((const unsigned char *)frame, len) == 0;
+}
+
+/* Reads an address of the given mode at frame[*off], advancing *off. */
+static uint64_t
+zbee_dot154_addr(const char *frame, int *off, int mode)
+{
+	uint64_t			addr = 0;
+
+	if (mode == DOT154_FCF_ADDR_SHORT) {
+		addr = ZBEE_GET16(frame + *off);
+		*off += 2;
+	} else if (mode == DOT154_FCF_ADDR_EXT) {
+		addr = ZBEE_GET64(frame + *off);
+		*off += 8;
+	}
+	return addr;
+}
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_dot154_parse
+ *  DESCRIPTION
+ *      Parses the 802.15.4 MAC header, and the auxiliary security
+ *      header of secured frames, in one pass. The payload of
+ *      secured frames starts after the key identifier, as in
+ *      Dot154PacketParser.
+ *  RETURNS
+ *      int                         - 0 on success, -1 if the header
+ *                                    can not be parsed.
+ *---------------------------------------------------------------
+ */
+int
+zbee_dot154_parse(const char *frame, int len, zbee_dot154_hdr *h)
+{
+	static const int	keyid_len[] = {0, 1, 5, 9};
+	static const int	mic_len[] = {0, 4, 8, 16};
+	unsigned char		sec_ctrl;
+	int					off = 3, need;
+
+	memset(h, 0, sizeof(*h));
+	if (len < 3 || len > 0xffff) {
+		return -1;
+	}
+	h->fcf = ZBEE_GET16(frame);
+	h->frame_type = h->fcf & DOT154_FCF_TYPE_MASK;
+	h->seq = (uint8_t)frame[2];
+	h->dst_addr_mode = DOT154_FCF_DADDR(h->fcf);
+	h->src_addr_mode = DOT154_FCF_SADDR(h->fcf);
+	if (DOT154_FCF_VERSION(h->fcf) > 1 || h->dst_addr_mode == 1 || h->src_addr_mode == 1) {
+		goto bad;
+	}
+
+	/* Destination PAN and address, then the source PAN unless it is
+	 * compressed into the destination's, then the source address. */
+	need = off;
+	if (h->dst_addr_mode != DOT154_FCF_ADDR_NONE) {
+		need += 2 + (h->dst_addr_mode == DOT154_FCF_ADDR_EXT ? 8 : 2);
+	}
+	if (h->src_addr_mode != DOT154_FCF_ADDR_NONE) {
+		if (!(h->fcf & DOT154_FCF_INTRA_PAN) || h->dst_addr_mode == DOT154_FCF_ADDR_NONE) {
+			need += 2;
+		}
+		need += (h->src_addr_mode == DOT154_FCF_ADDR_EXT ? 8 : 2);
+	}
+	if (need > len) {
+		goto bad;
+	}
+	if (h->dst_addr_mode != DOT154_FCF_ADDR_NONE) {
+		h->dst_pan = ZBEE_GET16(frame + off);
+		off += 2;
+		h->dst_addr = zbee_dot154_addr(frame, &off, h->dst_addr_mode);
+	}
+	if (h->src_addr_mode != DOT154_FCF_ADDR_NONE) {
+		if (!(h->fcf & DOT154_FCF_INTRA_PAN) || h->dst_addr_mode == DOT154_FCF_ADDR_NONE) {
+			h->src_pan = ZBEE_GET16(frame + off);
+			off += 2;
+		} else {
+			h->src_pan = h->dst_pan;
+		}
+		h->src_addr = zbee_dot154_addr(frame, &off, h->src_addr_mode);
+	}
+	h->hdr_len = (uint16_t)off;
+
+	/* Auxiliary security header: security control, frame counter, then
+	 * the key source and index as selected by the key identifier mode. */
+	need = 0;
+	if (h->fcf & DOT154_FCF_SEC_EN) {
+		if (off + 5 > len) {
+			goto bad;
+		}
+		sec_ctrl = (unsigned char)frame[off];
+		h->sec_level = sec_ctrl & DOT154_SEC_LEVEL_MASK;
+		h->key_id_mode = DOT154_SEC_KEYID(sec_ctrl);
+		h->frame_counter = ZBEE_GET32(frame + off + 1);
+		off += 5 + keyid_len[h->key_id_mode];
+		if (off > len) {
+			goto bad;
+		}
+		if (h->key_id_mode) {
+			h->key_index = (uint8_t)frame[off - 1];
+		}
+		need = mic_len[h->sec_level & 0x3];
+	}
+	if (len - off < need) {
+		goto bad;
+	}
+	h->payload = (uint16_t)off;
+	h->payload_len = (uint16_t)(len - off - need);
+	h->valid = 1;
+	return 0;
+bad:
+	memset(h, 0, sizeof(*h));
+	return -1;
+} /* zbee_dot154_parse */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_nwk_parse
+ *  DESCRIPTION
+ *      Walks a ZigBee NWK header: frame control, destination,
+ *      source, radius and sequence number, then the optional
+ *      fields in the order of their flags.
+ *  RETURNS
+ *      int                         - 0 on success, -1 if the header
+ *                                    runs past len.
+ *---------------------------------------------------------------
+ */
+int
+zbee_nwk_parse(const char *frame, int off, int len, zbee_nwk_hdr *h)
+{
+	h->start = off;
+	h->ext_dst = h->ext_src = h->mcast = h->src_route = -1;
+	if (off < 0 || len - off < 8) {
+		return -1;
+	}
+	h->fcf = ZBEE_GET16(frame + off);
+	off += 8;
+	if (h->fcf & ZBEE_NWK_FCF_EXT_DEST) {
+		h->ext_dst = off;
+		off += 8;
+	}
+	if (h->fcf & ZBEE_NWK_FCF_EXT_SRC) {
+		h->ext_src = off;
+		off += 8;
+	}
+	if (h->fcf & ZBEE_NWK_FCF_MULTICAST) {
+		h->mcast = off;
+		off += 1;
+	}
+	if (h->fcf & ZBEE_NWK_FCF_SRC_ROUTE) {
+		if (off + 2 > len) {
+			return -1;
+		}
+		h->src_route = off;
+		off += 2 + 2 * (unsigned char)frame[off];
+	}
+	h->payload = off;
+	return (off <= len) ? 0 : -1;
+} /* zbee_nwk_parse */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_aps_parse
+ *  DESCRIPTION
+ *      Walks a ZigBee APS header. Data frames, and acknowledgements
+ *      of data frames, carry the destination endpoint or group as
+ *      selected by the delivery mode, then the cluster, profile and
+ *      source endpoint. All frames carry the APS counter, followed
+ *      by the extended header when flagged.
+ *  RETURNS
+ *      int                         - 0 on success, -1 if the header
+ *                                    runs past len.
+ *---------------------------------------------------------------
+ */
+int
+zbee_aps_parse(const char *frame, int off, int len, zbee_aps_hdr *h)
+{
+	h->start = off;
+	h->dst_endpoint = h->group = h->cluster = -1;
+	h->ext_fcf = h->block = h->ack_bitfield = -1;
+	if (off < 0 || off >= len) {
+		return -1;
+	}
+	h->fcf = (uint8_t)frame[off++];
+	if ((h->fcf & ZBEE_APS_FCF_TYPE_MASK) == ZBEE_APS_FCF_TYPE_DATA ||
+		((h->fcf & ZBEE_APS_FCF_TYPE_MASK) == ZBEE_APS_FCF_TYPE_ACK && !(h->fcf & ZBEE_APS_FCF_ACK_FORMAT))) {
+		if (ZBEE_APS_FCF_DELIVERY(h->fcf) == ZBEE_APS_FCF_GROUP) {
+			h->group = off;
+			off += 2;
+		} else if (ZBEE_APS_FCF_DELIVERY(h->fcf) != ZBEE_APS_FCF_INDIRECT) {
+			h->dst_endpoint = off;
+			off += 1;
+		}
+		h->cluster = off;
+		off += 5;
+	}
+	h->counter = off;
+	off += 1;
+	if (h->fcf & ZBEE_APS_FCF_EXT_HEADER) {
+		/* Extended frame control, then the block number and for
+		 * acknowledgements the ack bitfield of fragmented frames. */
+		if (off >= len) {
+			return -1;
+		}
+		h->ext_fcf = off;
+		if (frame[off++] & 0x03) {
+			h->block = off++;
+			if ((h->fcf & ZBEE_APS_FCF_TYPE_MASK) == ZBEE_APS_FCF_TYPE_ACK) {
+				h->ack_bitfield = off++;
+			}
+		}
+	}
+	h->payload = off;
+	return (off <= len) ? 0 : -1;
+} /* zbee_aps_parse */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_frame_parse
+ *  DESCRIPTION
+ *      Walks the 802.15.4 MAC header, the ZigBee NWK header, the APS
+ *      header if the NWK frame is not secured, and the auxiliary
+ *      security header, the same fields kbdecrypt() reads through
+ *      scapy. Only 2003 and 2006 802.15.4 data frames without MAC
+ *      security are accepted.
+ *  RETURNS
+ *      int                         - 0 if the frame is NWK or APS
+ *                                    secured, -1 if not.
+ *---------------------------------------------------------------
+ */
+int
+zbee_sec_frame_parse(const char *frame, int len, zbee_sec_frame *f)
+{
+	zbee_dot154_hdr		mac;
+	zbee_nwk_hdr		nwk;
+	zbee_aps_hdr		aps;
+	unsigned char		sec_ctrl;
+	int					off;
+
+	/* MAC header: frame control, sequence and the addressing fields. */
+	if (zbee_dot154_parse(frame, len, &mac) || mac.frame_type != DOT154_FCF_TYPE_DATA ||
+		(mac.fcf & DOT154_FCF_SEC_EN)) {
+		return -1;
+	}
+	off = mac.hdr_len;
+	f->mac_src = (mac.src_addr_mode == DOT154_FCF_ADDR_SHORT) ? (int)mac.src_addr : -1;
+
+	/* NWK header, then without NWK security an APS data frame may be
+	 * secured instead. */
+	if (zbee_nwk_parse(frame, off, len, &nwk)) {
+		return -1;
+	}
+	f->hdr = off;
+	f->nwk_src = ZBEE_GET16(frame + off + 4);
+	f->nwk_ext_src = nwk.ext_src;
+	f->ext_src = f->nwk_ext_src;
+	off = nwk.payload;
+	f->aps = !(nwk.fcf & ZBEE_NWK_FCF_SECURITY);
+	if (f->aps) {
+		if ((nwk.fcf & ZBEE_NWK_FCF_TYPE_MASK) != ZBEE_NWK_FCF_TYPE_DATA ||
+			off >= len || !(frame[off] & ZBEE_APS_FCF_SECURITY) ||
+			zbee_aps_parse(frame, off, len, &aps)) {
+			return -1;
+		}
+		f->hdr = off;
+		off = aps.payload;
+	}
+
+	/* Auxiliary header: security control, frame counter, then the
+	 * extended source and key sequence number if flagged. */
+	f->aux = off;
+	if (off + 5 > len) {
+		return -1;
+	}
+	sec_ctrl = (unsigned char)frame[off];
+	off += 5;
+	if (sec_ctrl & ZBEE_SEC_CONTROL_NONCE) {
+		f->ext_src = off;
+		off += 8;
+	}
+	if ((sec_ctrl & ZBEE_SEC_CONTROL_KEY) == (ZBEE_SEC_KEY_NWK << 3)) {
+		off += 1;
+	}
+	f->payload = off;
+	f->payload_len = len - off - ZBEE_SEC_FRAME_MIC_LEN;
+	if (f->payload_len < 0 || off - f->hdr > ZBEE_SEC_AAD_MAX) {
+		return -1;
+	}
+	return 0;
+} /* zbee_sec_frame_parse */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_frame_decrypt
+ *  DESCRIPTION
+ *      Decrypts the payload of a frame parsed by zbee_sec_frame_parse().
+ *      The security level is sent as zero and restored by the receiver
+ *      from the network's setting, so like kbdecrypt() this assumes
+ *      ENC-MIC-32 in both the nonce and the a data.
+ *  RETURNS
+ *      int                         - 1 if the MIC matched, 0 if it did
+ *                                    not, -1 on failure.
+ *---------------------------------------------------------------
+ */
+int
+zbee_sec_frame_decrypt(zbee_cipher *cipher, const char *frame,
+                       const zbee_sec_frame *f, const char *ext_src, char *m)
+{
+	char				nonce[ZBEE_SEC_CONST_NONCE_LEN];
+	char				a[ZBEE_SEC_AAD_MAX];
+	char				sec_ctrl;
+	int					a_len = f->payload - f->hdr;
+
+	if (ext_src == NULL) {
+		if (f->ext_src < 0) {
+			return -1;
+		}
+		ext_src = frame + f->ext_src;
+	}
+	sec_ctrl = (char)((frame[f->aux] & ~ZBEE_SEC_CONTROL_LEVEL) | ZBEE_SEC_ENC_MIC32);
+
+	/* Nonce: extended source, frame counter, security control. */
+	memcpy(nonce, ext_src, 8);
+	memcpy(nonce + 8, frame + f->aux + 1, 4);
+	nonce[12] = sec_ctrl;
+	memcpy(a, frame + f->hdr, a_len);
+	a[f->aux - f->hdr] = sec_ctrl;
+
+	return zbee_ccm_decrypt(cipher, nonce,
+							frame + f->payload + f->payload_len, ZBEE_SEC_FRAME_MIC_LEN,
+							frame + f->payload, f->payload_len,
+							a, a_len, m);
+} /* zbee_sec_frame_decrypt */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_hash
+ *  DESCRIPTION
+ *      ZigBee Cryptographic Hash Function, described in ZigBee
+ *      specification sections B.1.3 and B.6.
+ *
+ *      This is a Matyas-Meyer-Oseas hash function using the AES-128
+ *      cipher. zbee_cipher gives us the raw block cipher.
+ *
+ *      Input may be up to ZBEE_SEC_HASH_MAX_INPUT bytes (the length is
+ *      encoded as 16 bits), and the output must be exactly 1-block in length.
+ *
+ *      Implements the function:
+ *          Hash(text) = Hash[t];
+ *          Hash[0] = 0^(blocksize).
+ *          Hash[i] = E(Hash[i-1], M[i]) XOR M[j];
+ *          M[i] = i'th block of text, with some padding and flags concatenated.
+ *  PARAMETERS
+ *      char *    input       - Hash Input.
+ *      int       input_len   - Hash Input Length.
+ *      char *    output      - Hash Output (exactly one block in length).
+ *  RETURNS
+ *      void
+ *---------------------------------------------------------------
+ */
+void
+zbee_sec_hash(const char *input, int input_len, char *output)
+{
+    char              cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
+    int               i, j;
+    /* Cipher Instance. */
+    zbee_cipher         cipher;
+
+    /* Clear the first hash block (Hash0). */
+    memset(output, 0, ZBEE_SEC_CONST_BLOCKSIZE);
+    /* Create the cipher instance in ECB mode. */
+    if (zbee_cipher_open(&cipher)) {
+        return; /* Failed. */
+    }
+    /* Create the subsequent hash blocks using the formula: Hash[i] = E(Hash[i-1], M[i]) XOR M[i]
+     *
+     * because we can't guarantee that M will be exactly a multiple of the
+     * block size, we will need to copy it into local buffers and pad it.
+     *
+     * Note that we check for the next cipher block at the end of the loop
+     * rather than the start. This is so that if the input happens to end
+     * on a block boundary, the next cipher block will be generated for the
+     * start of the padding to be placed into.
+     */
+    i = 0;
+    j = 0;
+    while (i<input_len) {
+        /* Copy data into the cipher input. */
+        cipher_in[j++] = input[i++];
+        /* Check if this cipher block is done. */
+        if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
+            /* We have reached the end of this block. Process it with the
+             * cipher, note that the Key input to the cipher is actually
+             * the previous hash block, which we are keeping in output.
+             * zbee_cipher_mmo() also XORs the input into the hash block.
+             */
+            (void)zbee_cipher_mmo(&cipher, output, cipher_in);
+            /* Reset j to start again at the beginning at the next block. */
+            j = 0;
+        }
+    } /* for */
+    /* Need to append the bit '1', followed by '0' padding long enough to end
+     * the hash input on a block boundary. However, because 'n' is 16, and 'l'
+     * will be a multiple of 8, the padding will be >= 7-bits, and we can just
+     * append the byte 0x80.
+     */
+    cipher_in[j++] = 0x80;
+    /* Pad with '0' until the the current block is exactly 'n' bits from the
+     * end.
+     */
+    while (j!=(ZBEE_SEC_CONST_BLOCKSIZE-2)) {
+        if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
+            /* We have reached the end of this block. Process it with the
+             * cipher, note that the Key input to the cipher is actually
+             * the previous hash block, which we are keeping in output.
+             * zbee_cipher_mmo() also XORs the input into the hash block.
+             */
+            (void)zbee_cipher_mmo(&cipher, output, cipher_in);
+            /* Reset j to start again at the beginning at the next block. */
+            j = 0;
+        }
+        /* Pad the input with 0. */
+        cipher_in[j++] = 0x00;
+    } /* while */
+    /* Add the 'n'-bit representation of 'l' to the end of the block. */
+    cipher_in[j++] = ((input_len * 8) >> 8) & 0xff;
+    cipher_in[j] = ((input_len * 8) >> 0) & 0xff;
+    /* Process the last cipher block, XORing it back into the cipher
+     * output to get the hash. */
+    (void)zbee_cipher_mmo(&cipher, output, cipher_in);
+    /* Cleanup the cipher. */
+    zbee_cipher_close(&cipher);
+    /* Done */
+} /* zbee_sec_hash */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_key_hash
+ *  DESCRIPTION
+ *      ZigBee Keyed Hash Function. Described in ZigBee specification
+ *      section B.1.4, and in FIPS Publication 198. Strictly speaking
+ *      there is nothing about the Keyed Hash Function which restricts
+ *      it to only a single byte input, but that's all ZigBee ever uses.
+ *
+ *      This function implements the hash function:
+ *          Hash(Key, text) = H((Key XOR opad) || H((Key XOR ipad) || text));
+ *          ipad = 0x36 repeated.
+ *          opad = 0x5c repeated.
+ *          H() = ZigBee Cryptographic Hash (B.1.3 and B.6).
+ *  PARAMETERS
+ *      const char *     key        - 16-byte key.
+ *      char             input      - Hash input byte.
+ *      char *           output     - Hash output (exactly one block).
+ *---------------------------------------------------------------
+ */
+void
+zbee_sec_key_hash(const char *key, char input, char *output)
+{
+    char          hash_in[2*ZBEE_SEC_CONST_BLOCKSIZE];
+    char          hash_out[ZBEE_SEC_CONST_BLOCKSIZE+1];
+    int                 i;
+    static const char ipad = 0x36;
+    static const char opad = 0x5c;
+
+    /* Copy the key into hash_in and XOR with opad to form: (Key XOR opad) */
+    for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) hash_in[i] = key[i] ^ opad;
+    /* Copy the Key into hash_out and XOR with ipad to form: (Key XOR ipad) */
+    for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) hash_out[i] = key[i] ^ ipad;
+    /* Append the input byte to form: (Key XOR ipad) || text. */
+    hash_out[ZBEE_SEC_CONST_BLOCKSIZE] = input;
+    /* Hash the contents of hash_out and append the contents to hash_in to
+     * form: (Key XOR opad) || H((Key XOR ipad) || text).
+     */
+    zbee_sec_hash(hash_out, ZBEE_SEC_CONST_BLOCKSIZE+1, hash_in+ZBEE_SEC_CONST_BLOCKSIZE);
+    /* Hash the contents of hash_in to get the final result. */
+    zbee_sec_hash(hash_in, 2*ZBEE_SEC_CONST_BLOCKSIZE, output);
+} /* zbee_sec_key_hash */
@@ -0,0 +1,182 @@
+/*
+ * zbcrypt.h
+ * libzbcrypt, the ZigBee security functions behind zigbee_crypt, usable
+ * from C without Python.
+ *
+ * Build with ZBEE_USE_GCRYPT defined to use libgcrypt for AES-128 instead
+ * of the in-tree zbee_aes.c; programs using the library must be compiled
+ * with the same setting, as it changes the zbee_cipher type. All functions
+ * are thread safe, as long as each zbee_cipher is used by one thread at a
+ * time.
+ */
+
+#ifndef ZBCRYPT_H
+#define ZBCRYPT_H
+
+#include <stdint.h>
+#ifdef ZBEE_USE_GCRYPT
+#include <gcrypt.h>
+#else
+#include "zbee_aes.h"
+#endif
+#include "zigbee_crypt.h"
+
+/* A keyed AES-128 block cipher. */
+#ifdef ZBEE_USE_GCRYPT
+typedef gcry_cipher_hd_t zbee_cipher;
+
+#define ZBEE_CIPHER_LANES	4
+#else
+typedef zbee_aes_key zbee_cipher;
+
+#define ZBEE_CIPHER_LANES	ZBEE_AES_LANES
+#endif
+
+/* Longest input whose length in bits fits the 16-bit MMO length field. */
+#define ZBEE_SEC_HASH_MAX_INPUT	(0xffff / 8)
+
+int zbee_crypt_init(void);
+const char *zbee_crypt_impl(void);
+
+/* Low level cipher handle, for changing the key of an open cipher. */
+int zbee_cipher_open(zbee_cipher *cipher);
+int zbee_cipher_setkey(zbee_cipher *cipher, const char *key);
+void zbee_cipher_close(zbee_cipher *cipher);
+
+/*
+ * CCM* with a 13-byte nonce and 0, 4, 8 or 16-byte MIC. zbee_ccm_open()
+ * keys a cipher for any number of frames, release it with
+ * zbee_cipher_close(). zbee_ccm_decrypt() returns 1 if the MIC matched, 0
+ * if not and -1 on failure, the others 0 on success.
+ */
+int zbee_ccm_open(zbee_cipher *cipher, const char *key);
+int zbee_ccm_encrypt(zbee_cipher *cipher, const char *nonce, int mic_len,
+                     const char *m, int m_len, const char *a, int a_len,
+                     char *c, char *mic);
+int zbee_ccm_decrypt(zbee_cipher *cipher, const char *nonce,
+                     const char *mic, int mic_len, const char *c, int c_len,
+                     const char *a, int a_len, char *m);
+int zbee_ccm_check_lanes(zbee_cipher **ciphers, int n, const char *nonce,
+                         const char *mic, int mic_len, const char *c, int c_len,
+                         const char *a, int a_len, char *m, int *match);
+
+/*
+ * An IEEE 802.15.4-2003/2006 MAC header and auxiliary security header, as
+ * found by zbee_dot154_parse(). Addresses are integers like scapy's and 0
+ * when their addressing mode is none; src_pan is the destination PAN under
+ * PAN ID compression. The layout is fixed, without padding, so arrays of it
+ * can be read as NumPy structured arrays.
+ */
+typedef struct {
+	uint64_t			dst_addr;
+	uint64_t			src_addr;
+	uint32_t			frame_counter;	/* 0 if not secured */
+	uint16_t			fcf;
+	uint16_t			dst_pan;
+	uint16_t			src_pan;
+	uint16_t			hdr_len;		/* addressing fields end, auxiliary header start */
+	uint16_t			payload;		/* MAC payload */
+	uint16_t			payload_len;	/* MAC payload, without the MIC */
+	uint8_t				frame_type;
+	uint8_t				seq;
+	uint8_t				dst_addr_mode;
+	uint8_t				src_addr_mode;
+	uint8_t				sec_level;		/* 0 if not secured */
+	uint8_t				key_id_mode;
+	uint8_t				key_index;
+	uint8_t				valid;			/* 1 once parsed */
+} zbee_dot154_hdr;
+
+/*
+ * zbee_dot154_parse() fills h from frame (len bytes, without the FCS).
+ * Returns 0 on success, -1 if the frame is truncated, uses a reserved
+ * addressing mode or is of a frame version other than 2003 or 2006, with h
+ * zeroed.
+ */
+int zbee_dot154_parse(const char *frame, int len, zbee_dot154_hdr *h);
+
+/*
+ * Field positions of a ZigBee NWK header and an APS header, as found by
+ * zbee_nwk_parse() and zbee_aps_parse(). All positions are byte offsets into
+ * the frame, -1 for fields the header does not carry. The NWK destination,
+ * source, radius and sequence number follow the frame control field at
+ * start; the APS profile and source endpoint follow the cluster.
+ */
+typedef struct {
+	int					start;
+	uint16_t			fcf;
+	int					ext_dst;
+	int					ext_src;
+	int					mcast;			/* multicast control */
+	int					src_route;		/* relay count, relay index, relay list */
+	int					payload;
+} zbee_nwk_hdr;
+
+typedef struct {
+	int					start;
+	uint8_t				fcf;
+	int					dst_endpoint;
+	int					group;
+	int					cluster;
+	int					counter;
+	int					ext_fcf;		/* extended frame control */
+	int					block;			/* block number of a fragment */
+	int					ack_bitfield;
+	int					payload;
+} zbee_aps_hdr;
+
+/*
+ * Parse the NWK or APS header at frame[off], len bytes being the end of its
+ * payload. Return 0, or -1 if the header runs past len.
+ */
+int zbee_nwk_parse(const char *frame, int off, int len, zbee_nwk_hdr *h);
+int zbee_aps_parse(const char *frame, int off, int len, zbee_aps_hdr *h);
+
+/*
+ * A NWK or APS-secured ZigBee frame inside an IEEE 802.15.4 data frame, as
+ * found by zbee_sec_frame_parse(). All positions are byte offsets into the
+ * 802.15.4 frame.
+ */
+typedef struct {
+	int					aps;			/* 1 if APS secured, 0 if NWK secured */
+	int					hdr;			/* the secured NWK or APS header */
+	int					aux;			/* auxiliary security header */
+	int					payload;		/* encrypted payload */
+	int					payload_len;	/* encrypted payload, without the MIC */
+	int					mac_src;		/* MAC short source address, -1 if none */
+	int					nwk_src;		/* NWK short source address */
+	int					nwk_ext_src;	/* NWK header extended source, -1 if not sent */
+	int					ext_src;		/* extended source of the nonce, -1 if not sent */
+} zbee_sec_frame;
+
+#define ZBEE_SEC_FRAME_MIC_LEN	4
+
+/* Security flags of the 802.15.4, NWK and APS frame control fields. */
+#define ZBEE_DOT154_FCF_SECURITY	0x0008
+#define ZBEE_NWK_FCF_SECURITY	0x0200
+#define ZBEE_APS_FCF_SECURITY	0x20
+
+/*
+ * zbee_sec_frame_parse() returns 0 if frame (len bytes, without the FCS)
+ * carries a NWK or APS-secured frame, -1 if not. zbee_sec_frame_decrypt()
+ * decrypts its payload into m; ext_src is the extended source address in
+ * over-the-air byte order, or NULL to take it from the frame. Returns like
+ * zbee_ccm_decrypt(), and -1 if no extended source is known.
+ */
+int zbee_sec_frame_parse(const char *frame, int len, zbee_sec_frame *f);
+int zbee_sec_frame_decrypt(zbee_cipher *cipher, const char *frame,
+                           const zbee_sec_frame *f, const char *ext_src, char *m);
+
+/*
+ * Writes the 2-byte FCS of an 802.15.4 frame of len bytes to fcs.
+ * zbee_dot154_fcs_check() returns 1 if the last 2 of len bytes are the FCS
+ * of the rest, 0 if not or if len is below 2.
+ */
+void zbee_dot154_fcs(const char *frame, int len, char *fcs);
+int zbee_dot154_fcs_check(const char *frame, int len);
+
+/* ZigBee Cryptographic Hash (B.1.3 and B.6) and Keyed Hash (B.1.4). */
+void zbee_sec_hash(const char *input, int input_len, char *output);
+void zbee_sec_key_hash(const char *key, char input, char *output);
+
+#endif /* ZBCRYPT_H */
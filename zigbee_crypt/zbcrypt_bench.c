@@ -0,0 +1,126 @@
+/*
+ * zbcrypt_bench.c
+ * Microbenchmarks of the libzbcrypt routines, one JSON object per line on
+ * stdout, so runs of different builds and backends can be compared.
+ *
+ * Usage: zbcrypt_bench [seconds per benchmark]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zbcrypt.h"
+
+/* The longest ZigBee NWK payload. */
+#define BENCH_MAX_PAYLOAD	110
+
+static double bench_seconds = 0.2;
+
+static double
+now(void)
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *name, int payload, int mic, long ops, double elapsed)
+{
+	double				ns = elapsed * 1e9 / ops;
+
+	printf("{\"name\": \"%s\", \"impl\": \"%s\", \"payload\": %d, \"mic\": %d, "
+		   "\"ops\": %ld, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f}\n",
+		   name, zbee_crypt_impl(), payload, mic, ops, ns,
+		   payload > 0 ? payload * 1e3 / ns : 0.0);
+}
+
+/*
+ * Runs body in batches until bench_seconds have passed, then reports the
+ * time per run. body must not be optimized away, so every benchmark
+ * below feeds its output back into its input.
+ */
+#define BENCH(name, payload, mic, body) do {							\
+	long				_ops = 0, _i;									\
+	double				_start = now(), _elapsed;						\
+	do {																\
+		for (_i = 0; _i < 1000; _i++) {									\
+			body;														\
+		}																\
+		_ops += 1000;													\
+		_elapsed = now() - _start;										\
+	} while (_elapsed < bench_seconds);									\
+	report(name, payload, mic, _ops, _elapsed);							\
+} while (0)
+
+int
+main(int argc, char *argv[])
+{
+	static const int	mic_lens[] = {0, 4, 8, 16};
+	static const int	payloads[] = {0, 16, 32, 64, BENCH_MAX_PAYLOAD};
+	char				key[ZBEE_SEC_CONST_KEYSIZE];
+	char				nonce[ZBEE_SEC_CONST_NONCE_LEN];
+	char				a[32];
+	char				m[BENCH_MAX_PAYLOAD], c[BENCH_MAX_PAYLOAD];
+	char				mic[ZBEE_SEC_CONST_MICSIZE];
+	char				hash[ZBEE_SEC_CONST_BLOCKSIZE];
+	char				frame[128];
+	zbee_cipher			cipher;
+	zbee_sec_frame		f;
+	int					i, j, p, n, frame_len;
+
+	if (argc > 1) {
+		bench_seconds = atof(argv[1]);
+	}
+	if (zbee_crypt_init()) {
+		fprintf(stderr, "Could not initialize the crypto backend.\n");
+		return 1;
+	}
+	for (i = 0; i < (int)sizeof(key); i++) {
+		key[i] = (char)(0x40 + i);
+	}
+	memset(nonce, 0x11, sizeof(nonce));
+	memset(a, 0x22, sizeof(a));
+	memset(m, 0x33, sizeof(m));
+	memset(c, 0, sizeof(c));
+	if (zbee_ccm_open(&cipher, key)) {
+		fprintf(stderr, "Could not set up the cipher.\n");
+		return 1;
+	}
+
+	BENCH("setkey", 0, 0, (zbee_cipher_setkey(&cipher, key), key[0] ^= c[0]));
+	zbee_cipher_setkey(&cipher, key);
+
+	for (i = 0; i < (int)(sizeof(payloads) / sizeof(payloads[0])); i++) {
+		p = payloads[i];
+		for (j = 0; j < (int)(sizeof(mic_lens) / sizeof(mic_lens[0])); j++) {
+			n = mic_lens[j];
+			BENCH("ccm_encrypt", p, n,
+				  (zbee_ccm_encrypt(&cipher, nonce, n, m, p, a, 20, c, mic), nonce[0] ^= mic[0]));
+			BENCH("ccm_decrypt", p, n,
+				  (zbee_ccm_decrypt(&cipher, nonce, mic, n, c, p, a, 20, m), nonce[1] ^= m[0]));
+		}
+	}
+
+	BENCH("sec_key_hash", 0, 0, (zbee_sec_key_hash(key, 0x02, hash), key[0] ^= hash[0]));
+	BENCH("sec_hash", 18, 0, (zbee_sec_hash(m, 18, hash), m[0] ^= hash[0]));
+
+	/* A NWK-secured data frame as captured, with a 40-byte payload. */
+	memcpy(frame, "\x41\x88\x01\x34\x12\x00\x00\x01\x00", 9);
+	memcpy(frame + 9, "\x08\x02\x00\x00\x01\x00\x1e\x01", 8);
+	memcpy(frame + 17, "\x28\x01\x00\x00\x00\x01\x02\x03\x04\x05\x06\x07\x08\x00", 14);
+	frame_len = 31 + 40 + 4;
+	memset(frame + 31, 0x44, 44);
+	if (zbee_sec_frame_parse(frame, frame_len, &f)) {
+		fprintf(stderr, "Benchmark frame did not parse.\n");
+		return 1;
+	}
+	BENCH("nwk_frame_parse", 40, 4, (zbee_sec_frame_parse(frame, frame_len, &f), frame[40] ^= (char)f.payload));
+	BENCH("nwk_frame_decrypt", 40, 4, (zbee_sec_frame_decrypt(&cipher, frame, &f, NULL, m), frame[40] ^= m[0]));
+	BENCH("dot154_fcs", frame_len, 0, (zbee_dot154_fcs(frame, frame_len, hash), frame[40] ^= hash[0]));
+
+	zbee_cipher_close(&cipher);
+	return 0;
+}
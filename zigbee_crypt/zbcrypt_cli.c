@@ -0,0 +1,219 @@
+/*
+ * zbcrypt_cli.c
+ * zbcrypt, decrypts the NWK or APS-secured ZigBee frames of an IEEE 802.15.4
+ * pcap with a known key, using libzbcrypt and no Python.
+ *
+ * Frames that decrypt with a matching MIC are written with the security
+ * header and MIC removed and the NWK or APS security flag cleared, so they can be
+ * read as plaintext ZigBee. Every other frame is copied unchanged. As with
+ * kbdecrypt(), the security level is taken to be ENC-MIC-32 whatever the
+ * frame claims, as receivers overwrite it with the network's level.
+ *
+ * Usage: zbcrypt -k <key> -r <in.pcap> -w <out.pcap> [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "zbcrypt.h"
+
+#define PCAP_MAGIC				0xa1b2c3d4
+#define PCAP_MAGIC_NSEC			0xa1b23c4d
+#define PCAP_GLOBAL_HDR_LEN		24
+#define PCAP_RECORD_HDR_LEN		16
+#define PCAP_MAX_FRAME			65535
+
+#define DLT_IEEE802_15_4		195	/* 802.15.4 with FCS */
+#define DLT_IEEE802_15_4_NOFCS	230	/* 802.15.4 without FCS */
+
+static int verbose = 0;
+
+static uint32_t
+get32(const unsigned char *p, int swapped)
+{
+	if (swapped) {
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+	return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static void
+put32(unsigned char *p, uint32_t v, int swapped)
+{
+	int					i;
+
+	for (i = 0; i < 4; i++) {
+		p[swapped ? 3 - i : i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+/*
+ * Decrypts the NWK or APS payload of frame (without FCS) into out. Returns
+ * the length of the decrypted frame, 0 if the frame is not secured or can
+ * not be decrypted, and -1 if the MIC did not match.
+ */
+static int
+zbcrypt_frame(zbee_cipher *cipher, const unsigned char *frame, int len, unsigned char *out)
+{
+	zbee_sec_frame		f;
+	int					rc;
+
+	if (zbee_sec_frame_parse((const char *)frame, len, &f)) {
+		return 0;
+	}
+	/* Plaintext frame: the headers up to the security header, then the
+	 * payload, which is decrypted into place right behind them. */
+	rc = zbee_sec_frame_decrypt(cipher, (const char *)frame, &f, NULL, (char *)out + f.aux);
+	if (rc != 1) {
+		return (rc == 0) ? -1 : 0;
+	}
+	memcpy(out, frame, f.aux);
+	if (f.aps) {
+		out[f.hdr] &= (unsigned char)~ZBEE_APS_FCF_SECURITY;
+	} else {
+		out[f.hdr + 1] &= (unsigned char)~(ZBEE_NWK_FCF_SECURITY >> 8);
+	}
+	return f.aux + f.payload_len;
+}
+
+static int
+parse_key(const char *hex, char *key)
+{
+	unsigned int		b;
+	int					i;
+
+	if (strlen(hex) != 2 * ZBEE_SEC_CONST_KEYSIZE) {
+		return -1;
+	}
+	for (i = 0; i < ZBEE_SEC_CONST_KEYSIZE; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &b) != 1) {
+			return -1;
+		}
+		key[i] = (char)b;
+	}
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -k <key> -r <in.pcap> -w <out.pcap> [-v]\n"
+			"  -k  network or link key as 32 hex digits\n"
+			"  -r  IEEE 802.15.4 pcap to decrypt\n"
+			"  -w  pcap to write\n"
+			"  -v  print every decrypted frame\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static unsigned char	frame[PCAP_MAX_FRAME + 2], out[PCAP_MAX_FRAME + 2];
+	unsigned char		ghdr[PCAP_GLOBAL_HDR_LEN], rhdr[PCAP_RECORD_HDR_LEN];
+	const char			*inname = NULL, *outname = NULL, *keyhex = NULL;
+	char				key[ZBEE_SEC_CONST_KEYSIZE];
+	FILE				*in, *outf;
+	zbee_cipher			cipher;
+	uint32_t			magic, linktype, caplen;
+	unsigned long		frames = 0, decrypted = 0, failed = 0;
+	int					swapped, fcs, len, n, i, opt;
+
+	while ((opt = getopt(argc, argv, "k:r:w:vh")) != -1) {
+		switch (opt) {
+		case 'k': keyhex = optarg; break;
+		case 'r': inname = optarg; break;
+		case 'w': outname = optarg; break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]); return 2;
+		}
+	}
+	if (keyhex == NULL || inname == NULL || outname == NULL) {
+		usage(argv[0]);
+		return 2;
+	}
+	if (parse_key(keyhex, key)) {
+		fprintf(stderr, "Invalid key, must be 32 hex digits.\n");
+		return 2;
+	}
+	if (zbee_crypt_init() || zbee_ccm_open(&cipher, key)) {
+		fprintf(stderr, "Could not set up the cipher.\n");
+		return 1;
+	}
+
+	in = fopen(inname, "rb");
+	if (in == NULL) {
+		perror(inname);
+		return 1;
+	}
+	if (fread(ghdr, 1, sizeof(ghdr), in) != sizeof(ghdr)) {
+		fprintf(stderr, "%s: not a pcap file.\n", inname);
+		return 1;
+	}
+	magic = get32(ghdr, 0);
+	if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC) {
+		swapped = 0;
+	} else if (get32(ghdr, 1) == PCAP_MAGIC || get32(ghdr, 1) == PCAP_MAGIC_NSEC) {
+		swapped = 1;
+	} else {
+		fprintf(stderr, "%s: not a pcap file.\n", inname);
+		return 1;
+	}
+	linktype = get32(ghdr + 20, swapped);
+	if (linktype != DLT_IEEE802_15_4 && linktype != DLT_IEEE802_15_4_NOFCS) {
+		fprintf(stderr, "%s: unsupported link type %u, expected IEEE 802.15.4.\n", inname, linktype);
+		return 1;
+	}
+	fcs = (linktype == DLT_IEEE802_15_4) ? 2 : 0;
+
+	outf = fopen(outname, "wb");
+	if (outf == NULL) {
+		perror(outname);
+		return 1;
+	}
+	fwrite(ghdr, 1, sizeof(ghdr), outf);
+
+	while (fread(rhdr, 1, sizeof(rhdr), in) == sizeof(rhdr)) {
+		caplen = get32(rhdr + 8, swapped);
+		if (caplen > PCAP_MAX_FRAME || fread(frame, 1, caplen, in) != caplen) {
+			fprintf(stderr, "%s: truncated or corrupt record.\n", inname);
+			break;
+		}
+		frames++;
+		len = (int)caplen;
+		n = (len >= fcs) ? zbcrypt_frame(&cipher, frame, len - fcs, out) : 0;
+		if (n > 0) {
+			decrypted++;
+			if (fcs) {
+				zbee_dot154_fcs((const char *)out, n, (char *)out + n);
+			}
+			if (verbose) {
+				printf("%lu:", frames);
+				for (i = 0; i < n; i++) {
+					printf(" %02x", out[i]);
+				}
+				printf("\n");
+			}
+			/* The frame only shrinks, so the original length shrinks with it. */
+			put32(rhdr + 12, get32(rhdr + 12, swapped) - (caplen - (uint32_t)(n + fcs)), swapped);
+			put32(rhdr + 8, (uint32_t)(n + fcs), swapped);
+			fwrite(rhdr, 1, sizeof(rhdr), outf);
+			fwrite(out, 1, n + fcs, outf);
+		} else {
+			if (n < 0) {
+				failed++;
+			}
+			fwrite(rhdr, 1, sizeof(rhdr), outf);
+			fwrite(frame, 1, caplen, outf);
+		}
+	}
+
+	fclose(in);
+	if (fclose(outf)) {
+		perror(outname);
+		return 1;
+	}
+	zbee_cipher_close(&cipher);
+	fprintf(stderr, "%lu frames, %lu decrypted, %lu with a MIC mismatch.\n", frames, decrypted, failed);
+	return 0;
+}
@@ -0,0 +1,641 @@
+/*
+ * zbee_aes.c
+ * In-tree AES-128 block cipher used by zigbee_crypt.
+ *
+ * The portable implementation never indexes memory with secret data. The
+ * S-box is evaluated as a boolean circuit (Boyar and Peralta) on the state
+ * transposed into bit planes, and the state stays in that form through
+ * ShiftRows and MixColumns until the end of the block. The AES-NI
+ * implementation is compiled with a per-function target attribute, so the
+ * module itself needs no special compiler flags and still loads on CPUs
+ * without AES-NI.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "zbee_aes.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ZBEE_AES_HAVE_NI	1
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define ZBEE_AESNI			__attribute__((target("aes,sse2")))
+#endif
+
+/* Set by zbee_aes_init() when the CPU has the AES-NI instructions. */
+static int zbee_aes_use_ni = 0;
+
+/*
+ * Transposes an 8x8 bit matrix held in x, where bit 8*r + c is row r,
+ * column c (Hacker's Delight, 7-3).
+ */
+static uint64_t
+zbee_aes_transpose8(uint64_t x)
+{
+	uint64_t			t;
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x = x ^ t ^ (t << 28);
+	return x;
+}
+
+/*
+ * The AES S-box as a boolean circuit over bit planes, q[i] holds bit i of
+ * every byte being substituted.
+ */
+static void
+zbee_aes_sbox_bitslice(uint32_t *q)
+{
+	uint32_t			x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t			y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	uint32_t			y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	uint32_t			y20, y21;
+	uint32_t			z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	uint32_t			z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t			t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	uint32_t			t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint32_t			t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	uint32_t			t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint32_t			t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	uint32_t			t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint32_t			t60, t61, t62, t63, t64, t65, t66, t67;
+	uint32_t			s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* Top linear transformation. */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* Non-linear section. */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* Bottom linear transformation. */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/*
+ * Transposes a 16-byte state into bit planes, bit j of q[i] is bit i of
+ * byte j. Only the low half of each plane is used, the high half can hold
+ * a second block (see zbee_aes_portable_encrypt2()).
+ */
+static void
+zbee_aes_to_planes(const unsigned char *s, uint32_t *q)
+{
+	uint64_t			lo = 0, hi = 0;
+	int					i;
+
+	for (i = 0; i < 8; i++) {
+		lo |= (uint64_t)s[i] << (8 * i);
+		hi |= (uint64_t)s[i + 8] << (8 * i);
+	}
+	lo = zbee_aes_transpose8(lo);
+	hi = zbee_aes_transpose8(hi);
+	for (i = 0; i < 8; i++) {
+		q[i] = (uint32_t)((lo >> (8 * i)) & 0xff) | (uint32_t)(((hi >> (8 * i)) & 0xff) << 8);
+	}
+}
+
+/* Inverse of zbee_aes_to_planes(). */
+static void
+zbee_aes_from_planes(const uint32_t *q, unsigned char *s)
+{
+	uint64_t			lo = 0, hi = 0;
+	int					i;
+
+	for (i = 0; i < 8; i++) {
+		lo |= (uint64_t)(q[i] & 0xff) << (8 * i);
+		hi |= (uint64_t)((q[i] >> 8) & 0xff) << (8 * i);
+	}
+	lo = zbee_aes_transpose8(lo);
+	hi = zbee_aes_transpose8(hi);
+	for (i = 0; i < 8; i++) {
+		s[i] = (unsigned char)(lo >> (8 * i));
+		s[i + 8] = (unsigned char)(hi >> (8 * i));
+	}
+}
+
+/*
+ * ShiftRows on bit planes. Byte 4*c + r is row r of column c, so row r
+ * rotates by 4*r bit positions, within each half of the plane.
+ */
+#define ZBEE_AES_SHIFT_ROWS16(x) \
+	(((x) & 0x1111) | (((x) >> 4) & 0x2222) | (((x) >> 8) & 0x4444) | (((x) >> 12) & 0x8888))
+
+static void
+zbee_aes_shift_rows(uint32_t *q)
+{
+	uint32_t			lo, hi;
+	int					i;
+
+	for (i = 0; i < 8; i++) {
+		lo = q[i] & 0xffff;
+		hi = q[i] >> 16;
+		lo |= lo << 16;
+		hi |= hi << 16;
+		q[i] = ZBEE_AES_SHIFT_ROWS16(lo) | (ZBEE_AES_SHIFT_ROWS16(hi) << 16);
+	}
+}
+
+/* Moves row r + n of every column to row r, on one bit plane. */
+#define ZBEE_AES_ROT1(x)	((((x) >> 1) & 0x77777777) | (((x) << 3) & 0x88888888))
+#define ZBEE_AES_ROT2(x)	((((x) >> 2) & 0x33333333) | (((x) << 2) & 0xcccccccc))
+#define ZBEE_AES_ROT3(x)	((((x) >> 3) & 0x11111111) | (((x) << 1) & 0xeeeeeeee))
+
+/*
+ * MixColumns on bit planes, out = 2 * (a ^ a1) ^ a1 ^ a2 ^ a3 where an is
+ * the column rotated by n rows. Multiplying by 2 shifts the planes up by
+ * one and folds the top plane back in as 0x1b.
+ */
+static void
+zbee_aes_mix_columns(uint32_t *q)
+{
+	uint32_t			b[8], r[8];
+	int					i;
+
+	for (i = 0; i < 8; i++) {
+		r[i] = ZBEE_AES_ROT1(q[i]);
+		b[i] = q[i] ^ r[i];
+		r[i] ^= ZBEE_AES_ROT2(q[i]) ^ ZBEE_AES_ROT3(q[i]);
+	}
+	q[0] = b[7] ^ r[0];
+	q[1] = b[0] ^ b[7] ^ r[1];
+	q[2] = b[1] ^ r[2];
+	q[3] = b[2] ^ b[7] ^ r[3];
+	q[4] = b[3] ^ b[7] ^ r[4];
+	q[5] = b[4] ^ r[5];
+	q[6] = b[5] ^ r[6];
+	q[7] = b[6] ^ r[7];
+}
+
+static void
+zbee_aes_portable_setkey(zbee_aes_key *key, const unsigned char *k)
+{
+	unsigned char		tmp[ZBEE_AES_BLOCKSIZE];
+	uint32_t			q[8];
+	unsigned char		*rk = key->rk;
+	unsigned char		rcon = 0x01;
+	int					i, j;
+
+	memcpy(rk, k, ZBEE_AES_KEYSIZE);
+	memset(tmp, 0, sizeof(tmp));
+	for (i = 4; i < 4 * (ZBEE_AES_ROUNDS + 1); i++) {
+		for (j = 0; j < 4; j++) {
+			tmp[j] = rk[4 * (i - 1) + j];
+		}
+		if ((i % 4) == 0) {
+			/* RotWord, SubWord and the round constant. */
+			tmp[4] = tmp[0];
+			for (j = 0; j < 4; j++) {
+				tmp[j] = tmp[j + 1];
+			}
+			zbee_aes_to_planes(tmp, q);
+			zbee_aes_sbox_bitslice(q);
+			zbee_aes_from_planes(q, tmp);
+			tmp[0] ^= rcon;
+			rcon = (unsigned char)((rcon << 1) ^ ((rcon >> 7) * 0x1b));
+		}
+		for (j = 0; j < 4; j++) {
+			rk[4 * i + j] = rk[4 * (i - 4) + j] ^ tmp[j];
+		}
+	}
+	/* The portable cipher adds the round keys as bit planes. */
+	for (i = 0; i <= ZBEE_AES_ROUNDS; i++) {
+		zbee_aes_to_planes(rk + i * ZBEE_AES_BLOCKSIZE, key->sk + 8 * i);
+	}
+}
+
+static void
+zbee_aes_portable_encrypt(const zbee_aes_key *key, const unsigned char *in, unsigned char *out)
+{
+	uint32_t			q[8];
+	const uint32_t		*sk = key->sk;
+	int					i, r;
+
+	zbee_aes_to_planes(in, q);
+	for (i = 0; i < 8; i++) {
+		q[i] ^= sk[i];
+	}
+	for (r = 1; r <= ZBEE_AES_ROUNDS; r++) {
+		zbee_aes_sbox_bitslice(q);
+		zbee_aes_shift_rows(q);
+		if (r != ZBEE_AES_ROUNDS) {
+			zbee_aes_mix_columns(q);
+		}
+		sk += 8;
+		for (i = 0; i < 8; i++) {
+			q[i] ^= sk[i];
+		}
+	}
+	zbee_aes_from_planes(q, out);
+}
+
+/*
+ * Two blocks under one key. The second block rides in the unused high half
+ * of the bit planes, so it costs little more than one.
+ */
+static void
+zbee_aes_portable_encrypt2(const zbee_aes_key *key, const unsigned char *in, unsigned char *out)
+{
+	uint32_t			q[8], q2[8];
+	const uint32_t		*sk = key->sk;
+	int					i, r;
+
+	zbee_aes_to_planes(in, q);
+	zbee_aes_to_planes(in + ZBEE_AES_BLOCKSIZE, q2);
+	for (i = 0; i < 8; i++) {
+		q[i] |= q2[i] << 16;
+		q[i] ^= sk[i] | (sk[i] << 16);
+	}
+	for (r = 1; r <= ZBEE_AES_ROUNDS; r++) {
+		zbee_aes_sbox_bitslice(q);
+		zbee_aes_shift_rows(q);
+		if (r != ZBEE_AES_ROUNDS) {
+			zbee_aes_mix_columns(q);
+		}
+		sk += 8;
+		for (i = 0; i < 8; i++) {
+			q[i] ^= sk[i] | (sk[i] << 16);
+		}
+	}
+	for (i = 0; i < 8; i++) {
+		q2[i] = q[i] >> 16;
+	}
+	zbee_aes_from_planes(q, out);
+	zbee_aes_from_planes(q2, out + ZBEE_AES_BLOCKSIZE);
+}
+
+#ifdef ZBEE_AES_HAVE_NI
+static ZBEE_AESNI __m128i
+zbee_aesni_expand(__m128i rk, __m128i assist)
+{
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	rk = _mm_xor_si128(rk, _mm_slli_si128(rk, 4));
+	rk = _mm_xor_si128(rk, _mm_slli_si128(rk, 4));
+	rk = _mm_xor_si128(rk, _mm_slli_si128(rk, 4));
+	return _mm_xor_si128(rk, assist);
+}
+
+/* The round constant of aeskeygenassist must be an immediate. */
+#define ZBEE_AESNI_ROUND_KEY(i, rcon) \
+	rk = zbee_aesni_expand(rk, _mm_aeskeygenassist_si128(rk, rcon)); \
+	_mm_storeu_si128((__m128i *)(key->rk + (i) * ZBEE_AES_BLOCKSIZE), rk);
+
+static ZBEE_AESNI void
+zbee_aesni_setkey(zbee_aes_key *key, const unsigned char *k)
+{
+	__m128i				rk;
+
+	rk = _mm_loadu_si128((const __m128i *)k);
+	_mm_storeu_si128((__m128i *)key->rk, rk);
+	ZBEE_AESNI_ROUND_KEY(1, 0x01)
+	ZBEE_AESNI_ROUND_KEY(2, 0x02)
+	ZBEE_AESNI_ROUND_KEY(3, 0x04)
+	ZBEE_AESNI_ROUND_KEY(4, 0x08)
+	ZBEE_AESNI_ROUND_KEY(5, 0x10)
+	ZBEE_AESNI_ROUND_KEY(6, 0x20)
+	ZBEE_AESNI_ROUND_KEY(7, 0x40)
+	ZBEE_AESNI_ROUND_KEY(8, 0x80)
+	ZBEE_AESNI_ROUND_KEY(9, 0x1b)
+	ZBEE_AESNI_ROUND_KEY(10, 0x36)
+}
+
+static ZBEE_AESNI void
+zbee_aesni_encrypt(const zbee_aes_key *key, const unsigned char *in, unsigned char *out)
+{
+	const __m128i		*rk = (const __m128i *)key->rk;
+	__m128i				b;
+	int					r;
+
+	b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), _mm_loadu_si128(rk));
+	for (r = 1; r < ZBEE_AES_ROUNDS; r++) {
+		b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + r));
+	}
+	b = _mm_aesenclast_si128(b, _mm_loadu_si128(rk + ZBEE_AES_ROUNDS));
+	_mm_storeu_si128((__m128i *)out, b);
+}
+
+/* Two blocks under one key, with the rounds of the two interleaved. */
+static ZBEE_AESNI void
+zbee_aesni_encrypt2(const zbee_aes_key *key, const unsigned char *in, unsigned char *out)
+{
+	const __m128i		*rk = (const __m128i *)key->rk;
+	__m128i				k, b0, b1;
+	int					r;
+
+	k = _mm_loadu_si128(rk);
+	b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), k);
+	b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 1), k);
+	for (r = 1; r < ZBEE_AES_ROUNDS; r++) {
+		k = _mm_loadu_si128(rk + r);
+		b0 = _mm_aesenc_si128(b0, k);
+		b1 = _mm_aesenc_si128(b1, k);
+	}
+	k = _mm_loadu_si128(rk + ZBEE_AES_ROUNDS);
+	_mm_storeu_si128((__m128i *)out, _mm_aesenclast_si128(b0, k));
+	_mm_storeu_si128((__m128i *)out + 1, _mm_aesenclast_si128(b1, k));
+}
+
+/*
+ * Four blocks under four different keys. The rounds of the lanes are
+ * interleaved, so the latency of each aesenc is hidden behind the others.
+ */
+static ZBEE_AESNI void
+zbee_aesni_encrypt4(const zbee_aes_key *const *keys, const unsigned char *in, unsigned char *out)
+{
+	const __m128i		*k0 = (const __m128i *)keys[0]->rk;
+	const __m128i		*k1 = (const __m128i *)keys[1]->rk;
+	const __m128i		*k2 = (const __m128i *)keys[2]->rk;
+	const __m128i		*k3 = (const __m128i *)keys[3]->rk;
+	__m128i				b0, b1, b2, b3;
+	int					r;
+
+	b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), _mm_loadu_si128(k0));
+	b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 1), _mm_loadu_si128(k1));
+	b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 2), _mm_loadu_si128(k2));
+	b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 3), _mm_loadu_si128(k3));
+	for (r = 1; r < ZBEE_AES_ROUNDS; r++) {
+		b0 = _mm_aesenc_si128(b0, _mm_loadu_si128(k0 + r));
+		b1 = _mm_aesenc_si128(b1, _mm_loadu_si128(k1 + r));
+		b2 = _mm_aesenc_si128(b2, _mm_loadu_si128(k2 + r));
+		b3 = _mm_aesenc_si128(b3, _mm_loadu_si128(k3 + r));
+	}
+	_mm_storeu_si128((__m128i *)out, _mm_aesenclast_si128(b0, _mm_loadu_si128(k0 + ZBEE_AES_ROUNDS)));
+	_mm_storeu_si128((__m128i *)out + 1, _mm_aesenclast_si128(b1, _mm_loadu_si128(k1 + ZBEE_AES_ROUNDS)));
+	_mm_storeu_si128((__m128i *)out + 2, _mm_aesenclast_si128(b2, _mm_loadu_si128(k2 + ZBEE_AES_ROUNDS)));
+	_mm_storeu_si128((__m128i *)out + 3, _mm_aesenclast_si128(b3, _mm_loadu_si128(k3 + ZBEE_AES_ROUNDS)));
+}
+
+/* One round of the key schedule fused with the matching cipher round. */
+#define ZBEE_AESNI_MMO_ROUND(rcon) \
+	rk = zbee_aesni_expand(rk, _mm_aeskeygenassist_si128(rk, rcon)); \
+	b = _mm_aesenc_si128(b, rk);
+
+static ZBEE_AESNI void
+zbee_aesni_mmo(unsigned char *hash, const unsigned char *block)
+{
+	__m128i				rk, m, b;
+
+	rk = _mm_loadu_si128((const __m128i *)hash);
+	m = _mm_loadu_si128((const __m128i *)block);
+	b = _mm_xor_si128(m, rk);
+	ZBEE_AESNI_MMO_ROUND(0x01)
+	ZBEE_AESNI_MMO_ROUND(0x02)
+	ZBEE_AESNI_MMO_ROUND(0x04)
+	ZBEE_AESNI_MMO_ROUND(0x08)
+	ZBEE_AESNI_MMO_ROUND(0x10)
+	ZBEE_AESNI_MMO_ROUND(0x20)
+	ZBEE_AESNI_MMO_ROUND(0x40)
+	ZBEE_AESNI_MMO_ROUND(0x80)
+	ZBEE_AESNI_MMO_ROUND(0x1b)
+	rk = zbee_aesni_expand(rk, _mm_aeskeygenassist_si128(rk, 0x36));
+	b = _mm_aesenclast_si128(b, rk);
+	_mm_storeu_si128((__m128i *)hash, _mm_xor_si128(b, m));
+}
+#endif /* ZBEE_AES_HAVE_NI */
+
+static void
+zbee_aes_portable_mmo(unsigned char *hash, const unsigned char *block)
+{
+	zbee_aes_key		key;
+	int					i;
+
+	zbee_aes_portable_setkey(&key, hash);
+	zbee_aes_portable_encrypt(&key, block, hash);
+	for (i = 0; i < ZBEE_AES_BLOCKSIZE; i++) {
+		hash[i] ^= block[i];
+	}
+}
+
+/* Picks the implementation for this CPU, called once at module load. */
+void
+zbee_aes_init(void)
+{
+#ifdef ZBEE_AES_HAVE_NI
+	unsigned int		eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		zbee_aes_use_ni = ((ecx & bit_AES) != 0) && ((edx & bit_SSE2) != 0);
+	}
+#endif
+}
+
+/* Name of the implementation in use. */
+const char *
+zbee_aes_impl(void)
+{
+	return zbee_aes_use_ni ? "aesni" : "portable";
+}
+
+void
+zbee_aes_setkey(zbee_aes_key *key, const unsigned char *k)
+{
+#ifdef ZBEE_AES_HAVE_NI
+	if (zbee_aes_use_ni) {
+		zbee_aesni_setkey(key, k);
+		return;
+	}
+#endif
+	zbee_aes_portable_setkey(key, k);
+}
+
+void
+zbee_aes_encrypt(const zbee_aes_key *key, const unsigned char *in, unsigned char *out)
+{
+#ifdef ZBEE_AES_HAVE_NI
+	if (zbee_aes_use_ni) {
+		zbee_aesni_encrypt(key, in, out);
+		return;
+	}
+#endif
+	zbee_aes_portable_encrypt(key, in, out);
+}
+
+/*
+ * Encrypts two consecutive blocks of in under one key. For two independent
+ * streams, such as the CTR and CBC-MAC halves of CCM*, which then go
+ * through the cipher together.
+ */
+void
+zbee_aes_encrypt2(const zbee_aes_key *key, const unsigned char *in, unsigned char *out)
+{
+#ifdef ZBEE_AES_HAVE_NI
+	if (zbee_aes_use_ni) {
+		zbee_aesni_encrypt2(key, in, out);
+		return;
+	}
+#endif
+	zbee_aes_portable_encrypt2(key, in, out);
+}
+
+/*
+ * Encrypts n consecutive blocks of in, block i under keys[i]. With AES-NI
+ * groups of ZBEE_AES_LANES blocks are encrypted together.
+ */
+void
+zbee_aes_encrypt_lanes(const zbee_aes_key *const *keys, int n, const unsigned char *in, unsigned char *out)
+{
+	int					i = 0;
+
+#ifdef ZBEE_AES_HAVE_NI
+	if (zbee_aes_use_ni) {
+		for (; i + ZBEE_AES_LANES <= n; i += ZBEE_AES_LANES) {
+			zbee_aesni_encrypt4(keys + i, in + i * ZBEE_AES_BLOCKSIZE, out + i * ZBEE_AES_BLOCKSIZE);
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		zbee_aes_encrypt(keys[i], in + i * ZBEE_AES_BLOCKSIZE, out + i * ZBEE_AES_BLOCKSIZE);
+	}
+}
+
+/*
+ * One Matyas-Meyer-Oseas step, hash = E(hash, block) XOR block. The key
+ * changes every block, so with AES-NI the key schedule is expanded round by
+ * round alongside the cipher instead of being stored.
+ */
+void
+zbee_aes_mmo(unsigned char *hash, const unsigned char *block)
+{
+#ifdef ZBEE_AES_HAVE_NI
+	if (zbee_aes_use_ni) {
+		zbee_aesni_mmo(hash, block);
+		return;
+	}
+#endif
+	zbee_aes_portable_mmo(hash, block);
+}
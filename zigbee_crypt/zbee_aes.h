@@ -0,0 +1,38 @@
+/*
+ * zbee_aes.h
+ * In-tree AES-128 block cipher used by zigbee_crypt.
+ *
+ * Only the forward cipher is provided, CCM* and the Matyas-Meyer-Oseas
+ * hash never need to decrypt a block. On x86 CPUs with AES-NI the round
+ * instructions are used, otherwise a constant-time bitsliced implementation.
+ * The choice is made once at module load by zbee_aes_init().
+ */
+
+#ifndef ZBEE_AES_H
+#define ZBEE_AES_H
+
+#include <stdint.h>
+
+#define ZBEE_AES_BLOCKSIZE		16
+#define ZBEE_AES_KEYSIZE		16
+#define ZBEE_AES_ROUNDS			10
+#define ZBEE_AES_LANES			4
+
+/*
+ * Expanded AES-128 key. rk holds the round keys in FIPS-197 byte order, sk
+ * the same round keys as bit planes for the portable implementation.
+ */
+typedef struct {
+	unsigned char		rk[(ZBEE_AES_ROUNDS + 1) * ZBEE_AES_BLOCKSIZE];
+	uint32_t			sk[(ZBEE_AES_ROUNDS + 1) * 8];
+} zbee_aes_key;
+
+void zbee_aes_init(void);
+const char *zbee_aes_impl(void);
+void zbee_aes_setkey(zbee_aes_key *key, const unsigned char *k);
+void zbee_aes_encrypt(const zbee_aes_key *key, const unsigned char *in, unsigned char *out);
+void zbee_aes_encrypt2(const zbee_aes_key *key, const unsigned char *in, unsigned char *out);
+void zbee_aes_encrypt_lanes(const zbee_aes_key *const *keys, int n, const unsigned char *in, unsigned char *out);
+void zbee_aes_mmo(unsigned char *hash, const unsigned char *block);
+
+#endif /* ZBEE_AES_H */
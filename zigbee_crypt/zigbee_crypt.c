@@ -6,14 +6,22 @@
  * alot of this code was "borrowed" from wireshark
  * packet-zbee-security.c & pzcket-zbee-security.h
  * function: zbee_sec_ccm_decrypt
+ *
+ * The crypto itself now lives in libzbcrypt (zbcrypt.c), this file is the
+ * Python binding around it.
  */
 
 // Explaination of Python Build Values http://docs.python.org/c-api/arg.html#Py_BuildValue
 
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <structmember.h>
 #include <stdio.h>
-#include <gcrypt.h>
-#include "zigbee_crypt.h"
+#include "zbcrypt.h"
+
+#ifndef PYTHREAD_INVALID_THREAD_ID
+#define PYTHREAD_INVALID_THREAD_ID ((long)-1)
+#endif
 
 
 #if PY_MAJOR_VERSION >= 3
@@ -32,612 +40,2602 @@
         module = PyModule_Create(&moduledef);
     #define ZIGBEE_CRYPT_INIT PyMODINIT_FUNC PyInit_zigbee_crypt(void)
     #define ZIGBEE_CRYPT_INIT_CALL PyInit_zigbee_crypt();
+    #define ZIGBEE_MOD_ERROR_VAL NULL
 #else
     #define ZIGBEE_MOD_DEF \
         module = Py_InitModule("zigbee_crypt", zigbee_crypt_Methods);
     #define ZIGBEE_CRYPT_INIT void initzigbee_crypt(void)
     #define ZIGBEE_CRYPT_INIT_CALL initzigbee_crypt();
+    #define ZIGBEE_MOD_ERROR_VAL
 #endif
 
 
+/*
+ * Returns why a payload and additional data of these lengths can not be
+ * put through CCM*, or NULL if they can. Callers check this before the
+ * lengths are narrowed to int.
+ */
+static const char *
+zbee_ccm_length_error(Py_ssize_t m_len, Py_ssize_t a_len)
+{
+	if (m_len > ZBEE_SEC_CONST_MAX_PAYLOAD) {
+		return "payload too long (must be at most 0xffff bytes)";
+	}
+	if (a_len > ZBEE_SEC_CONST_MAX_AAD) {
+		return "additional data too long (must be less than 0xff00 bytes)";
+	}
+	return NULL;
+}
+
 static PyObject *zigbee_crypt_encrypt_ccm(PyObject *self, PyObject *args) {
 	// This was modeled after zigbee_crypt_decrypt_ccm in reverse
-	const char			*pZkey;
-	int					sizeZkey;
-	const char			*pNonce;
-	int					sizeNonce;
+	Py_buffer			zkey;
+	Py_buffer			nonce;
 	int					sizeMIC;
-	const char			*pUnencryptedData;
-	int					sizeUnencryptedData;
-	const char			*zigbeeData;
-	int					sizeZigbeeData;
-	int i, j;
-	PyObject			*res;
-
-	char				pMIC[ZBEE_SEC_CONST_MICSIZE];
+	Py_buffer			unencryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*pEncrypted = NULL;
 	char				pEncMIC[ZBEE_SEC_CONST_MICSIZE];
-	char				*pEncrypted;
-	char				cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
-	char				cipher_out[ZBEE_SEC_CONST_BLOCKSIZE];
+	char				*pOut;
+	const char			*err;
+	int					rc;
 	/* Cipher Instance. */
-	gcry_cipher_hd_t	cipher_hd;
+	zbee_cipher			cipher;
 
 #if PY_MAJOR_VERSION >= 3
-	if (!PyArg_ParseTuple(args, "y#y#iy#y#",
+	if (!PyArg_ParseTuple(args, "y*y*iy*y*",
 #else
-	if (!PyArg_ParseTuple(args, "s#s#is#s#",
+	if (!PyArg_ParseTuple(args, "s*s*is*s*",
 #endif
-								&pZkey, &sizeZkey,
-								&pNonce, &sizeNonce,
+								&zkey,
+								&nonce,
 								&sizeMIC,
-								&pUnencryptedData, &sizeUnencryptedData,
-								&zigbeeData, &sizeZigbeeData)) {
+								&unencryptedData,
+								&zigbeeData)) {
 								return NULL;
 	}
-	if (sizeZkey != ZBEE_SEC_CONST_KEYSIZE) {
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
 		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
-		return NULL;
+		goto out;
 	}
 
-	if (sizeNonce != ZBEE_SEC_CONST_NONCE_LEN) {
+	if (nonce.len != ZBEE_SEC_CONST_NONCE_LEN) {
 		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
-		return NULL;
+		goto out;
 	}
 
 	if ((sizeMIC != 0) && (sizeMIC != 4) && (sizeMIC != 8) && (sizeMIC != 16)) {
 		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be 0, 4, 8, or 16 bytes)");
-		return NULL;
+		goto out;
 	}
 
-	memset(pMIC, 0, ZBEE_SEC_CONST_MICSIZE);	// set both mics to 0
-	memset(pEncMIC, 0, ZBEE_SEC_CONST_MICSIZE);
+	err = zbee_ccm_length_error(unencryptedData.len, zigbeeData.len);
+	if (err != NULL) {
+		PyErr_SetString(PyExc_ValueError, err);
+		goto out;
+	}
 
-	pEncrypted = malloc(sizeUnencryptedData);
+	/* The payload is encrypted straight into the result object. */
+	pEncrypted = PyBytes_FromStringAndSize(NULL, unencryptedData.len);
 	if (pEncrypted == NULL) {
-		PyErr_SetString(PyExc_MemoryError, "could not allocate memory");
-		return NULL;
+		goto out;
 	}
+	pOut = PyBytes_AS_STRING(pEncrypted);
 
-	memset(pEncrypted, 0, sizeUnencryptedData);
-
-	/* Open the cipher in ECB mode. */
-	if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
-		PyErr_SetString(PyExc_Exception, "gcrypt open AES-128 ECB cipher failed");
-		free(pEncrypted);
-		return NULL;
-	}
-	/* Load the key. */
-	if (gcry_cipher_setkey(cipher_hd, pZkey, ZBEE_SEC_CONST_KEYSIZE)) {
-		PyErr_SetString(PyExc_Exception, "setting the key failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
-	}
-	/* Generate the first cipher block B0. */
-	cipher_in[0] = ZBEE_SEC_CCM_FLAG_M(sizeMIC) | ((sizeZigbeeData>0)?0x40:0x00) | ZBEE_SEC_CCM_FLAG_L;
-	memcpy(cipher_in + 1, pNonce, ZBEE_SEC_CONST_NONCE_LEN);
-	for (i = 0; i < ZBEE_SEC_CONST_L; i++) {
-		cipher_in[(ZBEE_SEC_CONST_BLOCKSIZE-1)-i] = (sizeUnencryptedData >> (8*i)) & 0xff;
-	}
-	/* Generate the first cipher block, X1 = E(Key, 0^128 XOR B0). */
-	if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-		PyErr_SetString(PyExc_Exception, "mic creation failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
-	}
-
-	j = 0;
-	if (sizeZigbeeData > 0) {
-		/* Process L(a) into the cipher block. */
-		cipher_in[j] = cipher_out[j] ^ ((sizeZigbeeData >> 8) & 0xff);
-		j++;
-		cipher_in[j] = cipher_out[j] ^ ((sizeZigbeeData >> 0) & 0xff);
-		j++;
-		/* Process a into the cipher block. */
-		for (i = 0; i < sizeZigbeeData; i++, j++) {
-			if ( j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-				/* Generate the next cipher block. */
-				if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-					PyErr_SetString(PyExc_Exception, "mic creation failed");
-					gcry_cipher_close(cipher_hd);
-					free(pEncrypted);
-					return NULL;
-				}
-				/* Reset j to point back to the start of the new cipher block. */
-				j = 0;
-			}
-			/* Cipher in = cipher_out ^ a */
-			cipher_in[j] = cipher_out[j] ^ zigbeeData[i];
-		} /* for */
-		/* Process padding into the cipher block. */
-		for (; j < ZBEE_SEC_CONST_BLOCKSIZE; j++)
-			cipher_in[j] = cipher_out[j];
-	}
-	/* Process m into the cipher block. */
-	for (i = 0; i < sizeUnencryptedData; i++, j++) {
-		if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-			/* Generate the next cipher block. */
-			if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-				PyErr_SetString(PyExc_Exception, "mic creation failed");
-				gcry_cipher_close(cipher_hd);
-				free(pEncrypted);
-				return NULL;
-			}
-			/* Reset j to point back to the start of the new cipher block. */
-			j = 0;
-		}
-		/* Cipher in = cipher out ^ m */
-		cipher_in[j] = cipher_out[j] ^ pUnencryptedData[i];
-	} /* for */
-	/* Padding. */
-	for (; j < ZBEE_SEC_CONST_BLOCKSIZE; j++) {
-		cipher_in[j] = cipher_out[j];
+	/*
+	 * The argument buffers are held until the end of the call, which also
+	 * keeps a bytearray from being resized, and the result object is not
+	 * visible to any other thread yet, so the cipher can run without the GIL.
+	 */
+	Py_BEGIN_ALLOW_THREADS
+	rc = zbee_ccm_open(&cipher, zkey.buf);
+	if (rc == 0) {
+		rc = zbee_ccm_encrypt(&cipher, nonce.buf, sizeMIC,
+							unencryptedData.buf, unencryptedData.len,
+							zigbeeData.buf, zigbeeData.len,
+							pOut, pEncMIC);
+		zbee_cipher_close(&cipher);
 	}
-	/* Generate the last cipher block, which will be the MIC tag. */
-	if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-		PyErr_SetString(PyExc_Exception, "mic creation failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
+	Py_END_ALLOW_THREADS
+	if (rc) {
+		PyErr_SetString(PyExc_Exception, "encryption of the payload failed");
+		Py_CLEAR(pEncrypted);
+		goto out;
 	}
 
-	gcry_cipher_close(cipher_hd);
-	memcpy(pMIC, cipher_out, sizeMIC);
+#if PY_MAJOR_VERSION >= 3
+	pEncrypted = Py_BuildValue("(Ny#)", pEncrypted, pEncMIC, (Py_ssize_t)sizeMIC);
+#else
+	pEncrypted = Py_BuildValue("(Ns#)", pEncrypted, pEncMIC, (Py_ssize_t)sizeMIC);
+#endif
+out:
+	PyBuffer_Release(&zkey);
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&unencryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return pEncrypted;
+};
 
-	/* Create the CCM* counter block A0 */
-	memset(cipher_in, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-	cipher_in[0] = ZBEE_SEC_CCM_FLAG_L;
-	memcpy(cipher_in + 1, pNonce, ZBEE_SEC_CONST_NONCE_LEN);
+/*
+ * Checks the arguments of a single frame decryption, and that out can take
+ * the decrypted payload. out may be the encrypted payload itself, but must
+ * not otherwise overlap the inputs, which are still read while it is written.
+ */
+static int
+zbee_ccm_check_decrypt_args(const Py_buffer *nonce, const Py_buffer *mic,
+                            const Py_buffer *c, const Py_buffer *a,
+                            const Py_buffer *out, Py_ssize_t mic_len)
+{
+	const char			*err;
 
-	if (pEncrypted == NULL) {
-		PyErr_SetString(PyExc_MemoryError, "could not allocate memory");
-		free(pEncrypted);
-		return NULL;
+	if (nonce->len != ZBEE_SEC_CONST_NONCE_LEN) {
+		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
+		return -1;
 	}
-	/*
-	 * The encryption/decryption process of CCM* works in CTR mode. Open a CTR
-	 * mode cipher for this phase. NOTE: The 'counter' part of the CCM* counter
-	 * block is the last two bytes, and is big-endian.
-	 */
-	if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CTR, 0)) {
-		PyErr_SetString(PyExc_Exception, "gcrypt open AES-128 CTR cipher failed");
-		free(pEncrypted);
-		return NULL;
+	if (mic_len < 0 && mic->len > ZBEE_SEC_CONST_MICSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be between 0 and 16)");
+		return -1;
 	}
-	/* Re-load the Key. */
-	if (gcry_cipher_setkey(cipher_hd, pZkey, ZBEE_SEC_CONST_KEYSIZE)) {
-		PyErr_SetString(PyExc_Exception, "setting the key failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
+	if (mic_len >= 0 && mic->len != mic_len) {
+		PyErr_Format(PyExc_ValueError, "incorrect mic size (context expects %zd bytes)", mic_len);
+		return -1;
 	}
-	/* Set the counter. */
-	if (gcry_cipher_setctr(cipher_hd, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-		PyErr_SetString(PyExc_Exception, "setting the counter failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
+	err = zbee_ccm_length_error(c->len, a->len);
+	if (err != NULL) {
+		PyErr_SetString(PyExc_ValueError, err);
+		return -1;
 	}
-	/* Encrypt/Decrypt the payload. */
-	if (gcry_cipher_encrypt(cipher_hd, pEncMIC, ZBEE_SEC_CONST_MICSIZE, pMIC, ZBEE_SEC_CONST_MICSIZE)) {
-		PyErr_SetString(PyExc_Exception, "encryption of the mic failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
+	if (out == NULL) {
+		return 0;
 	}
-	/* Encrypt/Decrypt the payload. */
-	if (gcry_cipher_encrypt(cipher_hd, pEncrypted, sizeUnencryptedData, pUnencryptedData, sizeUnencryptedData)) {
-		PyErr_SetString(PyExc_Exception, "encryption of the payload failed");
-		gcry_cipher_close(cipher_hd);
-		free(pEncrypted);
-		return NULL;
+	if (out->len < c->len) {
+		PyErr_Format(PyExc_ValueError, "output buffer too small (need %zd bytes)", c->len);
+		return -1;
 	}
-	/* Done with the CTR Cipher. */
-	gcry_cipher_close(cipher_hd);
+#define ZBEE_OVERLAPS(x, y) \
+	((x)->len > 0 && (y)->len > 0 && \
+	 (const char *)(x)->buf < (const char *)(y)->buf + (y)->len && \
+	 (const char *)(y)->buf < (const char *)(x)->buf + (x)->len)
+	if (ZBEE_OVERLAPS(out, nonce) || ZBEE_OVERLAPS(out, a) ||
+		(ZBEE_OVERLAPS(out, c) && out->buf != c->buf)) {
+		PyErr_SetString(PyExc_ValueError, "output buffer overlaps the input");
+		return -1;
+	}
+#undef ZBEE_OVERLAPS
+	return 0;
+}
+
+static PyObject *zigbee_crypt_decrypt_ccm(PyObject *self, PyObject *args) {
+	Py_buffer			zkey;
+	Py_buffer			nonce;
+	Py_buffer			oldMIC;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*pUnencrypted = NULL;
+	char				*pOut;
+	int					micCheck;
+	/* Cipher Instance. */
+	zbee_cipher			cipher;
 
 #if PY_MAJOR_VERSION >= 3
-	res = Py_BuildValue("(y#y#)", pEncrypted, sizeUnencryptedData, pEncMIC, sizeMIC);
+	if (!PyArg_ParseTuple(args, "y*y*y*y*y*",
 #else
-	res = Py_BuildValue("(s#s#)", pEncrypted, sizeUnencryptedData, pEncMIC, sizeMIC);
+	if (!PyArg_ParseTuple(args, "s*s*s*s*s*",
 #endif
-	free(pEncrypted);
-	return res;
+								&zkey,
+								&nonce,
+								&oldMIC,
+								&encryptedData,
+								&zigbeeData)) {
+								return NULL;
+	}
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+		goto out;
+	}
+	if (zbee_ccm_check_decrypt_args(&nonce, &oldMIC, &encryptedData, &zigbeeData, NULL, -1)) {
+		goto out;
+	}
+
+	/* The payload is decrypted straight into the result object. */
+	pUnencrypted = PyBytes_FromStringAndSize(NULL, encryptedData.len);
+	if (pUnencrypted == NULL) {
+		goto out;
+	}
+	pOut = PyBytes_AS_STRING(pUnencrypted);
+
+	Py_BEGIN_ALLOW_THREADS
+	micCheck = -1;
+	if (zbee_ccm_open(&cipher, zkey.buf) == 0) {
+		micCheck = zbee_ccm_decrypt(&cipher, nonce.buf, oldMIC.buf, oldMIC.len,
+									encryptedData.buf, encryptedData.len,
+									zigbeeData.buf, zigbeeData.len,
+									pOut);
+		zbee_cipher_close(&cipher);
+	}
+	Py_END_ALLOW_THREADS
+	if (micCheck < 0) {
+		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
+		Py_CLEAR(pUnencrypted);
+		goto out;
+	}
+
+	pUnencrypted = Py_BuildValue("(Ni)", pUnencrypted, micCheck);
+out:
+	PyBuffer_Release(&zkey);
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&oldMIC);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return pUnencrypted;
 };
 
-static PyObject *zigbee_crypt_decrypt_ccm(PyObject *self, PyObject *args) {
-	const char			*pZkey;
-	int					sizeZkey;
-	const char			*pNonce;
-	int					sizeNonce;
-	const char			*pOldMIC;
-	int					sizeMIC;
-	const char			*pEncryptedData;
-	int					sizeEncryptedData;
-	const char			*zigbeeData;
-	int					sizeZigbeeData;
-	PyObject			*res;
+static PyObject *zigbee_crypt_decrypt_ccm_into(PyObject *self, PyObject *args) {
+	Py_buffer			outBuffer;
+	Py_buffer			zkey;
+	Py_buffer			nonce;
+	Py_buffer			oldMIC;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*res = NULL;
+	int					micCheck;
+	/* Cipher Instance. */
+	zbee_cipher			cipher;
 
-	char				pMIC[ZBEE_SEC_CONST_MICSIZE];
-	char				pUnencMIC[ZBEE_SEC_CONST_MICSIZE];
-	char				*pUnencrypted;
-	char				cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
-	char				cipher_out[ZBEE_SEC_CONST_BLOCKSIZE];
 #if PY_MAJOR_VERSION >= 3
-	if (!PyArg_ParseTuple(args, "y#y#y#y#y#",
+	if (!PyArg_ParseTuple(args, "w*y*y*y*y*y*",
 #else
-	if (!PyArg_ParseTuple(args, "s#s#s#s#s#",
+	if (!PyArg_ParseTuple(args, "w*s*s*s*s*s*",
 #endif
-								&pZkey, &sizeZkey,
-								&pNonce, &sizeNonce,
-								&pOldMIC, &sizeMIC,
-								&pEncryptedData, &sizeEncryptedData,
-								&zigbeeData, &sizeZigbeeData)) {
+								&outBuffer,
+								&zkey,
+								&nonce,
+								&oldMIC,
+								&encryptedData,
+								&zigbeeData)) {
 								return NULL;
 	}
-	if (sizeZkey != ZBEE_SEC_CONST_KEYSIZE) {
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
 		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
-		return NULL;
+		goto out;
 	}
-
-	if (sizeNonce != ZBEE_SEC_CONST_NONCE_LEN) {
-		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
-		return NULL;
+	if (zbee_ccm_check_decrypt_args(&nonce, &oldMIC, &encryptedData, &zigbeeData, &outBuffer, -1)) {
+		goto out;
 	}
 
-	if (sizeMIC > 16) {
-		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be between 0 and 16)");
-		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	micCheck = -1;
+	if (zbee_ccm_open(&cipher, zkey.buf) == 0) {
+		micCheck = zbee_ccm_decrypt(&cipher, nonce.buf, oldMIC.buf, oldMIC.len,
+									encryptedData.buf, encryptedData.len,
+									zigbeeData.buf, zigbeeData.len,
+									outBuffer.buf);
+		zbee_cipher_close(&cipher);
+	}
+	Py_END_ALLOW_THREADS
+	if (micCheck < 0) {
+		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
+		goto out;
 	}
 
-	memset(pMIC, 0, ZBEE_SEC_CONST_MICSIZE);
-	memcpy(pMIC, pOldMIC, sizeMIC);
+	res = PyLong_FromLong(micCheck);
+out:
+	PyBuffer_Release(&outBuffer);
+	PyBuffer_Release(&zkey);
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&oldMIC);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return res;
+};
 
-	memset(pUnencMIC, 0, ZBEE_SEC_CONST_MICSIZE);
+/*
+ * Per-frame byte strings handed to the batch functions. Either a sequence of
+ * bytes-like objects, or one packed buffer which is split into records by an
+ * offsets sequence (count + 1 boundaries) or into fixed width records.
+ */
+typedef struct {
+	Py_buffer			*items;
+	Py_buffer			packed;
+	int					have_packed;
+	Py_ssize_t			*offsets;
+	Py_ssize_t			width;
+	Py_ssize_t			count;
+	const char			*name;
+} zbee_field_list;
 
-	pUnencrypted = malloc(sizeEncryptedData);
-	if (pUnencrypted == NULL) {
-		PyErr_SetString(PyExc_MemoryError, "could not allocate memory");
-		return NULL;
+static void
+zbee_field_list_release(zbee_field_list *fl)
+{
+	Py_ssize_t			i;
+
+	if (fl->items != NULL) {
+		for (i = 0; i < fl->count; i++) {
+			PyBuffer_Release(&fl->items[i]);
+		}
+		PyMem_Free(fl->items);
+		fl->items = NULL;
+	}
+	if (fl->have_packed) {
+		PyBuffer_Release(&fl->packed);
+		fl->have_packed = 0;
 	}
+	PyMem_Free(fl->offsets);
+	fl->offsets = NULL;
+}
 
-	memset(pUnencrypted, 0, sizeEncryptedData);
+/*
+ * Set up a field list. For packed buffers without offsets, width gives the
+ * record size; a width of 0 splits the buffer evenly into count records. A
+ * count of -1 means the number of records is taken from this field.
+ */
+static int
+zbee_field_list_init(zbee_field_list *fl, const char *name, PyObject *obj,
+                     PyObject *offsets, Py_ssize_t width, Py_ssize_t count)
+{
+	PyObject			*offseq;
+	PyObject			*seq;
+	Py_ssize_t			i, n;
 
-	/* Create the CCM* counter block A0 */
-	memset(cipher_in, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-	cipher_in[0] = ZBEE_SEC_CCM_FLAG_L;
-	memcpy(cipher_in + 1, pNonce, ZBEE_SEC_CONST_NONCE_LEN);
+	memset(fl, 0, sizeof(*fl));
+	fl->name = name;
 
-	/* Cipher Instance. */
-	gcry_cipher_hd_t	cipher_hd;
+	if (PyObject_CheckBuffer(obj)) {
+		if (PyObject_GetBuffer(obj, &fl->packed, PyBUF_SIMPLE) < 0) {
+			return -1;
+		}
+		fl->have_packed = 1;
+		if (offsets != NULL && offsets != Py_None) {
+			offseq = PySequence_Fast(offsets, "offsets must be a sequence of integers");
+			if (offseq == NULL) {
+				zbee_field_list_release(fl);
+				return -1;
+			}
+			fl->count = PySequence_Fast_GET_SIZE(offseq) - 1;
+			if (fl->count < 0) {
+				PyErr_Format(PyExc_ValueError, "%s offsets must contain at least one entry", name);
+				Py_DECREF(offseq);
+				zbee_field_list_release(fl);
+				return -1;
+			}
+			fl->offsets = PyMem_New(Py_ssize_t, fl->count + 1);
+			if (fl->offsets == NULL) {
+				PyErr_NoMemory();
+				Py_DECREF(offseq);
+				zbee_field_list_release(fl);
+				return -1;
+			}
+			for (i = 0; i <= fl->count; i++) {
+				fl->offsets[i] = PyLong_AsSsize_t(PySequence_Fast_GET_ITEM(offseq, i));
+				if (fl->offsets[i] == -1 && PyErr_Occurred()) {
+					Py_DECREF(offseq);
+					zbee_field_list_release(fl);
+					return -1;
+				}
+				if (fl->offsets[i] < (i ? fl->offsets[i-1] : 0) || fl->offsets[i] > fl->packed.len) {
+					PyErr_Format(PyExc_ValueError, "%s offsets must be increasing and within the buffer", name);
+					Py_DECREF(offseq);
+					zbee_field_list_release(fl);
+					return -1;
+				}
+			}
+			Py_DECREF(offseq);
+		} else {
+			if (width == 0 && count > 0) {
+				width = fl->packed.len / count;
+			}
+			if (count == 0 && fl->packed.len == 0) {
+				return 0;
+			}
+			if (width <= 0 || fl->packed.len % width != 0) {
+				PyErr_Format(PyExc_ValueError, "packed %s must be split with offsets or be a whole number of records", name);
+				zbee_field_list_release(fl);
+				return -1;
+			}
+			fl->width = width;
+			fl->count = fl->packed.len / width;
+		}
+	} else {
+		if (offsets != NULL && offsets != Py_None) {
+			PyErr_Format(PyExc_TypeError, "%s offsets given but %s is not a packed buffer", name, name);
+			return -1;
+		}
+		/*
+		 * Hold a buffer of every item, so the items stay alive and in place
+		 * while the cipher runs without the GIL, even if the caller's list
+		 * or a bytearray in it changes.
+		 */
+		seq = PySequence_Fast(obj, "expected a sequence or a buffer");
+		if (seq == NULL) {
+			return -1;
+		}
+		n = PySequence_Fast_GET_SIZE(seq);
+		fl->items = PyMem_New(Py_buffer, n ? n : 1);
+		if (fl->items == NULL) {
+			PyErr_NoMemory();
+			Py_DECREF(seq);
+			return -1;
+		}
+		for (i = 0; i < n; i++, fl->count++) {
+			if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i), &fl->items[i], PyBUF_SIMPLE) < 0) {
+				Py_DECREF(seq);
+				zbee_field_list_release(fl);
+				return -1;
+			}
+		}
+		Py_DECREF(seq);
+	}
 
-	/*
-	 * The encryption/decryption process of CCM* works in CTR mode. Open a CTR
-	 * mode cipher for this phase. NOTE: The 'counter' part of the CCM* counter
-	 * block is the last two bytes, and is big-endian.
-	 */
-	if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CTR, 0)) {
-		PyErr_SetString(PyExc_Exception, "gcrypt open AES-128 CTR cipher failed");
-		free(pUnencrypted);
-		return NULL;
+	if (count >= 0 && fl->count != count) {
+		PyErr_Format(PyExc_ValueError, "expected %zd %s, got %zd", count, name, fl->count);
+		zbee_field_list_release(fl);
+		return -1;
 	}
-	/* Set the Key. */
-	if (gcry_cipher_setkey(cipher_hd, pZkey, ZBEE_SEC_CONST_KEYSIZE)) {
-		PyErr_SetString(PyExc_Exception, "setting the key failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
-		return NULL;
+	return 0;
+}
+
+static int
+zbee_field_list_get(zbee_field_list *fl, Py_ssize_t i, const char **p, Py_ssize_t *len)
+{
+	if (fl->items != NULL) {
+		*p = (const char *)fl->items[i].buf;
+		*len = fl->items[i].len;
+	} else if (fl->offsets != NULL) {
+		*p = (const char *)fl->packed.buf + fl->offsets[i];
+		*len = fl->offsets[i+1] - fl->offsets[i];
+	} else {
+		*p = (const char *)fl->packed.buf + i * fl->width;
+		*len = fl->width;
 	}
-	/* Set the counter. */
-	if (gcry_cipher_setctr(cipher_hd, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-		PyErr_SetString(PyExc_Exception, "setting the counter failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
-		return NULL;
+	return 0;
+}
+
+/*
+ * CCMContext: a CCM* cipher with the key schedule expanded once, for callers
+ * which encrypt or decrypt many frames with the same key (e.g. all NWK frames
+ * of a capture under the network key).
+ *
+ * The cipher runs without the GIL. A libgcrypt handle must not be used by two
+ * threads at once and re-keying replaces the key schedule, so the cipher is
+ * guarded by a per-context lock; threads which want to run in parallel
+ * should each use their own context.
+ */
+typedef struct {
+	PyObject_HEAD
+	zbee_cipher			cipher;
+	PyThread_type_lock	lock;
+	int					keyed;
+	int					mic_len;
+} zigbee_crypt_CCMContext;
+
+/* One frame of a batch, resolved while holding the GIL. */
+typedef struct {
+	const char			*nonce;
+	const char			*mic;
+	Py_ssize_t			mic_len;
+	const char			*in;
+	Py_ssize_t			in_len;
+	const char			*a;
+	Py_ssize_t			a_len;
+	PyObject			*out;
+	char				enc_mic[ZBEE_SEC_CONST_MICSIZE];
+	int					result;
+} zbee_ccm_frame;
+
+/*
+ * Runs CCM* over a resolved batch with the GIL released. If key is given a
+ * cipher is opened for the batch, otherwise the cipher of ctx is used while
+ * holding its lock. Returns non-zero if the cipher failed.
+ */
+static int
+zbee_ccm_run_many(const char *key, zigbee_crypt_CCMContext *ctx,
+                  zbee_ccm_frame *frames, Py_ssize_t count, int mic_len, int decrypt)
+{
+	zbee_cipher			own;
+	zbee_cipher			*cipher = &own;
+	Py_ssize_t			i;
+	int					opened = 0;
+	int					rc = 0;
+
+	Py_BEGIN_ALLOW_THREADS
+	if (key != NULL) {
+		rc = zbee_ccm_open(cipher, key);
+		opened = (rc == 0);
+	} else {
+		PyThread_acquire_lock(ctx->lock, WAIT_LOCK);
+		cipher = &ctx->cipher;
+		rc = !ctx->keyed;
 	}
-	/* Encrypt/Decrypt the payload. */
-	if (gcry_cipher_encrypt(cipher_hd, pUnencMIC, ZBEE_SEC_CONST_MICSIZE, pMIC, ZBEE_SEC_CONST_MICSIZE)) {
-		PyErr_SetString(PyExc_Exception, "decryption of the mic failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
-		return NULL;
+	for (i = 0; rc == 0 && i < count; i++) {
+		if (decrypt) {
+			frames[i].result = zbee_ccm_decrypt(cipher, frames[i].nonce,
+									frames[i].mic, frames[i].mic_len,
+									frames[i].in, frames[i].in_len,
+									frames[i].a, frames[i].a_len,
+									PyBytes_AS_STRING(frames[i].out));
+			rc = (frames[i].result < 0);
+		} else {
+			rc = zbee_ccm_encrypt(cipher, frames[i].nonce, mic_len,
+									frames[i].in, frames[i].in_len,
+									frames[i].a, frames[i].a_len,
+									PyBytes_AS_STRING(frames[i].out), frames[i].enc_mic);
+		}
 	}
-	/* Encrypt/Decrypt the payload. */
-	if (gcry_cipher_encrypt(cipher_hd, pUnencrypted, sizeEncryptedData, pEncryptedData, sizeEncryptedData)) {
-		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
-		return NULL;
+	if (opened) {
+		zbee_cipher_close(cipher);
+	} else if (key == NULL) {
+		PyThread_release_lock(ctx->lock);
 	}
-	/* Done with the CTR Cipher. */
-	gcry_cipher_close(cipher_hd);
+	Py_END_ALLOW_THREADS
+	return rc;
+}
 
-	int i, j;
-	/* Re-open the cipher in ECB mode. */
-	if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
-		PyErr_SetString(PyExc_Exception, "gcrypt open AES-128 ECB cipher failed");
-		free(pUnencrypted);
-		return NULL;
+static void
+zbee_ccm_free_frames(zbee_ccm_frame *frames, Py_ssize_t count)
+{
+	Py_ssize_t			i;
+
+	for (i = 0; i < count; i++) {
+		Py_XDECREF(frames[i].out);
 	}
-	/* Re-load the key. */
-	if (gcry_cipher_setkey(cipher_hd, pZkey, ZBEE_SEC_CONST_KEYSIZE)) {
-		PyErr_SetString(PyExc_Exception, "setting the key failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
+	PyMem_Free(frames);
+}
+
+/*
+ * Decrypt a batch of frames, either under key or with the cipher of ctx. A
+ * mic_len of -1 accepts MICs of any size up to 16 bytes, otherwise every MIC
+ * must be mic_len bytes. Returns a list of
+ * (decrypted_payload, mic_check) tuples.
+ */
+static PyObject *
+zbee_ccm_decrypt_many(const char *key, zigbee_crypt_CCMContext *ctx, int mic_len,
+                      PyObject *nonces, PyObject *mics, PyObject *payloads, PyObject *aads,
+                      PyObject *payload_offsets, PyObject *aad_offsets)
+{
+	zbee_field_list		f_payload, f_nonce, f_mic, f_aad;
+	zbee_ccm_frame		*frames = NULL;
+	Py_ssize_t			sizeNonce;
+	const char			*err;
+	PyObject			*res = NULL;
+	PyObject			*item;
+	Py_ssize_t			i, count = 0;
+
+	if (zbee_field_list_init(&f_payload, "payloads", payloads, payload_offsets, 0, -1)) {
 		return NULL;
 	}
-	/* Generate the first cipher block B0. */
-	cipher_in[0] = ZBEE_SEC_CCM_FLAG_M(sizeMIC) | ((sizeZigbeeData>0)?0x40:0x00) | ZBEE_SEC_CCM_FLAG_L;
-	memcpy(cipher_in + 1, pNonce, ZBEE_SEC_CONST_NONCE_LEN);
-	for (i = 0; i < ZBEE_SEC_CONST_L; i++) {
-		cipher_in[(ZBEE_SEC_CONST_BLOCKSIZE-1)-i] = (sizeEncryptedData >> (8*i)) & 0xff;
+	if (zbee_field_list_init(&f_nonce, "nonces", nonces, NULL, ZBEE_SEC_CONST_NONCE_LEN, f_payload.count)) {
+		goto out_payload;
 	}
-	/* Generate the first cipher block, X1 = E(Key, 0^128 XOR B0). */
-	if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-		PyErr_SetString(PyExc_Exception, "mic verification failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
-		return NULL;
+	if (zbee_field_list_init(&f_mic, "mics", mics, NULL, mic_len < 0 ? 0 : mic_len, f_payload.count)) {
+		goto out_nonce;
 	}
-	/*
-	 * We avoid mallocing() big chunks of memory by recycling small stack
-	 * buffers for the encryption process. Throughout this process, j is always
-	 * pointed to the position within the current buffer.
-	 */
-	j = 0;
-	/* AuthData = L(a) || a || Padding || m || Padding
-	 * Where L(a) =
-	 *	  - an empty string if l(a) == 0.
-	 *	  - 2-octet encoding of l(a) if 0 < l(a) < (2^16 - 2^8)
-	 *	  - 0xff || 0xfe || 4-octet encoding of l(a) if (2^16 - 2^8) <= l(a) < 2^32
-	 *	  - 0xff || 0xff || 8-octet encoding of l(a)
-	 * But for ZigBee, the largest packet size we should ever see is 2^7, so we
-	 * are only really concerned with the first two cases.
-	 *
-	 * To generate the MIC tag CCM* operates similar to CBC-MAC mode. Each block
-	 * of AuthData is XOR'd with the last block of cipher output to produce the
-	 * next block of cipher output. Padding sections have the minimum non-negative
-	 * length such that the padding ends on a block boundary. Padded bytes are 0.
-	 */
-	if (sizeZigbeeData > 0) {
-		/* Process L(a) into the cipher block. */
-		cipher_in[j] = cipher_out[j] ^ ((sizeZigbeeData >> 8) & 0xff);
-		j++;
-		cipher_in[j] = cipher_out[j] ^ ((sizeZigbeeData >> 0) & 0xff);
-		j++;
-		/* Process a into the cipher block. */
-		for (i = 0; i < sizeZigbeeData; i++, j++) {
-			if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-				/* Generate the next cipher block. */
-				if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-					PyErr_SetString(PyExc_Exception, "mic verification failed");
-					gcry_cipher_close(cipher_hd);
-					free(pUnencrypted);
-					return NULL;
-				}
-				/* Reset j to point back to the start of the new cipher block. */
-				j = 0;
-			}
-			/* Cipher in = cipher_out ^ a */
-			cipher_in[j] = cipher_out[j] ^ zigbeeData[i];
-		} /* for */
-		/* Process padding into the cipher block. */
-		for (; j<ZBEE_SEC_CONST_BLOCKSIZE; j++)
-			cipher_in[j] = cipher_out[j];
-	}
-	/* Process m into the cipher block. */
-	for (i = 0; i < sizeEncryptedData; i++, j++) {
-		if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-			/* Generate the next cipher block. */
-			if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-				PyErr_SetString(PyExc_Exception, "mic verification failed");
-				gcry_cipher_close(cipher_hd);
-				free(pUnencrypted);
-				return NULL;
-			}
-			/* Reset j to point back to the start of the new cipher block. */
-			j = 0;
-		}
-		/* Cipher in = cipher out ^ m */
-		cipher_in[j] = cipher_out[j] ^ pUnencrypted[i];
-	} /* for */
-	/* Padding. */
-	for (; j < ZBEE_SEC_CONST_BLOCKSIZE; j++) {
-		cipher_in[j] = cipher_out[j];
+	if (zbee_field_list_init(&f_aad, "aads", aads, aad_offsets, 0, f_payload.count)) {
+		goto out_mic;
 	}
-	/* Generate the last cipher block, which will be the MIC tag. */
-	if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-		PyErr_SetString(PyExc_Exception, "mic verification failed");
-		gcry_cipher_close(cipher_hd);
-		free(pUnencrypted);
-		return NULL;
+
+	frames = PyMem_New(zbee_ccm_frame, f_payload.count + 1);
+	if (frames == NULL) {
+		PyErr_NoMemory();
+		goto out_aad;
+	}
+	for (count = 0; count < f_payload.count; count++) {
+		i = count;
+		if (zbee_field_list_get(&f_nonce, i, &frames[i].nonce, &sizeNonce) ||
+			zbee_field_list_get(&f_mic, i, &frames[i].mic, &frames[i].mic_len) ||
+			zbee_field_list_get(&f_payload, i, &frames[i].in, &frames[i].in_len) ||
+			zbee_field_list_get(&f_aad, i, &frames[i].a, &frames[i].a_len)) {
+			goto out_frames;
+		}
+		if (sizeNonce != ZBEE_SEC_CONST_NONCE_LEN) {
+			PyErr_Format(PyExc_ValueError, "frame %zd: incorrect nonce size (must be 13)", i);
+			goto out_frames;
+		}
+		if ((mic_len < 0 && frames[i].mic_len > ZBEE_SEC_CONST_MICSIZE) ||
+			(mic_len >= 0 && frames[i].mic_len != mic_len)) {
+			PyErr_Format(PyExc_ValueError, "frame %zd: incorrect mic size", i);
+			goto out_frames;
+		}
+		err = zbee_ccm_length_error(frames[i].in_len, frames[i].a_len);
+		if (err != NULL) {
+			PyErr_Format(PyExc_ValueError, "frame %zd: %s", i, err);
+			goto out_frames;
+		}
+		frames[i].out = PyBytes_FromStringAndSize(NULL, frames[i].in_len);
+		if (frames[i].out == NULL) {
+			goto out_frames;
+		}
 	}
 
-	gcry_cipher_close(cipher_hd);
+	if (zbee_ccm_run_many(key, ctx, frames, count, mic_len, 1)) {
+		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
+		goto out_frames;
+	}
 
-	// now use j to indicate whether the MICs match
-	j = 0;
-	if (memcmp(cipher_out, pUnencMIC, sizeMIC) == 0) {
-		j = 1;
+	res = PyList_New(count);
+	if (res == NULL) {
+		goto out_frames;
 	}
-#if PY_MAJOR_VERSION >= 3
-	res = Py_BuildValue("(y#i)", pUnencrypted, sizeEncryptedData, j);
-#else
-	res = Py_BuildValue("(s#i)", pUnencrypted, sizeEncryptedData, j);
-#endif
-	free(pUnencrypted);
+	for (i = 0; i < count; i++) {
+		item = Py_BuildValue("(Ni)", frames[i].out, frames[i].result);
+		frames[i].out = NULL;
+		if (item == NULL) {
+			Py_CLEAR(res);
+			break;
+		}
+		PyList_SET_ITEM(res, i, item);
+	}
+
+out_frames:
+	zbee_ccm_free_frames(frames, count);
+out_aad:
+	zbee_field_list_release(&f_aad);
+out_mic:
+	zbee_field_list_release(&f_mic);
+out_nonce:
+	zbee_field_list_release(&f_nonce);
+out_payload:
+	zbee_field_list_release(&f_payload);
 	return res;
-};
+}
 
-/*FUNCTION:------------------------------------------------------
- *  NAME
- *      zbee_sec_hash
- *  DESCRIPTION
- *      ZigBee Cryptographic Hash Function, described in ZigBee
- *      specification sections B.1.3 and B.6.
- *
- *      This is a Matyas-Meyer-Oseas hash function using the AES-128
- *      cipher. We use the ECB mode of libgcrypt to get a raw block
- *      cipher.
- *
- *      Input may be any length, and the output must be exactly 1-block in length.
- *
- *      Implements the function:
- *          Hash(text) = Hash[t];
- *          Hash[0] = 0^(blocksize).
- *          Hash[i] = E(Hash[i-1], M[i]) XOR M[j];
- *          M[i] = i'th block of text, with some padding and flags concatenated.
- *  PARAMETERS
- *      char *    input       - Hash Input (any length).
- *      int       input_len   - Hash Input Length.
- *      char *    output      - Hash Output (exactly one block in length).
- *  RETURNS
- *      void
- *---------------------------------------------------------------
+/*
+ * Encrypt a batch of frames, either under key or with the cipher of ctx.
+ * Returns a list of (encrypted_payload, mic) tuples.
  */
-static void
-zbee_sec_hash(char *input, int input_len, char *output)
-{
-    char              cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
-    int               i, j;
-    /* Cipher Instance. */
-    gcry_cipher_hd_t    cipher_hd;
-
-    /* Clear the first hash block (Hash0). */
-    memset(output, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-    /* Create the cipher instance in ECB mode. */
-    if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
-        return; /* Failed. */
-    }
-    /* Create the subsequent hash blocks using the formula: Hash[i] = E(Hash[i-1], M[i]) XOR M[i]
-     *
-     * because we can't guarantee that M will be exactly a multiple of the
-     * block size, we will need to copy it into local buffers and pad it.
-     *
-     * Note that we check for the next cipher block at the end of the loop
-     * rather than the start. This is so that if the input happens to end
-     * on a block boundary, the next cipher block will be generated for the
-     * start of the padding to be placed into.
-     */
-    i = 0;
-    j = 0;
-    while (i<input_len) {
-        /* Copy data into the cipher input. */
-        cipher_in[j++] = input[i++];
-        /* Check if this cipher block is done. */
-        if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-            /* We have reached the end of this block. Process it with the
-             * cipher, note that the Key input to the cipher is actually
-             * the previous hash block, which we are keeping in output.
-             */
-            (void)gcry_cipher_setkey(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE);
-            (void)gcry_cipher_encrypt(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
-            /* Now we have to XOR the input into the hash block. */
-            for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
-            /* Reset j to start again at the beginning at the next block. */
-            j = 0;
-        }
-    } /* for */
-    /* Need to append the bit '1', followed by '0' padding long enough to end
-     * the hash input on a block boundary. However, because 'n' is 16, and 'l'
-     * will be a multiple of 8, the padding will be >= 7-bits, and we can just
-     * append the byte 0x80.
-     */
-    cipher_in[j++] = 0x80;
-    /* Pad with '0' until the the current block is exactly 'n' bits from the
-     * end.
-     */
-    while (j!=(ZBEE_SEC_CONST_BLOCKSIZE-2)) {
-        if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-            /* We have reached the end of this block. Process it with the
-             * cipher, note that the Key input to the cipher is actually
-             * the previous hash block, which we are keeping in output.
-             */
-            (void)gcry_cipher_setkey(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE);
-            (void)gcry_cipher_encrypt(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
-            /* Now we have to XOR the input into the hash block. */
-            for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
-            /* Reset j to start again at the beginning at the next block. */
-            j = 0;
-        }
-        /* Pad the input with 0. */
-        cipher_in[j++] = 0x00;
-    } /* while */
-    /* Add the 'n'-bit representation of 'l' to the end of the block. */
-    cipher_in[j++] = ((input_len * 8) >> 8) & 0xff;
-    cipher_in[j] = ((input_len * 8) >> 0) & 0xff;
-    /* Process the last cipher block. */
-    (void)gcry_cipher_setkey(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE);
-    (void)gcry_cipher_encrypt(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
-    /* XOR the last input block back into the cipher output to get the hash. */
-    for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
-    /* Cleanup the cipher. */
-    gcry_cipher_close(cipher_hd);
-    /* Done */
-} /* zbee_sec_hash */
+static PyObject *
+zbee_ccm_encrypt_many(const char *key, zigbee_crypt_CCMContext *ctx, int mic_len,
+                      PyObject *nonces, PyObject *payloads, PyObject *aads,
+                      PyObject *payload_offsets, PyObject *aad_offsets)
+{
+	zbee_field_list		f_payload, f_nonce, f_aad;
+	zbee_ccm_frame		*frames = NULL;
+	Py_ssize_t			sizeNonce;
+	const char			*err;
+	PyObject			*res = NULL;
+	PyObject			*item;
+	Py_ssize_t			i, count = 0;
 
-/*FUNCTION:------------------------------------------------------
- *  NAME
- *      zbee_sec_key_hash
- *  DESCRIPTION
- *      ZigBee Keyed Hash Function. Described in ZigBee specification
- *      section B.1.4, and in FIPS Publication 198. Strictly speaking
- *      there is nothing about the Keyed Hash Function which restricts
- *      it to only a single byte input, but that's all ZigBee ever uses.
- *
- *      This function implements the hash function:
- *          Hash(Key, text) = H((Key XOR opad) || H((Key XOR ipad) || text));
- *          ipad = 0x36 repeated.
- *          opad = 0x5c repeated.
- *          H() = ZigBee Cryptographic Hash (B.1.3 and B.6).
- *---------------------------------------------------------------
- */
-static PyObject *zigbee_sec_key_hash(PyObject *self, PyObject *args) {
-	const char			*key;
-	int					sizeKey;
-	const char           input;
+	if (zbee_field_list_init(&f_payload, "payloads", payloads, payload_offsets, 0, -1)) {
+		return NULL;
+	}
+	if (zbee_field_list_init(&f_nonce, "nonces", nonces, NULL, ZBEE_SEC_CONST_NONCE_LEN, f_payload.count)) {
+		goto out_payload;
+	}
+	if (zbee_field_list_init(&f_aad, "aads", aads, aad_offsets, 0, f_payload.count)) {
+		goto out_nonce;
+	}
+
+	frames = PyMem_New(zbee_ccm_frame, f_payload.count + 1);
+	if (frames == NULL) {
+		PyErr_NoMemory();
+		goto out_aad;
+	}
+	for (count = 0; count < f_payload.count; count++) {
+		i = count;
+		if (zbee_field_list_get(&f_nonce, i, &frames[i].nonce, &sizeNonce) ||
+			zbee_field_list_get(&f_payload, i, &frames[i].in, &frames[i].in_len) ||
+			zbee_field_list_get(&f_aad, i, &frames[i].a, &frames[i].a_len)) {
+			goto out_frames;
+		}
+		if (sizeNonce != ZBEE_SEC_CONST_NONCE_LEN) {
+			PyErr_Format(PyExc_ValueError, "frame %zd: incorrect nonce size (must be 13)", i);
+			goto out_frames;
+		}
+		err = zbee_ccm_length_error(frames[i].in_len, frames[i].a_len);
+		if (err != NULL) {
+			PyErr_Format(PyExc_ValueError, "frame %zd: %s", i, err);
+			goto out_frames;
+		}
+		frames[i].out = PyBytes_FromStringAndSize(NULL, frames[i].in_len);
+		if (frames[i].out == NULL) {
+			goto out_frames;
+		}
+	}
 
-    char          hash_in[2*ZBEE_SEC_CONST_BLOCKSIZE];
-    char          hash_out[ZBEE_SEC_CONST_BLOCKSIZE+1];
-    int                 i;
-    static const char ipad = 0x36;
-    static const char opad = 0x5c;
+	if (zbee_ccm_run_many(key, ctx, frames, count, mic_len, 0)) {
+		PyErr_SetString(PyExc_Exception, "encryption of the payload failed");
+		goto out_frames;
+	}
 
-	if (!PyArg_ParseTuple(args, "s#c", &key, &sizeKey, &input)) {
-		return NULL;
+	res = PyList_New(count);
+	if (res == NULL) {
+		goto out_frames;
+	}
+	for (i = 0; i < count; i++) {
+		item = Py_BuildValue("(Ny#)", frames[i].out, frames[i].enc_mic, (Py_ssize_t)mic_len);
+		frames[i].out = NULL;
+		if (item == NULL) {
+			Py_CLEAR(res);
+			break;
+		}
+		PyList_SET_ITEM(res, i, item);
 	}
 
-    /* Copy the key into hash_in and XOR with opad to form: (Key XOR opad) */
-    for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) hash_in[i] = key[i] ^ opad;
-    /* Copy the Key into hash_out and XOR with ipad to form: (Key XOR ipad) */
-    for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) hash_out[i] = key[i] ^ ipad;
-    /* Append the input byte to form: (Key XOR ipad) || text. */
-    hash_out[ZBEE_SEC_CONST_BLOCKSIZE] = input;
-    /* Hash the contents of hash_out and append the contents to hash_in to
-     * form: (Key XOR opad) || H((Key XOR ipad) || text).
-     */
-    zbee_sec_hash(hash_out, ZBEE_SEC_CONST_BLOCKSIZE+1, hash_in+ZBEE_SEC_CONST_BLOCKSIZE);
-    /* Hash the contents of hash_in to get the final result. */
-    zbee_sec_hash(hash_in, 2*ZBEE_SEC_CONST_BLOCKSIZE, hash_out);
+out_frames:
+	zbee_ccm_free_frames(frames, count);
+out_aad:
+	zbee_field_list_release(&f_aad);
+out_nonce:
+	zbee_field_list_release(&f_nonce);
+out_payload:
+	zbee_field_list_release(&f_payload);
+	return res;
+}
 
-	return Py_BuildValue("y", hash_out);
-} /* zbee_sec_key_hash */
+static PyObject *zigbee_crypt_decrypt_ccm_many(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"key", "nonces", "mics", "payloads", "aads", "payload_offsets", "aad_offsets", NULL};
+	Py_buffer			zkey;
+	PyObject			*nonces, *mics, *payloads, *aads;
+	PyObject			*payload_offsets = NULL;
+	PyObject			*aad_offsets = NULL;
+	PyObject			*res = NULL;
 
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*OOOO|OO", kwlist,
+								&zkey,
+								&nonces, &mics, &payloads, &aads,
+								&payload_offsets, &aad_offsets)) {
+		return NULL;
+	}
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+	} else {
+		res = zbee_ccm_decrypt_many(zkey.buf, NULL, -1, nonces, mics, payloads, aads, payload_offsets, aad_offsets);
+	}
+	PyBuffer_Release(&zkey);
+	return res;
+}
 
+static PyObject *zigbee_crypt_encrypt_ccm_many(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"key", "nonces", "mic_size", "payloads", "aads", "payload_offsets", "aad_offsets", NULL};
+	Py_buffer			zkey;
+	int					sizeMIC;
+	PyObject			*nonces, *payloads, *aads;
+	PyObject			*payload_offsets = NULL;
+	PyObject			*aad_offsets = NULL;
+	PyObject			*res = NULL;
 
-static PyMethodDef zigbee_crypt_Methods[] = {
-	{ "decrypt_ccm", zigbee_crypt_decrypt_ccm, METH_VARARGS, "decrypt_ccm(key, nonce, mic, encrypted_payload, zigbee_data)\nDecrypt data with a 0, 32, 64, or 128-bit MIC\n\n@type key: String\n@param key: 16-byte decryption key\n@type nonce: String\n@param nonce: 13-byte nonce\n@type mic: String\n@param mic: 4-16 byte message integrity check (MIC)\n@type encrypted_payload: String\n@param encrypted_payload: The encrypted data to decrypt\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the encrypted payload, MIC, or FCS" },
-	{ "encrypt_ccm", zigbee_crypt_encrypt_ccm, METH_VARARGS, "encrypt_ccm(key, nonce, mic_size, decrypted_payload, zigbee_data)\nEncrypt data with a 0, 32, 64, or 128-bit MIC\n\n@type key: String\n@param key: 16-byte decryption key\n@type nonce: String\n@param nonce: 13-byte nonce\n@type mic_size: Integer\n@param mic_size: the size in bytes of the desired MIC\n@type decrypted_payload: String\n@param decrypted_payload: The decrypted data to encrypt\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the decrypted payload, MIC or FCS" },
-	{ "sec_key_hash", zigbee_sec_key_hash, METH_VARARGS, "sec_key_hash(key, input)\nHash the supplied key as per ZigBee Cryptographic Hash (B.1.3 and B.6).\n\n@type key: String\n@param key: 16-byte key to hash\n@type input: Char\n@param input: Character terminator for key" },
-	{ NULL, NULL, 0, NULL },
-};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*OiOO|OO", kwlist,
+								&zkey,
+								&nonces, &sizeMIC, &payloads, &aads,
+								&payload_offsets, &aad_offsets)) {
+		return NULL;
+	}
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+	} else if ((sizeMIC != 0) && (sizeMIC != 4) && (sizeMIC != 8) && (sizeMIC != 16)) {
+		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be 0, 4, 8, or 16 bytes)");
+	} else {
+		res = zbee_ccm_encrypt_many(zkey.buf, NULL, sizeMIC, nonces, payloads, aads, payload_offsets, aad_offsets);
+	}
+	PyBuffer_Release(&zkey);
+	return res;
+}
 
+/* Offset of the frame counter in a ZigBee nonce, after the extended source. */
+#define ZBEE_SEC_NONCE_COUNTER	8
 
+static PyObject *zigbee_crypt_encrypt_ccm_sequence(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"key", "nonce_template", "counter_offset", "start", "count", "payload", "aad_template", "mic_size", "header", "fcs", NULL};
+	Py_buffer			zkey;
+	Py_buffer			nonce;
+	Py_buffer			payload;
+	Py_buffer			aad;
+	Py_buffer			header = {NULL};
+	Py_ssize_t			counterOffset, start, count, frameLen, i;
+	int					sizeMIC = 4;
+	int					fcs = 1;
+	int					rc;
+	char				**frames = NULL;
+	char				frameNonce[ZBEE_SEC_CONST_NONCE_LEN];
+	char				*pAad;
+	uint32_t			counter;
+	const char			*err;
+	PyObject			*res = NULL;
+	PyObject			*item;
+	/* Cipher Instance. */
+	zbee_cipher			cipher;
 
-ZIGBEE_CRYPT_INIT
-{
-    PyObject *module;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*y*nnny*y*|iy*p", kwlist,
+								&zkey,
+								&nonce,
+								&counterOffset, &start, &count,
+								&payload,
+								&aad,
+								&sizeMIC,
+								&header,
+								&fcs)) {
+		return NULL;
+	}
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+		goto out;
+	}
+	if (nonce.len != ZBEE_SEC_CONST_NONCE_LEN) {
+		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
+		goto out;
+	}
+	if ((sizeMIC != 0) && (sizeMIC != 4) && (sizeMIC != 8) && (sizeMIC != 16)) {
+		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be 0, 4, 8, or 16 bytes)");
+		goto out;
+	}
+	if (counterOffset < 0 || counterOffset > aad.len - 4) {
+		PyErr_SetString(PyExc_ValueError, "counter_offset must leave 4 bytes of aad_template for the frame counter");
+		goto out;
+	}
+	if (start < 0 || count < 0 || start > 0xffffffffLL || count > 0x100000000LL - start) {
+		PyErr_SetString(PyExc_ValueError, "frame counters must be between 0 and 0xffffffff");
+		goto out;
+	}
+	err = zbee_ccm_length_error(payload.len, aad.len);
+	if (err != NULL) {
+		PyErr_SetString(PyExc_ValueError, err);
+		goto out;
+	}
+	frameLen = header.len + aad.len + payload.len + sizeMIC + (fcs ? 2 : 0);
+	if (frameLen > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "frame too long");
+		goto out;
+	}
+
+	res = PyList_New(count);
+	if (res == NULL) {
+		goto out;
+	}
+	frames = PyMem_New(char *, count + 1);
+	if (frames == NULL) {
+		PyErr_NoMemory();
+		Py_CLEAR(res);
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		item = PyBytes_FromStringAndSize(NULL, frameLen);
+		if (item == NULL) {
+			Py_CLEAR(res);
+			goto out;
+		}
+		PyList_SET_ITEM(res, i, item);
+		frames[i] = PyBytes_AS_STRING(item);
+	}
+
+	/* Every frame is header || aad || encrypted payload || MIC || FCS, with
+	 * the frame counter written little endian into the nonce and aad. */
+	Py_BEGIN_ALLOW_THREADS
+	rc = zbee_ccm_open(&cipher, zkey.buf);
+	if (rc == 0) {
+		memcpy(frameNonce, nonce.buf, ZBEE_SEC_CONST_NONCE_LEN);
+		for (i = 0; i < count && rc == 0; i++) {
+			counter = (uint32_t)(start + i);
+			pAad = frames[i] + header.len;
+			if (header.len > 0) {
+				memcpy(frames[i], header.buf, header.len);
+			}
+			memcpy(pAad, aad.buf, aad.len);
+			pAad[counterOffset] = frameNonce[ZBEE_SEC_NONCE_COUNTER] = (char)(counter & 0xff);
+			pAad[counterOffset + 1] = frameNonce[ZBEE_SEC_NONCE_COUNTER + 1] = (char)((counter >> 8) & 0xff);
+			pAad[counterOffset + 2] = frameNonce[ZBEE_SEC_NONCE_COUNTER + 2] = (char)((counter >> 16) & 0xff);
+			pAad[counterOffset + 3] = frameNonce[ZBEE_SEC_NONCE_COUNTER + 3] = (char)((counter >> 24) & 0xff);
+			rc = zbee_ccm_encrypt(&cipher, frameNonce, sizeMIC, payload.buf, (int)payload.len,
+								  pAad, (int)aad.len, pAad + aad.len, pAad + aad.len + payload.len);
+			if (fcs) {
+				zbee_dot154_fcs(frames[i], (int)frameLen - 2, frames[i] + frameLen - 2);
+			}
+		}
+		zbee_cipher_close(&cipher);
+	}
+	Py_END_ALLOW_THREADS
+	if (rc) {
+		PyErr_SetString(PyExc_Exception, "encryption of the payload failed");
+		Py_CLEAR(res);
+	}
+out:
+	PyMem_Free(frames);
+	PyBuffer_Release(&zkey);
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&payload);
+	PyBuffer_Release(&aad);
+	PyBuffer_Release(&header);
+	return res;
+}
+
+/*
+ * Resolves the extended source of a frame which does not carry one, by
+ * NWK short address through ext_src_lookup, a mapping or callable giving
+ * the address as an integer or as 8 bytes in over-the-air order. Returns 1
+ * if found, 0 if not and -1 with an exception set.
+ */
+static int
+zbee_lookup_ext_src(PyObject *lookup, int nwk_src, char *ext_src)
+{
+	PyObject			*key, *addr;
+	Py_buffer			view;
+	unsigned long long	v;
+	int					i, rc = 0;
+
+	key = PyLong_FromLong(nwk_src);
+	if (key == NULL) {
+		return -1;
+	}
+	if (PyCallable_Check(lookup)) {
+		addr = PyObject_CallFunctionObjArgs(lookup, key, NULL);
+	} else {
+		addr = PyObject_GetItem(lookup, key);
+		if (addr == NULL && PyErr_ExceptionMatches(PyExc_KeyError)) {
+			PyErr_Clear();
+			addr = Py_None;
+			Py_INCREF(addr);
+		}
+	}
+	Py_DECREF(key);
+	if (addr == NULL) {
+		return -1;
+	}
+	if (addr == Py_None) {
+		rc = 0;
+	} else if (PyLong_Check(addr)) {
+		v = PyLong_AsUnsignedLongLong(addr);
+		if (v == (unsigned long long)-1 && PyErr_Occurred()) {
+			rc = -1;
+		} else {
+			for (i = 0; i < 8; i++) {
+				ext_src[i] = (char)(v >> (8 * i));
+			}
+			rc = 1;
+		}
+	} else if (PyObject_GetBuffer(addr, &view, PyBUF_SIMPLE) == 0) {
+		if (view.len != 8) {
+			PyErr_SetString(PyExc_ValueError, "incorrect extended source size (must be 8)");
+			rc = -1;
+		} else {
+			memcpy(ext_src, view.buf, 8);
+			rc = 1;
+		}
+		PyBuffer_Release(&view);
+	} else {
+		rc = -1;
+	}
+	Py_DECREF(addr);
+	return rc;
+}
+
+/*
+ * Decrypts a raw NWK or APS-secured frame for decrypt_nwk_frame(), with the
+ * given key or, if key is NULL, the cipher of ctx.
+ */
+static PyObject *
+zbee_decrypt_nwk_frame(const char *key, zigbee_crypt_CCMContext *ctx,
+                       const Py_buffer *frame, PyObject *lookup, int fcs)
+{
+	zbee_sec_frame		f;
+	zbee_cipher			own;
+	zbee_cipher			*cipher = &own;
+	char				ext_src[8];
+	const char			*pExtSrc = NULL;
+	PyObject			*pUnencrypted;
+	int					micCheck;
+
+	if (frame->len > INT_MAX || frame->len < (fcs ? 2 : 0) ||
+		zbee_sec_frame_parse(frame->buf, (int)frame->len - (fcs ? 2 : 0), &f)) {
+		Py_RETURN_NONE;
+	}
+	if (f.ext_src < 0) {
+		switch (lookup == Py_None ? 0 : zbee_lookup_ext_src(lookup, f.nwk_src, ext_src)) {
+		case 1:
+			pExtSrc = ext_src;
+			break;
+		case 0:
+			Py_RETURN_NONE;
+		default:
+			return NULL;
+		}
+	}
+
+	pUnencrypted = PyBytes_FromStringAndSize(NULL, f.payload_len);
+	if (pUnencrypted == NULL) {
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	micCheck = -1;
+	if (key != NULL) {
+		if (zbee_ccm_open(cipher, key) == 0) {
+			micCheck = zbee_sec_frame_decrypt(cipher, frame->buf, &f, pExtSrc,
+											  PyBytes_AS_STRING(pUnencrypted));
+			zbee_cipher_close(cipher);
+		}
+	} else {
+		PyThread_acquire_lock(ctx->lock, WAIT_LOCK);
+		if (ctx->keyed) {
+			micCheck = zbee_sec_frame_decrypt(&ctx->cipher, frame->buf, &f, pExtSrc,
+											  PyBytes_AS_STRING(pUnencrypted));
+		}
+		PyThread_release_lock(ctx->lock);
+	}
+	Py_END_ALLOW_THREADS
+	if (micCheck < 0) {
+		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
+		Py_DECREF(pUnencrypted);
+		return NULL;
+	}
+
+	return Py_BuildValue("(iNi)", f.payload, pUnencrypted, micCheck);
+}
+
+static PyObject *zigbee_crypt_decrypt_nwk_frame(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"raw_frame", "key", "ext_src_lookup", "fcs", NULL};
+	Py_buffer			frame;
+	Py_buffer			zkey;
+	PyObject			*lookup = Py_None;
+	PyObject			*res = NULL;
+	int					fcs = 1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*y*|Op", kwlist,
+								&frame,
+								&zkey,
+								&lookup,
+								&fcs)) {
+		return NULL;
+	}
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+	} else {
+		res = zbee_decrypt_nwk_frame(zkey.buf, NULL, &frame, lookup, fcs);
+	}
+	PyBuffer_Release(&frame);
+	PyBuffer_Release(&zkey);
+	return res;
+}
+
+/* An 8-byte over-the-air extended address as an integer, like scapy's. */
+static PyObject *
+zbee_ext_addr(const char *frame, int offset)
+{
+	unsigned long long	v = 0;
+	int					i;
+
+	if (offset < 0) {
+		Py_RETURN_NONE;
+	}
+	for (i = 7; i >= 0; i--) {
+		v = (v << 8) | (unsigned char)frame[offset + i];
+	}
+	return PyLong_FromUnsignedLongLong(v);
+}
+
+static PyObject *zigbee_crypt_parse_nwk_frame(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"raw_frame", "fcs", NULL};
+	Py_buffer			frame;
+	zbee_sec_frame		f;
+	const char			*p;
+	PyObject			*res;
+	int					fcs = 1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|p", kwlist,
+								&frame,
+								&fcs)) {
+		return NULL;
+	}
+	p = frame.buf;
+	if (frame.len > INT_MAX || frame.len < (fcs ? 2 : 0) ||
+		zbee_sec_frame_parse(p, (int)frame.len - (fcs ? 2 : 0), &f)) {
+		res = Py_None;
+		Py_INCREF(res);
+	} else {
+		res = Py_BuildValue("(OiNiNN)",
+							f.aps ? Py_True : Py_False,
+							(p[f.aux] & ZBEE_SEC_CONTROL_KEY) >> 3,
+							f.mac_src < 0 ? (Py_INCREF(Py_None), Py_None) : PyLong_FromLong(f.mac_src),
+							f.nwk_src,
+							zbee_ext_addr(p, f.nwk_ext_src),
+							zbee_ext_addr(p, (p[f.aux] & ZBEE_SEC_CONTROL_NONCE) ? f.aux + 5 : -1));
+	}
+	PyBuffer_Release(&frame);
+	return res;
+}
+
+
+/*
+ * parse_mac_many() writes zbee_dot154_hdr records as they are, so their
+ * layout is part of the module's interface, described by MAC_RECORD_FORMAT.
+ */
+#define ZBEE_MAC_RECORD_FORMAT	"=QQIHHHHHHBBBBBBBB"
+#define ZBEE_MAC_RECORD_SIZE	40
+typedef char zbee_mac_record_size_check[(sizeof(zbee_dot154_hdr) == ZBEE_MAC_RECORD_SIZE) ? 1 : -1];
+
+static PyStructSequence_Field zigbee_crypt_MACHeader_fields[] = {
+	{ "frame_type", "frame type, 0 for beacons to 3 for MAC commands" },
+	{ "fcf", "frame control field" },
+	{ "seq", "sequence number" },
+	{ "dst_addr_mode", "destination addressing mode, 0, 2 (short) or 3 (extended)" },
+	{ "dst_pan", "destination PAN ID, or None" },
+	{ "dst_addr", "destination address, or None" },
+	{ "src_addr_mode", "source addressing mode, 0, 2 (short) or 3 (extended)" },
+	{ "src_pan", "source PAN ID, the destination PAN ID under PAN ID compression, or None" },
+	{ "src_addr", "source address, or None" },
+	{ "sec_level", "auxiliary security header security level, or None" },
+	{ "key_id_mode", "auxiliary security header key identifier mode, or None" },
+	{ "key_index", "auxiliary security header key index, or None" },
+	{ "frame_counter", "auxiliary security header frame counter, or None" },
+	{ "hdr_len", "length of the MAC header up to the auxiliary security header" },
+	{ "payload", "offset of the MAC payload" },
+	{ "payload_len", "length of the MAC payload, without the MIC and FCS" },
+	{ NULL, NULL }
+};
+
+static PyStructSequence_Desc zigbee_crypt_MACHeader_desc = {
+	"zigbee_crypt.MACHeader",
+	"IEEE 802.15.4 MAC header, as returned by parse_mac()",
+	zigbee_crypt_MACHeader_fields,
+	16
+};
+
+static PyTypeObject zigbee_crypt_MACHeaderType;
+
+/* A value of a MAC header field, or None when absent from the frame. */
+static PyObject *
+zbee_mac_field(int present, unsigned long long v)
+{
+	if (!present) {
+		Py_RETURN_NONE;
+	}
+	return PyLong_FromUnsignedLongLong(v);
+}
+
+static PyObject *zigbee_crypt_parse_mac(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"raw_frame", "fcs", NULL};
+	Py_buffer			frame;
+	zbee_dot154_hdr		h;
+	PyObject			*res;
+	PyObject			*v;
+	int					fcs = 1;
+	int					secured, i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|p", kwlist,
+								&frame,
+								&fcs)) {
+		return NULL;
+	}
+	if (frame.len > INT_MAX || frame.len < (fcs ? 2 : 0) ||
+		zbee_dot154_parse(frame.buf, (int)frame.len - (fcs ? 2 : 0), &h)) {
+		PyBuffer_Release(&frame);
+		Py_RETURN_NONE;
+	}
+	PyBuffer_Release(&frame);
+
+	res = PyStructSequence_New(&zigbee_crypt_MACHeaderType);
+	if (res == NULL) {
+		return NULL;
+	}
+	secured = (h.fcf & ZBEE_DOT154_FCF_SECURITY) != 0;
+	for (i = 0; i < zigbee_crypt_MACHeader_desc.n_in_sequence; i++) {
+		switch (i) {
+		case 0: v = zbee_mac_field(1, h.frame_type); break;
+		case 1: v = zbee_mac_field(1, h.fcf); break;
+		case 2: v = zbee_mac_field(1, h.seq); break;
+		case 3: v = zbee_mac_field(1, h.dst_addr_mode); break;
+		case 4: v = zbee_mac_field(h.dst_addr_mode, h.dst_pan); break;
+		case 5: v = zbee_mac_field(h.dst_addr_mode, h.dst_addr); break;
+		case 6: v = zbee_mac_field(1, h.src_addr_mode); break;
+		case 7: v = zbee_mac_field(h.src_addr_mode, h.src_pan); break;
+		case 8: v = zbee_mac_field(h.src_addr_mode, h.src_addr); break;
+		case 9: v = zbee_mac_field(secured, h.sec_level); break;
+		case 10: v = zbee_mac_field(secured, h.key_id_mode); break;
+		case 11: v = zbee_mac_field(secured && h.key_id_mode, h.key_index); break;
+		case 12: v = zbee_mac_field(secured, h.frame_counter); break;
+		case 13: v = zbee_mac_field(1, h.hdr_len); break;
+		case 14: v = zbee_mac_field(1, h.payload); break;
+		default: v = zbee_mac_field(1, h.payload_len); break;
+		}
+		if (v == NULL) {
+			Py_DECREF(res);
+			return NULL;
+		}
+		PyStructSequence_SET_ITEM(res, i, v);
+	}
+	return res;
+}
+
+static PyObject *zigbee_crypt_parse_mac_many(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"frames", "offsets", "fcs", "out", NULL};
+	PyObject			*frames;
+	PyObject			*offsets = NULL;
+	PyObject			*out = NULL;
+	zbee_field_list		f_frame;
+	Py_buffer			records;
+	zbee_dot154_hdr		h;
+	PyObject			*res = NULL;
+	const char			*p;
+	Py_ssize_t			len, i;
+	int					fcs = 1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OpO", kwlist, &frames, &offsets, &fcs, &out)) {
+		return NULL;
+	}
+	if (zbee_field_list_init(&f_frame, "frames", frames, offsets, 0, -1)) {
+		return NULL;
+	}
+	if (out == NULL || out == Py_None) {
+		out = PyByteArray_FromStringAndSize(NULL, f_frame.count * ZBEE_MAC_RECORD_SIZE);
+		if (out == NULL) {
+			goto done;
+		}
+	} else {
+		Py_INCREF(out);
+	}
+	if (PyObject_GetBuffer(out, &records, PyBUF_WRITABLE) < 0) {
+		Py_DECREF(out);
+		goto done;
+	}
+	if (records.len < f_frame.count * ZBEE_MAC_RECORD_SIZE) {
+		PyErr_Format(PyExc_ValueError, "out must hold at least %zd bytes", f_frame.count * ZBEE_MAC_RECORD_SIZE);
+		PyBuffer_Release(&records);
+		Py_DECREF(out);
+		goto done;
+	}
+
+	/* The records are written with memcpy, so the buffer may be unaligned,
+	 * such as a slice of a larger one. */
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i < f_frame.count; i++) {
+		zbee_field_list_get(&f_frame, i, &p, &len);
+		if (len > INT_MAX || len < (fcs ? 2 : 0) ||
+			zbee_dot154_parse(p, (int)len - (fcs ? 2 : 0), &h)) {
+			memset(&h, 0, sizeof(h));
+		}
+		memcpy((char *)records.buf + i * ZBEE_MAC_RECORD_SIZE, &h, ZBEE_MAC_RECORD_SIZE);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&records);
+	res = out;
+done:
+	zbee_field_list_release(&f_frame);
+	return res;
+}
+
+
+/*
+ * NWKFrame and APSFrame: views of a NWK or APS header in the caller's
+ * buffer. Creating one only finds the positions of the fields, which are
+ * read from the buffer when accessed, so a tool that only looks at the NWK
+ * source or the security flag pays for nothing else. The buffer is held for
+ * the life of the view, which keeps a bytearray from being resized.
+ */
+typedef struct {
+	PyObject_HEAD
+	Py_buffer			buf;
+	int					have_buf;
+	int					end;
+	zbee_nwk_hdr		h;
+} zigbee_crypt_NWKFrame;
+
+typedef struct {
+	PyObject_HEAD
+	Py_buffer			buf;
+	int					have_buf;
+	int					end;
+	zbee_aps_hdr		h;
+} zigbee_crypt_APSFrame;
+
+/*
+ * Shared argument handling of the views: (buffer, offset=0, length=None),
+ * the header starting at offset and its payload running for length bytes
+ * from there, or to the end of the buffer.
+ */
+static int
+zbee_view_init(PyObject *args, PyObject *kwds, Py_buffer *buf, int *have_buf, int *off, int *end)
+{
+	static char			*kwlist[] = {"buffer", "offset", "length", NULL};
+	Py_buffer			b;
+	Py_ssize_t			offset = 0;
+	PyObject			*length = Py_None;
+	Py_ssize_t			n;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|nO", kwlist, &b, &offset, &length)) {
+		return -1;
+	}
+	n = b.len - offset;
+	if (length != Py_None) {
+		n = PyLong_AsSsize_t(length);
+		if (n == -1 && PyErr_Occurred()) {
+			PyBuffer_Release(&b);
+			return -1;
+		}
+	}
+	if (offset < 0 || n < 0 || offset > b.len || n > b.len - offset || b.len > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "offset and length must lie within the buffer");
+		PyBuffer_Release(&b);
+		return -1;
+	}
+	if (*have_buf) {
+		PyBuffer_Release(buf);
+	}
+	*buf = b;
+	*have_buf = 1;
+	*off = (int)offset;
+	*end = (int)(offset + n);
+	return 0;
+}
+
+/* The little endian field of size bytes at pos, or None if pos is -1. */
+static PyObject *
+zbee_view_field(const Py_buffer *buf, int pos, int size)
+{
+	const unsigned char	*p = (const unsigned char *)buf->buf + pos;
+	unsigned long		v = 0;
+
+	if (pos < 0) {
+		Py_RETURN_NONE;
+	}
+	while (size-- > 0) {
+		v = (v << 8) | p[size];
+	}
+	return PyLong_FromUnsignedLong(v);
+}
+
+static PyObject *
+zbee_view_payload(const Py_buffer *buf, int start, int end)
+{
+	return PyBytes_FromStringAndSize((const char *)buf->buf + start, end - start);
+}
+
+enum {
+	NWK_FCF, NWK_FRAME_TYPE, NWK_VERSION, NWK_DISCOVER_ROUTE, NWK_MULTICAST, NWK_SECURITY,
+	NWK_SOURCE_ROUTE, NWK_DST, NWK_SRC, NWK_RADIUS, NWK_SEQ, NWK_EXT_DST, NWK_EXT_SRC,
+	NWK_MCAST_CTRL, NWK_RELAY_COUNT, NWK_RELAY_INDEX, NWK_RELAYS, NWK_HDR_LEN,
+	NWK_PAYLOAD_OFFSET, NWK_PAYLOAD
+};
+
+static int
+NWKFrame_init(zigbee_crypt_NWKFrame *self, PyObject *args, PyObject *kwds)
+{
+	int					off;
+
+	if (zbee_view_init(args, kwds, &self->buf, &self->have_buf, &off, &self->end)) {
+		return -1;
+	}
+	if (zbee_nwk_parse(self->buf.buf, off, self->end, &self->h)) {
+		PyErr_SetString(PyExc_ValueError, "truncated NWK header");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+NWKFrame_dealloc(zigbee_crypt_NWKFrame *self)
+{
+	if (self->have_buf) {
+		PyBuffer_Release(&self->buf);
+	}
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+NWKFrame_get(zigbee_crypt_NWKFrame *self, void *closure)
+{
+	const zbee_nwk_hdr	*h = &self->h;
+	PyObject			*relays;
+	int					i, n;
+
+	if (!self->have_buf) {
+		PyErr_SetString(PyExc_ValueError, "NWKFrame not initialized");
+		return NULL;
+	}
+	switch ((int)(intptr_t)closure) {
+	case NWK_FCF:				return PyLong_FromLong(h->fcf);
+	case NWK_FRAME_TYPE:		return PyLong_FromLong(h->fcf & 0x0003);
+	case NWK_VERSION:			return PyLong_FromLong((h->fcf >> 2) & 0xf);
+	case NWK_DISCOVER_ROUTE:	return PyLong_FromLong((h->fcf >> 6) & 0x3);
+	case NWK_MULTICAST:			return PyBool_FromLong(h->mcast >= 0);
+	case NWK_SECURITY:			return PyBool_FromLong(h->fcf & ZBEE_NWK_FCF_SECURITY);
+	case NWK_SOURCE_ROUTE:		return PyBool_FromLong(h->src_route >= 0);
+	case NWK_DST:				return zbee_view_field(&self->buf, h->start + 2, 2);
+	case NWK_SRC:				return zbee_view_field(&self->buf, h->start + 4, 2);
+	case NWK_RADIUS:			return zbee_view_field(&self->buf, h->start + 6, 1);
+	case NWK_SEQ:				return zbee_view_field(&self->buf, h->start + 7, 1);
+	case NWK_EXT_DST:			return zbee_ext_addr(self->buf.buf, h->ext_dst);
+	case NWK_EXT_SRC:			return zbee_ext_addr(self->buf.buf, h->ext_src);
+	case NWK_MCAST_CTRL:		return zbee_view_field(&self->buf, h->mcast, 1);
+	case NWK_RELAY_COUNT:		return zbee_view_field(&self->buf, h->src_route, 1);
+	case NWK_RELAY_INDEX:		return zbee_view_field(&self->buf, h->src_route < 0 ? -1 : h->src_route + 1, 1);
+	case NWK_RELAYS:
+		if (h->src_route < 0) {
+			Py_RETURN_NONE;
+		}
+		n = ((const unsigned char *)self->buf.buf)[h->src_route];
+		relays = PyTuple_New(n);
+		for (i = 0; relays != NULL && i < n; i++) {
+			PyTuple_SET_ITEM(relays, i, zbee_view_field(&self->buf, h->src_route + 2 + 2 * i, 2));
+		}
+		return relays;
+	case NWK_HDR_LEN:			return PyLong_FromLong(h->payload - h->start);
+	case NWK_PAYLOAD_OFFSET:	return PyLong_FromLong(h->payload);
+	default:					return zbee_view_payload(&self->buf, h->payload, self->end);
+	}
+}
+
+#define ZBEE_VIEW_FIELD(type, name, id, doc) \
+	{ name, (getter)type##_get, NULL, doc, (void *)(intptr_t)(id) }
+
+static PyGetSetDef NWKFrame_GetSet[] = {
+	ZBEE_VIEW_FIELD(NWKFrame, "fcf", NWK_FCF, "frame control field"),
+	ZBEE_VIEW_FIELD(NWKFrame, "frame_type", NWK_FRAME_TYPE, "frame type, ZBEE_NWK_FCF_DATA or ZBEE_NWK_FCF_CMD"),
+	ZBEE_VIEW_FIELD(NWKFrame, "version", NWK_VERSION, "protocol version"),
+	ZBEE_VIEW_FIELD(NWKFrame, "discover_route", NWK_DISCOVER_ROUTE, "discover route field"),
+	ZBEE_VIEW_FIELD(NWKFrame, "multicast", NWK_MULTICAST, "True if the multicast flag is set"),
+	ZBEE_VIEW_FIELD(NWKFrame, "security", NWK_SECURITY, "True if the frame is NWK secured"),
+	ZBEE_VIEW_FIELD(NWKFrame, "source_route", NWK_SOURCE_ROUTE, "True if the frame carries a source route"),
+	ZBEE_VIEW_FIELD(NWKFrame, "dst", NWK_DST, "destination short address"),
+	ZBEE_VIEW_FIELD(NWKFrame, "src", NWK_SRC, "source short address"),
+	ZBEE_VIEW_FIELD(NWKFrame, "radius", NWK_RADIUS, "radius"),
+	ZBEE_VIEW_FIELD(NWKFrame, "seq", NWK_SEQ, "sequence number"),
+	ZBEE_VIEW_FIELD(NWKFrame, "ext_dst", NWK_EXT_DST, "extended destination address as an integer, or None"),
+	ZBEE_VIEW_FIELD(NWKFrame, "ext_src", NWK_EXT_SRC, "extended source address as an integer, or None"),
+	ZBEE_VIEW_FIELD(NWKFrame, "multicast_control", NWK_MCAST_CTRL, "multicast control field, or None"),
+	ZBEE_VIEW_FIELD(NWKFrame, "relay_count", NWK_RELAY_COUNT, "source route relay count, or None"),
+	ZBEE_VIEW_FIELD(NWKFrame, "relay_index", NWK_RELAY_INDEX, "source route relay index, or None"),
+	ZBEE_VIEW_FIELD(NWKFrame, "relays", NWK_RELAYS, "source route relay list as a tuple of short addresses, or None"),
+	ZBEE_VIEW_FIELD(NWKFrame, "hdr_len", NWK_HDR_LEN, "length of the NWK header"),
+	ZBEE_VIEW_FIELD(NWKFrame, "payload_offset", NWK_PAYLOAD_OFFSET, "offset of the NWK payload in the buffer"),
+	ZBEE_VIEW_FIELD(NWKFrame, "payload", NWK_PAYLOAD, "NWK payload, copied from the buffer"),
+	{ NULL }
+};
+
+static PyTypeObject zigbee_crypt_NWKFrameType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "zigbee_crypt.NWKFrame",
+	.tp_basicsize	= sizeof(zigbee_crypt_NWKFrame),
+	.tp_dealloc		= (destructor)NWKFrame_dealloc,
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_doc			= "NWKFrame(buffer, offset=0, length=None)\nView of the ZigBee NWK header at offset in buffer, its fields read when accessed\n\nSource routes, multicast control and extended addresses are handled. ValueError is raised if the header is truncated.\n\n@type buffer: Buffer\n@param buffer: Frame holding the NWK header, such as a raw 802.15.4 frame with offset at its MAC payload\n@type offset: Integer\n@param offset: Offset of the NWK header in buffer\n@type length: Integer\n@param length: Length of the NWK frame from offset, to leave out e.g. the FCS",
+	.tp_getset		= NWKFrame_GetSet,
+	.tp_init		= (initproc)NWKFrame_init,
+	.tp_new			= PyType_GenericNew,
+};
+
+enum {
+	APS_FCF, APS_FRAME_TYPE, APS_DELIVERY_MODE, APS_ACK_FORMAT, APS_SECURITY, APS_ACK_REQUEST,
+	APS_EXT_HEADER, APS_DST_ENDPOINT, APS_GROUP, APS_CLUSTER, APS_PROFILE, APS_SRC_ENDPOINT,
+	APS_COUNTER, APS_FRAGMENTATION, APS_BLOCK_NUMBER, APS_ACK_BITFIELD, APS_HDR_LEN,
+	APS_PAYLOAD_OFFSET, APS_PAYLOAD
+};
+
+static int
+APSFrame_init(zigbee_crypt_APSFrame *self, PyObject *args, PyObject *kwds)
+{
+	int					off;
+
+	if (zbee_view_init(args, kwds, &self->buf, &self->have_buf, &off, &self->end)) {
+		return -1;
+	}
+	if (zbee_aps_parse(self->buf.buf, off, self->end, &self->h)) {
+		PyErr_SetString(PyExc_ValueError, "truncated APS header");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+APSFrame_dealloc(zigbee_crypt_APSFrame *self)
+{
+	if (self->have_buf) {
+		PyBuffer_Release(&self->buf);
+	}
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+APSFrame_get(zigbee_crypt_APSFrame *self, void *closure)
+{
+	const zbee_aps_hdr	*h = &self->h;
+	const unsigned char	*p = self->buf.buf;
+
+	if (!self->have_buf) {
+		PyErr_SetString(PyExc_ValueError, "APSFrame not initialized");
+		return NULL;
+	}
+	switch ((int)(intptr_t)closure) {
+	case APS_FCF:				return PyLong_FromLong(h->fcf);
+	case APS_FRAME_TYPE:		return PyLong_FromLong(h->fcf & 0x03);
+	case APS_DELIVERY_MODE:		return PyLong_FromLong((h->fcf >> 2) & 0x03);
+	case APS_ACK_FORMAT:		return PyBool_FromLong(h->fcf & 0x10);
+	case APS_SECURITY:			return PyBool_FromLong(h->fcf & ZBEE_APS_FCF_SECURITY);
+	case APS_ACK_REQUEST:		return PyBool_FromLong(h->fcf & 0x40);
+	case APS_EXT_HEADER:		return PyBool_FromLong(h->ext_fcf >= 0);
+	case APS_DST_ENDPOINT:		return zbee_view_field(&self->buf, h->dst_endpoint, 1);
+	case APS_GROUP:				return zbee_view_field(&self->buf, h->group, 2);
+	case APS_CLUSTER:			return zbee_view_field(&self->buf, h->cluster, 2);
+	case APS_PROFILE:			return zbee_view_field(&self->buf, h->cluster < 0 ? -1 : h->cluster + 2, 2);
+	case APS_SRC_ENDPOINT:		return zbee_view_field(&self->buf, h->cluster < 0 ? -1 : h->cluster + 4, 1);
+	case APS_COUNTER:			return zbee_view_field(&self->buf, h->counter, 1);
+	case APS_FRAGMENTATION:
+		if (h->ext_fcf < 0) {
+			Py_RETURN_NONE;
+		}
+		return PyLong_FromLong(p[h->ext_fcf] & 0x03);
+	case APS_BLOCK_NUMBER:		return zbee_view_field(&self->buf, h->block, 1);
+	case APS_ACK_BITFIELD:		return zbee_view_field(&self->buf, h->ack_bitfield, 1);
+	case APS_HDR_LEN:			return PyLong_FromLong(h->payload - h->start);
+	case APS_PAYLOAD_OFFSET:	return PyLong_FromLong(h->payload);
+	default:					return zbee_view_payload(&self->buf, h->payload, self->end);
+	}
+}
+
+static PyGetSetDef APSFrame_GetSet[] = {
+	ZBEE_VIEW_FIELD(APSFrame, "fcf", APS_FCF, "frame control field"),
+	ZBEE_VIEW_FIELD(APSFrame, "frame_type", APS_FRAME_TYPE, "frame type, ZBEE_APS_FCF_DATA, ZBEE_APS_FCF_CMD or ZBEE_APS_FCF_ACK"),
+	ZBEE_VIEW_FIELD(APSFrame, "delivery_mode", APS_DELIVERY_MODE, "delivery mode"),
+	ZBEE_VIEW_FIELD(APSFrame, "ack_format", APS_ACK_FORMAT, "True for acknowledgements of APS commands"),
+	ZBEE_VIEW_FIELD(APSFrame, "security", APS_SECURITY, "True if the frame is APS secured"),
+	ZBEE_VIEW_FIELD(APSFrame, "ack_request", APS_ACK_REQUEST, "True if an acknowledgement is requested"),
+	ZBEE_VIEW_FIELD(APSFrame, "ext_header", APS_EXT_HEADER, "True if the extended header is present"),
+	ZBEE_VIEW_FIELD(APSFrame, "dst_endpoint", APS_DST_ENDPOINT, "destination endpoint, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "group", APS_GROUP, "group address, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "cluster", APS_CLUSTER, "cluster identifier, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "profile", APS_PROFILE, "profile identifier, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "src_endpoint", APS_SRC_ENDPOINT, "source endpoint, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "counter", APS_COUNTER, "APS counter"),
+	ZBEE_VIEW_FIELD(APSFrame, "fragmentation", APS_FRAGMENTATION, "extended header fragmentation field, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "block_number", APS_BLOCK_NUMBER, "block number of a fragment, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "ack_bitfield", APS_ACK_BITFIELD, "ack bitfield of a fragment acknowledgement, or None"),
+	ZBEE_VIEW_FIELD(APSFrame, "hdr_len", APS_HDR_LEN, "length of the APS header"),
+	ZBEE_VIEW_FIELD(APSFrame, "payload_offset", APS_PAYLOAD_OFFSET, "offset of the APS payload in the buffer"),
+	ZBEE_VIEW_FIELD(APSFrame, "payload", APS_PAYLOAD, "APS payload, copied from the buffer"),
+	{ NULL }
+};
+
+static PyTypeObject zigbee_crypt_APSFrameType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "zigbee_crypt.APSFrame",
+	.tp_basicsize	= sizeof(zigbee_crypt_APSFrame),
+	.tp_dealloc		= (destructor)APSFrame_dealloc,
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_doc			= "APSFrame(buffer, offset=0, length=None)\nView of the ZigBee APS header at offset in buffer, its fields read when accessed\n\nThe extended header of fragmented frames is handled. ValueError is raised if the header is truncated.\n\n@type buffer: Buffer\n@param buffer: Frame holding the APS header, such as a raw 802.15.4 frame with offset at NWKFrame.payload_offset\n@type offset: Integer\n@param offset: Offset of the APS header in buffer\n@type length: Integer\n@param length: Length of the APS frame from offset, to leave out e.g. the FCS",
+	.tp_getset		= APSFrame_GetSet,
+	.tp_init		= (initproc)APSFrame_init,
+	.tp_new			= PyType_GenericNew,
+};
+
+
+/* Number of candidate keys a search worker claims at a time. */
+#define ZBEE_SEARCH_CHUNK	4096
+
+/*
+ * Shared state of a key search. Workers claim chunks of candidate indices
+ * in increasing order under mutex, so once a match is found every lower
+ * candidate has already been claimed and the lowest match wins.
+ */
+typedef struct {
+	const char			*buf;
+	Py_ssize_t			stride;
+	Py_ssize_t			count;
+	const char			*nonce;
+	const char			*mic;
+	int					mic_len;
+	const char			*c;
+	int					c_len;
+	const char			*a;
+	int					a_len;
+	PyThread_type_lock	mutex;
+	PyThread_type_lock	done;
+	Py_ssize_t			next;
+	Py_ssize_t			found;
+	int					running;
+	int					failed;
+} zbee_search;
+
+/*
+ * Tries candidate keys until the buffer is exhausted or a lower match is
+ * known. Runs without the GIL, on the calling thread and on every spawned
+ * worker.
+ */
+static void
+zbee_search_run(zbee_search *s)
+{
+	zbee_cipher			cipher;
+	char				*m;
+	Py_ssize_t			i, start, end;
+	int					rc;
+
+	m = malloc(s->c_len > 0 ? s->c_len : 1);
+	if (m == NULL || zbee_cipher_open(&cipher)) {
+		free(m);
+		PyThread_acquire_lock(s->mutex, WAIT_LOCK);
+		s->failed = 1;
+		PyThread_release_lock(s->mutex);
+		return;
+	}
+	for (;;) {
+		PyThread_acquire_lock(s->mutex, WAIT_LOCK);
+		start = s->next;
+		if (start >= s->count || (s->found >= 0 && start > s->found)) {
+			PyThread_release_lock(s->mutex);
+			break;
+		}
+		s->next += ZBEE_SEARCH_CHUNK;
+		PyThread_release_lock(s->mutex);
+
+		end = start + ZBEE_SEARCH_CHUNK;
+		if (end > s->count) {
+			end = s->count;
+		}
+		for (i = start; i < end; i++) {
+			if (zbee_cipher_setkey(&cipher, s->buf + i * s->stride)) {
+				rc = -1;
+			} else {
+				rc = zbee_ccm_decrypt(&cipher, s->nonce, s->mic, s->mic_len,
+									s->c, s->c_len, s->a, s->a_len, m);
+			}
+			if (rc != 0) {
+				PyThread_acquire_lock(s->mutex, WAIT_LOCK);
+				if (rc < 0) {
+					s->failed = 1;
+				} else if (s->found < 0 || i < s->found) {
+					s->found = i;
+				}
+				PyThread_release_lock(s->mutex);
+				break;
+			}
+		}
+		if (i < end) {
+			break;
+		}
+	}
+	zbee_cipher_close(&cipher);
+	free(m);
+}
+
+/* Drops one worker from the search, returns non-zero for the last one. */
+static int
+zbee_search_finish(zbee_search *s)
+{
+	int					last;
+
+	PyThread_acquire_lock(s->mutex, WAIT_LOCK);
+	last = (--s->running == 0);
+	PyThread_release_lock(s->mutex);
+	return last;
+}
+
+static void
+zbee_search_worker(void *arg)
+{
+	zbee_search			*s = arg;
+
+	zbee_search_run(s);
+	if (zbee_search_finish(s)) {
+		PyThread_release_lock(s->done);
+	}
+}
+
+static PyObject *zigbee_crypt_search_key(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"nonce", "mic", "encrypted_payload", "zigbee_data", "buffer", "stride", "threads", NULL};
+	Py_buffer			nonce;
+	Py_buffer			mic;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	Py_buffer			buffer;
+	Py_ssize_t			stride = 1;
+	int					threads = 1;
+	zbee_search			s;
+	int					i;
+	PyObject			*res = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*y*y*y*y*|ni", kwlist,
+								&nonce,
+								&mic,
+								&encryptedData,
+								&zigbeeData,
+								&buffer, &stride, &threads)) {
+		return NULL;
+	}
+	if (nonce.len != ZBEE_SEC_CONST_NONCE_LEN) {
+		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
+		goto out;
+	}
+	if ((mic.len != 4) && (mic.len != 8) && (mic.len != 16)) {
+		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be 4, 8, or 16 bytes)");
+		goto out;
+	}
+	if (stride < 1 || threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "stride and threads must be at least 1");
+		goto out;
+	}
+	if (encryptedData.len > ZBEE_MAX_FRAME_LEN || zigbeeData.len > ZBEE_MAX_FRAME_LEN) {
+		PyErr_Format(PyExc_ValueError, "encrypted_payload and zigbee_data must be at most %d bytes", ZBEE_MAX_FRAME_LEN);
+		goto out;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.buf = buffer.buf;
+	s.stride = stride;
+	s.count = (buffer.len < ZBEE_SEC_CONST_KEYSIZE) ? 0 : (buffer.len - ZBEE_SEC_CONST_KEYSIZE) / stride + 1;
+	s.nonce = nonce.buf;
+	s.mic = mic.buf;
+	s.mic_len = (int)mic.len;
+	s.c = encryptedData.buf;
+	s.c_len = (int)encryptedData.len;
+	s.a = zigbeeData.buf;
+	s.a_len = (int)zigbeeData.len;
+	s.found = -1;
+	s.running = 1;
+	s.mutex = PyThread_allocate_lock();
+	s.done = PyThread_allocate_lock();
+	if (s.mutex == NULL || s.done == NULL) {
+		PyErr_NoMemory();
+		goto out_locks;
+	}
+	PyThread_acquire_lock(s.done, WAIT_LOCK);
+
+	Py_BEGIN_ALLOW_THREADS
+	/* The calling thread is worker number one. Fewer workers than asked
+	 * for is fine if a thread cannot be started. */
+	for (i = 1; i < threads; i++) {
+		PyThread_acquire_lock(s.mutex, WAIT_LOCK);
+		s.running++;
+		PyThread_release_lock(s.mutex);
+		if (PyThread_start_new_thread(zbee_search_worker, &s) == PYTHREAD_INVALID_THREAD_ID) {
+			zbee_search_finish(&s);
+			break;
+		}
+	}
+	zbee_search_run(&s);
+	if (!zbee_search_finish(&s)) {
+		PyThread_acquire_lock(s.done, WAIT_LOCK);
+	}
+	Py_END_ALLOW_THREADS
+
+	if (s.found >= 0) {
+		res = PyLong_FromSsize_t(s.found * stride);
+	} else if (s.failed) {
+		PyErr_SetString(PyExc_Exception, "key search failed");
+	} else {
+		Py_INCREF(Py_None);
+		res = Py_None;
+	}
+out_locks:
+	if (s.done != NULL) {
+		PyThread_free_lock(s.done);
+	}
+	if (s.mutex != NULL) {
+		PyThread_free_lock(s.mutex);
+	}
+out:
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&mic);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	PyBuffer_Release(&buffer);
+	return res;
+}
+
+static int
+CCMContext_init(zigbee_crypt_CCMContext *self, PyObject *args, PyObject *kwds)
+{
+	static char			*kwlist[] = {"key", "mic_len", NULL};
+	Py_buffer			zkey;
+	int					sizeMIC = 4;
+	char				key[ZBEE_SEC_CONST_KEYSIZE];
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|i", kwlist,
+								&zkey, &sizeMIC)) {
+		return -1;
+	}
+	if (zkey.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+		PyBuffer_Release(&zkey);
+		return -1;
+	}
+	memcpy(key, zkey.buf, ZBEE_SEC_CONST_KEYSIZE);
+	PyBuffer_Release(&zkey);
+	if ((sizeMIC != 0) && (sizeMIC != 4) && (sizeMIC != 8) && (sizeMIC != 16)) {
+		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be 0, 4, 8, or 16 bytes)");
+		return -1;
+	}
+	if (self->lock == NULL) {
+		self->lock = PyThread_allocate_lock();
+		if (self->lock == NULL) {
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	if (self->keyed) {
+		zbee_cipher_close(&self->cipher);
+	}
+	self->keyed = (zbee_ccm_open(&self->cipher, key) == 0);
+	self->mic_len = sizeMIC;
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_Exception, "setting the key failed");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+CCMContext_dealloc(zigbee_crypt_CCMContext *self)
+{
+	if (self->keyed) {
+		zbee_cipher_close(&self->cipher);
+	}
+	if (self->lock != NULL) {
+		PyThread_free_lock(self->lock);
+	}
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+CCMContext_encrypt(zigbee_crypt_CCMContext *self, PyObject *args)
+{
+	Py_buffer			nonce;
+	Py_buffer			unencryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*pEncrypted = NULL;
+	char				pEncMIC[ZBEE_SEC_CONST_MICSIZE];
+	char				*pOut;
+	const char			*err;
+	int					rc;
+
+	if (!PyArg_ParseTuple(args, "y*y*y*",
+								&nonce,
+								&unencryptedData,
+								&zigbeeData)) {
+		return NULL;
+	}
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_ValueError, "CCMContext has no key");
+		goto out;
+	}
+	if (nonce.len != ZBEE_SEC_CONST_NONCE_LEN) {
+		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
+		goto out;
+	}
+	err = zbee_ccm_length_error(unencryptedData.len, zigbeeData.len);
+	if (err != NULL) {
+		PyErr_SetString(PyExc_ValueError, err);
+		goto out;
+	}
+
+	pEncrypted = PyBytes_FromStringAndSize(NULL, unencryptedData.len);
+	if (pEncrypted == NULL) {
+		goto out;
+	}
+	pOut = PyBytes_AS_STRING(pEncrypted);
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	rc = -1;
+	if (self->keyed) {
+		rc = zbee_ccm_encrypt(&self->cipher, nonce.buf, self->mic_len,
+							unencryptedData.buf, unencryptedData.len,
+							zigbeeData.buf, zigbeeData.len,
+							pOut, pEncMIC);
+	}
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+	if (rc) {
+		PyErr_SetString(PyExc_Exception, "encryption of the payload failed");
+		Py_CLEAR(pEncrypted);
+		goto out;
+	}
+	pEncrypted = Py_BuildValue("(Ny#)", pEncrypted, pEncMIC, (Py_ssize_t)self->mic_len);
+out:
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&unencryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return pEncrypted;
+}
+
+/*
+ * Decrypts one frame with the context's key into out, which is either a
+ * fresh bytes object or a caller supplied writable buffer.
+ *  RETURNS
+ *      int                         - 1 if the MIC matched, 0 if it did
+ *                                    not, -1 with an exception set.
+ */
+static int
+CCMContext_decrypt_frame(zigbee_crypt_CCMContext *self, const Py_buffer *nonce,
+                         const Py_buffer *mic, const Py_buffer *c,
+                         const Py_buffer *a, char *out)
+{
+	int					micCheck;
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	micCheck = -1;
+	if (self->keyed) {
+		micCheck = zbee_ccm_decrypt(&self->cipher, nonce->buf, mic->buf, mic->len,
+									c->buf, c->len,
+									a->buf, a->len,
+									out);
+	}
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+	if (micCheck < 0) {
+		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
+	}
+	return micCheck;
+}
+
+static PyObject *
+CCMContext_decrypt(zigbee_crypt_CCMContext *self, PyObject *args)
+{
+	Py_buffer			nonce;
+	Py_buffer			oldMIC;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*pUnencrypted = NULL;
+	int					micCheck;
+
+	if (!PyArg_ParseTuple(args, "y*y*y*y*",
+								&nonce,
+								&oldMIC,
+								&encryptedData,
+								&zigbeeData)) {
+		return NULL;
+	}
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_ValueError, "CCMContext has no key");
+		goto out;
+	}
+	if (zbee_ccm_check_decrypt_args(&nonce, &oldMIC, &encryptedData, &zigbeeData, NULL, self->mic_len)) {
+		goto out;
+	}
+
+	pUnencrypted = PyBytes_FromStringAndSize(NULL, encryptedData.len);
+	if (pUnencrypted == NULL) {
+		goto out;
+	}
+	micCheck = CCMContext_decrypt_frame(self, &nonce, &oldMIC, &encryptedData, &zigbeeData,
+										PyBytes_AS_STRING(pUnencrypted));
+	if (micCheck < 0) {
+		Py_CLEAR(pUnencrypted);
+		goto out;
+	}
+	pUnencrypted = Py_BuildValue("(Ni)", pUnencrypted, micCheck);
+out:
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&oldMIC);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return pUnencrypted;
+}
+
+static PyObject *
+CCMContext_decrypt_into(zigbee_crypt_CCMContext *self, PyObject *args)
+{
+	Py_buffer			outBuffer;
+	Py_buffer			nonce;
+	Py_buffer			oldMIC;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*res = NULL;
+	int					micCheck;
+
+	if (!PyArg_ParseTuple(args, "w*y*y*y*y*",
+								&outBuffer,
+								&nonce,
+								&oldMIC,
+								&encryptedData,
+								&zigbeeData)) {
+		return NULL;
+	}
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_ValueError, "CCMContext has no key");
+		goto out;
+	}
+	if (zbee_ccm_check_decrypt_args(&nonce, &oldMIC, &encryptedData, &zigbeeData, &outBuffer, self->mic_len)) {
+		goto out;
+	}
+	micCheck = CCMContext_decrypt_frame(self, &nonce, &oldMIC, &encryptedData, &zigbeeData, outBuffer.buf);
+	if (micCheck >= 0) {
+		res = PyLong_FromLong(micCheck);
+	}
+out:
+	PyBuffer_Release(&outBuffer);
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&oldMIC);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return res;
+}
+
+static PyObject *
+CCMContext_decrypt_nwk_frame(zigbee_crypt_CCMContext *self, PyObject *args, PyObject *kwds)
+{
+	static char			*kwlist[] = {"raw_frame", "ext_src_lookup", "fcs", NULL};
+	Py_buffer			frame;
+	PyObject			*lookup = Py_None;
+	PyObject			*res = NULL;
+	int					fcs = 1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|Op", kwlist,
+								&frame,
+								&lookup,
+								&fcs)) {
+		return NULL;
+	}
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_ValueError, "CCMContext has no key");
+	} else {
+		res = zbee_decrypt_nwk_frame(NULL, self, &frame, lookup, fcs);
+	}
+	PyBuffer_Release(&frame);
+	return res;
+}
+
+static PyObject *
+CCMContext_encrypt_many(zigbee_crypt_CCMContext *self, PyObject *args, PyObject *kwds)
+{
+	static char			*kwlist[] = {"nonces", "payloads", "aads", "payload_offsets", "aad_offsets", NULL};
+	PyObject			*nonces, *payloads, *aads;
+	PyObject			*payload_offsets = NULL;
+	PyObject			*aad_offsets = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOO|OO", kwlist,
+								&nonces, &payloads, &aads,
+								&payload_offsets, &aad_offsets)) {
+		return NULL;
+	}
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_ValueError, "CCMContext has no key");
+		return NULL;
+	}
+	return zbee_ccm_encrypt_many(NULL, self, self->mic_len, nonces, payloads, aads, payload_offsets, aad_offsets);
+}
+
+static PyObject *
+CCMContext_decrypt_many(zigbee_crypt_CCMContext *self, PyObject *args, PyObject *kwds)
+{
+	static char			*kwlist[] = {"nonces", "mics", "payloads", "aads", "payload_offsets", "aad_offsets", NULL};
+	PyObject			*nonces, *mics, *payloads, *aads;
+	PyObject			*payload_offsets = NULL;
+	PyObject			*aad_offsets = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOO|OO", kwlist,
+								&nonces, &mics, &payloads, &aads,
+								&payload_offsets, &aad_offsets)) {
+		return NULL;
+	}
+	if (!self->keyed) {
+		PyErr_SetString(PyExc_ValueError, "CCMContext has no key");
+		return NULL;
+	}
+	return zbee_ccm_decrypt_many(NULL, self, self->mic_len, nonces, mics, payloads, aads, payload_offsets, aad_offsets);
+}
+
+static PyMethodDef CCMContext_Methods[] = {
+	{ "encrypt", (PyCFunction)CCMContext_encrypt, METH_VARARGS, "encrypt(nonce, decrypted_payload, zigbee_data)\nEncrypt data with the context's key and MIC size\n\n@type nonce: String\n@param nonce: 13-byte nonce\n@type decrypted_payload: String\n@param decrypted_payload: The decrypted data to encrypt\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the decrypted payload, MIC or FCS\n@rtype: Tuple\n@return: (encrypted_payload, mic)" },
+	{ "decrypt", (PyCFunction)CCMContext_decrypt, METH_VARARGS, "decrypt(nonce, mic, encrypted_payload, zigbee_data)\nDecrypt data with the context's key and MIC size\n\n@type nonce: String\n@param nonce: 13-byte nonce\n@type mic: String\n@param mic: message integrity check (MIC), mic_len bytes\n@type encrypted_payload: String\n@param encrypted_payload: The encrypted data to decrypt\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the encrypted payload, MIC, or FCS\n@rtype: Tuple\n@return: (decrypted_payload, mic_check)" },
+	{ "decrypt_into", (PyCFunction)CCMContext_decrypt_into, METH_VARARGS, "decrypt_into(out_buffer, nonce, mic, encrypted_payload, zigbee_data)\nDecrypt data with the context's key and MIC size into a writable buffer, see decrypt_ccm_into()\n\n@rtype: Integer\n@return: mic_check" },
+	{ "decrypt_nwk_frame", (PyCFunction)(void(*)(void))CCMContext_decrypt_nwk_frame, METH_VARARGS | METH_KEYWORDS, "decrypt_nwk_frame(raw_frame, ext_src_lookup=None, fcs=True)\nDecrypt a raw NWK or APS-secured frame with the context's key, see decrypt_nwk_frame(). The MIC size is the frame's, not the context's.\n\n@rtype: Tuple\n@return: (header_len, decrypted_payload, mic_check), or None" },
+	{ "encrypt_many", (PyCFunction)(void(*)(void))CCMContext_encrypt_many, METH_VARARGS | METH_KEYWORDS, "encrypt_many(nonces, payloads, aads, payload_offsets=None, aad_offsets=None)\nEncrypt a batch of frames with the context's key and MIC size, see encrypt_ccm_many()\n\n@rtype: List\n@return: [(encrypted_payload, mic), ...]" },
+	{ "decrypt_many", (PyCFunction)(void(*)(void))CCMContext_decrypt_many, METH_VARARGS | METH_KEYWORDS, "decrypt_many(nonces, mics, payloads, aads, payload_offsets=None, aad_offsets=None)\nDecrypt a batch of frames with the context's key and MIC size, see decrypt_ccm_many()\n\n@rtype: List\n@return: [(decrypted_payload, mic_check), ...]" },
+	{ NULL, NULL, 0, NULL },
+};
+
+static PyMemberDef CCMContext_Members[] = {
+	{ "mic_len", T_INT, offsetof(zigbee_crypt_CCMContext, mic_len), READONLY, "MIC size in bytes" },
+	{ NULL, 0, 0, 0, NULL },
+};
+
+static PyTypeObject zigbee_crypt_CCMContextType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "zigbee_crypt.CCMContext",
+	.tp_basicsize	= sizeof(zigbee_crypt_CCMContext),
+	.tp_dealloc		= (destructor)CCMContext_dealloc,
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_doc			= "CCMContext(key, mic_len=4)\nCCM* cipher keyed once and reused for many frames\n\n@type key: String\n@param key: 16-byte key\n@type mic_len: Integer\n@param mic_len: the size in bytes of the MIC (0, 4, 8 or 16)",
+	.tp_methods		= CCMContext_Methods,
+	.tp_members		= CCMContext_Members,
+	.tp_init		= (initproc)CCMContext_init,
+	.tp_new			= PyType_GenericNew,
+};
+
+/*
+ * Keyring: a set of candidate keys with their key schedules expanded once,
+ * for trying every key of a session against captured frames. The keys can
+ * not be changed after creation, but the ciphers run without the GIL and a
+ * libgcrypt handle must not be used by two threads at once, so as with
+ * CCMContext they are guarded by a per-keyring lock.
+ */
+typedef struct {
+	PyObject_HEAD
+	zbee_cipher			*ciphers;
+	Py_ssize_t			count;
+	PyThread_type_lock	lock;
+} zigbee_crypt_Keyring;
+
+static PyTypeObject zigbee_crypt_KeyringType;
+
+static int
+Keyring_init(zigbee_crypt_Keyring *self, PyObject *args, PyObject *kwds)
+{
+	static char			*kwlist[] = {"keys", NULL};
+	PyObject			*keys;
+	zbee_field_list		f_key;
+	const char			*key;
+	Py_ssize_t			sizeKey;
+	Py_ssize_t			i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &keys)) {
+		return -1;
+	}
+	if (self->ciphers != NULL) {
+		PyErr_SetString(PyExc_TypeError, "Keyring keys can not be changed");
+		return -1;
+	}
+	self->lock = PyThread_allocate_lock();
+	if (self->lock == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	if (zbee_field_list_init(&f_key, "keys", keys, NULL, ZBEE_SEC_CONST_KEYSIZE, -1)) {
+		return -1;
+	}
+	self->ciphers = PyMem_New(zbee_cipher, f_key.count ? f_key.count : 1);
+	if (self->ciphers == NULL) {
+		PyErr_NoMemory();
+		zbee_field_list_release(&f_key);
+		return -1;
+	}
+	for (i = 0; i < f_key.count; i++) {
+		if (zbee_field_list_get(&f_key, i, &key, &sizeKey)) {
+			break;
+		}
+		if (sizeKey != ZBEE_SEC_CONST_KEYSIZE) {
+			PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+			break;
+		}
+		if (zbee_ccm_open(&self->ciphers[i], key)) {
+			PyErr_SetString(PyExc_Exception, "setting the key failed");
+			break;
+		}
+		self->count++;
+	}
+	zbee_field_list_release(&f_key);
+	return (self->count == f_key.count) ? 0 : -1;
+}
+
+static void
+Keyring_dealloc(zigbee_crypt_Keyring *self)
+{
+	Py_ssize_t			i;
+
+	for (i = 0; i < self->count; i++) {
+		zbee_cipher_close(&self->ciphers[i]);
+	}
+	PyMem_Free(self->ciphers);
+	if (self->lock != NULL) {
+		PyThread_free_lock(self->lock);
+	}
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static Py_ssize_t
+Keyring_length(zigbee_crypt_Keyring *self)
+{
+	return self->count;
+}
+
+/*
+ * Returns the index of the first key in the keyring under which the MIC of
+ * the frame matches, or None.
+ */
+static PyObject *
+zbee_keyring_try(zigbee_crypt_Keyring *self, const char *nonce, Py_ssize_t sizeNonce,
+                 const char *mic, Py_ssize_t sizeMIC, const char *c, Py_ssize_t sizeC,
+                 const char *a, Py_ssize_t sizeA)
+{
+	zbee_cipher			*lanes[ZBEE_CIPHER_LANES];
+	int					match[ZBEE_CIPHER_LANES];
+	char				*m;
+	const char			*err;
+	Py_ssize_t			i, found = -1;
+	int					n, l, rc = 0;
+
+	if (sizeNonce != ZBEE_SEC_CONST_NONCE_LEN) {
+		PyErr_SetString(PyExc_ValueError, "incorrect nonce size (must be 13)");
+		return NULL;
+	}
+	if ((sizeMIC != 4) && (sizeMIC != 8) && (sizeMIC != 16)) {
+		PyErr_SetString(PyExc_ValueError, "incorrect mic size (must be 4, 8, or 16 bytes)");
+		return NULL;
+	}
+	err = zbee_ccm_length_error(sizeC, sizeA);
+	if (err != NULL) {
+		PyErr_SetString(PyExc_ValueError, err);
+		return NULL;
+	}
+	if (self->lock == NULL) {
+		PyErr_SetString(PyExc_ValueError, "Keyring has no keys");
+		return NULL;
+	}
+	m = PyMem_Malloc(ZBEE_CIPHER_LANES * sizeC + 1);
+	if (m == NULL) {
+		return PyErr_NoMemory();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	for (i = 0; rc == 0 && found < 0 && i < self->count; i += n) {
+		n = (self->count - i < ZBEE_CIPHER_LANES) ? (int)(self->count - i) : ZBEE_CIPHER_LANES;
+		for (l = 0; l < n; l++) {
+			lanes[l] = &self->ciphers[i + l];
+		}
+		rc = zbee_ccm_check_lanes(lanes, n, nonce, mic, (int)sizeMIC, c, (int)sizeC, a, (int)sizeA, m, match);
+		for (l = 0; rc == 0 && l < n; l++) {
+			if (match[l]) {
+				found = i + l;
+				break;
+			}
+		}
+	}
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+
+	PyMem_Free(m);
+	if (rc) {
+		PyErr_SetString(PyExc_Exception, "decryption of the payload failed");
+		return NULL;
+	}
+	if (found < 0) {
+		Py_RETURN_NONE;
+	}
+	return PyLong_FromSsize_t(found);
+}
+
+static PyObject *
+Keyring_try_keys(zigbee_crypt_Keyring *self, PyObject *args)
+{
+	Py_buffer			nonce;
+	Py_buffer			mic;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*res;
+
+	if (!PyArg_ParseTuple(args, "y*y*y*y*",
+								&nonce,
+								&mic,
+								&encryptedData,
+								&zigbeeData)) {
+		return NULL;
+	}
+	res = zbee_keyring_try(self, nonce.buf, nonce.len, mic.buf, mic.len,
+							encryptedData.buf, encryptedData.len, zigbeeData.buf, zigbeeData.len);
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&mic);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return res;
+}
+
+static PyMethodDef Keyring_Methods[] = {
+	{ "try_keys", (PyCFunction)Keyring_try_keys, METH_VARARGS, "try_keys(nonce, mic, encrypted_payload, zigbee_data)\nFind the key of the keyring which a frame was encrypted with\n\n@type nonce: String\n@param nonce: 13-byte nonce\n@type mic: String\n@param mic: 4, 8 or 16-byte message integrity check (MIC)\n@type encrypted_payload: String\n@param encrypted_payload: The encrypted data\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the encrypted payload, MIC, or FCS\n@rtype: Integer\n@return: Index of the first key whose MIC matches, or None" },
+	{ NULL, NULL, 0, NULL },
+};
+
+static PySequenceMethods Keyring_Sequence = {
+	.sq_length		= (lenfunc)Keyring_length,
+};
+
+static PyTypeObject zigbee_crypt_KeyringType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "zigbee_crypt.Keyring",
+	.tp_basicsize	= sizeof(zigbee_crypt_Keyring),
+	.tp_dealloc		= (destructor)Keyring_dealloc,
+	.tp_as_sequence	= &Keyring_Sequence,
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_doc			= "Keyring(keys)\nCandidate keys with their key schedules expanded once, for try_keys()\n\n@type keys: List\n@param keys: 16-byte keys, or one packed buffer of keys",
+	.tp_methods		= Keyring_Methods,
+	.tp_init		= (initproc)Keyring_init,
+	.tp_new			= PyType_GenericNew,
+};
+
+static PyObject *zigbee_crypt_try_keys(PyObject *self, PyObject *args) {
+	PyObject			*keyring;
+	Py_buffer			nonce;
+	Py_buffer			mic;
+	Py_buffer			encryptedData;
+	Py_buffer			zigbeeData;
+	PyObject			*res = NULL;
+
+	if (!PyArg_ParseTuple(args, "Oy*y*y*y*", &keyring,
+								&nonce,
+								&mic,
+								&encryptedData,
+								&zigbeeData)) {
+		return NULL;
+	}
+	/* A plain list of keys gets a keyring for the length of the call. */
+	if (PyObject_TypeCheck(keyring, &zigbee_crypt_KeyringType)) {
+		Py_INCREF(keyring);
+	} else {
+		keyring = PyObject_CallFunctionObjArgs((PyObject *)&zigbee_crypt_KeyringType, keyring, NULL);
+	}
+	if (keyring != NULL) {
+		res = zbee_keyring_try((zigbee_crypt_Keyring *)keyring, nonce.buf, nonce.len, mic.buf, mic.len,
+								encryptedData.buf, encryptedData.len, zigbeeData.buf, zigbeeData.len);
+		Py_DECREF(keyring);
+	}
+	PyBuffer_Release(&nonce);
+	PyBuffer_Release(&mic);
+	PyBuffer_Release(&encryptedData);
+	PyBuffer_Release(&zigbeeData);
+	return res;
+}
+
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_key_hash
+ *  DESCRIPTION
+ *      ZigBee Keyed Hash Function. Described in ZigBee specification
+ *      section B.1.4, and in FIPS Publication 198. Strictly speaking
+ *      there is nothing about the Keyed Hash Function which restricts
+ *      it to only a single byte input, but that's all ZigBee ever uses.
+ *
+ *      This function implements the hash function:
+ *          Hash(Key, text) = H((Key XOR opad) || H((Key XOR ipad) || text));
+ *          ipad = 0x36 repeated.
+ *          opad = 0x5c repeated.
+ *          H() = ZigBee Cryptographic Hash (B.1.3 and B.6).
+ *---------------------------------------------------------------
+ */
+static PyObject *zigbee_sec_key_hash(PyObject *self, PyObject *args) {
+	Py_buffer			key;
+	char				input;
+	char				hash_out[ZBEE_SEC_CONST_BLOCKSIZE];
+
+	if (!PyArg_ParseTuple(args, "s*c", &key, &input)) {
+		return NULL;
+	}
+	if (key.len != ZBEE_SEC_CONST_KEYSIZE) {
+		PyErr_SetString(PyExc_ValueError, "incorrect key size (must be 16)");
+		PyBuffer_Release(&key);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	zbee_sec_key_hash(key.buf, input, hash_out);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&key);
+
+	return Py_BuildValue("y#", hash_out, (Py_ssize_t)ZBEE_SEC_CONST_BLOCKSIZE);
+}
+
+static PyObject *zigbee_crypt_hash_mmo(PyObject *self, PyObject *args) {
+	Py_buffer			data;
+	char				hash_out[ZBEE_SEC_CONST_BLOCKSIZE];
+
+	if (!PyArg_ParseTuple(args, "y*", &data)) {
+		return NULL;
+	}
+	if (data.len > ZBEE_SEC_HASH_MAX_INPUT) {
+		PyErr_Format(PyExc_ValueError, "input too long (must be at most %d bytes)", ZBEE_SEC_HASH_MAX_INPUT);
+		PyBuffer_Release(&data);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	zbee_sec_hash(data.buf, (int)data.len, hash_out);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&data);
+
+	return Py_BuildValue("y#", hash_out, (Py_ssize_t)ZBEE_SEC_CONST_BLOCKSIZE);
+}
+
+/* One input of hash_mmo_many(), resolved while holding the GIL. */
+typedef struct {
+	const char			*data;
+	Py_ssize_t			len;
+	char				hash[ZBEE_SEC_CONST_BLOCKSIZE];
+} zbee_hash_input;
+
+static PyObject *zigbee_crypt_hash_mmo_many(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"inputs", "offsets", NULL};
+	PyObject			*inputs;
+	PyObject			*offsets = NULL;
+	zbee_field_list		f_input;
+	zbee_hash_input		*items = NULL;
+	PyObject			*res = NULL;
+	PyObject			*item;
+	Py_ssize_t			i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &inputs, &offsets)) {
+		return NULL;
+	}
+	if (zbee_field_list_init(&f_input, "inputs", inputs, offsets, 0, -1)) {
+		return NULL;
+	}
+	items = PyMem_New(zbee_hash_input, f_input.count ? f_input.count : 1);
+	if (items == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < f_input.count; i++) {
+		if (zbee_field_list_get(&f_input, i, &items[i].data, &items[i].len)) {
+			goto out;
+		}
+		if (items[i].len > ZBEE_SEC_HASH_MAX_INPUT) {
+			PyErr_Format(PyExc_ValueError, "input %zd too long (must be at most %d bytes)", i, ZBEE_SEC_HASH_MAX_INPUT);
+			goto out;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i < f_input.count; i++) {
+		zbee_sec_hash(items[i].data, (int)items[i].len, items[i].hash);
+	}
+	Py_END_ALLOW_THREADS
+
+	res = PyList_New(f_input.count);
+	if (res == NULL) {
+		goto out;
+	}
+	for (i = 0; i < f_input.count; i++) {
+		item = PyBytes_FromStringAndSize(items[i].hash, ZBEE_SEC_CONST_BLOCKSIZE);
+		if (item == NULL) {
+			Py_CLEAR(res);
+			goto out;
+		}
+		PyList_SET_ITEM(res, i, item);
+	}
+out:
+	PyMem_Free(items);
+	zbee_field_list_release(&f_input);
+	return res;
+}
+
+static PyObject *zigbee_crypt_fcs(PyObject *self, PyObject *args) {
+	Py_buffer			data;
+	char				fcs[2];
+
+	if (!PyArg_ParseTuple(args, "y*", &data)) {
+		return NULL;
+	}
+	if (data.len > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "data too long");
+		PyBuffer_Release(&data);
+		return NULL;
+	}
+	zbee_dot154_fcs(data.buf, (int)data.len, fcs);
+	PyBuffer_Release(&data);
+
+	return Py_BuildValue("y#", fcs, (Py_ssize_t)2);
+}
+
+static PyObject *zigbee_crypt_fcs_check(PyObject *self, PyObject *args) {
+	Py_buffer			frame;
+	int					valid;
+
+	if (!PyArg_ParseTuple(args, "y*", &frame)) {
+		return NULL;
+	}
+	if (frame.len > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "frame too long");
+		PyBuffer_Release(&frame);
+		return NULL;
+	}
+	valid = zbee_dot154_fcs_check(frame.buf, (int)frame.len);
+	PyBuffer_Release(&frame);
+
+	return PyBool_FromLong(valid);
+}
+
+static PyObject *zigbee_crypt_fcs_check_many(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char			*kwlist[] = {"frames", "offsets", NULL};
+	PyObject			*frames;
+	PyObject			*offsets = NULL;
+	zbee_field_list		f_frame;
+	const char			*p;
+	Py_ssize_t			len;
+	char				*valid = NULL;
+	PyObject			*res = NULL;
+	Py_ssize_t			i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &frames, &offsets)) {
+		return NULL;
+	}
+	if (zbee_field_list_init(&f_frame, "frames", frames, offsets, 0, -1)) {
+		return NULL;
+	}
+	valid = PyMem_Malloc(f_frame.count ? f_frame.count : 1);
+	if (valid == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < f_frame.count; i++) {
+		zbee_field_list_get(&f_frame, i, &p, &len);
+		if (len > INT_MAX) {
+			PyErr_Format(PyExc_ValueError, "frame %zd too long", i);
+			goto out;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i < f_frame.count; i++) {
+		zbee_field_list_get(&f_frame, i, &p, &len);
+		valid[i] = (char)zbee_dot154_fcs_check(p, (int)len);
+	}
+	Py_END_ALLOW_THREADS
+
+	res = PyList_New(f_frame.count);
+	if (res == NULL) {
+		goto out;
+	}
+	for (i = 0; i < f_frame.count; i++) {
+		PyList_SET_ITEM(res, i, PyBool_FromLong(valid[i]));
+	}
+out:
+	PyMem_Free(valid);
+	zbee_field_list_release(&f_frame);
+	return res;
+}
+
+
+
+static PyMethodDef zigbee_crypt_Methods[] = {
+	{ "decrypt_ccm", zigbee_crypt_decrypt_ccm, METH_VARARGS, "decrypt_ccm(key, nonce, mic, encrypted_payload, zigbee_data)\nDecrypt data with a 0, 32, 64, or 128-bit MIC\n\n@type key: String\n@param key: 16-byte decryption key\n@type nonce: String\n@param nonce: 13-byte nonce\n@type mic: String\n@param mic: 4-16 byte message integrity check (MIC)\n@type encrypted_payload: String\n@param encrypted_payload: The encrypted data to decrypt\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the encrypted payload, MIC, or FCS" },
+	{ "decrypt_ccm_into", zigbee_crypt_decrypt_ccm_into, METH_VARARGS, "decrypt_ccm_into(out_buffer, key, nonce, mic, encrypted_payload, zigbee_data)\nDecrypt data like decrypt_ccm(), writing the payload into the start of a writable buffer instead of a new bytes object\n\nout_buffer may be the encrypted payload itself to decrypt in place, but must not otherwise overlap the other arguments.\n\n@type out_buffer: Buffer\n@param out_buffer: Writable buffer of at least len(encrypted_payload) bytes, such as a bytearray or memoryview\n@rtype: Integer\n@return: mic_check" },
+	{ "decrypt_nwk_frame", (PyCFunction)(void(*)(void))zigbee_crypt_decrypt_nwk_frame, METH_VARARGS | METH_KEYWORDS, "decrypt_nwk_frame(raw_frame, key, ext_src_lookup=None, fcs=True)\nDecrypt a NWK or APS-secured ZigBee frame straight from the raw IEEE 802.15.4 bytes, such as those of pnext()\n\nThe MAC, NWK, APS and auxiliary security headers are parsed in C to build the nonce and zigbee_data, with the security level taken to be ENC-MIC-32 like kbdecrypt(). APS security is only looked for when the NWK frame is not secured.\n\n@type raw_frame: String\n@param raw_frame: The 802.15.4 frame\n@type key: String\n@param key: 16-byte decryption key\n@type ext_src_lookup: Mapping or Callable\n@param ext_src_lookup: Maps the NWK short source address to the extended source address (an integer, or 8 bytes in over-the-air order) for frames which do not carry it\n@type fcs: Boolean\n@param fcs: Whether raw_frame ends in the 2-byte FCS\n@rtype: Tuple\n@return: (header_len, decrypted_payload, mic_check), where header_len is the offset of the encrypted payload in raw_frame, or None if the frame is not secured or its extended source is unknown" },
+	{ "parse_nwk_frame", (PyCFunction)(void(*)(void))zigbee_crypt_parse_nwk_frame, METH_VARARGS | METH_KEYWORDS, "parse_nwk_frame(raw_frame, fcs=True)\nRead the addressing and key identifier of a NWK or APS-secured frame, parsed as by decrypt_nwk_frame()\n\nExtended addresses are returned as integers, like scapy's, and are None when the frame does not carry them.\n\n@type raw_frame: String\n@param raw_frame: The 802.15.4 frame\n@type fcs: Boolean\n@param fcs: Whether raw_frame ends in the 2-byte FCS\n@rtype: Tuple\n@return: (aps, key_id, mac_src, nwk_src, nwk_ext_src, aux_ext_src), where aps is True for APS security and mac_src is None unless the MAC source is a short address, or None if the frame is not secured" },
+	{ "parse_mac", (PyCFunction)(void(*)(void))zigbee_crypt_parse_mac, METH_VARARGS | METH_KEYWORDS, "parse_mac(raw_frame, fcs=True)\nParse the IEEE 802.15.4-2003/2006 MAC header and auxiliary security header of a frame in C\n\nAddresses are integers, like scapy's. Fields the frame does not carry are None.\n\n@type raw_frame: String\n@param raw_frame: The 802.15.4 frame\n@type fcs: Boolean\n@param fcs: Whether raw_frame ends in the 2-byte FCS\n@rtype: MACHeader\n@return: The parsed header, or None if the frame is truncated or of another frame version" },
+	{ "parse_mac_many", (PyCFunction)(void(*)(void))zigbee_crypt_parse_mac_many, METH_VARARGS | METH_KEYWORDS, "parse_mac_many(frames, offsets=None, fcs=True, out=None)\nParse the MAC headers of a batch of frames into packed fixed-size records\n\nframes is either a sequence of bytes objects or a single packed buffer split by offsets (count + 1 boundaries). Each record is MAC_RECORD_SIZE bytes laid out as MAC_RECORD_FORMAT, in the fields dst_addr, src_addr, frame_counter, fcf, dst_pan, src_pan, hdr_len, payload, payload_len, frame_type, seq, dst_addr_mode, src_addr_mode, sec_level, key_id_mode, key_index and valid; absent fields are 0, and the record of a frame parse_mac() rejects is all zero. killerbee.dot154decode.DOT154_MAC_RECORD_DTYPE reads the records as a NumPy structured array.\n\n@type out: Buffer\n@param out: Writable buffer to fill, such as a NumPy array, instead of a new bytearray\n@rtype: Buffer\n@return: out, or the new bytearray" },
+	{ "encrypt_ccm", zigbee_crypt_encrypt_ccm, METH_VARARGS, "encrypt_ccm(key, nonce, mic_size, decrypted_payload, zigbee_data)\nEncrypt data with a 0, 32, 64, or 128-bit MIC\n\n@type key: String\n@param key: 16-byte decryption key\n@type nonce: String\n@param nonce: 13-byte nonce\n@type mic_size: Integer\n@param mic_size: the size in bytes of the desired MIC\n@type decrypted_payload: String\n@param decrypted_payload: The decrypted data to encrypt\n@type zigbee_data: String\n@param zigbee_data: The zigbee data within the frame, without the decrypted payload, MIC or FCS" },
+	{ "decrypt_ccm_many", (PyCFunction)(void(*)(void))zigbee_crypt_decrypt_ccm_many, METH_VARARGS | METH_KEYWORDS, "decrypt_ccm_many(key, nonces, mics, payloads, aads, payload_offsets=None, aad_offsets=None)\nDecrypt a batch of frames under one key in a single call\n\nEach of nonces, mics, payloads and aads is either a sequence with one bytes object per frame, or a single packed buffer. Packed payloads and aads are split by payload_offsets and aad_offsets (count + 1 boundaries), packed nonces are 13 bytes per frame and packed mics are split evenly between the frames.\n\n@type key: String\n@param key: 16-byte decryption key\n@rtype: List\n@return: [(decrypted_payload, mic_check), ...]" },
+	{ "encrypt_ccm_many", (PyCFunction)(void(*)(void))zigbee_crypt_encrypt_ccm_many, METH_VARARGS | METH_KEYWORDS, "encrypt_ccm_many(key, nonces, mic_size, payloads, aads, payload_offsets=None, aad_offsets=None)\nEncrypt a batch of frames under one key in a single call\n\nnonces, payloads and aads take the same forms as for decrypt_ccm_many().\n\n@type key: String\n@param key: 16-byte encryption key\n@type mic_size: Integer\n@param mic_size: the size in bytes of the desired MIC\n@rtype: List\n@return: [(encrypted_payload, mic), ...]" },
+	{ "encrypt_ccm_sequence", (PyCFunction)(void(*)(void))zigbee_crypt_encrypt_ccm_sequence, METH_VARARGS | METH_KEYWORDS, "encrypt_ccm_sequence(key, nonce_template, counter_offset, start, count, payload, aad_template, mic_size=4, header=b'', fcs=True)\nEncrypt one payload under count consecutive frame counters, building complete frames for injection\n\nFor each frame counter from start, the counter is written little endian into bytes 8 to 11 of the nonce and at counter_offset in the aad, and the frame header || aad || encrypted payload || MIC || FCS is built. The aad is sent as it is authenticated, ZigBee receivers restore the security level of the security control field themselves.\n\n@type key: String\n@param key: 16-byte encryption key\n@type nonce_template: String\n@param nonce_template: 13-byte nonce, its frame counter is replaced\n@type counter_offset: Integer\n@param counter_offset: Offset of the 4-byte frame counter in aad_template, the auxiliary security header's\n@type payload: String\n@param payload: The decrypted data to encrypt\n@type aad_template: String\n@param aad_template: The zigbee data within the frame, without the decrypted payload, MIC or FCS\n@type header: String\n@param header: Bytes sent ahead of the aad, such as the 802.15.4 MAC header\n@type fcs: Boolean\n@param fcs: Whether to append the 802.15.4 FCS\n@rtype: List\n@return: [frame, ...]" },
+	{ "search_key", (PyCFunction)(void(*)(void))zigbee_crypt_search_key, METH_VARARGS | METH_KEYWORDS, "search_key(nonce, mic, encrypted_payload, zigbee_data, buffer, stride=1, threads=1)\nSearch a buffer for the key of an encrypted frame\n\nEvery 16-byte window of buffer, stepping by stride bytes, is tried as the key until one decrypts the frame with a matching MIC. The nonce and zigbee_data of the frame are the same as for decrypt_ccm(). The search runs without the GIL on the given number of threads.\n\n@type buffer: Buffer\n@param buffer: Key material to search, such as bytes or an mmap\n@type stride: Integer\n@param stride: Distance in bytes between candidate keys\n@type threads: Integer\n@param threads: Number of threads to search with\n@rtype: Integer\n@return: Offset of the lowest matching key in buffer, or None" },
+	{ "try_keys", zigbee_crypt_try_keys, METH_VARARGS, "try_keys(keyring, nonce, mic, encrypted_payload, zigbee_data)\nFind which of several candidate keys a frame was encrypted with\n\n@type keyring: Keyring\n@param keyring: A Keyring, or a list of 16-byte keys\n@type mic: String\n@param mic: 4, 8 or 16-byte message integrity check (MIC)\n@rtype: Integer\n@return: Index of the first key whose MIC matches, or None" },
+	{ "hash_mmo", zigbee_crypt_hash_mmo, METH_VARARGS, "hash_mmo(data)\nZigBee Cryptographic Hash (Matyas-Meyer-Oseas, B.1.3 and B.6) of the supplied data.\n\n@type data: String\n@param data: Data to hash, at most 8191 bytes\n@rtype: String\n@return: 16-byte hash" },
+	{ "hash_mmo_many", (PyCFunction)(void(*)(void))zigbee_crypt_hash_mmo_many, METH_VARARGS | METH_KEYWORDS, "hash_mmo_many(inputs, offsets=None)\nZigBee Cryptographic Hash of every input in a single call, e.g. link keys from a list of install codes\n\ninputs is either a sequence of bytes objects or a single packed buffer split by offsets (count + 1 boundaries).\n\n@rtype: List\n@return: [hash, ...]" },
+	{ "fcs", zigbee_crypt_fcs, METH_VARARGS, "fcs(data)\nIEEE 802.15.4 FCS (CRC-16 Kermit) of a frame, like killerbee.kbutils.makeFCS()\n\n@type data: String\n@param data: The frame, without FCS\n@rtype: String\n@return: 2-byte FCS in little-endian order" },
+	{ "fcs_check", zigbee_crypt_fcs_check, METH_VARARGS, "fcs_check(frame)\nCheck the FCS of an IEEE 802.15.4 frame\n\n@type frame: String\n@param frame: The frame, ending in its 2-byte FCS\n@rtype: Boolean\n@return: True if the FCS matches" },
+	{ "fcs_check_many", (PyCFunction)(void(*)(void))zigbee_crypt_fcs_check_many, METH_VARARGS | METH_KEYWORDS, "fcs_check_many(frames, offsets=None)\nCheck the FCS of every frame in a single call, e.g. all records of a capture\n\nframes is either a sequence of bytes objects or a single packed buffer split by offsets (count + 1 boundaries).\n\n@rtype: List\n@return: [valid, ...]" },
+	{ "sec_key_hash", zigbee_sec_key_hash, METH_VARARGS, "sec_key_hash(key, input)\nHash the supplied key as per ZigBee Cryptographic Hash (B.1.3 and B.6).\n\n@type key: String\n@param key: 16-byte key to hash\n@type input: Char\n@param input: Character terminator for key" },
+	{ NULL, NULL, 0, NULL },
+};
+
+
+
+ZIGBEE_CRYPT_INIT
+{
+    PyObject *module;
+    if (zbee_crypt_init()) {
+        PyErr_SetString(PyExc_ImportError, "libgcrypt initialization failed");
+        return ZIGBEE_MOD_ERROR_VAL;
+    }
+    if (PyType_Ready(&zigbee_crypt_CCMContextType) < 0)
+        return ZIGBEE_MOD_ERROR_VAL;
+    if (PyType_Ready(&zigbee_crypt_KeyringType) < 0)
+        return ZIGBEE_MOD_ERROR_VAL;
+    if (PyType_Ready(&zigbee_crypt_NWKFrameType) < 0)
+        return ZIGBEE_MOD_ERROR_VAL;
+    if (PyType_Ready(&zigbee_crypt_APSFrameType) < 0)
+        return ZIGBEE_MOD_ERROR_VAL;
+    if (zigbee_crypt_MACHeaderType.tp_name == NULL &&
+        PyStructSequence_InitType2(&zigbee_crypt_MACHeaderType, &zigbee_crypt_MACHeader_desc) < 0)
+        return ZIGBEE_MOD_ERROR_VAL;
     ZIGBEE_MOD_DEF
+    if (module == NULL)
+        return ZIGBEE_MOD_ERROR_VAL;
+    Py_INCREF(&zigbee_crypt_CCMContextType);
+    PyModule_AddObject(module, "CCMContext", (PyObject *)&zigbee_crypt_CCMContextType);
+    Py_INCREF(&zigbee_crypt_KeyringType);
+    PyModule_AddObject(module, "Keyring", (PyObject *)&zigbee_crypt_KeyringType);
+    Py_INCREF(&zigbee_crypt_NWKFrameType);
+    PyModule_AddObject(module, "NWKFrame", (PyObject *)&zigbee_crypt_NWKFrameType);
+    Py_INCREF(&zigbee_crypt_APSFrameType);
+    PyModule_AddObject(module, "APSFrame", (PyObject *)&zigbee_crypt_APSFrameType);
+    Py_INCREF(&zigbee_crypt_MACHeaderType);
+    PyModule_AddObject(module, "MACHeader", (PyObject *)&zigbee_crypt_MACHeaderType);
+    PyModule_AddStringConstant(module, "aes_impl", zbee_crypt_impl());
+    PyModule_AddStringConstant(module, "MAC_RECORD_FORMAT", ZBEE_MAC_RECORD_FORMAT);
+    PyModule_AddIntConstant(module, "MAC_RECORD_SIZE", ZBEE_MAC_RECORD_SIZE);
     return module;
 }
 
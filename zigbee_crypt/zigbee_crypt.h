@@ -29,6 +29,14 @@
 #define ZBEE_SEC_CONST_MICSIZE		16
 #define ZBEE_SEC_CONST_KEYSIZE		16
 
+/* Longest CCM* payload (its length is L bytes), and longest additional
+ * data whose length still has the two byte encoding. */
+#define ZBEE_SEC_CONST_MAX_PAYLOAD	0xffff
+#define ZBEE_SEC_CONST_MAX_AAD		0xfeff
+
+/* Longest IEEE 802.15.4 frame (aMaxPHYPacketSize). */
+#define ZBEE_MAX_FRAME_LEN		127
+
 /* CCM* Flags */
 #define ZBEE_SEC_CCM_FLAG_L             0x01    /* 3-bit encoding of (L-1). */
 #define ZBEE_SEC_CCM_FLAG_M(m)          ((((m-2)/2) & 0x7)<<3)  /* 3-bit encoding of (M-2)/2 shifted 3 bits. */